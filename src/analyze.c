@@ -0,0 +1,162 @@
+/**
+ * sctools: Listen trace analyzer
+ * Copyright (C) 2016 Tim Hentenaar.
+ *
+ * This code is licenced under the Simplified BSD License.
+ * See the LICENSE file for details.
+ *
+ * Reads a trace written by "listen --record", and reports how often
+ * each key is pressed, how long keys are held (make to break), the
+ * intervals between key presses, and the latency from the scancode
+ * to the key down sent to the host.
+ *
+ * Events in a report share its arrival time, so latencies are only
+ * as fine as the interval between reports.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "hid_tokens.h"
+#include "histogram.h"
+#include "monotime.h"
+#include "sclog.h"
+#include "analyze.h"
+
+struct key_stats {
+	int              code;
+	unsigned long    presses;
+	struct histogram hold;
+	struct histogram latency;
+};
+
+static int by_presses(const void *a, const void *b)
+{
+	const struct key_stats *ka = a, *kb = b;
+
+	if (ka->presses != kb->presses)
+		return ka->presses < kb->presses ? 1 : -1;
+	return ka->code - kb->code;
+}
+
+/**
+ * Where each device is up to. Events from different devices are
+ * interleaved in a trace from listen --all.
+ */
+struct device_state {
+	uint64_t down_at[256];
+	char     down[256];
+	uint64_t scan_start, make_scan, last_make;
+	int      in_scan, have_make, make_code;
+};
+
+/* {{{ analyze_trace */
+/**
+ * Analyze a trace, and print the results.
+ *
+ * \param[in] path Trace to read
+ * \param[in] fp   Stream to print to
+ * \return 0 on success, -1 on error.
+ */
+int analyze_trace(const char *path, FILE *fp)
+{
+	static struct key_stats keys[256];
+	static struct device_state devs[LISTEN_MAX_DEVICES];
+	struct histogram all_hold, interval, latency;
+	struct device_state *d;
+	struct listen_event ev;
+	struct sclog log;
+	uint64_t end = 0;
+	int i, n, n_devs = 0;
+	unsigned long presses = 0;
+	time_t wall;
+
+	if (sclog_open(&log, path))
+		return -1;
+
+	memset(keys, 0, sizeof(keys));
+	memset(devs, 0, sizeof(devs));
+	memset(&all_hold, 0, sizeof(all_hold));
+	memset(&interval, 0, sizeof(interval));
+	memset(&latency, 0, sizeof(latency));
+	for (i = 0; i < 256; i++) keys[i].code = i;
+	for (i = 0; i < LISTEN_MAX_DEVICES; i++) devs[i].make_code = -1;
+
+	while ((n = sclog_read(&log, &ev)) > 0) {
+		end = ev.time;
+		d   = &devs[ev.device % LISTEN_MAX_DEVICES];
+		if (ev.device >= n_devs) n_devs = ev.device + 1;
+
+		switch (ev.type) {
+		case 'r':
+			/* The first scancode of a sequence (e.g. E0 F0 6B) */
+			if (!d->in_scan) d->scan_start = ev.time;
+			d->in_scan = 1;
+		continue;
+		case '+':
+			++presses;
+			++keys[ev.code].presses;
+			d->down_at[ev.code] = ev.time;
+			d->down[ev.code]    = 1;
+			if (d->have_make)
+				hist_add(&interval, ev.time - d->last_make);
+			d->have_make = 1;
+			d->last_make = ev.time;
+			d->make_code = ev.code;
+			d->make_scan = d->in_scan ? d->scan_start : ev.time;
+		break;
+		case '-':
+			if (d->down[ev.code]) {
+				hist_add(&keys[ev.code].hold,
+				         ev.time - d->down_at[ev.code]);
+				hist_add(&all_hold, ev.time - d->down_at[ev.code]);
+				d->down[ev.code] = 0;
+			}
+			d->make_code = -1;
+		break;
+		case 'd':
+			/* The key down sent for the last make, if any */
+			if (d->make_code >= 0) {
+				hist_add(&keys[d->make_code].latency,
+				         ev.time - d->make_scan);
+				hist_add(&latency, ev.time - d->make_scan);
+				d->make_code = -1;
+			}
+		break;
+		}
+
+		d->in_scan = 0;
+	}
+
+	if (n < 0)
+		fprintf(stderr, "%s: truncated or unreadable after %lu events\n",
+		        path, log.records);
+	sclog_close(&log);
+
+	wall = (time_t)log.wall_start;
+	fprintf(fp, "Trace: %s\nStarted: %s", path, ctime(&wall));
+	fprintf(fp, "Duration: %.3f s\nDevices: %d\nEvents: %lu\n"
+	        "Key presses: %lu\n", (double)(end - log.start) / NS_PER_S,
+	        n_devs, log.records, presses);
+
+	/* Per-key table, most pressed first */
+	qsort(keys, 256, sizeof(struct key_stats), by_presses);
+	fprintf(fp, "\n%-20s %10s %7s %10s %10s %10s\n", "Key", "Presses",
+	        "%", "Hold ms", "Max hold", "Latency ms");
+	for (i = 0; i < 256 && keys[i].presses; i++) {
+		fprintf(fp, "%-20s %10lu %6.2f%% %10.3f %10.3f %10.3f\n",
+		        lookup_hid_token_by_value(keys[i].code), keys[i].presses,
+		        100.0 * (double)keys[i].presses / (double)presses,
+		        hist_mean_ms(&keys[i].hold),
+		        (double)keys[i].hold.max / NS_PER_MS,
+		        hist_mean_ms(&keys[i].latency));
+	}
+
+	hist_print(fp, "Hold time (make to break)", &all_hold);
+	hist_print(fp, "Interval between key presses", &interval);
+	hist_print(fp, "Latency (scancode to key down)", &latency);
+	return n < 0 ? -1 : 0;
+}
+/* }}} */
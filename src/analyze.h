@@ -0,0 +1,16 @@
+/**
+ * sctools: Listen trace analyzer
+ * Copyright (C) 2016 Tim Hentenaar.
+ *
+ * This code is licenced under the Simplified BSD License.
+ * See the LICENSE file for details.
+ */
+
+#ifndef ANALYZE_H
+#define ANALYZE_H
+
+#include <stdio.h>
+
+int analyze_trace(const char *path, FILE *fp);
+
+#endif /* ANALYZE_H */
@@ -0,0 +1,23 @@
+/**
+ * sctools: Benchmarks
+ * Copyright (C) 2016 Tim Hentenaar.
+ *
+ * This code is licenced under the Simplified BSD License.
+ * See the LICENSE file for details.
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+/* scas and scdis, built without their main() (bench_scas.c, bench_scdis.c) */
+int    bench_scas_line(const char *line);
+int    bench_scas_file(const char *path);
+size_t bench_scas_lex(const char *line);
+int    bench_scas_image(unsigned char **image, size_t *len);
+void   bench_scas_reset(void);
+int    bench_scdis(const unsigned char *image, size_t len, FILE *fp);
+
+#endif /* BENCH_H */
@@ -0,0 +1,127 @@
+/**
+ * sctools: scas, for the benchmarks
+ * Copyright (C) 2016 Tim Hentenaar.
+ *
+ * This code is licenced under the Simplified BSD License.
+ * See the LICENSE file for details.
+ *
+ * Builds scas without its main(), so that its lexer and block encoder
+ * can be benchmarked on their own.
+ */
+
+#define main scas_main
+int main(int argc, char *argv[]);
+#include "scas.c"
+#undef main
+
+#include "bench.h"
+
+/**
+ * Assemble a line, as if it were read from a file.
+ *
+ * \return 0 on success, or an ERR_* code.
+ */
+int bench_scas_line(const char *line)
+{
+	char linebuf[256];
+
+	strncpy(linebuf, line, sizeof(linebuf) - 1);
+	linebuf[sizeof(linebuf) - 1] = '\0';
+	return process_line(linebuf);
+}
+
+/**
+ * Assemble a file, reporting any error as scas does.
+ *
+ * \return 0 on success, or an ERR_* code.
+ */
+int bench_scas_file(const char *path)
+{
+	int err = process_file(path);
+
+	if (err) print_error(err);
+	return err;
+}
+
+/**
+ * Split a line into tokens, as scas does.
+ *
+ * \return the number of tokens.
+ */
+size_t bench_scas_lex(const char *line)
+{
+	const char *p = line;
+	char *t;
+	size_t n = 0;
+
+	while ((t = get_token(p))) {
+		free(t);
+		p = skip_token(p);
+		++n;
+	}
+
+	return n;
+}
+
+/* {{{ bench_scas_image */
+/**
+ * Get the binary config for what's been assembled so far.
+ *
+ * \param[out] image The image, to be freed by the caller
+ * \param[out] len   Its length
+ * \return 0 on success, -1 on error.
+ */
+int bench_scas_image(unsigned char **image, size_t *len)
+{
+	unsigned char *p;
+	unsigned int i;
+
+	for (*len = 6, i = 0; i < block_list_len; i++)
+		*len += block_list[i].len;
+
+	if (!(*image = p = malloc(*len)))
+		return -1;
+
+	*p++ = 'S';
+	*p++ = 'C';
+	*p++ = SETTINGS_VERSION_MAJOR;
+	*p++ = SETTINGS_VERSION_MINOR;
+	*p++ = current_force_flags;
+	*p++ = 0;
+
+	for (i = 0; i < block_list_len; i++) {
+		memcpy(p, block_list[i].bytes, block_list[i].len);
+		p += block_list[i].len;
+	}
+
+	return 0;
+}
+/* }}} */
+
+/**
+ * Forget everything that's been assembled, as if scas had just
+ * started.
+ */
+void bench_scas_reset(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < block_list_len; i++)
+		free(block_list[i].bytes);
+	free(block_list);
+	block_list     = NULL;
+	block_list_len = 0;
+
+	for (i = 0; i < N_PAIR_LISTS; i++)
+		pair_list_clear((int)i);
+	macro_list_clear();
+
+	current_force_flags        = 0;
+	current_select             = 0;
+	current_scanset            = 0;
+	current_keyboard_id        = 0;
+	current_layer              = 0;
+	current_macro_phase        = -1;
+	current_macro_release_meta = 1;
+	block_type                 = BLOCK_NONE;
+}
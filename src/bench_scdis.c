@@ -0,0 +1,28 @@
+/**
+ * sctools: scdis, for the benchmarks
+ * Copyright (C) 2016 Tim Hentenaar.
+ *
+ * This code is licenced under the Simplified BSD License.
+ * See the LICENSE file for details.
+ *
+ * Builds scdis without its main(), so that its rendering can be
+ * benchmarked on its own.
+ */
+
+#define main scdis_main
+int main(int argc, char *argv[]);
+#include "scdis.c"
+#undef main
+
+#include "bench.h"
+
+/**
+ * Disassemble a binary config.
+ *
+ * \return 0 on success, non-zero if there were errors.
+ */
+int bench_scdis(const unsigned char *image, size_t len, FILE *fp)
+{
+	fout = fp;
+	return process_file(image, len);
+}
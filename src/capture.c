@@ -0,0 +1,385 @@
+/**
+ * sctools: Report capture thread
+ * Copyright (C) 2016 Tim Hentenaar.
+ *
+ * This code is licenced under the Simplified BSD License.
+ * See the LICENSE file for details.
+ *
+ * The thread does nothing but read reports into the ring and
+ * timestamp them, from our monotonic clock, as they arrive. With more
+ * than one device, it waits on all of them at once with epoll, if the
+ * transport gives us descriptors to wait on. Otherwise (e.g. with
+ * hidapi), each device gets a reader thread of its own, blocked in
+ * its reads, as polling them in turn would keep a CPU busy. Those
+ * threads share the ring under a lock, and timestamp each report as
+ * they put it there, so either way the ring holds the reports in
+ * timestamp order.
+ *
+ * In real-time mode, the thread is pinned to a CPU and scheduled
+ * SCHED_FIFO, and memory is locked. It then waits for at most 1 ms at
+ * a time, and notes how late it wakes up when a wait times out: that's
+ * how long a report could sit between arriving and being timestamped.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif /* HAVE_SYS_EPOLL_H */
+
+#include "monotime.h"
+#include "capture.h"
+
+/* How often the thread checks whether it should stop */
+#define CAPTURE_POLL_MS 100
+#define CAPTURE_RT_POLL_MS 1
+
+#define poll_ms(c) ((c)->cpu >= 0 ? CAPTURE_RT_POLL_MS : CAPTURE_POLL_MS)
+
+/**
+ * A thread reading one of several devices.
+ */
+struct reader {
+	struct capture  *c;
+	int              dev;
+	pthread_mutex_t *lock;  /* taken to put a report in the ring */
+	int             *quit;  /* set if they can't all be started  */
+	pthread_t        thread;
+	struct realtime  rt;
+};
+
+/**
+ * Note how late a wait of \a timeout_ms from \a since, which timed
+ * out, woke us up at \a now.
+ */
+static void note_wakeup(struct capture *c, uint64_t since, uint64_t now,
+                        int timeout_ms)
+{
+	uint64_t due = since + (uint64_t)timeout_ms * NS_PER_MS;
+
+	if (c->cpu >= 0 && timeout_ms)
+		hist_add(&c->wakeup, now > due ? now - due : 0);
+}
+
+/* {{{ read_report */
+/**
+ * Read a report from a device into the ring. If the ring is full,
+ * the report is read and dropped.
+ *
+ * \return the report length, 0 if there wasn't one, or -1 on error,
+ *         in which case the device is no longer read.
+ */
+static int read_report(struct capture *c, int i, int timeout_ms)
+{
+	struct ring_slot *slot, scratch;
+	uint64_t start;
+	int count;
+
+	/*
+	 * A real-time thread never gives way to the consumer, so if it's
+	 * on the same CPU, and has fallen behind, let it catch up.
+	 */
+	if (!(slot = ring_reserve(&c->ring))) {
+		if (c->cpu >= 0) {
+			sleep_ns(CAPTURE_RT_POLL_MS * NS_PER_MS);
+			slot = ring_reserve(&c->ring);
+		}
+		if (!slot) slot = &scratch;
+	}
+
+	start = monotime_ns();
+	count      = transport_read(c->devs[i], slot->data, PACKET_LEN,
+	                            timeout_ms);
+	slot->time = monotime_ns();
+	if (count < 0) {
+		if (c->n_devs > 1)
+			fprintf(stderr, "\ndevice %d: read failed, ignoring it\n", i);
+		c->devs[i] = NULL;
+		if (!--c->live) store_release(&c->error, 1);
+		return -1;
+	}
+
+	if (!count) {
+		note_wakeup(c, start, slot->time, timeout_ms);
+		return 0;
+	}
+
+	slot->device = i;
+	slot->len    = (size_t)count;
+	++c->reports;
+
+	if (slot == &scratch)
+		store_release(&c->ring.overflow, c->ring.overflow + 1);
+	else ring_commit(&c->ring);
+	return count;
+}
+/* }}} */
+
+/* {{{ capture_poll */
+/**
+ * Read a single device, waiting for each report, or poll each of
+ * several in turn.
+ */
+static void capture_poll(struct capture *c)
+{
+	uint64_t start;
+	int i, got;
+
+	while (c->live && !load_acquire(&c->stop)) {
+		if (c->n_devs == 1) {
+			read_report(c, 0, poll_ms(c));
+			continue;
+		}
+
+		for (i = got = 0; i < c->n_devs; i++) {
+			if (c->devs[i] && read_report(c, i, 0) > 0)
+				got = 1;
+		}
+
+		if (!got) {
+			start = monotime_ns();
+			sleep_ns(NS_PER_MS);
+			note_wakeup(c, start, monotime_ns(), 1);
+		}
+	}
+}
+/* }}} */
+
+/* {{{ read_device */
+/**
+ * Read a device, waiting for each report, and put them in the ring,
+ * with the others' (see capture_threads()).
+ */
+static void *read_device(void *arg)
+{
+	struct reader *r = arg;
+	struct capture *c = r->c;
+	struct ring_slot *slot, scratch;
+	unsigned char data[PACKET_LEN];
+	uint64_t start;
+	int count;
+
+	if (c->cpu >= 0)
+		realtime_enter(&r->rt, c->cpu);
+
+	while (!load_acquire(&c->stop) && !load_acquire(r->quit)) {
+		start = monotime_ns();
+		count = transport_read(c->devs[r->dev], data, PACKET_LEN,
+		                       poll_ms(c));
+
+		pthread_mutex_lock(r->lock);
+		if (count > 0) {
+			if (!(slot = ring_reserve(&c->ring)))
+				slot = &scratch;
+
+			slot->time   = monotime_ns();
+			slot->device = r->dev;
+			slot->len    = (size_t)count;
+			memcpy(slot->data, data, (size_t)count);
+			++c->reports;
+
+			if (slot == &scratch)
+				store_release(&c->ring.overflow, c->ring.overflow + 1);
+			else ring_commit(&c->ring);
+		} else if (!count) {
+			note_wakeup(c, start, monotime_ns(), poll_ms(c));
+		} else {
+			fprintf(stderr, "\ndevice %d: read failed, ignoring it\n",
+			        r->dev);
+			c->devs[r->dev] = NULL;
+			if (!--c->live) store_release(&c->error, 1);
+		}
+		pthread_mutex_unlock(r->lock);
+
+		if (count < 0) break;
+	}
+
+	return NULL;
+}
+/* }}} */
+
+/* {{{ capture_threads */
+/**
+ * Read each device on a thread of its own, for transports with no
+ * descriptors to wait on.
+ *
+ * \return 0 once asked to stop, or -1 if the threads can't be
+ *         started, so the devices should be polled instead.
+ */
+static int capture_threads(struct capture *c)
+{
+	pthread_mutex_t lock;
+	struct reader *r;
+	int i, n, quit = 0;
+
+	if (!(r = calloc((size_t)c->n_devs, sizeof(*r))))
+		return -1;
+
+	pthread_mutex_init(&lock, NULL);
+	for (n = 0; n < c->n_devs; n++) {
+		r[n].c      = c;
+		r[n].dev    = n;
+		r[n].lock   = &lock;
+		r[n].quit   = &quit;
+		r[n].rt.cpu = -1;
+		if (pthread_create(&r[n].thread, NULL, read_device, &r[n]))
+			break;
+	}
+
+	if (n < c->n_devs)
+		store_release(&quit, 1);
+
+	for (i = 0; i < n; i++)
+		pthread_join(r[i].thread, NULL);
+
+	pthread_mutex_destroy(&lock);
+	free(r);
+	return quit ? -1 : 0;
+}
+/* }}} */
+
+#ifdef HAVE_SYS_EPOLL_H
+/* {{{ capture_epoll */
+/**
+ * Wait for reports from any of the devices.
+ *
+ * \return 0 once asked to stop, or -1 if the devices can't be
+ *         waited on, so they should be polled instead.
+ */
+static int capture_epoll(struct capture *c)
+{
+	struct epoll_event ev[16];
+	int i, n, dev, fd, epfd;
+	uint64_t start;
+
+	if ((epfd = epoll_create(c->n_devs)) < 0)
+		return -1;
+
+	for (i = 0; i < c->n_devs; i++) {
+		memset(&ev[0], 0, sizeof(ev[0]));
+		ev[0].events   = EPOLLIN;
+		ev[0].data.u32 = (uint32_t)i;
+		if ((fd = transport_fd(c->devs[i])) < 0 ||
+		    epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev[0]) < 0) {
+			close(epfd);
+			return -1;
+		}
+	}
+
+	while (c->live && !load_acquire(&c->stop)) {
+		start = monotime_ns();
+		if ((n = epoll_wait(epfd, ev, 16, poll_ms(c))) <= 0) {
+			if (!n) note_wakeup(c, start, monotime_ns(), poll_ms(c));
+			continue;
+		}
+
+		for (i = 0; i < n; i++) {
+			dev = (int)ev[i].data.u32;
+			if (!c->devs[dev])
+				continue;
+
+			fd = transport_fd(c->devs[dev]);
+			if (read_report(c, dev, 0) < 0)
+				epoll_ctl(epfd, EPOLL_CTL_DEL, fd, &ev[i]);
+		}
+	}
+
+	close(epfd);
+	return 0;
+}
+/* }}} */
+#else
+#define capture_epoll(C) (-1)
+#endif /* HAVE_SYS_EPOLL_H */
+
+static void *capture_main(void *arg)
+{
+	struct capture *c = arg;
+
+	if (c->cpu >= 0)
+		realtime_enter(&c->rt, c->cpu);
+
+	if (c->n_devs == 1 || (capture_epoll(c) && capture_threads(c)))
+		capture_poll(c);
+
+	store_release(&c->done, 1);
+	return NULL;
+}
+
+/* {{{ capture_start */
+/**
+ * Start capturing reports from one or more devices.
+ *
+ * \param[in] c    Capture
+ * \param[in] devs Devices. Nothing else may read from them until
+ *                 capture_stop() is called.
+ * \param[in] n    Number of devices
+ * \param[in] size Number of reports the ring can hold.
+ * \param[in] cpu  CPU to capture on in real-time mode, or -1 to
+ *                 capture normally.
+ * \return 0 on success, -1 on error.
+ */
+int capture_start(struct capture *c, struct transport **devs, int n,
+                  unsigned long size, int cpu)
+{
+	sigset_t set, old_set;
+	int retval;
+
+	memset(c, 0, sizeof(*c));
+	c->n_devs = n;
+	c->live   = n;
+	c->cpu    = cpu;
+	c->rt.cpu = -1;
+
+	/* Our own copy, as devices that fail are taken out of it */
+	if (!(c->devs = malloc((size_t)n * sizeof(struct transport *))))
+		goto err;
+	memcpy(c->devs, devs, (size_t)n * sizeof(struct transport *));
+
+	if (ring_init(&c->ring, size))
+		goto free_devs;
+
+	/* The ring, and everything else, stays in RAM from here on */
+	if (cpu >= 0)
+		realtime_lock(&c->rt);
+
+	/* Leave the signals to the main thread */
+	sigfillset(&set);
+	pthread_sigmask(SIG_SETMASK, &set, &old_set);
+	retval = pthread_create(&c->thread, NULL, capture_main, c);
+	pthread_sigmask(SIG_SETMASK, &old_set, NULL);
+	if (!retval)
+		return 0;
+
+	realtime_unlock(&c->rt);
+	ring_free(&c->ring);
+
+free_devs:
+	free(c->devs);
+
+err:
+	fputs("Unable to start capturing\n", stderr);
+	return -1;
+}
+/* }}} */
+
+/**
+ * Stop the capture thread, and wait for it. Anything left in the
+ * ring can still be taken out, until capture_free() is called.
+ */
+void capture_stop(struct capture *c)
+{
+	store_release(&c->stop, 1);
+	pthread_join(c->thread, NULL);
+}
+
+void capture_free(struct capture *c)
+{
+	realtime_unlock(&c->rt);
+	ring_free(&c->ring);
+	free(c->devs);
+}
@@ -0,0 +1,43 @@
+/**
+ * sctools: Report capture thread
+ * Copyright (C) 2016 Tim Hentenaar.
+ *
+ * This code is licenced under the Simplified BSD License.
+ * See the LICENSE file for details.
+ */
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <pthread.h>
+
+#include "transport.h"
+#include "ring.h"
+#include "histogram.h"
+#include "realtime.h"
+
+/**
+ * A thread reading reports from one or more devices into a ring, so
+ * that a slow consumer doesn't hold up reading from the devices.
+ */
+struct capture {
+	struct transport **devs;
+	int                n_devs;
+	int                live;     /* devices still being read      */
+	struct ring        ring;
+	pthread_t          thread;
+	unsigned long      reports;  /* reports captured              */
+	int                stop;     /* set to ask the thread to stop */
+	int                done;     /* set once the thread stops     */
+	int                error;    /* set if reading failed         */
+	int                cpu;      /* real-time on this CPU, or -1  */
+	struct realtime    rt;
+	struct histogram   wakeup;   /* how late timeouts wake us     */
+};
+
+int  capture_start(struct capture *c, struct transport **devs, int n,
+                   unsigned long size, int cpu);
+void capture_stop(struct capture *c);
+void capture_free(struct capture *c);
+
+#endif /* CAPTURE_H */
@@ -11,17 +11,30 @@
 #include <string.h>
 #include <limits.h>
 #include <errno.h>
+#include <signal.h>
+#include <unistd.h>
 
-#include <hidapi/hidapi.h>
 #include "rawhid_defs.h"
-#include "hid_tokens.h"
+#include "transport.h"
+#include "monotime.h"
+#include "listen.h"
+#include "capture.h"
+#include "sclog.h"
+#include "analyze.h"
+#include "server.h"
+#include "hidstats.h"
 #include "commands.h"
 
 #define VER_PROTOCOL 0x0100
 #define VER_SETTINGS 0x0101
 
 static unsigned char buf[PACKET_LEN];
-static unsigned char filebuf[BUFSIZ];
+
+/* The converter's interfaces: usage page, usage, and interface number */
+#define CONTROL_INTERFACE { 0xff99, 0x2468, 3 }
+#define DEBUG_INTERFACE   { 0xff31, 0x0074, 1 }
+
+static const struct transport_match debug_interface = DEBUG_INTERFACE;
 
 /* {{{ SIZE_MAX */
 /**
@@ -39,32 +52,394 @@ static unsigned char filebuf[BUFSIZ];
 #endif /* SSIZE_MAX == LONG_MAX */
 #endif /* }}} */
 
+/* {{{ Timeouts and retries
+ *
+ * Timeouts are derived from the measured round-trip times, in the same
+ * way TCP derives its retransmission timeout: RTO = SRTT + 4 * RTTVAR.
+ * Ordinary request / response exchanges, and waiting for the device to
+ * become ready (which includes EEPROM programming time) are tracked
+ * separately. Every retry doubles the timeout, up to its maximum.
+ */
+#define MAX_RETRIES  4
+#define WAIT_RETRIES 2 /* longer waits, before a transfer is resumed */
+#define MAX_RESYNCS  3 /* resumes at any one offset                 */
+#define BACKOFF_US  5000UL
+
+struct rtt_estimator {
+	unsigned long srtt;     /* smoothed round trip (us)         */
+	unsigned long rttvar;   /* round trip variation (us)        */
+	unsigned long min;      /* lower bound on the timeout (us)  */
+	unsigned long max;      /* upper bound on the timeout (us)  */
+	unsigned long initial;  /* timeout before any samples (us)  */
+	int valid;
+};
+
+static struct rtt_estimator request_rtt = {
+	0, 0, 10000UL, 2500000UL, 250000UL, 0
+};
+
+static struct rtt_estimator ready_rtt = {
+	0, 0, 100000UL, 10000000UL, 2500000UL, 0
+};
+
+static unsigned int n_retries  = 0;
+static unsigned int n_timeouts = 0;
+static unsigned int n_resyncs  = 0;
+
+static void rtt_update(struct rtt_estimator *r, unsigned long sample)
+{
+	unsigned long delta;
+
+	if (!r->valid) {
+		r->srtt   = sample;
+		r->rttvar = sample / 2;
+		r->valid  = 1;
+		return;
+	}
+
+	delta = (sample > r->srtt) ? sample - r->srtt : r->srtt - sample;
+	r->rttvar = (3 * r->rttvar + delta) / 4;
+	r->srtt   = (7 * r->srtt + sample) / 8;
+}
+
+/**
+ * Get the timeout for the given attempt, in milliseconds.
+ */
+static int rtt_timeout(const struct rtt_estimator *r, int attempt)
+{
+	unsigned long t = r->valid ? r->srtt + 4 * r->rttvar : r->initial;
+
+	if (t < r->min) t = r->min;
+	while (attempt-- > 0 && t < r->max) t <<= 1;
+	if (t > r->max) t = r->max;
+	return (int)((t + 999) / 1000);
+}
+/* }}} */
+
+/* {{{ drain */
+/**
+ * Discard any responses that have already arrived, so that a late
+ * response to an earlier attempt isn't mistaken for the answer to
+ * the next one.
+ */
+static void drain(struct transport *dev)
+{
+	unsigned char junk[PACKET_LEN];
+	while (transport_read(dev, junk, PACKET_LEN, 0) > 0)
+		hidstats_late();
+}
+/* }}} */
+
+/* {{{ swallow */
+/**
+ * Wait for, and discard, up to \a count late responses.
+ */
+static void swallow(struct transport *dev, int count)
+{
+	unsigned char junk[PACKET_LEN];
+
+	while (count-- > 0 &&
+	       transport_read(dev, junk, PACKET_LEN,
+	                      rtt_timeout(&request_rtt, 0)) > 0)
+		hidstats_late();
+}
+/* }}} */
+
+#define RETRY_TIMEOUT 1 /* Repeat the request after a timeout / error */
+#define RETRY_ERROR   2 /* Repeat the request if answered by RC_ERROR */
+
+/* {{{ exchange */
+/**
+ * Send a report to the device, and read the response into \a buf.
+ *
+ * The request is re-sent according to \a retry, backing off each
+ * time. Only requests which are safe to repeat may be retried, but
+ * a request which couldn't be sent at all is always tried again.
+ *
+ * \param[in] dev     Device to send to
+ * \param[in] report  Report number to send
+ * \param[in] type    HS_* type, for the statistics
+ * \param[in] retry   RETRY_* flags
+ * \return the length of the response, 0 on timeout, or -1 on error.
+ */
+static int exchange(struct transport *dev, unsigned char report, int type,
+                    int retry)
+{
+	int attempt, n = -1;
+	uint64_t start;
+	unsigned char out[PACKET_LEN];
+	struct hid_transaction t;
+
+	buf[0] = report;
+	memcpy(out, buf, PACKET_LEN);
+
+	for (attempt = 0; attempt <= MAX_RETRIES; attempt++) {
+		if (attempt) {
+			++n_retries;
+			fprintf(stderr, "Retrying request 0x%02x (attempt %d)\n",
+			        report, attempt + 1);
+			sleep_ns((BACKOFF_US << (attempt - 1)) * NS_PER_US);
+			drain(dev);
+		}
+
+		start = monotime_ns();
+		t.type    = type;
+		t.attempt = attempt;
+		t.start   = start;
+		if (transport_write(dev, out, PACKET_LEN) < 0) {
+			n = -1;
+			t.result   = HS_ERROR;
+			t.write_ns = t.rtt_ns = monotime_ns() - start;
+			hidstats_record(&t);
+			continue;
+		}
+		t.write_ns = monotime_ns() - start;
+
+		/* Read the response */
+		memset(buf, 0, PACKET_LEN);
+		n = transport_read(dev, buf, PACKET_LEN,
+		                   rtt_timeout(&request_rtt, attempt));
+		/* The answer to RC_READY is data, not a response code */
+		t.rtt_ns = monotime_ns() - start;
+		t.result = n > 0 ? (buf[0] == RC_ERROR && type != HS_READY ?
+		                    HS_REFUSED : HS_OK) :
+		           (n ? HS_ERROR : HS_TIMEOUT);
+		hidstats_record(&t);
+
+		if (n > 0) {
+			rtt_update(&request_rtt,
+			           (unsigned long)((monotime_ns() - start) /
+			                           NS_PER_US));
+			if (!(retry & RETRY_ERROR) || buf[0] != RC_ERROR)
+				break;
+			continue;
+		}
+
+		if (!n) ++n_timeouts;
+		if (!(retry & RETRY_TIMEOUT)) break;
+	}
+
+	/* Answers to the earlier attempts may still be on their way */
+	if (n > 0 && attempt > 0)
+		swallow(dev, attempt);
+	return n;
+}
+/* }}} */
+
 /* {{{ send_report */
 /**
  * Send a report to the device, and read the response.
  *
  * \param[in] dev     Device to send to
  * \param[in] report  Report number to send
+ * \param[in] type    HS_* type, for the statistics
  * \return 0 on success, -1 on error.
  */
-static int send_report(hid_device *dev, unsigned char report)
+static int send_report(struct transport *dev, unsigned char report,
+                       int type)
 {
-	buf[0] = report;
-	if (hid_write(dev, buf, PACKET_LEN) < 0)
-		goto err;
+	return exchange(dev, report, type, 0) < 0 ? -1 : 0;
+}
+/* }}} */
+
+/* {{{ send_request */
+/**
+ * Send a request which is safe to repeat, retrying until it's
+ * answered.
+ *
+ * \param[in] dev     Device to send to
+ * \param[in] report  Report number to send
+ * \param[in] type    HS_* type, for the statistics
+ * \param[in] retry   RETRY_* flags
+ * \return 0 on success, -1 on error.
+ */
+static int send_request(struct transport *dev, unsigned char report,
+                        int type, int retry)
+{
+	return exchange(dev, report, type, retry) > 0 ? 0 : -1;
+}
+/* }}} */
+
+/* {{{ wait_for */
+/**
+ * Wait for the device to send the given response code on its own,
+ * skipping any stale responses to earlier requests. A timeout is
+ * retried with a longer wait, as the device may just be slow (e.g.
+ * programming its EEPROM).
+ *
+ * \param[in] dev   Device
+ * \param[in] code  Response code to wait for
+ * \return 0 on success, -1 on error or timeout.
+ */
+static int wait_for(struct transport *dev, unsigned char code)
+{
+	int n, skipped = 0, attempt = 0;
+	uint64_t start = monotime_ns();
+	struct hid_transaction t;
+
+	t.type     = HS_WAIT;
+	t.start    = start;
+	t.write_ns = 0;
+
+	while (1) {
+		n = transport_read(dev, buf, PACKET_LEN,
+		                   rtt_timeout(&ready_rtt, attempt));
+		t.rtt_ns  = monotime_ns() - start;
+		t.attempt = attempt;
+		if (n > 0 && buf[0] == code) {
+			rtt_update(&ready_rtt, (unsigned long)(t.rtt_ns / NS_PER_US));
+			t.result = HS_OK;
+			hidstats_record(&t);
+			return 0;
+		}
+
+		if (!n) {
+			++n_timeouts;
+			if (attempt++ < WAIT_RETRIES) {
+				++n_retries;
+				continue;
+			}
+		} else if (n > 0 && buf[0] != RC_ERROR) {
+			hidstats_late();
+			if (++skipped < 4) continue;
+		}
 
-	/* Read the response */
+		break;
+	}
+
+	t.result = n > 0 ? (buf[0] == RC_ERROR ? HS_REFUSED : HS_ERROR) :
+	           (n ? HS_ERROR : HS_TIMEOUT);
+	hidstats_record(&t);
+	return -1;
+}
+/* }}} */
+
+/* {{{ start_write */
+/**
+ * Ask the device to accept a new configuration, or to resume taking
+ * one of the same length.
+ *
+ * \param[in] dev Device
+ * \param[in] len Length of the configuration
+ * \return RC_OK, RC_READY if the device is already known to be ready
+ *         (i.e. the RC_OK was lost), or -1 on error.
+ */
+static int start_write(struct transport *dev, size_t len)
+{
 	memset(buf, 0, PACKET_LEN);
-	if (hid_read_timeout(dev, buf, PACKET_LEN, 250) < 0)
-		goto err;
+	buf[1] = len & 0xff;
+	buf[2] = (len >> 8) & 0xff;
+	if (send_request(dev, RQ_WRITE, HS_WRITE, RETRY_TIMEOUT | RETRY_ERROR) ||
+	    (buf[0] != RC_OK && buf[0] != RC_READY))
+		return -1;
+	return buf[0];
+}
+/* }}} */
 
-	return 0;
+/* {{{ write_chunk */
+/**
+ * Send one packet of configuration data, repeating it until the
+ * device acknowledges it.
+ *
+ * If an acknowledgement is lost, the READY (or COMPLETED) which
+ * follows it is just as good, and a late answer to one attempt is
+ * taken as the answer to the next, rather than being discarded.
+ *
+ * \param[in] dev    Device
+ * \param[in] data   Configuration data (without the signature)
+ * \param[in] offset Offset of this packet within \a data
+ * \param[in] n      Number of bytes to send (at most PACKET_LEN - 4)
+ * \return RC_OK, RC_READY, or RC_COMPLETED on success, -RC_ERROR if
+ *         the device refused the packet, or -1 on error.
+ */
+static int write_chunk(struct transport *dev, const unsigned char *data,
+                       size_t offset, size_t n)
+{
+	int attempt, r = 0;
+	uint64_t start = 0;
+	unsigned char out[PACKET_LEN];
+	struct hid_transaction t;
+
+	/* The device's offsets start at 4 */
+	memset(out, 0, PACKET_LEN);
+	out[0] = RQ_WRITE | RQ_CONTINUATION;
+	out[1] = n & 0xff;
+	out[2] = (offset + 4) & 0xff;
+	out[3] = ((offset + 4) >> 8) & 0xff;
+	memcpy(out + 4, data + offset, n);
+	t.type  = HS_DATA;
+	t.start = 0;
+
+	for (attempt = 0; attempt <= MAX_RETRIES; attempt++) {
+		if (attempt) {
+			++n_retries;
+			fprintf(stderr, "Retrying data at offset %lu "
+			        "(attempt %d)\n", offset, attempt + 1);
+			sleep_ns((BACKOFF_US << (attempt - 1)) * NS_PER_US);
+
+			/* A late answer to the last attempt: nothing is sent */
+			if ((r = transport_read(dev, buf, PACKET_LEN, 0)) > 0) {
+				t.attempt  = attempt;
+				t.write_ns = 0;
+				goto answered;
+			}
+		}
+
+		start = monotime_ns();
+		t.attempt = attempt;
+		t.start   = start;
+		if (transport_write(dev, out, PACKET_LEN) < 0) {
+			t.result   = HS_ERROR;
+			t.write_ns = t.rtt_ns = monotime_ns() - start;
+			hidstats_record(&t);
+			continue;
+		}
+		t.write_ns = monotime_ns() - start;
+
+		memset(buf, 0, PACKET_LEN);
+		r = transport_read(dev, buf, PACKET_LEN,
+		                   rtt_timeout(&request_rtt, attempt));
+		if (!r) ++n_timeouts;
+		if (r <= 0) {
+			t.result = r ? HS_ERROR : HS_TIMEOUT;
+			t.rtt_ns = monotime_ns() - start;
+			hidstats_record(&t);
+			continue;
+		}
+
+answered:
+		t.rtt_ns = monotime_ns() - start;
+		t.result = buf[0] == RC_ERROR ? HS_REFUSED :
+		           (buf[0] >= RC_OK && buf[0] <= RC_COMPLETED) ? HS_OK :
+		           HS_ERROR;
+		hidstats_record(&t);
+
+		switch (buf[0]) {
+		case RC_OK:
+		case RC_READY:
+		case RC_COMPLETED:
+			if (start)
+				rtt_update(&request_rtt, (unsigned long)
+				           ((monotime_ns() - start) / NS_PER_US));
+			return buf[0];
+		case RC_ERROR:
+			return -RC_ERROR;
+		}
+	}
 
-err:
 	return -1;
 }
 /* }}} */
 
+static void print_retries(FILE *fp)
+{
+	if (n_resyncs)
+		fprintf(fp, "%u retries, %u timeouts, %u resyncs\n", n_retries,
+		        n_timeouts, n_resyncs);
+	else if (n_retries || n_timeouts)
+		fprintf(fp, "%u retries, %u timeouts\n", n_retries, n_timeouts);
+}
+
 /* {{{ do_boot */
 /**
  * Cause the microcontroller to reboot to its bootloader.
@@ -74,12 +449,12 @@ err:
  * \param[in] argv Arguments (unused)
  * \return 0 on success, -1 on error.
  */
-static int do_boot(hid_device *dev, int argc, char *argv[])
+static int do_boot(struct transport *dev, int argc, char *argv[])
 {
 	(void)argc;
 	(void)argv;
 	memset(buf, 0, PACKET_LEN);
-	return send_report(dev, RQ_BOOT);
+	return send_report(dev, RQ_BOOT, HS_BOOT);
 }
 /* }}} */
 
@@ -92,7 +467,7 @@ static int do_boot(hid_device *dev, int argc, char *argv[])
  * \param[in] argv Arguments (unused)
  * \return 0 on success, -1 on error.
  */
-static int do_info(hid_device *dev, int argc, char *argv[])
+static int do_info(struct transport *dev, int argc, char *argv[])
 {
 	int i;
 
@@ -100,7 +475,8 @@ static int do_info(hid_device *dev, int argc, char *argv[])
 	(void)argv;
 
 	memset(buf, 0, PACKET_LEN);
-	if (send_report(dev, RQ_INFO) || buf[0] != RC_OK)
+	if (send_request(dev, RQ_INFO, HS_INFO, RETRY_TIMEOUT | RETRY_ERROR) ||
+	    buf[0] != RC_OK)
 		return -1;
 
 	/* Parse the response */
@@ -155,68 +531,100 @@ static int do_info(hid_device *dev, int argc, char *argv[])
 /**
  * Read the current configuration from EEPROM.
  *
+ * Each packet is written out as soon as it arrives, so the
+ * configuration can be any size. If the output file is "-", it's
+ * written to stdout, and the progress messages go to stderr.
+ *
  * \param[in] dev  Device
  * \param[in| argc Argument count (1)
  * \param[in] argv Arguments (file to write)
  * \return 0 on success, -1 on error.
  */
-static int do_read(hid_device *dev, int argc, char *argv[])
+static int do_read(struct transport *dev, int argc, char *argv[])
 {
-	FILE *fp;
-	size_t len, bytes_read = 0;
+	FILE *fp = NULL, *msg = stdout;
+	size_t n, len, bytes_read = 0;
+	int to_stdout;
+	uint64_t start;
+	double secs;
 
+	if (argc != 1 || !argv[0])
+		goto err;
+
+	to_stdout = !strcmp(argv[0], "-");
+	if (to_stdout) {
+		fp  = stdout;
+		msg = stderr;
+	} else if (!(fp = fopen(argv[0], "wb"))) {
+		perror("failed to open file: ");
+		goto err;
+	}
+
+	/*
+	 * RQ_READ can't be repeated after a timeout, since once a read is
+	 * under way the device takes it to be RC_READY.
+	 */
+	n_retries = n_timeouts = n_resyncs = 0;
 	memset(buf, 0, PACKET_LEN);
-	if (argc != 1 || !argv[0] || send_report(dev, RQ_READ) ||
-	    buf[0] != RC_OK)
+	if (send_request(dev, RQ_READ, HS_READ, RETRY_ERROR) || buf[0] != RC_OK) {
+		fputs("Failed to send READ packet\n", stderr);
 		goto err;
+	}
 
 	/* Get the data */
-	memset(filebuf, 0, BUFSIZ);
 	len = (size_t)(buf[2] << 8) | buf[1];
-	printf("\n---- Read (%lu bytes) ----\n", len);
-	fflush(stdout);
+	fprintf(msg, "\n---- Read (%lu bytes) ----\n", len);
+	if (!to_stdout) fprintf(msg, "Writing to '%s'\n", argv[0]);
+	fflush(msg);
+
+	start = monotime_ns();
+	if (fputs("SC", fp) == EOF)
+		goto write_err;
 
 	while (bytes_read < len) {
-		if (send_report(dev, RC_READY)) {
+		if (send_request(dev, RC_READY, HS_READY, RETRY_TIMEOUT)) {
 			fputs("Failed to send READY packet\n", stderr);
 			goto err;
 		}
 
-		memcpy(filebuf + bytes_read, buf, PACKET_LEN);
-		bytes_read += PACKET_LEN;
+		/* Only the image itself, not the padding of the last packet */
+		n = len - bytes_read;
+		if (n > PACKET_LEN) n = PACKET_LEN;
+		if (fwrite(buf, 1, n, fp) != n)
+			goto write_err;
+		bytes_read += n;
 
-		if (send_report(dev, RC_OK) < 0) {
+		if (send_report(dev, RC_OK, HS_ACK) < 0) {
 			fputs("Failed to acknowledge data packet\n", stderr);
 			goto err;
 		}
 	}
 
-	bytes_read = 0;
-	if (send_report(dev, RC_COMPLETED) < 0) {
+	if (send_report(dev, RC_COMPLETED, HS_COMPLETED) < 0) {
 		fputs("Failed to send COMPLETED packet\n", stderr);
 		goto err;
 	}
 
-	/* Write the file */
-	printf("Writing to '%s'\n", argv[0]);
-	if (!(fp = fopen(argv[0], "w+"))) {
-		perror("failed to open file: ");
-		goto err;
-	}
-
-	fputs("SC", fp);
-	do {
-		bytes_read += fwrite(filebuf + bytes_read, 1,
-		                     len - bytes_read, fp);
-	} while (bytes_read < len && !ferror(fp));
+	if (fflush(fp) == EOF || ferror(fp))
+		goto write_err;
 
-	if (ferror(fp))
-		fputs("Error writing the file\n", stderr);
-	else printf("%lu bytes written\n", bytes_read);
-	fclose(fp);
+	secs = (double)(monotime_ns() - start) / (double)NS_PER_S;
+	fprintf(msg, "%lu bytes written\n", bytes_read + 2);
+	fprintf(msg, "%lu bytes in %.3f s (%.0f bytes/s)\n", bytes_read, secs,
+	        secs > 0.0 ? (double)bytes_read / secs : 0.0);
+	print_retries(msg);
+	if (!to_stdout) fclose(fp);
 	return 0;
 
+write_err:
+	fputs("Error writing the file\n", stderr);
+
 err:
+	print_retries(msg);
+	if (fp && fp != stdout) {
+		fclose(fp);
+		remove(argv[0]);
+	}
 	return -1;
 }
 /* }}} */
@@ -230,12 +638,16 @@ err:
  * \param[in] argv Arguments (file to read)
  * \return 0 on success, -1 on error.
  */
-static int do_write(hid_device *dev, int argc, char *argv[])
+static int do_write(struct transport *dev, int argc, char *argv[])
 {
 	FILE *fp = NULL;
-	size_t i, len, bytes_in = 4, bytes_out = 4, max_len = 0;
+	unsigned char *image = NULL;
+	size_t i, len, n = 0, written = 0, furthest = 0, max_len = 0;
+	int r = 0, resyncs = 0, resumed = 0;
 
-	if (argc != 1|| !argv[0] || send_report(dev, RQ_INFO) ||
+	n_retries = n_timeouts = n_resyncs = 0;
+	if (argc != 1|| !argv[0] ||
+	    send_request(dev, RQ_INFO, HS_INFO, RETRY_TIMEOUT | RETRY_ERROR) ||
 	    buf[0] != RC_OK)
 		goto err;
 
@@ -273,7 +685,7 @@ static int do_write(hid_device *dev, int argc, char *argv[])
 	}
 
 	/* Read in the file*/
-	if (!(fp = fopen(argv[0], "r"))) {
+	if (!(fp = fopen(argv[0], "rb"))) {
 		perror("Unable to open file: ");
 		goto err;
 	}
@@ -300,140 +712,446 @@ static int do_write(hid_device *dev, int argc, char *argv[])
 		goto err;
 	}
 
-	/* Verify the header */
-	len -= 2;
+	/*
+	 * Read the whole image, so that a failed transfer can resume
+	 * from wherever the device got to.
+	 */
 	rewind(fp);
-	if (!(i = fread(filebuf, 1, 4, fp))) {
-		fputs("Failed to read the file header\n", stderr);
+	if (!(image = malloc(len)) || fread(image, 1, len, fp) != len) {
+		fputs("Failed to read the file\n", stderr);
 		goto err;
 	}
 
-	if (filebuf[0] != 'S' || filebuf[1] != 'C') {
+	fclose(fp);
+	fp = NULL;
+
+	/* Verify the header */
+	if (image[0] != 'S' || image[1] != 'C') {
 		fputs("Invalid file header\n", stderr);
 		goto err;
 	}
 
-	if (((filebuf[2] << 8) | filebuf[3]) < VER_SETTINGS) {
-		fprintf(stderr, "File version mismatch (%d.%02d)\n", filebuf[2],
-		        filebuf[3]);
+	if (((image[2] << 8) | image[3]) < VER_SETTINGS) {
+		fprintf(stderr, "File version mismatch (%d.%02d)\n", image[2],
+		        image[3]);
 		goto err;
 	}
 
+	/* The signature isn't sent */
+	len -= 2;
+
 	/* Tell the device to get ready */
 	printf("\n---- Write (%lu bytes) ----\n", len);
-	memset(buf, 0, PACKET_LEN);
-	buf[1] = len & 0xff;
-	buf[2] = (len >> 8) & 0xff;
-	if (send_report(dev, RQ_WRITE) || buf[0] != RC_OK) {
+	if ((r = start_write(dev, len)) < 0) {
 		fputs("Failed to send WRITE packet\n", stderr);
 		goto err;
 	}
 
-	/* Buffer in the data and write it out */
-	do {
-		if (!feof(fp) &&
-		   !(i = fread(filebuf + bytes_in, 1, BUFSIZ - bytes_in, fp))) {
-			fputs("Failed to read from file\n", stderr);
-			goto err;
+	/*
+	 * Each packet carries its own offset, so a packet can safely be
+	 * sent again, and a transfer can be resumed by repeating the
+	 * WRITE request.
+	 */
+	while (1) {
+		if (written >= len) {
+			if (r == RC_COMPLETED || !wait_for(dev, RC_COMPLETED))
+				break;
+
+			/* Send the last packet again */
+			fputs("Transfer not completed\n", stderr);
+			written -= n;
+			goto resync;
 		}
 
-		if (hid_read_timeout(dev, buf, PACKET_LEN + 1, 2500) < 0 ||
-		    buf[0] != RC_READY) {
+		if (r != RC_READY && wait_for(dev, RC_READY)) {
 			fputs("Device not ready\n", stderr);
-			goto err;
+			goto resync;
 		} else printf("Device ready\n");
 
-		max_len = 2 + (bytes_in - bytes_out) + i;
-		max_len =(max_len > 60) ? 60 : max_len;
-		buf[1] = max_len & 0xff;
-		buf[2] = bytes_out & 0xff;
-		buf[3] = (bytes_out >> 8) & 0xff;
-		memcpy(buf + 4, filebuf + bytes_out - 2, max_len);
-		if (send_report(dev, RQ_WRITE | RQ_CONTINUATION) ||
-		    buf[0] != RC_OK) {
+		n = len - written;
+		if (n > PACKET_LEN - 4) n = PACKET_LEN - 4;
+
+		if ((r = write_chunk(dev, image + 2, written, n)) < 0) {
+			/* The device won't resume, so start over */
+			if (resumed && r == -RC_ERROR) {
+				fputs("Device refused to resume\n", stderr);
+				written = 0;
+			}
+
 			fputs("Failed to write to device\n", stderr);
+			goto resync;
+		}
+
+		resumed  = 0;
+		written += n;
+		printf("%lu / %lu bytes written\n", written, len);
+
+		/* Each new offset gets its own resyncs */
+		if (written > furthest) {
+			furthest = written;
+			resyncs  = 0;
+		}
+		continue;
+
+resync:
+		if (++resyncs > MAX_RESYNCS)
+			goto err;
+
+		++n_resyncs;
+
+		fprintf(stderr, "Resuming at offset %lu\n", written);
+		if ((r = start_write(dev, len)) < 0) {
+			fputs("Failed to send WRITE packet\n", stderr);
 			goto err;
 		}
 
-		bytes_in  += i;
-		bytes_out += max_len;
-		printf("%lu / %lu bytes written\n", bytes_out - 4, len);
-	} while (bytes_out < len && !ferror(fp));
+		resumed = 1;
+	}
 
-	if (hid_read_timeout(dev, buf, PACKET_LEN + 1, 2500) < 0 ||
-	    buf[0] != RC_COMPLETED) {
-		fputs("Transfer not completed\n", stderr);
-		goto err;
-	} else puts("Transfer complete");
+	puts("Transfer complete");
 
+	print_retries(stdout);
+	free(image);
 	return 0;
 
 err:
+	print_retries(stdout);
 	if (fp) fclose(fp);
+	free(image);
+	return -1;
+}
+/* }}} */
+
+/* {{{ do_listen */
+#define LISTEN_RING 4096
+
+struct listen_options {
+	int           format;
+	unsigned long max_events;
+	unsigned long ring_size;
+	const char   *record;    /* trace to write              */
+	const char   *serve;     /* socket to serve on          */
+	const char   *connect;   /* socket to get events from   */
+	int           all;       /* listen to every converter   */
+	int           scancodes; /* set to decode scancodes as  */
+	int           cpu;       /* real-time on this CPU, or -1 */
+};
+
+/* Where events go, besides the output */
+struct listen_sinks {
+	struct sclog  log;
+	struct server srv;
+};
+
+static volatile sig_atomic_t stop_listening = 0;
+
+static void on_interrupt(int sig)
+{
+	(void)sig;
+	stop_listening = 1;
+}
+
+static void sink_event(const struct listen_event *ev, void *ctx)
+{
+	struct listen_sinks *sinks = ctx;
+
+	if (sinks->log.fp) sclog_write(&sinks->log, ev);
+	if (sinks->srv.fd >= 0) server_event(&sinks->srv, ev);
+}
+
+/* {{{ parse_listen_options */
+static int parse_listen_options(struct listen_options *o, int argc,
+                                char *argv[])
+{
+	int i;
+
+	memset(o, 0, sizeof(*o));
+	o->format    = LISTEN_DECODED;
+	o->ring_size = LISTEN_RING;
+	o->cpu       = -1;
+
+	for (i = 0; i < argc; i++) {
+		if (!strcmp(argv[i], "--format") && i + 1 < argc) {
+			if ((o->format = listen_format_by_name(argv[++i])) < 0) {
+				fprintf(stderr, "%s: unknown format\n", argv[i]);
+				goto err;
+			}
+		} else if (!strcmp(argv[i], "--count") && i + 1 < argc) {
+			o->max_events = strtoul(argv[++i], NULL, 0);
+		} else if (!strcmp(argv[i], "--ring") && i + 1 < argc) {
+			o->ring_size = strtoul(argv[++i], NULL, 0);
+		} else if (!strcmp(argv[i], "--record") && i + 1 < argc) {
+			o->record = argv[++i];
+		} else if (!strcmp(argv[i], "--serve") && i + 1 < argc) {
+			o->serve = argv[++i];
+		} else if (!strcmp(argv[i], "--connect") && i + 1 < argc) {
+			o->connect = argv[++i];
+		} else if (!strcmp(argv[i], "--all")) {
+			o->all = 1;
+		} else if (!strcmp(argv[i], "--realtime")) {
+			if (o->cpu < 0) o->cpu = realtime_default_cpu();
+		} else if (!strcmp(argv[i], "--cpu") && i + 1 < argc) {
+			if ((o->cpu = atoi(argv[++i])) < 0) {
+				fprintf(stderr, "%s: invalid CPU\n", argv[i]);
+				goto err;
+			}
+		} else if (!strcmp(argv[i], "--scancodes") && i + 1 < argc) {
+			if ((o->scancodes = scancode_set_by_name(argv[++i])) < 0) {
+				fprintf(stderr, "%s: unknown scancode set\n", argv[i]);
+				goto err;
+			}
+		} else {
+			fprintf(stderr, "%s: unknown listen option\n", argv[i]);
+			goto err;
+		}
+	}
+
+	return 0;
+
+err:
 	return -1;
 }
 /* }}} */
 
-/* {{{ xlate_keys */
+/* {{{ listen_device */
 /**
- * Translate any key codes in the buffer to symbolic names.
- * \param[in] count Number of bytes in the buffer
+ * Listen to one or more devices.
+ *
+ * Reports are read by a capture thread into a ring, and decoded and
+ * written out here, so a slow terminal or pipe doesn't hold up reading
+ * from the device. Output is batched while there's a backlog, and
+ * written out as soon as it's cleared.
  */
-static void xlate_keys(int count)
+static int listen_device(struct transport **devs, int n,
+                         struct listen_decoder *dec,
+                         const struct listen_options *o, struct server *srv)
 {
-	int i;
-	unsigned char c;
-	const char *token;
-	long key;
-
-	for (i = 0; i < count; i++) {
-		/* A key event */
-		if ((buf[i] == 'd' || buf[i] == 'u' || buf[i] == '-' ||
-		     buf[i] == '+') && i + 3 < count) {
-			c = buf[i + 3];
-			buf[i + 3] = 0;
-			key = strtol((const char *)(buf + i + 1),  NULL, 16);
-			token = lookup_hid_token_by_value(key & 0xff);
-			if (token) {
-				printf("%c%c%c (%s) ", buf[i], buf[i + 1],
-				       buf[i + 2], token);
-				i += 2;
-			} else {
-				buf[i + 3] = c;
-				putchar(buf[i]);
+	struct capture cap;
+	struct ring_slot *slot;
+	unsigned long overflow = 0;
+	int retval = -1;
+
+	if (capture_start(&cap, devs, n, o->ring_size, o->cpu))
+		goto ret;
+
+	while (!stop_listening &&
+	       (!o->max_events || dec->events < o->max_events)) {
+		if ((slot = ring_peek(&cap.ring))) {
+			listen_decode(dec, slot->device, slot->data, slot->len,
+			              slot->time);
+			ring_release(&cap.ring);
+			if (srv->fd >= 0) server_poll(srv, 0);
+			continue;
+		}
+
+		/* Caught up: write out what we have, and wait for more */
+		if (load_acquire(&cap.done) || listen_flush(dec))
+			break;
+
+		if (load_acquire(&cap.ring.overflow) != overflow) {
+			overflow = load_acquire(&cap.ring.overflow);
+			fprintf(stderr, "\nwarning: %lu report(s) dropped so far\n",
+			        overflow);
+		}
+
+		if (srv->fd >= 0) server_poll(srv, 1);
+		else sleep_ns(NS_PER_MS);
+	}
+
+	/* Take whatever was captured before the thread stopped */
+	capture_stop(&cap);
+	while ((!o->max_events || dec->events < o->max_events) &&
+	       (slot = ring_peek(&cap.ring))) {
+		listen_decode(dec, slot->device, slot->data, slot->len,
+		              slot->time);
+		ring_release(&cap.ring);
+	}
+
+	if (cap.error) fputs("Unable to read from the device\n", stderr);
+	else if (listen_flush(dec))
+		fputs("Unable to write the output\n", stderr);
+	else retval = 0;
+
+	fprintf(stderr, "\n%lu reports, %lu dropped, ring peak %lu of %lu\n",
+	        cap.reports, cap.ring.overflow, cap.ring.peak,
+	        cap.ring.mask + 1);
+	if (srv->fd >= 0)
+		fprintf(stderr, "%lu slow subscriber(s) dropped\n", srv->dropped);
+
+	if (o->cpu >= 0) {
+		realtime_print(stderr, &cap.rt);
+		hist_print(stderr, "Wake-up delay (timeout to timestamp)",
+		           &cap.wakeup);
+	}
+	capture_free(&cap);
+
+ret:
+	return retval;
+}
+/* }}} */
+
+/* {{{ listen_client */
+/**
+ * Get events from a listen --serve process, rather than a device.
+ */
+static int listen_client(struct listen_decoder *dec,
+                         const struct listen_options *o)
+{
+	unsigned char in[4096];
+	struct listen_event ev;
+	struct sclog log;
+	size_t have = 0, off;
+	ssize_t n;
+	int fd, header = 0, retval = -1;
+
+	if ((fd = server_connect(o->connect)) < 0)
+		goto ret;
+
+	while (!stop_listening &&
+	       (!o->max_events || dec->events < o->max_events)) {
+		if ((n = read(fd, in + have, sizeof(in) - have)) < 0 &&
+		    errno == EINTR)
+			continue;
+
+		if (n <= 0) {
+			fputs("\nThe server went away", stderr);
+			goto close;
+		}
+
+		have += (size_t)n;
+		off   = 0;
+		if (!header) {
+			if (have < SCLOG_HEADER_LEN)
+				continue;
+
+			if (sclog_unpack_header(&log, in)) {
+				fputs("Not a listen server\n", stderr);
+				goto close;
 			}
-		} else putchar(buf[i]);
+
+			/* Times are relative to the server's session */
+			dec->start = log.start;
+			off        = SCLOG_HEADER_LEN;
+			header     = 1;
+		}
+
+		for (; have - off >= SCLOG_RECORD_LEN &&
+		       (!o->max_events || dec->events < o->max_events);
+		     off += SCLOG_RECORD_LEN) {
+			sclog_unpack(&log, in + off, &ev);
+			listen_emit(dec, &ev);
+		}
+
+		have -= off;
+		memmove(in, in + off, have);
+		if (listen_flush(dec))
+			goto close;
 	}
+	retval = 0;
+
+close:
+	fputc('\n', stderr);
+	close(fd);
 
-	fflush(stdout);
+ret:
+	return retval;
 }
 /* }}} */
 
-/* {{{ do_listen */
 /**
- * Listen for events from the device.
+ * Listen for events from the device, every converter (--all), or
+ * another sctool serving them (--connect). With --all, hidraw devices
+ * are waited on together with epoll; devices of other transports get a
+ * reader thread each, or are polled if the threads can't be started.
  *
- * \param[in] dev  Device
- * \param[in| argc Argument count (unused)
- * \param[in] argv Arguments (unused)
+ * \param[in] dev  Device, or NULL with --connect or --all
+ * \param[in| argc Argument count
+ * \param[in] argv Arguments ([--format raw|decoded|json|none]
+ *                 [--count n] [--ring n] [--record file]
+ *                 [--serve socket | --connect socket] [--all]
+ *                 [--scancodes set1|set2|set3]
+ *                 [--realtime] [--cpu n])
  * \return 0 on success, -1 on error.
  */
-static int do_listen(hid_device *dev, int argc, char *argv[])
+static int do_listen(struct transport *dev, int argc, char *argv[])
 {
-	int count;
-	(void)argc;
-	(void)argv;
+	static struct listen_decoder dec;
+	static struct listen_sinks sinks;
+	struct transport *devs[LISTEN_MAX_DEVICES];
+	struct listen_options o;
+	struct scancode_stats sc_stats;
+	struct sigaction sa, old_sa;
+	int i, n = 1, retval = -1;
+	uint64_t start;
+
+	if (parse_listen_options(&o, argc, argv))
+		goto ret;
 
-	do {
-		memset(buf, 0, PACKET_LEN);
-		if ((count = hid_read_timeout(dev, buf, PACKET_LEN, 250)) < 0)
-			goto err;
-		xlate_keys(count);
-	} while (1);
+	/* Stop cleanly on ^C, so the output and summary are complete */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_interrupt;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, &old_sa);
+
+	start = monotime_ns();
+	listen_init(&dec, o.format, stdout, start);
+	if (o.scancodes) listen_set_scancodes(&dec, o.scancodes);
+	listen_set_limit(&dec, o.max_events);
+	sinks.log.fp = NULL;
+	sinks.srv.fd = -1;
+	listen_set_hook(&dec, sink_event, &sinks);
+
+	if (o.record && sclog_create(&sinks.log, o.record, start))
+		goto restore;
+
+	if (o.serve && !o.connect && server_start(&sinks.srv, o.serve, start))
+		goto close;
+
+	devs[0] = dev;
+	if (o.connect) retval = listen_client(&dec, &o);
+	else if (o.all && !(n = transport_open_all(&debug_interface, devs,
+	                                           LISTEN_MAX_DEVICES)))
+		goto close;
+	else {
+		if (o.all) fprintf(stderr, "Listening to %d device(s)\n", n);
+		dec.devices = n;
+		retval = listen_device(devs, n, &dec, &o, &sinks.srv);
+	}
 
-err:
-	fputs("Unable to read from the device\n", stderr);
-	return -1;
+	for (i = 0; o.all && i < n; i++)
+		transport_close(devs[i]);
+
+	if (listen_flush(&dec) && !retval) {
+		fputs("Unable to write the output\n", stderr);
+		retval = -1;
+	}
+
+	fprintf(stderr, "%lu events in %.3f s (%.0f events/s)\n",
+	        dec.events, (double)(monotime_ns() - start) / NS_PER_S,
+	        (double)dec.events * NS_PER_S /
+	        (double)(monotime_ns() - start + 1));
+
+	if (o.scancodes) {
+		listen_scancode_stats(&dec, &sc_stats);
+		scancode_print_stats(stderr, o.scancodes, &sc_stats);
+	}
+
+close:
+	if (sinks.srv.fd >= 0)
+		server_stop(&sinks.srv);
+
+	if (o.record && sclog_close(&sinks.log)) {
+		fprintf(stderr, "Unable to write the trace to '%s'\n", o.record);
+		retval = -1;
+	} else if (o.record)
+		fprintf(stderr, "%lu events recorded\n", sinks.log.records);
+
+restore:
+	sigaction(SIGINT, &old_sa, NULL);
+	stop_listening = 0;
+
+ret:
+	return retval;
 }
 /* }}} */
 
@@ -445,112 +1163,268 @@ static const struct command {
 	const char *name;
 	size_t name_len;
 	int argc;
-	int usage_page;
-	int usage;
-	int interface;
-	int (*proc)(hid_device *dev, int argc, char *argv[]);
+	struct transport_match match;
+	int (*proc)(struct transport *dev, int argc, char *argv[]);
 } commands[N_COMMANDS] = {
-	{ "boot",   4, 0, 0xff99, 0x2468, 3, do_boot,  },
-	{ "info",   4, 0, 0xff99, 0x2468, 3, do_info,  },
-	{ "read",   4, 1, 0xff99, 0x2468, 3, do_read   }, /* <output_file> */
-	{ "write",  5, 1, 0xff99, 0x2468, 3, do_write  }, /* <input_file>  */
-	{ "listen", 6, 0, 0xff31, 0x0074, 1, do_listen }
+	{ "boot",   4, 0, CONTROL_INTERFACE, do_boot   },
+	{ "info",   4, 0, CONTROL_INTERFACE, do_info   },
+	{ "read",   4, 1, CONTROL_INTERFACE, do_read   }, /* <output_file> */
+	{ "write",  5, 1, CONTROL_INTERFACE, do_write  }, /* <input_file>  */
+	{ "listen", 6, 0, DEBUG_INTERFACE,   do_listen }
 };
 
-/* {{{ find_device */
+/* {{{ find_command */
 /**
- * Find the converter
+ * Look up a command by name.
  *
- * \param[in] i Command index
- * \return the device handle, or NULL if the device can't be found.
+ * \param[in] name Command name
+ * \return the command, or NULL if there's no such command.
  */
-static hid_device *find_device(int i)
+static const struct command *find_command(const char *name)
 {
-	int is_hidraw = 0;
-	struct hid_device_info *devs = NULL, *cur_dev;
-	hid_device *dev;
-
-	/* Enumerate devices */
- 	devs = hid_enumerate(SC_VID, SC_PID);
- 	if (!devs) goto not_found;
-
- 	cur_dev = devs;
- 	do {
-		/* XXX: hidapi's usage page info is worthless with hidraw */
-		is_hidraw = strstr(cur_dev->path, "/dev/") != NULL;
-
-		if (!is_hidraw &&
- 		    cur_dev->usage      == commands[i].usage &&
- 		    cur_dev->usage_page == commands[i].usage_page)
- 			break;
-
- 		/* Search by interface if we don't have the usage info */
- 		if ((is_hidraw || (!cur_dev->usage && !cur_dev->usage_page)) &&
- 		    cur_dev->interface_number == commands[i].interface)
- 			break;
- 		cur_dev = cur_dev->next;
- 	} while (cur_dev);
-
-	if (!cur_dev) goto not_found;
-	if (!(dev = hid_open_path(cur_dev->path)))
-		goto no_device;
-
-	/* Free the enumeration data */
-	hid_free_enumeration(devs);
-	devs = NULL;
-	return dev;
-
-no_device:
-	fputs("Unable to open device\n", stderr);
-	goto err;
-
-not_found:
-	fputs("No devices found.\n", stderr);
+	int i = -1;
+	size_t len;
+
+	if (!name)
+		goto err;
+
+	len = strlen(name);
+	if (len < MIN_COMMAND_LEN || len > MAX_COMMAND_LEN)
+		goto err;
+
+	while (++i < N_COMMANDS) {
+		if (len == commands[i].name_len &&
+		    !memcmp(name, commands[i].name, len))
+			return &commands[i];
+	}
 
 err:
-	if (devs) hid_free_enumeration(devs);
 	return NULL;
 }
 /* }}} */
 
-int run_command(int argc, char *argv[])
+/**
+ * A device kept open across several commands.
+ */
+struct session {
+	struct transport *dev;
+	const struct transport_match *match;
+};
+
+/* {{{ session_open */
+/**
+ * Get a device matching \a match, reusing the open one if it
+ * matches. Otherwise, the open device is closed first.
+ *
+ * \return the device, or NULL if it can't be found or opened.
+ */
+static struct transport *session_open(struct session *s,
+                                      const struct transport_match *match)
 {
-	int i = -1;
-	size_t len;
-	int retval = -EINVAL;
-	hid_device *dev;
+	if (s->dev && !memcmp(s->match, match, sizeof(*match)))
+		return s->dev;
 
-	if (argc < 1 || !argv || !argv[0])
+	if (s->dev)
+		transport_close(s->dev);
+	s->match = match;
+	return s->dev = transport_open(match);
+}
+/* }}} */
+
+static void session_close(struct session *s)
+{
+	if (s->dev)
+		transport_close(s->dev);
+	s->dev = NULL;
+}
+
+/* {{{ listen_without_device */
+/**
+ * Check whether listen's arguments mean it doesn't use the device:
+ * --connect gets events from another sctool, and --all opens every
+ * converter itself.
+ */
+static int listen_without_device(int argc, char *argv[])
+{
+	int i;
+
+	for (i = 0; i < argc; i++) {
+		if (!strcmp(argv[i], "--connect") || !strcmp(argv[i], "--all"))
+			return 1;
+	}
+
+	return 0;
+}
+/* }}} */
+
+/* {{{ run_step */
+/**
+ * Run a single batch step, timing it. listen takes the options which
+ * follow it, up to the next command.
+ *
+ * \param[in] s    Session
+ * \param[in] n    Step number
+ * \param[in] argc Argument count, including the command name
+ * \param[in] argv Command name, followed by its arguments
+ * \return the number of arguments consumed on success,
+ *         -EINVAL for an invalid command, or -1 on error.
+ */
+static int run_step(struct session *s, int n, int argc, char *argv[])
+{
+	const struct command *cmd;
+	struct transport *dev;
+	uint64_t start, opened;
+	int nargs, retval = -EINVAL;
+
+	if (!(cmd = find_command(argv[0]))) {
+		fprintf(stderr, "batch: step %d: %s: invalid command\n",
+		        n, argv[0]);
 		goto ret;
+	}
 
-	/* Find the command */
-	len = strlen(argv[0]);
-	if (len < MIN_COMMAND_LEN || len > MAX_COMMAND_LEN)
+	nargs = cmd->argc;
+	if (cmd->proc == do_listen) {
+		while (nargs < argc - 1 && !find_command(argv[nargs + 1]))
+			++nargs;
+	}
+
+	if (argc - 1 < cmd->argc) {
+		fprintf(stderr, "batch: step %d: %s: missing argument\n",
+		        n, argv[0]);
 		goto ret;
+	}
 
-	while (++i < N_COMMANDS) {
-		if (len != commands[i].name_len)
+	/*
+	 * A listen which doesn't use the device gets none, and the open one
+	 * is closed, so that listen --all can open it too.
+	 */
+	start = monotime_ns();
+	if (cmd->proc == do_listen && listen_without_device(nargs, &argv[1])) {
+		session_close(s);
+		dev = NULL;
+	} else if (!(dev = session_open(s, &cmd->match))) {
+		retval = -1;
+		goto ret;
+	}
+
+	opened = monotime_ns();
+	retval = cmd->proc(dev, nargs, &argv[1]);
+	fprintf(stderr, "batch: step %d: %s: %s (open %.3f ms, run %.3f ms)\n",
+	        n, cmd->name, retval ? "failed" : "ok",
+	        (double)(opened - start) / NS_PER_MS,
+	        (double)(monotime_ns() - opened) / NS_PER_MS);
+	if (!retval) retval = nargs + 1;
+
+	/* The device goes away once it reboots to the bootloader */
+	if (cmd->proc == do_boot)
+		session_close(s);
+
+ret:
+	return retval;
+}
+/* }}} */
+
+#define MAX_LINE_ARGS 8
+
+/* {{{ do_batch */
+/**
+ * Run a sequence of commands over the same device handle.
+ *
+ * The commands are taken from \a argv, one after another, each
+ * followed by its arguments (e.g. "info write a.scb read b.scb").
+ * If there are none, they're read from stdin, one per line. Blank
+ * lines, and lines starting with '#', are ignored.
+ *
+ * The batch stops at the first command that fails.
+ *
+ * \param[in] argc Argument count
+ * \param[in] argv Commands and their arguments
+ * \return 0 on success, -EINVAL for an invalid command, -1 on error.
+ */
+static int do_batch(int argc, char *argv[])
+{
+	struct session s = { NULL, NULL };
+	char line[1024], *args[MAX_LINE_ARGS], *p;
+	int i = 0, n = 0, nargs, retval = 0;
+	uint64_t start = monotime_ns();
+
+	/* Commands given on the command line */
+	while (i < argc) {
+		if ((retval = run_step(&s, ++n, argc - i, &argv[i])) < 0)
+			goto ret;
+		i += retval;
+		retval = 0;
+	}
+
+	/* ... or in a script on stdin */
+	while (!argc && fgets(line, sizeof(line), stdin)) {
+		nargs = 0;
+		p = strtok(line, " \t\r\n");
+		while (p && *p != '#' && nargs < MAX_LINE_ARGS) {
+			args[nargs++] = p;
+			p = strtok(NULL, " \t\r\n");
+		}
+
+		if (!nargs)
 			continue;
 
-		if (!memcmp(argv[0], commands[i].name, len))
-			break;
+		if ((retval = run_step(&s, ++n, nargs, args)) < 0)
+			goto ret;
+
+		if (retval != nargs) {
+			fprintf(stderr, "batch: step %d: too many arguments\n", n);
+			retval = -EINVAL;
+			goto ret;
+		}
+		retval = 0;
 	}
 
-	/* Return if we didn't find the command */
-	if (i >= N_COMMANDS)
+ret:
+	session_close(&s);
+	fprintf(stderr, "batch: %d step(s) in %.3f ms\n", n,
+	        (double)(monotime_ns() - start) / NS_PER_MS);
+	return retval == -EINVAL ? -1 : retval;
+}
+/* }}} */
+
+int run_command(int argc, char *argv[])
+{
+	int retval = -EINVAL;
+	const struct command *cmd;
+	struct transport *dev;
+
+	if (argc < 1 || !argv || !argv[0])
+		goto ret;
+
+	if (!strcmp(argv[0], "batch"))
+		return do_batch(argc - 1, &argv[1]);
+
+	/* analyze only needs the trace, not the device */
+	if (!strcmp(argv[0], "analyze"))
+		return argc < 2 ? -EINVAL : analyze_trace(argv[1], stdout);
+
+	/*
+	 * ... nor does listen, getting events from another sctool, and
+	 * listen --all opens the devices itself.
+	 */
+	if (!strcmp(argv[0], "listen") &&
+	    listen_without_device(argc - 1, &argv[1]))
+		return do_listen(NULL, argc - 1, &argv[1]);
+
+	/* Find the command */
+	if (!(cmd = find_command(argv[0])))
 		goto ret;
 
 	/* Ensure we have sufficient args */
-	if (argc - 1 < commands[i].argc)
+	if (argc - 1 < cmd->argc)
 		goto ret;
 
 	/* Now, look for the device and run the command. */
-	if ((dev = find_device(i))) {
-		retval = commands[i].proc(dev, argc - 1, &argv[1]);
-		hid_close(dev);
+	if ((dev = transport_open(&cmd->match))) {
+		retval = cmd->proc(dev, argc - 1, &argv[1]);
+		transport_close(dev);
 	} else retval = 0;
 
 ret:
 	return retval;
 }
-
@@ -0,0 +1,521 @@
+/**
+ * sctools: Binary config parser
+ * Copyright (C) 2016 Tim Hentenaar.
+ *
+ * This code is licenced under the Simplified BSD License.
+ * See the LICENSE file for details.
+ *
+ * Splits a binary config (as written by scas, and read by scdis) into
+ * its blocks, and each block into its entries, checking the lengths
+ * as it goes. Everything points into a copy of the image, so nothing
+ * is copied again.
+ *
+ * The layout is:
+ *
+ *   'S' 'C' <major> <minor> <force> <reserved>
+ *   then blocks of: <length> <flags> [<set>] [<id lo> <id hi>] <data>
+ *
+ * where the data for each type of block is:
+ *
+ *   layerdef: <count> then <count> (fn mask, layer) pairs
+ *   remap:    <layer> <count> then <count> (from, to) pairs
+ *   macro:    <count> then <count> macros of:
+ *             <hid> <desired meta> <matched meta> <press flags>
+ *             <release flags> then the (command, value) steps
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "macro_tokens.h"
+
+static const char *set_names[4] = { "set1", "set2", "set3", "set2ext" };
+static const char *meta_names[4] = { "CTRL", "SHIFT", "ALT", "GUI" };
+static const char *hmeta_names[8] = {
+	"LCTRL", "LSHIFT", "LALT", "LGUI",
+	"RCTRL", "RSHIFT", "RALT", "RGUI"
+};
+
+/* {{{ parse_macros */
+static const char *parse_macros(struct sc_block *b, const unsigned char *p,
+                                const unsigned char *end,
+                                const unsigned char *image)
+{
+	struct sc_macro *m;
+	unsigned int i;
+
+	if (p >= end) return "truncated";
+	b->n_entries = *p++;
+	if (!b->n_entries) return NULL;
+
+	if (!(b->macros = calloc(b->n_entries, sizeof(struct sc_macro))))
+		return "out of memory";
+
+	for (i = 0; i < b->n_entries; i++) {
+		m = &b->macros[i];
+		if (end - p < 5) return "macro truncated";
+
+		m->offset       = (size_t)(p - image);
+		m->hid          = p[0];
+		m->desired_meta = p[1];
+		m->matched_meta = p[2];
+		m->n_press      = p[3] & SC_MACRO_STEPS;
+		m->n_release    = p[4] & SC_MACRO_STEPS;
+		m->restore_meta = (p[4] & SC_MACRO_RESTORE_META) != 0;
+		p += 5;
+
+		if ((size_t)(end - p) < 2 * (m->n_press + m->n_release))
+			return "macro size mismatch";
+
+		m->press   = p;
+		m->release = p + 2 * m->n_press;
+		p         += 2 * (m->n_press + m->n_release);
+	}
+
+	return p == end ? NULL : "block size mismatch";
+}
+/* }}} */
+
+/* {{{ parse_block */
+/**
+ * Parse a block's header and entries.
+ *
+ * \return NULL on success, or what's wrong with it.
+ */
+static const char *parse_block(struct sc_block *b, const unsigned char *image,
+                               size_t offset)
+{
+	const unsigned char *p = image + offset, *end = p + p[0];
+	unsigned char flags;
+
+	b->offset   = offset;
+	b->length   = p[0];
+	b->keyboard = -1;
+	if (b->length < 2) return "block truncated";
+
+	flags     = p[1];
+	b->type   = flags & SC_BLOCK_TYPE;
+	b->select = (unsigned char)((flags & SC_BLOCK_SELECT) >> 3);
+	p        += 2;
+
+	if (flags & SC_BLOCK_HAS_SET) {
+		if (p >= end) return "block truncated";
+		b->set_mask = *p++;
+	}
+
+	if (flags & SC_BLOCK_HAS_ID) {
+		if (end - p < 2) return "block truncated";
+		b->keyboard = p[0] | (p[1] << 8);
+		p += 2;
+	}
+
+	b->header = (unsigned int)(p - (image + offset));
+
+	switch (b->type) {
+	case SC_BLOCK_LAYERDEF:
+		if (p >= end) return "block truncated";
+		b->n_entries = p[0];
+		b->entries   = p + 1;
+		if (end - p != (int)(2 * b->n_entries + 1))
+			return "block size mismatch";
+	break;
+	case SC_BLOCK_REMAP:
+		if (end - p < 2) return "block truncated";
+		b->layer     = p[0];
+		b->n_entries = p[1];
+		b->entries   = p + 2;
+		if (end - p != (int)(2 * b->n_entries + 2))
+			return "block size mismatch";
+	break;
+	case SC_BLOCK_MACRO:
+		return parse_macros(b, p, end, image);
+	default:
+		return "invalid block type";
+	}
+
+	return NULL;
+}
+/* }}} */
+
+/* {{{ sc_config_parse */
+/**
+ * Parse a binary config.
+ *
+ * \param[in] cfg   Config
+ * \param[in] image The binary config, which is copied
+ * \param[in] len   Its length
+ * \return 0 on success, -1 on error.
+ */
+int sc_config_parse(struct sc_config *cfg, const unsigned char *image,
+                    size_t len)
+{
+	const char *why;
+	size_t i;
+	unsigned int n;
+
+	memset(cfg, 0, sizeof(*cfg));
+	if (len < SC_HEADER_LEN || image[0] != 'S' || image[1] != 'C') {
+		fputs("Not a binary config\n", stderr);
+		goto err;
+	}
+
+	if (!(cfg->image = malloc(len))) {
+		fputs("Unable to allocate memory for the config\n", stderr);
+		goto err;
+	}
+
+	memcpy(cfg->image, image, len);
+	cfg->len        = len;
+	cfg->version[0] = image[2];
+	cfg->version[1] = image[3];
+	cfg->force      = image[4];
+
+	/* Count the blocks, then parse them */
+	for (i = SC_HEADER_LEN, n = 0; i < len; i += image[i], n++) {
+		if (!image[i] || i + image[i] > len) {
+			fprintf(stderr, "Block %u at offset %lu: bad length\n", n,
+			        (unsigned long)i);
+			goto free;
+		}
+	}
+
+	if (n && !(cfg->blocks = calloc(n, sizeof(struct sc_block)))) {
+		fputs("Unable to allocate memory for the config\n", stderr);
+		goto free;
+	}
+
+	cfg->n_blocks = n;
+	for (i = SC_HEADER_LEN, n = 0; i < len; i += image[i], n++) {
+		if ((why = parse_block(&cfg->blocks[n], cfg->image, i))) {
+			fprintf(stderr, "Block %u at offset %lu: %s\n", n,
+			        (unsigned long)i, why);
+			goto free;
+		}
+	}
+
+	return 0;
+
+free:
+	sc_config_free(cfg);
+
+err:
+	return -1;
+}
+/* }}} */
+
+/* {{{ sc_config_load */
+/**
+ * Load a binary config from a file ("-" for stdin).
+ *
+ * \return 0 on success, -1 on error.
+ */
+int sc_config_load(struct sc_config *cfg, const char *path)
+{
+	unsigned char *image = NULL, *tmp;
+	size_t len = 0, size = 0, n;
+	int retval = -1;
+	FILE *fp;
+
+	if (!strcmp(path, "-")) fp = stdin;
+	else if (!(fp = fopen(path, "rb"))) {
+		fprintf(stderr, "Unable to open '%s'\n", path);
+		goto ret;
+	}
+
+	for (;;) {
+		if (len == size) {
+			size = size ? 2 * size : 4096;
+			if (!(tmp = realloc(image, size))) {
+				fputs("Unable to allocate memory for the config\n",
+				      stderr);
+				goto close;
+			}
+			image = tmp;
+		}
+
+		if (!(n = fread(image + len, 1, size - len, fp)))
+			break;
+		len += n;
+	}
+
+	if (ferror(fp)) {
+		fprintf(stderr, "Unable to read '%s'\n", path);
+		goto close;
+	}
+
+	if (sc_config_parse(cfg, image, len))
+		fprintf(stderr, "%s: invalid config\n", path);
+	else retval = 0;
+
+close:
+	if (fp != stdin) fclose(fp);
+	free(image);
+
+ret:
+	return retval;
+}
+/* }}} */
+
+void sc_config_free(struct sc_config *cfg)
+{
+	unsigned int i;
+
+	for (i = 0; cfg->blocks && i < cfg->n_blocks; i++)
+		free(cfg->blocks[i].macros);
+
+	free(cfg->blocks);
+	free(cfg->image);
+	memset(cfg, 0, sizeof(*cfg));
+}
+
+/**
+ * Whether a block applies with the given selects (bit n for select
+ * n), set (SC_SET*), and keyboard ID (-1 if unknown).
+ */
+int sc_config_applies(const struct sc_block *b, unsigned char selects,
+                      unsigned char set, int keyboard)
+{
+	return (!b->select   || (selects & (1 << b->select))) &&
+	       (!b->set_mask || (b->set_mask & set))          &&
+	       (b->keyboard < 0 || b->keyboard == keyboard);
+}
+
+/* {{{ sc_config_keyboards */
+/**
+ * Find the keyboard IDs the ifkeyboard blocks use.
+ *
+ * \param[in]  cfg Config
+ * \param[out] ids One ID per block, at most
+ * \return the number of IDs.
+ */
+unsigned int sc_config_keyboards(const struct sc_config *cfg, int *ids)
+{
+	unsigned int i, j, n = 0;
+
+	for (i = 0; i < cfg->n_blocks; i++) {
+		if (cfg->blocks[i].keyboard < 0) continue;
+		for (j = 0; j < n && ids[j] != cfg->blocks[i].keyboard; j++);
+		if (j == n) ids[n++] = cfg->blocks[i].keyboard;
+	}
+
+	return n;
+}
+/* }}} */
+
+/* {{{ split_metas */
+/**
+ * Take the unhanded metas (e.g. SHIFT, for either hand) out of a
+ * macro's desired and matched metas, leaving the handed ones.
+ *
+ * \return the unhanded metas: bit n for CTRL, SHIFT, ALT, and GUI.
+ */
+static unsigned int split_metas(unsigned char *desired,
+                                unsigned char *matched)
+{
+	unsigned char unhanded = (unsigned char)(*desired & ~*matched & 0xf0);
+	unsigned int i, mask, ret = 0;
+
+	for (i = 0; i < 4; i++) {
+		mask = (1U << i) | (1U << (i + 4));
+		if (!(unhanded & mask)) continue;
+		ret      |= 1U << i;
+		*desired &= (unsigned char)~mask;
+		*matched &= (unsigned char)~mask;
+	}
+
+	return ret;
+}
+/* }}} */
+
+/* {{{ sc_macro_matches */
+/**
+ * Whether a macro's metas match. For an unhanded meta (e.g. SHIFT),
+ * either hand will do; otherwise each of the matched metas must be
+ * as desired.
+ */
+int sc_macro_matches(const struct sc_macro *m, unsigned char meta)
+{
+	unsigned char desired = m->desired_meta, matched = m->matched_meta;
+	unsigned int i, unhanded = split_metas(&desired, &matched);
+
+	for (i = 0; i < 4; i++) {
+		if ((unhanded & (1U << i)) &&
+		    !(meta & ((1U << i) | (1U << (i + 4)))))
+			return 0;
+	}
+
+	return (meta & matched) == (desired & matched);
+}
+/* }}} */
+
+/* {{{ sc_macro_meta_names */
+/**
+ * Write the metas a macro matches, as scas spells them (e.g. "SHIFT
+ * -LCTRL"), or "" if it matches any.
+ *
+ * \param[out] buf At least SC_META_NAMES_LEN bytes
+ */
+char *sc_macro_meta_names(unsigned char desired, unsigned char matched,
+                          char *buf)
+{
+	unsigned int i, unhanded = split_metas(&desired, &matched);
+	char *p = buf;
+
+	*p = '\0';
+	for (i = 0; i < 4; i++) {
+		if (!(unhanded & (1U << i))) continue;
+		p += sprintf(p, "%s%s", p != buf ? " " : "", meta_names[i]);
+	}
+
+	for (i = 0; i < 8; i++) {
+		if (!(matched & (1U << i))) continue;
+		p += sprintf(p, "%s%s%s", p != buf ? " " : "",
+		             desired & (1U << i) ? "" : "-", hmeta_names[i]);
+	}
+
+	return buf;
+}
+/* }}} */
+
+/**
+ * Get the ifset bit for a set's name, as scas and scdis spell them
+ * (e.g. "set2ext").
+ *
+ * \return the SC_SET* bit, or -1 if it isn't a set.
+ */
+int sc_config_set_by_name(const char *name)
+{
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		if (!strcmp(name, set_names[i]))
+			return 1 << i;
+	}
+
+	return -1;
+}
+
+/**
+ * Get the name of a set (SC_SET*).
+ */
+const char *sc_config_set_name(unsigned char set)
+{
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		if (set == 1 << i)
+			return set_names[i];
+	}
+
+	return "any";
+}
+
+/**
+ * Get the set a config forces, or set 2 if it doesn't force one.
+ */
+unsigned char sc_config_set(const struct sc_config *cfg)
+{
+	unsigned char force = cfg->force & 0x0f;
+	return (unsigned char)(force >= 1 && force <= 4 ? 1 << (force - 1)
+	                                                : SC_SET2);
+}
+
+/**
+ * Get the selects after a SELECT_n code is output: SELECT_0 resets
+ * them, and the others toggle their select.
+ */
+unsigned char sc_config_select(unsigned char selects, unsigned char code)
+{
+	if (code == SC_HID_SELECT_0) return 1;
+	return (unsigned char)(selects ^ (1 << (code - SC_HID_SELECT_0)));
+}
+
+/**
+ * Write the selects in a mask, other than select 0, as e.g. "1,3",
+ * or "-" if there are none.
+ *
+ * \param[out] buf At least 16 bytes
+ */
+char *sc_config_select_names(unsigned char selects, char *buf)
+{
+	char *p = buf;
+	unsigned int i;
+
+	for (i = 1; i < 8; i++) {
+		if (!(selects & (1 << i))) continue;
+		if (p != buf) *p++ = ',';
+		*p++ = (char)('0' + i);
+	}
+
+	if (p == buf) *p++ = '-';
+	*p = '\0';
+	return buf;
+}
+
+/* {{{ sc_config_selects */
+
+/**
+ * Find the select masks (bit n for select n) that can be reached from
+ * power-up, by the SELECT_n codes that the blocks which apply in each
+ * output, from remaps or macro steps.
+ *
+ * \param[in]  cfg      Config
+ * \param[in]  set      Set (SC_SET*)
+ * \param[in]  keyboard Keyboard ID, or -1
+ * \param[out] masks    SC_MAX_SELECTS masks, the power-up one first
+ * \return the number of masks found.
+ */
+unsigned int sc_config_selects(const struct sc_config *cfg, unsigned char set,
+                               int keyboard, unsigned char *masks)
+{
+	unsigned char seen[SC_MAX_SELECTS], cur, next, code;
+	const struct sc_block *b;
+	const struct sc_macro *m;
+	const unsigned char *step;
+	unsigned int i, j, k, cmd, n = 1;
+
+	memset(seen, 0, sizeof(seen));
+	masks[0] = 1;
+	seen[1]  = 1;
+
+	for (i = 0; i < n; i++) {
+		cur = masks[i];
+		for (j = 0; j < cfg->n_blocks; j++) {
+			b = &cfg->blocks[j];
+			if (b->type == SC_BLOCK_LAYERDEF ||
+			    !sc_config_applies(b, cur, set, keyboard))
+				continue;
+
+			for (k = 0; k < b->n_entries; k++) {
+				if (b->type == SC_BLOCK_REMAP) {
+					code = b->entries[2 * k + 1];
+					if (!sc_is_select(code)) continue;
+					if (!seen[next = sc_config_select(cur, code)]) {
+						seen[next]  = 1;
+						masks[n++] = next;
+					}
+					continue;
+				}
+
+				m = &b->macros[k];
+				for (step = m->press;
+				     step < m->press + 2 * (m->n_press + m->n_release);
+				     step += 2) {
+					cmd = step[0] & (unsigned int)~Q_PUSH_META;
+					if (cmd != Q_KEY_PRESS && cmd != Q_KEY_MAKE)
+						continue;
+					if (!sc_is_select(step[1])) continue;
+					if (!seen[next = sc_config_select(cur, step[1])]) {
+						seen[next]  = 1;
+						masks[n++] = next;
+					}
+				}
+			}
+		}
+	}
+
+	return n;
+}
+/* }}} */
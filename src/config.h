@@ -0,0 +1,106 @@
+/**
+ * sctools: Binary config parser
+ * Copyright (C) 2016 Tim Hentenaar.
+ *
+ * This code is licenced under the Simplified BSD License.
+ * See the LICENSE file for details.
+ */
+
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <stddef.h>
+
+/* Block types */
+#define SC_BLOCK_LAYERDEF 0
+#define SC_BLOCK_REMAP    1
+#define SC_BLOCK_MACRO    2
+
+/* Block flags */
+#define SC_BLOCK_HAS_ID     0x80 /* a 2-byte keyboard ID follows   */
+#define SC_BLOCK_HAS_SET    0x40 /* a 1-byte set mask follows      */
+#define SC_BLOCK_SELECT     0x38 /* ifselect (0 for any)           */
+#define SC_BLOCK_TYPE       0x07
+
+/* ifset bits */
+#define SC_SET1     0x01
+#define SC_SET2     0x02
+#define SC_SET3     0x04
+#define SC_SET2EXT  0x08
+
+/* Macro flags */
+#define SC_MACRO_STEPS        0x3f /* number of steps                  */
+#define SC_MACRO_RESTORE_META 0x80 /* onbreak (without norestoremeta)  */
+
+#define SC_HEADER_LEN 6
+
+/* Codes the converter handles itself */
+#define SC_HID_FN1       0xD0 /* ... FN8 is 0xD7      */
+#define SC_HID_SELECT_0  0xD8 /* ... SELECT_7 is 0xDF */
+
+#define sc_is_fn(c)     ((c) >= SC_HID_FN1 && (c) < SC_HID_FN1 + 8)
+#define sc_is_select(c) ((c) >= SC_HID_SELECT_0 && (c) < SC_HID_SELECT_0 + 8)
+
+/* Every select mask reachable from power-up fits in a byte */
+#define SC_MAX_SELECTS 256
+
+/* Room for every meta a macro can match, by name */
+#define SC_META_NAMES_LEN 80
+
+/**
+ * A macro: the key and metas which trigger it, and the steps to run
+ * when it's made and broken. Each step is a (command, value) pair.
+ */
+struct sc_macro {
+	unsigned char        hid;
+	unsigned char        desired_meta;
+	unsigned char        matched_meta;
+	unsigned char        restore_meta;
+	unsigned int         n_press, n_release;
+	const unsigned char *press;
+	const unsigned char *release;
+	size_t               offset; /* in the image */
+};
+
+struct sc_block {
+	size_t               offset;   /* in the image                  */
+	unsigned int         length;
+	unsigned int         header;   /* bytes before the data         */
+	unsigned char        type;     /* SC_BLOCK_*                    */
+	unsigned char        select;   /* ifselect, or 0 for any        */
+	unsigned char        set_mask; /* ifset, or 0 for any           */
+	int                  keyboard; /* ifkeyboard, or -1 for any     */
+	unsigned char        layer;    /* remap blocks                  */
+	unsigned int         n_entries;/* remaps, layer defs, or macros */
+	const unsigned char *entries;  /* pairs (not for macro blocks)  */
+	struct sc_macro     *macros;
+};
+
+struct sc_config {
+	unsigned char   *image;
+	size_t           len;
+	unsigned char    version[2];
+	unsigned char    force;
+	unsigned int     n_blocks;
+	struct sc_block *blocks;
+};
+
+int  sc_config_load(struct sc_config *cfg, const char *path);
+int  sc_config_parse(struct sc_config *cfg, const unsigned char *image,
+                     size_t len);
+void sc_config_free(struct sc_config *cfg);
+int  sc_config_applies(const struct sc_block *b, unsigned char selects,
+                       unsigned char set, int keyboard);
+unsigned int sc_config_keyboards(const struct sc_config *cfg, int *ids);
+int  sc_macro_matches(const struct sc_macro *m, unsigned char meta);
+char *sc_macro_meta_names(unsigned char desired, unsigned char matched,
+                          char *buf);
+int  sc_config_set_by_name(const char *name);
+const char *sc_config_set_name(unsigned char set);
+unsigned char sc_config_set(const struct sc_config *cfg);
+unsigned char sc_config_select(unsigned char selects, unsigned char code);
+char *sc_config_select_names(unsigned char selects, char *buf);
+unsigned int sc_config_selects(const struct sc_config *cfg, unsigned char set,
+                               int keyboard, unsigned char *masks);
+
+#endif /* CONFIG_H */
@@ -0,0 +1,628 @@
+/**
+ * sctools: Emulated converter
+ * Copyright (C) 2016 Tim Hentenaar.
+ *
+ * This code is licenced under the Simplified BSD License.
+ * See the LICENSE file for details.
+ *
+ * This plays the part of a Soarer's converter on top of the fake
+ * transport, implementing the rawhid protocol (info, read, write,
+ * boot) on the control interface, and typing a stream of keys on
+ * the debug interface used by listen. Every report the emulator
+ * sends can be delayed, dropped, or turned into an error.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rawhid_defs.h"
+#include "transport.h"
+#include "transport_fake.h"
+#include "monotime.h"
+#include "emulator.h"
+
+#define EMU_PENDING 8
+#define EMU_MAX_EEPROM 0xffff
+#define DEBUG_USAGE_PAGE 0xff31
+
+/* Protocol state of the control interface */
+#define ST_IDLE    0
+#define ST_READING 1
+#define ST_WRITING 2
+#define ST_BOOTED  3
+
+struct pending {
+	uint64_t due;
+	size_t len;
+	unsigned char data[PACKET_LEN];
+};
+
+struct emu_device {
+	int debug;
+	struct pending pending[EMU_PENDING];
+	unsigned int head, count;
+	uint64_t last_due;
+
+	/* control interface */
+	int state;
+	size_t offset;
+
+	/* debug interface */
+	char text[2 * PACKET_LEN];
+	size_t text_len;
+	unsigned long keys_typed;
+	int key, key_down;
+	uint64_t next_key;
+
+	/* Each device has its own, as they may be read on their own threads */
+	unsigned long rng;
+};
+
+static struct emu_config config = {
+	1024, 2560, 2048, 0, 0, 0.0, 0.0, 0.0, 1, 0, 0, NULL, 1
+};
+
+/* EEPROM contents, and the write staging area */
+static unsigned char *eeprom = NULL;
+static unsigned char *staging = NULL;
+static size_t eeprom_len = 0;
+static size_t write_len = 0;
+static size_t received = 0;
+static unsigned long rng; /* seeds each device's */
+
+/* HID code, set 2 scancode, extended flag */
+#define N_EMU_KEYS 42
+static const unsigned char emu_keys[N_EMU_KEYS][3] = {
+	{ 0x04, 0x1c, 0 }, { 0x05, 0x32, 0 }, { 0x06, 0x21, 0 },
+	{ 0x07, 0x23, 0 }, { 0x08, 0x24, 0 }, { 0x09, 0x2b, 0 },
+	{ 0x0a, 0x34, 0 }, { 0x0b, 0x33, 0 }, { 0x0c, 0x43, 0 },
+	{ 0x0d, 0x3b, 0 }, { 0x0e, 0x42, 0 }, { 0x0f, 0x4b, 0 },
+	{ 0x10, 0x3a, 0 }, { 0x11, 0x31, 0 }, { 0x12, 0x44, 0 },
+	{ 0x13, 0x4d, 0 }, { 0x14, 0x15, 0 }, { 0x15, 0x2d, 0 },
+	{ 0x16, 0x1b, 0 }, { 0x17, 0x2c, 0 }, { 0x18, 0x3c, 0 },
+	{ 0x19, 0x2a, 0 }, { 0x1a, 0x1d, 0 }, { 0x1b, 0x22, 0 },
+	{ 0x1c, 0x35, 0 }, { 0x1d, 0x1a, 0 }, { 0x1e, 0x16, 0 },
+	{ 0x1f, 0x1e, 0 }, { 0x20, 0x26, 0 }, { 0x21, 0x25, 0 },
+	{ 0x22, 0x2e, 0 }, { 0x23, 0x36, 0 }, { 0x24, 0x3d, 0 },
+	{ 0x25, 0x3e, 0 }, { 0x26, 0x46, 0 }, { 0x27, 0x45, 0 },
+	{ 0x28, 0x5a, 0 }, { 0x2a, 0x66, 0 }, { 0x2c, 0x29, 0 },
+	{ 0xe1, 0x12, 0 }, { 0x4f, 0x74, 1 }, { 0x50, 0x6b, 1 }
+};
+
+/* {{{ random_next */
+/**
+ * xorshift32, so runs are reproducible regardless of the C library.
+ *
+ * \param[in,out] state Generator state
+ * \return a random number in [0, 1).
+ */
+static double random_next(unsigned long *state)
+{
+	unsigned long x = *state;
+
+	x ^= (x << 13) & 0xffffffffUL;
+	x ^= x >> 17;
+	x ^= (x << 5) & 0xffffffffUL;
+	*state = x;
+	return (double)x / 4294967296.0;
+}
+/* }}} */
+
+/* {{{ queue_report */
+/**
+ * Schedule a report for delivery to the host, subject to the
+ * configured latency, jitter, and loss.
+ *
+ * \param[in] dev Device
+ * \param[in] at  Earliest time the report may be delivered
+ * \param[in] buf Report
+ * \param[in] len Report length
+ */
+static void queue_report(struct emu_device *dev, uint64_t at,
+                         const unsigned char *buf, size_t len)
+{
+	struct pending *p;
+
+	if (config.drop > 0.0 && random_next(&dev->rng) < config.drop)
+		return;
+
+	if (dev->count >= EMU_PENDING)
+		return;
+
+	at += config.latency_us * NS_PER_US;
+	if (config.jitter_us)
+		at += (uint64_t)(random_next(&dev->rng) * (double)config.jitter_us *
+		                 (double)NS_PER_US);
+
+	/* Reports are delivered in order */
+	if (at < dev->last_due) at = dev->last_due;
+	dev->last_due = at;
+
+	p = &dev->pending[(dev->head + dev->count++) % EMU_PENDING];
+	p->due = at;
+	p->len = len > PACKET_LEN ? PACKET_LEN : len;
+	memset(p->data, 0, PACKET_LEN);
+	memcpy(p->data, buf, p->len);
+}
+/* }}} */
+
+static void respond(struct emu_device *dev, unsigned char *buf)
+{
+	queue_report(dev, monotime_ns(), buf, PACKET_LEN);
+}
+
+static void put_info(unsigned char *p, unsigned char code, unsigned int v)
+{
+	p[0] = code;
+	p[1] = v & 0xff;
+	p[2] = (v >> 8) & 0xff;
+}
+
+static void put_version(unsigned char *p, unsigned char code,
+                        unsigned char major, unsigned char minor)
+{
+	p[0] = code;
+	p[1] = major;
+	p[2] = minor;
+}
+
+/* {{{ do_info */
+static void do_info(struct emu_device *dev, unsigned char *buf)
+{
+	buf[0] = RC_OK;
+	put_version(buf + 1,  IC_CODE_VERSION,       1, 10);
+	put_version(buf + 4,  IC_PROTOCOL_VERSION,   1, 0);
+	put_version(buf + 7,  IC_CONFIG_MAX_VERSION, 1, 1);
+	put_version(buf + 10, IC_CONFIG_VERSION,
+	            eeprom_len > 1 ? eeprom[0] : 0,
+	            eeprom_len > 1 ? eeprom[1] : 0);
+	put_info(buf + 13, IC_RAM_SIZE,    config.ram_size);
+	put_info(buf + 16, IC_RAM_FREE,    config.ram_free);
+	put_info(buf + 19, IC_EEPROM_SIZE, config.eeprom_size);
+	put_info(buf + 22, IC_EEPROM_FREE,
+	         (unsigned int)(config.eeprom_size - eeprom_len));
+	buf[25] = IC_END;
+	respond(dev, buf);
+}
+/* }}} */
+
+/* {{{ control_write */
+/**
+ * Handle a report sent to the control interface.
+ *
+ * Note that the response codes sent by the host during a read
+ * overlap with the request codes, so they're only interpreted as
+ * such while a read is in progress.
+ */
+static void control_write(struct emu_device *dev, const unsigned char *in)
+{
+	size_t n, off;
+	unsigned char buf[PACKET_LEN];
+
+	memset(buf, 0, PACKET_LEN);
+	if (dev->state == ST_BOOTED)
+		return;
+
+	/* Injected errors reject the request without acting on it */
+	if (dev->state != ST_READING && config.error > 0.0 &&
+	    random_next(&dev->rng) < config.error) {
+		buf[0] = RC_ERROR;
+		respond(dev, buf);
+		return;
+	}
+
+	switch (dev->state) {
+	case ST_READING:
+		switch (in[0]) {
+		case RC_READY:
+			n = eeprom_len > dev->offset ? eeprom_len - dev->offset : 0;
+			memcpy(buf, eeprom + dev->offset, n > PACKET_LEN ?
+			       PACKET_LEN : n);
+			queue_report(dev, monotime_ns(), buf, PACKET_LEN);
+		return;
+		case RC_OK:
+			dev->offset += PACKET_LEN;
+			buf[0] = RC_OK;
+			respond(dev, buf);
+		return;
+		case RC_COMPLETED:
+			dev->state = ST_IDLE;
+			buf[0] = RC_OK;
+			respond(dev, buf);
+		return;
+		}
+	break;
+	case ST_WRITING:
+		if (in[0] != (RQ_WRITE | RQ_CONTINUATION))
+			break;
+
+		/* The host's offsets start at 4 */
+		n   = in[1];
+		off = (size_t)(in[2] | (in[3] << 8));
+		if (n > PACKET_LEN - 4 || off < 4 || off - 4 > received) {
+			dev->state = ST_IDLE;
+			buf[0] = RC_ERROR;
+			respond(dev, buf);
+			return;
+		}
+
+		off -= 4;
+		if (off + n > write_len) n = write_len - off;
+		memcpy(staging + off, in + 4, n);
+		if (off + n > received) received = off + n;
+
+		buf[0] = RC_OK;
+		respond(dev, buf);
+
+		memset(buf, 0, PACKET_LEN);
+		if (received >= write_len) {
+			memcpy(eeprom, staging, write_len);
+			eeprom_len = write_len;
+			write_len  = received = 0;
+			dev->state = ST_IDLE;
+			buf[0] = RC_COMPLETED;
+		} else buf[0] = RC_READY;
+		queue_report(dev, monotime_ns(), buf, PACKET_LEN);
+	return;
+	}
+
+	switch (in[0]) {
+	case RQ_INFO:
+		do_info(dev, buf);
+	break;
+	case RQ_READ:
+		dev->state  = ST_READING;
+		dev->offset = 0;
+		buf[0] = RC_OK;
+		buf[1] = eeprom_len & 0xff;
+		buf[2] = (eeprom_len >> 8) & 0xff;
+		respond(dev, buf);
+	break;
+	case RQ_WRITE:
+		n = (size_t)(in[1] | (in[2] << 8));
+		if (!n || n > config.eeprom_size) {
+			buf[0] = RC_ERROR;
+			respond(dev, buf);
+			break;
+		}
+
+		/*
+		 * A new request of the same length resumes an unfinished
+		 * transfer, even after an error.
+		 */
+		if (n != write_len)
+			received = 0;
+
+		dev->state = ST_WRITING;
+		write_len  = n;
+		buf[0] = RC_OK;
+		respond(dev, buf);
+
+		memset(buf, 0, PACKET_LEN);
+		buf[0] = RC_READY;
+		queue_report(dev, monotime_ns(), buf, PACKET_LEN);
+	break;
+	case RQ_BOOT:
+		dev->state = ST_BOOTED;
+	break;
+	default:
+		dev->state = ST_IDLE;
+		buf[0] = RC_ERROR;
+		respond(dev, buf);
+	}
+}
+/* }}} */
+
+/* {{{ type_key */
+/**
+ * Add the debug output for the next key event to the text waiting
+ * to be sent, in the format the converter uses (e.g. "r5A +28 d28 "
+ * for a make).
+ */
+static void type_key(struct emu_device *dev)
+{
+	const unsigned char *k;
+	char *text = dev->text + dev->text_len;
+	int len = 0;
+
+	if (!dev->key_down)
+		dev->key = (int)(random_next(&dev->rng) * N_EMU_KEYS) % N_EMU_KEYS;
+
+	k = emu_keys[dev->key];
+	if (k[2]) len += sprintf(text + len, "rE0 ");
+	if (dev->key_down) {
+		len += sprintf(text + len, "rF0 r%02X -%02X u%02X ",
+		               k[1], k[0], k[0]);
+		++dev->keys_typed;
+	} else len += sprintf(text + len, "r%02X +%02X d%02X ",
+	                      k[1], k[0], k[0]);
+
+	dev->key_down  = !dev->key_down;
+	dev->text_len += (size_t)len;
+}
+/* }}} */
+
+/* {{{ send_text */
+/**
+ * Queue up to a report's worth of the text waiting to be sent.
+ */
+static void send_text(struct emu_device *dev, uint64_t at)
+{
+	size_t len = dev->text_len > PACKET_LEN ? PACKET_LEN : dev->text_len;
+
+	queue_report(dev, at, (unsigned char *)dev->text, len);
+	dev->text_len -= len;
+	memmove(dev->text, dev->text + len, dev->text_len);
+}
+/* }}} */
+
+/* {{{ emu_open */
+static int emu_open(struct transport *t, void *ctx)
+{
+	struct emu_device *dev;
+	(void)ctx;
+
+	if (!(dev = calloc(1, sizeof(struct emu_device)))) {
+		fputs("Unable to open device\n", stderr);
+		return -1;
+	}
+
+	dev->debug    = fake_match(t)->usage_page == DEBUG_USAGE_PAGE;
+	dev->next_key = monotime_ns();
+	dev->rng      = rng;
+	random_next(&rng);
+	fake_set_priv(t, dev);
+	return 0;
+}
+/* }}} */
+
+static int emu_write(struct transport *t, const unsigned char *buf,
+                     size_t len, void *ctx)
+{
+	struct emu_device *dev = fake_priv(t);
+	(void)ctx;
+
+	if (config.ioerror > 0.0 && random_next(&dev->rng) < config.ioerror)
+		return -1;
+
+	if (!dev->debug && len)
+		control_write(dev, buf);
+	return 0;
+}
+
+/* {{{ emu_wait */
+/**
+ * Deliver the next report, if it's due within \a timeout_ms.
+ */
+static int emu_wait(struct transport *t, int timeout_ms, void *ctx)
+{
+	struct emu_device *dev = fake_priv(t);
+	struct pending *p;
+	uint64_t now, deadline, interval;
+	(void)ctx;
+
+	now = monotime_ns();
+	deadline = now + (uint64_t)(timeout_ms < 0 ? 250 : timeout_ms) *
+	                 NS_PER_MS;
+
+	/*
+	 * Keep the debug interface typing: a key event per report at the
+	 * configured rate, or else as fast as possible, with every report
+	 * filled, so events are split across reports like in a burst.
+	 */
+	if (dev->debug && !dev->count && config.rate &&
+	    (!config.keys || dev->keys_typed < config.keys)) {
+		interval = NS_PER_S / config.rate / 2;
+		type_key(dev);
+		send_text(dev, dev->next_key);
+		dev->next_key += interval;
+		if (dev->next_key < now) dev->next_key = now;
+	} else if (dev->debug && !dev->count) {
+		while (dev->text_len < PACKET_LEN &&
+		       (!config.keys || dev->keys_typed < config.keys))
+			type_key(dev);
+		if (dev->text_len) send_text(dev, now);
+	}
+
+	if (!dev->count) {
+		sleep_ns(deadline - now);
+		return 0;
+	}
+
+	p = &dev->pending[dev->head];
+	if (p->due > deadline) {
+		sleep_ns(deadline - now);
+		return 0;
+	}
+
+	if (p->due > now)
+		sleep_ns(p->due - now);
+
+	fake_push(t, p->data, p->len);
+	dev->head = (dev->head + 1) % EMU_PENDING;
+	--dev->count;
+	return 0;
+}
+/* }}} */
+
+static void emu_close(struct transport *t, void *ctx)
+{
+	(void)ctx;
+	free(fake_priv(t));
+}
+
+static const struct fake_responder emu_responder = {
+	emu_open,
+	emu_write,
+	emu_wait,
+	emu_close
+};
+
+/* {{{ load_image */
+/**
+ * Load the initial EEPROM contents from a binary config.
+ */
+static int load_image(const char *fname)
+{
+	FILE *fp;
+	size_t n;
+
+	if (!(fp = fopen(fname, "rb"))) {
+		perror("emu: unable to open image");
+		return -1;
+	}
+
+	n = fread(eeprom, 1, config.eeprom_size, fp);
+	fclose(fp);
+
+	/* Strip the signature, since it isn't stored */
+	if (n >= 2 && eeprom[0] == 'S' && eeprom[1] == 'C') {
+		memmove(eeprom, eeprom + 2, n - 2);
+		n -= 2;
+	}
+
+	eeprom_len = n;
+	return 0;
+}
+/* }}} */
+
+/* {{{ parse_option */
+/**
+ * Parse a single "name=value" option.
+ *
+ * \return 0 on success, -1 if the option is invalid.
+ */
+static int parse_option(char *opt)
+{
+	char *val = strchr(opt, '=');
+
+	if (!val) goto err;
+	*val++ = '\0';
+
+	if (!strcmp(opt, "eeprom"))
+		config.eeprom_size = (unsigned int)strtoul(val, NULL, 0);
+	else if (!strcmp(opt, "ram"))
+		config.ram_size = (unsigned int)strtoul(val, NULL, 0);
+	else if (!strcmp(opt, "ramfree"))
+		config.ram_free = (unsigned int)strtoul(val, NULL, 0);
+	else if (!strcmp(opt, "latency"))
+		config.latency_us = strtoul(val, NULL, 0);
+	else if (!strcmp(opt, "jitter"))
+		config.jitter_us = strtoul(val, NULL, 0);
+	else if (!strcmp(opt, "drop"))
+		config.drop = strtod(val, NULL);
+	else if (!strcmp(opt, "error"))
+		config.error = strtod(val, NULL);
+	else if (!strcmp(opt, "ioerror"))
+		config.ioerror = strtod(val, NULL);
+	else if (!strcmp(opt, "seed"))
+		config.seed = strtoul(val, NULL, 0);
+	else if (!strcmp(opt, "rate"))
+		config.rate = (unsigned int)strtoul(val, NULL, 0);
+	else if (!strcmp(opt, "keys"))
+		config.keys = strtoul(val, NULL, 0);
+	else if (!strcmp(opt, "image"))
+		config.image = val;
+	else if (!strcmp(opt, "devices"))
+		config.devices = (unsigned int)strtoul(val, NULL, 0);
+	else goto err;
+	return 0;
+
+err:
+	fprintf(stderr, "emu: invalid option '%s'\n", opt);
+	return -1;
+}
+/* }}} */
+
+/* {{{ emu_init */
+/**
+ * Parse the options, and power on the emulated converter.
+ *
+ * \param[in] options Comma-separated list of name=value pairs
+ * \return 0 on success, -1 on error.
+ */
+static int emu_init(const char *options)
+{
+	static char *opts = NULL;
+	char *p, *next;
+	int i;
+
+	if (options) {
+		if (!(opts = malloc(strlen(options) + 1)))
+			goto err;
+		strcpy(opts, options);
+
+		for (p = opts; p && *p; p = next) {
+			if ((next = strchr(p, ','))) *next++ = '\0';
+			if (parse_option(p)) goto err;
+		}
+	}
+
+	if (!config.eeprom_size || config.eeprom_size > EMU_MAX_EEPROM) {
+		fputs("emu: invalid EEPROM size\n", stderr);
+		goto err;
+	}
+
+	/* Scramble the seed, so that small seeds don't start out small */
+	rng = (config.seed * 2654435761UL + 0x9e3779b9UL) & 0xffffffffUL;
+	if (!rng) rng = 1;
+	for (i = 0; i < 8; i++) random_next(&rng);
+
+	eeprom  = calloc(1, config.eeprom_size);
+	staging = calloc(1, config.eeprom_size);
+	if (!eeprom || !staging)
+		goto err;
+
+	/* An empty v1.01 config, unless we've been given one */
+	if (config.image) {
+		if (load_image(config.image))
+			goto err;
+	} else {
+		eeprom[0] = 1;
+		eeprom[1] = 1;
+		eeprom_len = 4;
+	}
+
+	fake_set_responder(&emu_responder, NULL);
+	fake_set_devices((int)config.devices);
+	return 0;
+
+err:
+	free(opts);
+	opts = NULL;
+	return -1;
+}
+/* }}} */
+
+static void emu_exit(void)
+{
+	fake_set_responder(NULL, NULL);
+	free(eeprom);
+	free(staging);
+	eeprom = staging = NULL;
+}
+
+static struct transport *emu_open_device(const struct transport_match *m)
+{
+	return fake_transport.open(m);
+}
+
+static int emu_open_all(const struct transport_match *m,
+                        struct transport **devs, int max)
+{
+	return fake_transport.open_all(m, devs, max);
+}
+
+/* Opened devices are fake ones, so they use the fake transport's ops */
+const struct transport_ops emu_transport = {
+	"emu",
+	emu_init,
+	emu_exit,
+	emu_open_device,
+	NULL,
+	NULL,
+	NULL,
+	emu_open_all,
+	NULL
+};
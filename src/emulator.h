@@ -0,0 +1,36 @@
+/**
+ * sctools: Emulated converter
+ * Copyright (C) 2016 Tim Hentenaar.
+ *
+ * This code is licenced under the Simplified BSD License.
+ * See the LICENSE file for details.
+ */
+
+#ifndef EMULATOR_H
+#define EMULATOR_H
+
+#include "transport.h"
+
+/**
+ * Emulator settings, parsed from the transport options
+ * (e.g. "emu:eeprom=1024,latency=500,drop=0.01").
+ */
+struct emu_config {
+	unsigned int  eeprom_size; /* bytes                          */
+	unsigned int  ram_size;    /* bytes                          */
+	unsigned int  ram_free;    /* bytes                          */
+	unsigned long latency_us;  /* added to every report          */
+	unsigned long jitter_us;   /* uniformly distributed, added   */
+	double        drop;        /* probability a report is lost   */
+	double        error;       /* probability of an RC_ERROR     */
+	double        ioerror;     /* probability a write fails      */
+	unsigned long seed;        /* PRNG seed                      */
+	unsigned int  rate;        /* keys per second (0 = no limit) */
+	unsigned long keys;        /* keys to type (0 = forever)     */
+	const char   *image;       /* initial EEPROM contents        */
+	unsigned int  devices;     /* converters plugged in          */
+};
+
+extern const struct transport_ops emu_transport;
+
+#endif /* EMULATOR_H */
@@ -0,0 +1,469 @@
+/**
+ * sctools: Linux input devices (evdev and uinput)
+ * Copyright (C) 2016 Tim Hentenaar.
+ *
+ * This code is licenced under the Simplified BSD License.
+ * See the LICENSE file for details.
+ *
+ * Keys are translated between HID codes and Linux key codes with the
+ * same table the kernel's HID driver uses, plus the converter's own
+ * media and system codes.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "rawhid_defs.h"
+#include "sim.h"
+#include "monotime.h"
+#include "evdev.h"
+
+#ifdef HAVE_LINUX_UINPUT_H
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+
+#define NO_HID 0xffff
+
+/* How long to wait for the keys held at startup to be released */
+#define RELEASE_WAIT_NS ((uint64_t)10 * NS_PER_S)
+
+/**
+ * HID codes, and the keys they're sent as. Where several codes are
+ * sent as the same key, the one marked for input is what that key
+ * is read as: the code the converter itself would produce.
+ */
+static const struct {
+	unsigned char  hid;
+	unsigned short key;
+	unsigned char  input;
+} keymap[] = {
+	{ 0x04, KEY_A, 1 },            { 0x05, KEY_B, 1 },
+	{ 0x06, KEY_C, 1 },            { 0x07, KEY_D, 1 },
+	{ 0x08, KEY_E, 1 },            { 0x09, KEY_F, 1 },
+	{ 0x0A, KEY_G, 1 },            { 0x0B, KEY_H, 1 },
+	{ 0x0C, KEY_I, 1 },            { 0x0D, KEY_J, 1 },
+	{ 0x0E, KEY_K, 1 },            { 0x0F, KEY_L, 1 },
+	{ 0x10, KEY_M, 1 },            { 0x11, KEY_N, 1 },
+	{ 0x12, KEY_O, 1 },            { 0x13, KEY_P, 1 },
+	{ 0x14, KEY_Q, 1 },            { 0x15, KEY_R, 1 },
+	{ 0x16, KEY_S, 1 },            { 0x17, KEY_T, 1 },
+	{ 0x18, KEY_U, 1 },            { 0x19, KEY_V, 1 },
+	{ 0x1A, KEY_W, 1 },            { 0x1B, KEY_X, 1 },
+	{ 0x1C, KEY_Y, 1 },            { 0x1D, KEY_Z, 1 },
+	{ 0x1E, KEY_1, 1 },            { 0x1F, KEY_2, 1 },
+	{ 0x20, KEY_3, 1 },            { 0x21, KEY_4, 1 },
+	{ 0x22, KEY_5, 1 },            { 0x23, KEY_6, 1 },
+	{ 0x24, KEY_7, 1 },            { 0x25, KEY_8, 1 },
+	{ 0x26, KEY_9, 1 },            { 0x27, KEY_0, 1 },
+	{ 0x28, KEY_ENTER, 1 },        { 0x29, KEY_ESC, 1 },
+	{ 0x2A, KEY_BACKSPACE, 1 },    { 0x2B, KEY_TAB, 1 },
+	{ 0x2C, KEY_SPACE, 1 },        { 0x2D, KEY_MINUS, 1 },
+	{ 0x2E, KEY_EQUAL, 1 },        { 0x2F, KEY_LEFTBRACE, 1 },
+	{ 0x30, KEY_RIGHTBRACE, 1 },   { 0x31, KEY_BACKSLASH, 1 },
+	{ 0x32, KEY_BACKSLASH, 0 },    { 0x33, KEY_SEMICOLON, 1 },
+	{ 0x34, KEY_APOSTROPHE, 1 },   { 0x35, KEY_GRAVE, 1 },
+	{ 0x36, KEY_COMMA, 1 },        { 0x37, KEY_DOT, 1 },
+	{ 0x38, KEY_SLASH, 1 },        { 0x39, KEY_CAPSLOCK, 1 },
+	{ 0x3A, KEY_F1, 1 },           { 0x3B, KEY_F2, 1 },
+	{ 0x3C, KEY_F3, 1 },           { 0x3D, KEY_F4, 1 },
+	{ 0x3E, KEY_F5, 1 },           { 0x3F, KEY_F6, 1 },
+	{ 0x40, KEY_F7, 1 },           { 0x41, KEY_F8, 1 },
+	{ 0x42, KEY_F9, 1 },           { 0x43, KEY_F10, 1 },
+	{ 0x44, KEY_F11, 1 },          { 0x45, KEY_F12, 1 },
+	{ 0x46, KEY_SYSRQ, 1 },        { 0x47, KEY_SCROLLLOCK, 1 },
+	{ 0x48, KEY_PAUSE, 1 },        { 0x49, KEY_INSERT, 1 },
+	{ 0x4A, KEY_HOME, 1 },         { 0x4B, KEY_PAGEUP, 1 },
+	{ 0x4C, KEY_DELETE, 1 },       { 0x4D, KEY_END, 1 },
+	{ 0x4E, KEY_PAGEDOWN, 1 },     { 0x4F, KEY_RIGHT, 1 },
+	{ 0x50, KEY_LEFT, 1 },         { 0x51, KEY_DOWN, 1 },
+	{ 0x52, KEY_UP, 1 },           { 0x53, KEY_NUMLOCK, 1 },
+	{ 0x54, KEY_KPSLASH, 1 },      { 0x55, KEY_KPASTERISK, 1 },
+	{ 0x56, KEY_KPMINUS, 1 },      { 0x57, KEY_KPPLUS, 1 },
+	{ 0x58, KEY_KPENTER, 1 },      { 0x59, KEY_KP1, 1 },
+	{ 0x5A, KEY_KP2, 1 },          { 0x5B, KEY_KP3, 1 },
+	{ 0x5C, KEY_KP4, 1 },          { 0x5D, KEY_KP5, 1 },
+	{ 0x5E, KEY_KP6, 1 },          { 0x5F, KEY_KP7, 1 },
+	{ 0x60, KEY_KP8, 1 },          { 0x61, KEY_KP9, 1 },
+	{ 0x62, KEY_KP0, 1 },          { 0x63, KEY_KPDOT, 1 },
+	{ 0x64, KEY_102ND, 1 },        { 0x65, KEY_COMPOSE, 1 },
+	{ 0x66, KEY_POWER, 0 },        { 0x67, KEY_KPEQUAL, 1 },
+	{ 0x68, KEY_F13, 1 },          { 0x69, KEY_F14, 1 },
+	{ 0x6A, KEY_F15, 1 },          { 0x6B, KEY_F16, 1 },
+	{ 0x6C, KEY_F17, 1 },          { 0x6D, KEY_F18, 1 },
+	{ 0x6E, KEY_F19, 1 },          { 0x6F, KEY_F20, 1 },
+	{ 0x70, KEY_F21, 1 },          { 0x71, KEY_F22, 1 },
+	{ 0x72, KEY_F23, 1 },          { 0x73, KEY_F24, 1 },
+	{ 0x74, KEY_OPEN, 1 },         { 0x75, KEY_HELP, 1 },
+	{ 0x76, KEY_PROPS, 1 },        { 0x77, KEY_FRONT, 1 },
+	{ 0x78, KEY_STOP, 0 },         { 0x79, KEY_AGAIN, 1 },
+	{ 0x7A, KEY_UNDO, 1 },         { 0x7B, KEY_CUT, 1 },
+	{ 0x7C, KEY_COPY, 1 },         { 0x7D, KEY_PASTE, 1 },
+	{ 0x7E, KEY_FIND, 1 },         { 0x7F, KEY_MUTE, 0 },
+	{ 0x80, KEY_VOLUMEUP, 0 },     { 0x81, KEY_VOLUMEDOWN, 0 },
+	{ 0x85, KEY_KPCOMMA, 1 },      { 0x87, KEY_RO, 1 },
+	{ 0x88, KEY_KATAKANAHIRAGANA, 1 },
+	{ 0x89, KEY_YEN, 1 },          { 0x8A, KEY_HENKAN, 1 },
+	{ 0x8B, KEY_MUHENKAN, 1 },     { 0x8C, KEY_KPJPCOMMA, 1 },
+	{ 0x90, KEY_HANGEUL, 1 },      { 0x91, KEY_HANJA, 1 },
+	{ 0x92, KEY_KATAKANA, 1 },     { 0x93, KEY_HIRAGANA, 1 },
+	{ 0x94, KEY_ZENKAKUHANKAKU, 1 },
+	{ 0x99, KEY_ALTERASE, 1 },     { 0x9B, KEY_CANCEL, 1 },
+	{ 0x9C, KEY_CLEAR, 1 },
+	{ 0xA8, KEY_POWER, 1 },        { 0xA9, KEY_SLEEP, 1 },
+	{ 0xAA, KEY_WAKEUP, 1 },
+	{ 0xE0, KEY_LEFTCTRL, 1 },     { 0xE1, KEY_LEFTSHIFT, 1 },
+	{ 0xE2, KEY_LEFTALT, 1 },      { 0xE3, KEY_LEFTMETA, 1 },
+	{ 0xE4, KEY_RIGHTCTRL, 1 },    { 0xE5, KEY_RIGHTSHIFT, 1 },
+	{ 0xE6, KEY_RIGHTALT, 1 },     { 0xE7, KEY_RIGHTMETA, 1 },
+	{ 0xE8, KEY_NEXTSONG, 1 },     { 0xE9, KEY_PREVIOUSSONG, 1 },
+	{ 0xEA, KEY_STOPCD, 1 },       { 0xEB, KEY_PLAYPAUSE, 1 },
+	{ 0xEC, KEY_MUTE, 1 },         { 0xED, KEY_BASSBOOST, 1 },
+	{ 0xEF, KEY_VOLUMEUP, 1 },     { 0xF0, KEY_VOLUMEDOWN, 1 },
+	{ 0xF5, KEY_MEDIA, 1 },        { 0xF6, KEY_MAIL, 1 },
+	{ 0xF7, KEY_CALC, 1 },         { 0xF8, KEY_COMPUTER, 1 },
+	{ 0xF9, KEY_SEARCH, 1 },       { 0xFA, KEY_HOMEPAGE, 1 },
+	{ 0xFB, KEY_BACK, 1 },         { 0xFC, KEY_FORWARD, 1 },
+	{ 0xFD, KEY_STOP, 1 },         { 0xFE, KEY_REFRESH, 1 },
+	{ 0xFF, KEY_BOOKMARKS, 1 }
+};
+
+#define N_KEYMAP (sizeof(keymap) / sizeof(keymap[0]))
+
+static unsigned short key_of[256];
+static unsigned short hid_of[KEY_CNT];
+static int built = 0;
+
+static void build_tables(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < KEY_CNT; i++)
+		hid_of[i] = NO_HID;
+
+	for (i = 0; i < N_KEYMAP; i++) {
+		key_of[keymap[i].hid] = keymap[i].key;
+		if (keymap[i].input)
+			hid_of[keymap[i].key] = keymap[i].hid;
+	}
+
+	built = 1;
+}
+
+/**
+ * Get the key a HID code is sent as.
+ *
+ * \return the Linux key code, or 0 if there isn't one.
+ */
+unsigned int evdev_key(unsigned char hid)
+{
+	if (!built) build_tables();
+	return key_of[hid];
+}
+
+/**
+ * Get the HID code a key is read as.
+ *
+ * \return the HID code, or -1 if there isn't one.
+ */
+int evdev_hid(unsigned int key)
+{
+	if (!built) build_tables();
+	return key < KEY_CNT && hid_of[key] != NO_HID ? hid_of[key] : -1;
+}
+
+/* {{{ wait_released */
+/**
+ * Wait until no keys on a keyboard are held down (e.g. the Enter that
+ * started us), so that grabbing it doesn't swallow their releases and
+ * leave them stuck down for everything else.
+ */
+static void wait_released(int fd, const char *path)
+{
+	unsigned char keys[KEY_CNT / 8 + 1];
+	uint64_t until = monotime_ns() + RELEASE_WAIT_NS;
+	unsigned int i;
+	int waiting = 0;
+
+	do {
+		memset(keys, 0, sizeof(keys));
+		if (ioctl(fd, EVIOCGKEY(sizeof(keys)), keys) < 0)
+			return;
+
+		for (i = 0; i < sizeof(keys) && !keys[i]; i++);
+		if (i == sizeof(keys))
+			return;
+
+		if (!waiting++)
+			fprintf(stderr, "%s: waiting for keys to be released\n",
+			        path);
+		sleep_ns(10 * NS_PER_MS);
+	} while (monotime_ns() < until);
+
+	fprintf(stderr, "%s: keys are still held down\n", path);
+}
+/* }}} */
+
+/* {{{ evdev_open */
+/**
+ * Open a keyboard, with its events timestamped by the monotonic
+ * clock, so they can be compared with monotime_ns().
+ *
+ * \param[in] path Device (e.g. /dev/input/event3)
+ * \param[in] grab Take the device for ourselves, so that nothing
+ *                 else sees its events, once no keys are held down
+ * \return the descriptor, or -1 on error.
+ */
+int evdev_open(const char *path, int grab)
+{
+	int fd, clock = CLOCK_MONOTONIC;
+
+	/* Writable if we can, to set its LEDs */
+	if ((fd = open(path, O_RDWR | O_NONBLOCK)) < 0 &&
+	    (fd = open(path, O_RDONLY | O_NONBLOCK)) < 0) {
+		fprintf(stderr, "Unable to open '%s': %s\n", path,
+		        strerror(errno));
+		return -1;
+	}
+
+	if (ioctl(fd, EVIOCSCLOCKID, &clock) < 0)
+		fprintf(stderr, "%s: timestamps aren't monotonic, so latency "
+		        "can't be measured\n", path);
+
+	if (grab) wait_released(fd, path);
+	if (grab && ioctl(fd, EVIOCGRAB, 1) < 0) {
+		fprintf(stderr, "Unable to grab '%s': %s\n", path,
+		        strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+/* }}} */
+
+void evdev_close(int fd)
+{
+	if (fd < 0) return;
+	ioctl(fd, EVIOCGRAB, 0);
+	close(fd);
+}
+
+/* {{{ uinput_open */
+/**
+ * Create a virtual keyboard, which can send every key a HID code is
+ * sent as, and every ordinary key besides (so that keys which aren't
+ * HID codes can be passed through.) The kernel repeats held keys.
+ *
+ * \param[in] u    Keyboard
+ * \param[in] name Its name
+ * \return 0 on success, -1 on error.
+ */
+int uinput_open(struct uinput *u, const char *name)
+{
+	struct uinput_user_dev dev;
+	unsigned int i;
+
+	memset(u, 0, sizeof(*u));
+	if ((u->fd = open("/dev/uinput", O_RDWR | O_NONBLOCK)) < 0) {
+		fprintf(stderr, "Unable to open /dev/uinput: %s\n",
+		        strerror(errno));
+		return -1;
+	}
+
+	if (ioctl(u->fd, UI_SET_EVBIT, EV_KEY) < 0 ||
+	    ioctl(u->fd, UI_SET_EVBIT, EV_REP) < 0 ||
+	    ioctl(u->fd, UI_SET_EVBIT, EV_LED) < 0 ||
+	    ioctl(u->fd, UI_SET_EVBIT, EV_SYN) < 0)
+		goto err;
+
+	for (i = KEY_ESC; i <= KEY_MICMUTE; i++) {
+		if (ioctl(u->fd, UI_SET_KEYBIT, i) < 0)
+			goto err;
+	}
+
+	for (i = 0; i < 256; i++) {
+		if (evdev_key((unsigned char)i) > KEY_MICMUTE &&
+		    ioctl(u->fd, UI_SET_KEYBIT, evdev_key((unsigned char)i)) < 0)
+			goto err;
+	}
+
+	for (i = LED_NUML; i <= LED_KANA; i++) {
+		if (ioctl(u->fd, UI_SET_LEDBIT, i) < 0)
+			goto err;
+	}
+
+	memset(&dev, 0, sizeof(dev));
+	strncpy(dev.name, name, UINPUT_MAX_NAME_SIZE - 1);
+	dev.id.bustype = BUS_VIRTUAL;
+	dev.id.vendor  = SC_VID;
+	dev.id.product = SC_PID;
+	dev.id.version = 1;
+
+	if (write(u->fd, &dev, sizeof(dev)) != (ssize_t)sizeof(dev) ||
+	    ioctl(u->fd, UI_DEV_CREATE) < 0)
+		goto err;
+	return 0;
+
+err:
+	fprintf(stderr, "Unable to create the virtual keyboard: %s\n",
+	        strerror(errno));
+	close(u->fd);
+	u->fd = -1;
+	return -1;
+}
+/* }}} */
+
+/* {{{ uinput_key */
+/**
+ * Batch a key event, flushing first if the batch is full.
+ */
+void uinput_key(struct uinput *u, unsigned int key, int down)
+{
+	struct input_event *ev;
+
+	if (u->n >= UINPUT_BATCH - 1)
+		uinput_flush(u);
+
+	ev = &u->batch[u->n++];
+	memset(ev, 0, sizeof(*ev));
+	ev->type  = EV_KEY;
+	ev->code  = (unsigned short)key;
+	ev->value = down;
+	++u->keys;
+}
+/* }}} */
+
+/* {{{ uinput_event */
+/**
+ * Batch an event from the simulator: a key going down or up, or the
+ * modifiers changing (sent as the modifier keys that changed).
+ */
+void uinput_event(struct uinput *u, int type, unsigned char code)
+{
+	unsigned char changed;
+	unsigned int key;
+	int i;
+
+	if (type == SIM_META) {
+		changed = (unsigned char)(u->meta ^ code);
+		for (i = 0; i < 8; i++) {
+			if (changed & (1 << i))
+				uinput_key(u, evdev_key((unsigned char)(SIM_LCTRL + i)),
+				           (code >> i) & 1);
+		}
+		u->meta = code;
+		return;
+	}
+
+	if (!(key = evdev_key(code))) {
+		++u->unmapped;
+		return;
+	}
+
+	uinput_key(u, key, type == SIM_DOWN);
+}
+/* }}} */
+
+/* {{{ uinput_flush */
+/**
+ * Write out the batched events, with a SYN_REPORT.
+ *
+ * \return 0 on success, -1 on error.
+ */
+int uinput_flush(struct uinput *u)
+{
+	struct input_event *ev;
+	size_t len;
+
+	if (!u->n) return 0;
+
+	ev = &u->batch[u->n++];
+	memset(ev, 0, sizeof(*ev));
+	ev->type = EV_SYN;
+	ev->code = SYN_REPORT;
+
+	len = u->n * sizeof(struct input_event);
+	u->n = 0;
+	if (write(u->fd, u->batch, len) != (ssize_t)len) {
+		u->error = 1;
+		return -1;
+	}
+
+	return 0;
+}
+/* }}} */
+
+void uinput_close(struct uinput *u)
+{
+	if (u->fd < 0) return;
+	uinput_flush(u);
+	ioctl(u->fd, UI_DEV_DESTROY);
+	close(u->fd);
+	u->fd = -1;
+}
+
+#else /* HAVE_LINUX_UINPUT_H */
+
+unsigned int evdev_key(unsigned char hid)
+{
+	(void)hid;
+	return 0;
+}
+
+int evdev_hid(unsigned int key)
+{
+	(void)key;
+	return -1;
+}
+
+int evdev_open(const char *path, int grab)
+{
+	(void)grab;
+	fprintf(stderr, "%s: input devices aren't supported here\n", path);
+	return -1;
+}
+
+void evdev_close(int fd)
+{
+	(void)fd;
+}
+
+int uinput_open(struct uinput *u, const char *name)
+{
+	(void)name;
+	memset(u, 0, sizeof(*u));
+	u->fd = -1;
+	fputs("uinput isn't supported here\n", stderr);
+	return -1;
+}
+
+void uinput_key(struct uinput *u, unsigned int key, int down)
+{
+	(void)u;
+	(void)key;
+	(void)down;
+}
+
+void uinput_event(struct uinput *u, int type, unsigned char code)
+{
+	(void)u;
+	(void)type;
+	(void)code;
+}
+
+int uinput_flush(struct uinput *u)
+{
+	(void)u;
+	return -1;
+}
+
+void uinput_close(struct uinput *u)
+{
+	(void)u;
+}
+#endif /* HAVE_LINUX_UINPUT_H */
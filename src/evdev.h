@@ -0,0 +1,49 @@
+/**
+ * sctools: Linux input devices (evdev and uinput)
+ * Copyright (C) 2016 Tim Hentenaar.
+ *
+ * This code is licenced under the Simplified BSD License.
+ * See the LICENSE file for details.
+ */
+
+#ifndef EVDEV_H
+#define EVDEV_H
+
+#include <stdint.h>
+
+#ifdef HAVE_LINUX_UINPUT_H
+#include <sys/time.h>
+#include <linux/input.h>
+#include <linux/uinput.h>
+#endif /* HAVE_LINUX_UINPUT_H */
+
+#define UINPUT_BATCH 64
+
+/**
+ * A virtual keyboard. Key events are batched, and written with a
+ * SYN_REPORT by uinput_flush(), so a report costs one write().
+ */
+struct uinput {
+	int           fd;
+	unsigned char meta;       /* modifiers down, as a HID meta byte */
+	unsigned int  n;          /* events batched                     */
+	unsigned long keys;       /* key events sent                    */
+	unsigned long unmapped;   /* HID codes with no key to send      */
+	int           error;
+#ifdef HAVE_LINUX_UINPUT_H
+	struct input_event batch[UINPUT_BATCH];
+#endif /* HAVE_LINUX_UINPUT_H */
+};
+
+unsigned int evdev_key(unsigned char hid);
+int  evdev_hid(unsigned int key);
+int  evdev_open(const char *path, int grab);
+void evdev_close(int fd);
+
+int  uinput_open(struct uinput *u, const char *name);
+void uinput_key(struct uinput *u, unsigned int key, int down);
+void uinput_event(struct uinput *u, int type, unsigned char code);
+int  uinput_flush(struct uinput *u);
+void uinput_close(struct uinput *u);
+
+#endif /* EVDEV_H */
@@ -285,7 +285,8 @@ static const struct token hid_token_list[N_HID_TOKENS] =
 	{ "MEDIA_WWW_FAVORITES", 0xFF }  /* WWW Favorites                     */
 };
 
-const char *lookup_hid_token_by_value(int value)
+/* Like lookup_hid_token_by_value(), but NULL for a code with no name */
+const char *find_hid_token_by_value(int value)
 {
 	unsigned int i;
 
@@ -294,7 +295,13 @@ const char *lookup_hid_token_by_value(int value)
 			return hid_token_list[i].token;
 	}
 
-	return "INVALID";
+	return NULL;
+}
+
+const char *lookup_hid_token_by_value(int value)
+{
+	const char *name = find_hid_token_by_value(value);
+	return name ? name : "INVALID";
 }
 
 int lookup_hid_token_by_name(const char *name)
@@ -0,0 +1,419 @@
+/**
+ * sctools: HID transaction statistics
+ * Copyright (C) 2016 Tim Hentenaar.
+ *
+ * This code is licenced under the Simplified BSD License.
+ * See the LICENSE file for details.
+ *
+ * Every request sent to the device, and the wait for its answer, is
+ * recorded by type. At the end of the run, the round trips are
+ * summarized as exact percentiles (from the samples) and histograms,
+ * and can be written as JSON lines, or as a Prometheus textfile for
+ * node_exporter's textfile collector.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "monotime.h"
+#include "histogram.h"
+#include "hidstats.h"
+
+static const char *type_names[HS_TYPES] = {
+	"info", "write", "data", "read", "ready", "ack", "completed",
+	"boot", "wait"
+};
+
+static const char *result_names[] = { "ok", "timeout", "error", "refused" };
+
+struct type_stats {
+	unsigned long count;
+	unsigned long results[4];
+	unsigned long retries;
+	uint64_t      write_ns;    /* total time spent writing       */
+	uint64_t     *rtt;         /* round trips of the answered    */
+	unsigned long n_rtt, sz_rtt;
+	struct histogram hist;
+};
+
+static struct {
+	int      formats;
+	FILE    *json;
+	char    *prom_path;
+	uint64_t start;
+	unsigned long late;
+	int      oom;
+	struct type_stats types[HS_TYPES];
+} hs;
+
+/* {{{ hidstats_open */
+/**
+ * Start recording transactions.
+ *
+ * \param[in] formats   HS_TEXT, HS_JSON and / or HS_PROMETHEUS
+ * \param[in] json_path Where to write the JSON lines ("-" for stdout)
+ * \param[in] prom_path Where to write the Prometheus textfile
+ * \return 0 on success, -1 on error.
+ */
+int hidstats_open(int formats, const char *json_path, const char *prom_path)
+{
+	memset(&hs, 0, sizeof(hs));
+	hs.formats = formats;
+	hs.start   = monotime_ns();
+
+	if ((formats & HS_JSON) && json_path) {
+		if (!strcmp(json_path, "-")) hs.json = stdout;
+		else if (!(hs.json = fopen(json_path, "w"))) {
+			perror(json_path);
+			goto err;
+		}
+	}
+
+	if ((formats & HS_PROMETHEUS) && prom_path) {
+		if (!(hs.prom_path = malloc(strlen(prom_path) + 1)))
+			goto err;
+		strcpy(hs.prom_path, prom_path);
+	}
+
+	return 0;
+
+err:
+	hs.formats = 0;
+	return -1;
+}
+/* }}} */
+
+int hidstats_enabled(void)
+{
+	return hs.formats != 0;
+}
+
+/* {{{ add_rtt */
+static void add_rtt(struct type_stats *ts, uint64_t ns)
+{
+	uint64_t *tmp;
+
+	hist_add(&ts->hist, ns);
+	if (hs.oom) return;
+
+	if (ts->n_rtt == ts->sz_rtt) {
+		ts->sz_rtt = ts->sz_rtt ? ts->sz_rtt * 2 : 64;
+		if (!(tmp = realloc(ts->rtt, ts->sz_rtt * sizeof(uint64_t)))) {
+			fputs("Out of memory: percentiles will be incomplete\n",
+			      stderr);
+			hs.oom = 1;
+			return;
+		}
+		ts->rtt = tmp;
+	}
+	ts->rtt[ts->n_rtt++] = ns;
+}
+/* }}} */
+
+/* {{{ hidstats_record */
+/**
+ * Record a transaction, writing it out as a JSON line if need be.
+ */
+void hidstats_record(const struct hid_transaction *t)
+{
+	struct type_stats *ts;
+
+	if (!hs.formats || t->type < 0 || t->type >= HS_TYPES)
+		return;
+
+	ts = &hs.types[t->type];
+	++ts->count;
+	++ts->results[t->result];
+	if (t->attempt) ++ts->retries;
+	ts->write_ns += t->write_ns;
+	if (t->result == HS_OK || t->result == HS_REFUSED)
+		add_rtt(ts, t->rtt_ns);
+
+	if (hs.json) {
+		fprintf(hs.json, "{\"t_ns\":%lu,\"type\":\"%s\",\"attempt\":%d,"
+		        "\"result\":\"%s\",\"write_ns\":%lu,\"rtt_ns\":%lu}\n",
+		        (unsigned long)(t->start - hs.start),
+		        type_names[t->type], t->attempt,
+		        result_names[t->result], (unsigned long)t->write_ns,
+		        (unsigned long)t->rtt_ns);
+	}
+}
+/* }}} */
+
+/**
+ * Count a response which arrived too late, and was discarded.
+ */
+void hidstats_late(void)
+{
+	++hs.late;
+}
+
+/* {{{ Percentiles */
+static int by_value(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+/**
+ * Get the \a p th percentile (nearest rank) of sorted samples.
+ */
+static uint64_t percentile(const struct type_stats *ts, unsigned long p)
+{
+	unsigned long rank;
+
+	if (!ts->n_rtt) return 0;
+	rank = (p * ts->n_rtt + 99) / 100;
+	return ts->rtt[rank ? rank - 1 : 0];
+}
+
+static double ms(uint64_t ns)
+{
+	return (double)ns / NS_PER_MS;
+}
+
+static double secs(uint64_t ns)
+{
+	return (double)ns / NS_PER_S;
+}
+/* }}} */
+
+/* {{{ print_text */
+static void print_text(FILE *fp)
+{
+	const struct type_stats *ts;
+	char title[32];
+	int i;
+
+	fputs("\n---- HID transactions ----\n", fp);
+	fprintf(fp, "%-10s %7s %7s %8s %6s %7s %9s %9s %9s %9s\n", "Type",
+	        "Count", "Retries", "Timeouts", "Errors", "Refused",
+	        "p50 (ms)", "p95 (ms)", "p99 (ms)", "max (ms)");
+
+	for (i = 0; i < HS_TYPES; i++) {
+		ts = &hs.types[i];
+		if (!ts->count) continue;
+		fprintf(fp, "%-10s %7lu %7lu %8lu %6lu %7lu %9.3f %9.3f %9.3f "
+		        "%9.3f\n", type_names[i], ts->count, ts->retries,
+		        ts->results[HS_TIMEOUT], ts->results[HS_ERROR],
+		        ts->results[HS_REFUSED], ms(percentile(ts, 50)),
+		        ms(percentile(ts, 95)), ms(percentile(ts, 99)),
+		        ms(ts->hist.max));
+	}
+
+	if (hs.late)
+		fprintf(fp, "%lu late responses discarded\n", hs.late);
+
+	for (i = 0; i < HS_TYPES; i++) {
+		ts = &hs.types[i];
+		if (!ts->hist.count) continue;
+		sprintf(title, "Round trip (%s)", type_names[i]);
+		hist_print(fp, title, &ts->hist);
+	}
+}
+/* }}} */
+
+/* {{{ print_json_summary */
+/**
+ * Finish the JSON lines with a summary of each type.
+ */
+static void print_json_summary(FILE *fp)
+{
+	const struct type_stats *ts;
+	int i;
+
+	for (i = 0; i < HS_TYPES; i++) {
+		ts = &hs.types[i];
+		if (!ts->count) continue;
+		fprintf(fp, "{\"summary\":\"%s\",\"count\":%lu,\"retries\":%lu,"
+		        "\"timeouts\":%lu,\"errors\":%lu,\"refused\":%lu,"
+		        "\"write_mean_ns\":%lu,", type_names[i], ts->count,
+		        ts->retries, ts->results[HS_TIMEOUT],
+		        ts->results[HS_ERROR], ts->results[HS_REFUSED],
+		        (unsigned long)(ts->write_ns / ts->count));
+		fprintf(fp, "\"p50_ns\":%lu,\"p95_ns\":%lu,\"p99_ns\":%lu,"
+		        "\"max_ns\":%lu}\n",
+		        (unsigned long)percentile(ts, 50),
+		        (unsigned long)percentile(ts, 95),
+		        (unsigned long)percentile(ts, 99),
+		        (unsigned long)ts->hist.max);
+	}
+
+	if (hs.late)
+		fprintf(fp, "{\"summary\":\"late\",\"count\":%lu}\n", hs.late);
+}
+/* }}} */
+
+/* {{{ print_prometheus */
+/**
+ * Write the statistics in Prometheus' text exposition format.
+ *
+ * The round trips are a histogram on the same power-of-2 buckets as
+ * hist_print(), with the exact percentiles alongside as gauges.
+ */
+static void print_prometheus(FILE *fp)
+{
+	static const unsigned long quantiles[] = { 50, 95, 99 };
+	const struct type_stats *ts;
+	unsigned long cum;
+	int i, j, r, last = 0;
+
+	fputs("# HELP sctool_hid_transactions_total HID transactions, by type "
+	      "and result.\n"
+	      "# TYPE sctool_hid_transactions_total counter\n", fp);
+	for (i = 0; i < HS_TYPES; i++) {
+		for (r = 0; r < 4 && hs.types[i].count; r++) {
+			fprintf(fp, "sctool_hid_transactions_total{type=\"%s\","
+			        "result=\"%s\"} %lu\n", type_names[i],
+			        result_names[r], hs.types[i].results[r]);
+		}
+	}
+
+	fputs("# HELP sctool_hid_retries_total Requests sent again.\n"
+	      "# TYPE sctool_hid_retries_total counter\n", fp);
+	for (i = 0; i < HS_TYPES; i++) {
+		if (!hs.types[i].count) continue;
+		fprintf(fp, "sctool_hid_retries_total{type=\"%s\"} %lu\n",
+		        type_names[i], hs.types[i].retries);
+	}
+
+	fputs("# HELP sctool_hid_late_responses_total Responses discarded "
+	      "for arriving too late.\n"
+	      "# TYPE sctool_hid_late_responses_total counter\n", fp);
+	fprintf(fp, "sctool_hid_late_responses_total %lu\n", hs.late);
+
+	/* Only the buckets up to the last one used by any type */
+	for (i = 0; i < HS_TYPES; i++) {
+		for (j = 0; j < HIST_BUCKETS; j++)
+			if (hs.types[i].hist.bucket[j] && j > last) last = j;
+	}
+
+	fputs("# HELP sctool_hid_round_trip_seconds Time from a request to "
+	      "its answer.\n"
+	      "# TYPE sctool_hid_round_trip_seconds histogram\n", fp);
+	for (i = 0; i < HS_TYPES; i++) {
+		ts = &hs.types[i];
+		if (!ts->hist.count) continue;
+
+		for (cum = 0, j = 0; j <= last; j++) {
+			cum += ts->hist.bucket[j];
+			fprintf(fp, "sctool_hid_round_trip_seconds_bucket{type=\"%s\","
+			        "le=\"%g\"} %lu\n", type_names[i],
+			        (double)((uint64_t)1 << j) / 1e6, cum);
+		}
+
+		fprintf(fp, "sctool_hid_round_trip_seconds_bucket{type=\"%s\","
+		        "le=\"+Inf\"} %lu\n", type_names[i], ts->hist.count);
+		fprintf(fp, "sctool_hid_round_trip_seconds_sum{type=\"%s\"} %.9f\n",
+		        type_names[i], secs(ts->hist.sum));
+		fprintf(fp, "sctool_hid_round_trip_seconds_count{type=\"%s\"} "
+		        "%lu\n", type_names[i], ts->hist.count);
+	}
+
+	fputs("# HELP sctool_hid_round_trip_quantile_seconds Exact round trip "
+	      "percentiles.\n"
+	      "# TYPE sctool_hid_round_trip_quantile_seconds gauge\n", fp);
+	for (i = 0; i < HS_TYPES; i++) {
+		ts = &hs.types[i];
+		if (!ts->n_rtt) continue;
+
+		for (j = 0; j < 3; j++) {
+			fprintf(fp, "sctool_hid_round_trip_quantile_seconds{type="
+			        "\"%s\",quantile=\"%g\"} %.9f\n", type_names[i],
+			        (double)quantiles[j] / 100.0,
+			        secs(percentile(ts, quantiles[j])));
+		}
+		fprintf(fp, "sctool_hid_round_trip_quantile_seconds{type=\"%s\","
+		        "quantile=\"1\"} %.9f\n", type_names[i],
+		        secs(ts->hist.max));
+	}
+
+	fputs("# HELP sctool_hid_last_run_timestamp_seconds When these "
+	      "statistics were written.\n"
+	      "# TYPE sctool_hid_last_run_timestamp_seconds gauge\n", fp);
+	fprintf(fp, "sctool_hid_last_run_timestamp_seconds %lu\n",
+	        (unsigned long)time(NULL));
+}
+/* }}} */
+
+/* {{{ write_prometheus */
+/**
+ * Write the Prometheus textfile. It's written alongside, then renamed
+ * into place, so that node_exporter never sees half of it.
+ */
+static int write_prometheus(const char *path)
+{
+	FILE *fp;
+	char *tmp;
+	int retval = -1;
+
+	if (!(tmp = malloc(strlen(path) + 5)))
+		return -1;
+	sprintf(tmp, "%s.tmp", path);
+
+	if (!(fp = fopen(tmp, "w"))) {
+		perror(tmp);
+		goto ret;
+	}
+
+	print_prometheus(fp);
+	if (fclose(fp) == EOF) {
+		perror(tmp);
+		remove(tmp);
+		goto ret;
+	}
+
+	if (rename(tmp, path)) {
+		perror(path);
+		remove(tmp);
+		goto ret;
+	}
+	retval = 0;
+
+ret:
+	free(tmp);
+	return retval;
+}
+/* }}} */
+
+/* {{{ hidstats_close */
+/**
+ * Stop recording, and write out the statistics.
+ *
+ * \param[in] fp Where to print the text summary
+ * \return 0 on success, -1 if they couldn't all be written.
+ */
+int hidstats_close(FILE *fp)
+{
+	int i, retval = 0;
+
+	if (!hs.formats)
+		return 0;
+
+	for (i = 0; i < HS_TYPES; i++) {
+		if (hs.types[i].n_rtt)
+			qsort(hs.types[i].rtt, hs.types[i].n_rtt,
+			      sizeof(uint64_t), by_value);
+	}
+
+	if (hs.formats & HS_TEXT)
+		print_text(fp);
+
+	if (hs.json) {
+		print_json_summary(hs.json);
+		if (hs.json == stdout) fflush(stdout);
+		else if (fclose(hs.json) == EOF) retval = -1;
+	}
+
+	if (hs.prom_path && write_prometheus(hs.prom_path))
+		retval = -1;
+
+	for (i = 0; i < HS_TYPES; i++)
+		free(hs.types[i].rtt);
+	free(hs.prom_path);
+	memset(&hs, 0, sizeof(hs));
+	return retval;
+}
+/* }}} */
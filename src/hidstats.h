@@ -0,0 +1,62 @@
+/**
+ * sctools: HID transaction statistics
+ * Copyright (C) 2016 Tim Hentenaar.
+ *
+ * This code is licenced under the Simplified BSD License.
+ * See the LICENSE file for details.
+ */
+
+#ifndef HIDSTATS_H
+#define HIDSTATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/*
+ * What a transaction was for. The report number alone won't do, since
+ * the RC_* codes sent during a read share their values with RQ_*.
+ */
+#define HS_INFO      0  /* RQ_INFO                                */
+#define HS_WRITE     1  /* RQ_WRITE: start (or resume) a write    */
+#define HS_DATA      2  /* RQ_WRITE | RQ_CONTINUATION: one packet */
+#define HS_READ      3  /* RQ_READ                                */
+#define HS_READY     4  /* RC_READY: ask for the next packet      */
+#define HS_ACK       5  /* RC_OK: acknowledge a packet            */
+#define HS_COMPLETED 6  /* RC_COMPLETED: end a read               */
+#define HS_BOOT      7  /* RQ_BOOT                                */
+#define HS_WAIT      8  /* Waiting for the device to be ready     */
+#define HS_TYPES     9
+
+/* How it ended */
+#define HS_OK        0  /* Answered                               */
+#define HS_TIMEOUT   1  /* No answer in time                      */
+#define HS_ERROR     2  /* The write or read failed               */
+#define HS_REFUSED   3  /* Answered with RC_ERROR                 */
+
+/* Output formats */
+#define HS_TEXT       1
+#define HS_JSON       2
+#define HS_PROMETHEUS 4
+
+/**
+ * One write to the device, and the read of its answer. A retry is
+ * a transaction of its own, with a non-zero \a attempt. For HS_WAIT,
+ * nothing is written.
+ */
+struct hid_transaction {
+	int      type;      /* HS_* type                           */
+	int      attempt;   /* 0 for the first try                 */
+	int      result;    /* HS_OK, HS_TIMEOUT, ...              */
+	uint64_t start;     /* monotonic time it started (ns)      */
+	uint64_t write_ns;  /* time taken by the write             */
+	uint64_t rtt_ns;    /* time until the answer (or give up)  */
+};
+
+int  hidstats_open(int formats, const char *json_path,
+                   const char *prom_path);
+int  hidstats_enabled(void);
+void hidstats_record(const struct hid_transaction *t);
+void hidstats_late(void);
+int  hidstats_close(FILE *fp);
+
+#endif /* HIDSTATS_H */
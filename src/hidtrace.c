@@ -0,0 +1,201 @@
+/**
+ * sctools: Binary trace of transport calls
+ * Copyright (C) 2016 Tim Hentenaar.
+ *
+ * This code is licenced under the Simplified BSD License.
+ * See the LICENSE file for details.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "hidtrace.h"
+
+#define HIDTRACE_BUFSIZ 65536
+
+static void put_u32(unsigned char *p, unsigned long v)
+{
+	int i;
+
+	for (i = 0; i < 4; i++, v >>= 8)
+		p[i] = (unsigned char)(v & 0xff);
+}
+
+static void put_u64(unsigned char *p, uint64_t v)
+{
+	int i;
+
+	for (i = 0; i < 8; i++, v >>= 8)
+		p[i] = (unsigned char)(v & 0xff);
+}
+
+static unsigned long get_u32(const unsigned char *p)
+{
+	unsigned long v = 0;
+	int i;
+
+	for (i = 3; i >= 0; i--)
+		v = (v << 8) | p[i];
+	return v;
+}
+
+static uint64_t get_u64(const unsigned char *p)
+{
+	uint64_t v = 0;
+	int i;
+
+	for (i = 7; i >= 0; i--)
+		v = (v << 8) | p[i];
+	return v;
+}
+
+/* {{{ hidtrace_create */
+/**
+ * Create a trace, and write its header.
+ *
+ * \param[in] tr    Trace
+ * \param[in] path  File to write
+ * \param[in] start Monotonic time the trace starts at (ns)
+ * \return 0 on success, -1 on error.
+ */
+int hidtrace_create(struct hidtrace *tr, const char *path, uint64_t start)
+{
+	unsigned char hdr[HIDTRACE_HEADER_LEN];
+
+	memset(tr, 0, sizeof(*tr));
+	if (!(tr->fp = fopen(path, "wb"))) {
+		fprintf(stderr, "Unable to open '%s' for writing\n", path);
+		goto err;
+	}
+
+	setvbuf(tr->fp, NULL, _IOFBF, HIDTRACE_BUFSIZ);
+	tr->wall_start = (uint64_t)time(NULL);
+	tr->start      = start;
+
+	memcpy(hdr, "SCHID", 5);
+	hdr[5] = HIDTRACE_VERSION;
+	hdr[6] = HIDTRACE_RECORD_LEN;
+	hdr[7] = 0;
+	put_u64(hdr + 8, tr->wall_start);
+	put_u64(hdr + 16, tr->start);
+	if (fwrite(hdr, 1, HIDTRACE_HEADER_LEN, tr->fp) == HIDTRACE_HEADER_LEN)
+		return 0;
+
+	fprintf(stderr, "Unable to write to '%s'\n", path);
+	fclose(tr->fp);
+	tr->fp = NULL;
+
+err:
+	return -1;
+}
+/* }}} */
+
+/* {{{ hidtrace_write */
+/**
+ * Append a record to the trace. Errors are picked up by
+ * hidtrace_close().
+ */
+void hidtrace_write(struct hidtrace *tr, const struct hidtrace_record *r)
+{
+	unsigned char rec[HIDTRACE_RECORD_LEN];
+
+	put_u64(rec, r->time);
+	put_u32(rec + 8, r->duration_us);
+	rec[12] = r->device;
+	rec[13] = r->call;
+	rec[14] = r->result;
+	rec[15] = r->len;
+
+	if (fwrite(rec, 1, HIDTRACE_RECORD_LEN, tr->fp) != HIDTRACE_RECORD_LEN ||
+	    fwrite(r->data, 1, r->len, tr->fp) != r->len)
+		tr->error = 1;
+	++tr->records;
+}
+/* }}} */
+
+/* {{{ hidtrace_open */
+/**
+ * Open a trace for reading, and check its header.
+ *
+ * \param[in] tr   Trace
+ * \param[in] path File to read
+ * \return 0 on success, -1 on error.
+ */
+int hidtrace_open(struct hidtrace *tr, const char *path)
+{
+	unsigned char hdr[HIDTRACE_HEADER_LEN];
+
+	memset(tr, 0, sizeof(*tr));
+	if (!(tr->fp = fopen(path, "rb"))) {
+		fprintf(stderr, "Unable to open '%s'\n", path);
+		goto err;
+	}
+
+	setvbuf(tr->fp, NULL, _IOFBF, HIDTRACE_BUFSIZ);
+	if (fread(hdr, 1, HIDTRACE_HEADER_LEN, tr->fp) != HIDTRACE_HEADER_LEN ||
+	    memcmp(hdr, "SCHID", 5) || hdr[5] != HIDTRACE_VERSION ||
+	    hdr[6] != HIDTRACE_RECORD_LEN) {
+		fprintf(stderr, "%s: not a version %d capture\n", path,
+		        HIDTRACE_VERSION);
+		goto close;
+	}
+
+	tr->wall_start = get_u64(hdr + 8);
+	tr->start      = get_u64(hdr + 16);
+	return 0;
+
+close:
+	fclose(tr->fp);
+	tr->fp = NULL;
+
+err:
+	return -1;
+}
+/* }}} */
+
+/* {{{ hidtrace_read */
+/**
+ * Read the next record from a trace.
+ *
+ * \return 1 if a record was read, 0 at the end of the trace, or
+ *         -1 on error (including a truncated or malformed record).
+ */
+int hidtrace_read(struct hidtrace *tr, struct hidtrace_record *r)
+{
+	unsigned char rec[HIDTRACE_RECORD_LEN];
+	size_t n;
+
+	if ((n = fread(rec, 1, HIDTRACE_RECORD_LEN, tr->fp)) !=
+	    HIDTRACE_RECORD_LEN)
+		return n || ferror(tr->fp) ? -1 : 0;
+
+	r->time        = get_u64(rec);
+	r->duration_us = get_u32(rec + 8);
+	r->device      = rec[12];
+	r->call        = rec[13];
+	r->result      = rec[14];
+	r->len         = rec[15];
+
+	if (r->len > PACKET_LEN || r->result > HT_ERROR ||
+	    fread(r->data, 1, r->len, tr->fp) != r->len)
+		return -1;
+
+	++tr->records;
+	return 1;
+}
+/* }}} */
+
+/**
+ * Close a trace.
+ *
+ * \return 0 on success, -1 if anything couldn't be written.
+ */
+int hidtrace_close(struct hidtrace *tr)
+{
+	if (tr->fp && fclose(tr->fp))
+		tr->error = 1;
+
+	tr->fp = NULL;
+	return tr->error ? -1 : 0;
+}
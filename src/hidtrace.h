@@ -0,0 +1,80 @@
+/**
+ * sctools: Binary trace of transport calls
+ * Copyright (C) 2016 Tim Hentenaar.
+ *
+ * This code is licenced under the Simplified BSD License.
+ * See the LICENSE file for details.
+ */
+
+#ifndef HIDTRACE_H
+#define HIDTRACE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "rawhid_defs.h"
+
+/**
+ * A trace starts with a header:
+ *
+ *  0  "SCHID"
+ *  5  version (1)
+ *  6  record header length (16)
+ *  7  reserved (0)
+ *  8  wall clock time the trace started (seconds since the epoch)
+ * 16  monotonic clock time the trace started (ns)
+ *
+ * followed by a record per call into the transport:
+ *
+ *  0  time the call was made, since the trace started (ns)
+ *  8  how long it took (us)
+ * 12  device (in the order they were opened, from 0)
+ * 13  call ('o', 'a', 'w', 'r' or 'c')
+ * 14  result (HT_OK, HT_TIMEOUT or HT_ERROR)
+ * 15  length of the data which follows (at most PACKET_LEN)
+ * 16  data: the report written or read, or for an open, what was
+ *     asked for (usage page and usage, 16 bits each, then interface)
+ *
+ * All of the integers are little-endian.
+ */
+#define HIDTRACE_VERSION    1
+#define HIDTRACE_HEADER_LEN 24
+#define HIDTRACE_RECORD_LEN 16
+
+/* Calls */
+#define HT_OPEN     'o'  /* open()                          */
+#define HT_OPEN_ALL 'a'  /* one of the devices open_all() found */
+#define HT_WRITE    'w'
+#define HT_READ     'r'
+#define HT_CLOSE    'c'
+
+/* Results */
+#define HT_OK       0
+#define HT_TIMEOUT  1    /* reads only                      */
+#define HT_ERROR    2
+
+struct hidtrace_record {
+	uint64_t      time;         /* since the trace started (ns) */
+	unsigned long duration_us;
+	unsigned char device;
+	unsigned char call;
+	unsigned char result;
+	unsigned char len;
+	unsigned char data[PACKET_LEN];
+};
+
+struct hidtrace {
+	FILE         *fp;
+	uint64_t      wall_start;   /* seconds since the epoch */
+	uint64_t      start;        /* monotonic, ns           */
+	unsigned long records;
+	int           error;
+};
+
+int  hidtrace_create(struct hidtrace *tr, const char *path, uint64_t start);
+void hidtrace_write(struct hidtrace *tr, const struct hidtrace_record *r);
+int  hidtrace_open(struct hidtrace *tr, const char *path);
+int  hidtrace_read(struct hidtrace *tr, struct hidtrace_record *r);
+int  hidtrace_close(struct hidtrace *tr);
+
+#endif /* HIDTRACE_H */
@@ -0,0 +1,94 @@
+/**
+ * sctools: Time histograms
+ * Copyright (C) 2016 Tim Hentenaar.
+ *
+ * This code is licenced under the Simplified BSD License.
+ * See the LICENSE file for details.
+ *
+ * Times are counted in buckets of powers of 2 microseconds, which
+ * covers everything from a fast report to a key held for hours in a
+ * few dozen buckets.
+ */
+
+#include <stdio.h>
+
+#include "monotime.h"
+#include "histogram.h"
+
+#define BAR_WIDTH 40
+
+void hist_add(struct histogram *h, uint64_t ns)
+{
+	uint64_t us = ns / NS_PER_US;
+	int i = 0;
+
+	while (us && i < HIST_BUCKETS - 1) {
+		us >>= 1;
+		++i;
+	}
+
+	++h->bucket[i];
+	if (!h->count || ns < h->min) h->min = ns;
+	if (ns > h->max) h->max = ns;
+	h->sum += ns;
+	++h->count;
+}
+
+double hist_mean_ms(const struct histogram *h)
+{
+	return h->count ? (double)h->sum / (double)h->count / NS_PER_MS : 0.0;
+}
+
+/* {{{ print_bound */
+/**
+ * Print the lower bound of a histogram bucket, in a sensible unit.
+ */
+static void print_bound(FILE *fp, int i)
+{
+	uint64_t us = i ? (uint64_t)1 << (i - 1) : 0;
+
+	if (us < 1000)
+		fprintf(fp, "%4lu us", (unsigned long)us);
+	else if (us < 1000000UL)
+		fprintf(fp, "%4lu ms", (unsigned long)(us / 1000));
+	else fprintf(fp, "%4lu s ", (unsigned long)(us / 1000000UL));
+}
+/* }}} */
+
+/* {{{ hist_print */
+/**
+ * Print a histogram, with a bar for each bucket from the first to
+ * the last with anything in it.
+ */
+void hist_print(FILE *fp, const char *title, const struct histogram *h)
+{
+	unsigned long peak = 0;
+	int i, j, first = HIST_BUCKETS, last = 0;
+
+	fprintf(fp, "\n%s: %lu samples", title, h->count);
+	if (!h->count) {
+		fputc('\n', fp);
+		return;
+	}
+
+	fprintf(fp, ", mean %.3f ms, min %.3f ms, max %.3f ms\n",
+	        hist_mean_ms(h), (double)h->min / NS_PER_MS,
+	        (double)h->max / NS_PER_MS);
+
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		if (!h->bucket[i]) continue;
+		if (i < first) first = i;
+		last = i;
+		if (h->bucket[i] > peak) peak = h->bucket[i];
+	}
+
+	for (i = first; i <= last; i++) {
+		fputs("  >= ", fp);
+		print_bound(fp, i);
+		fprintf(fp, " %10lu ", h->bucket[i]);
+		for (j = 0; j < (int)(h->bucket[i] * BAR_WIDTH / peak); j++)
+			fputc('#', fp);
+		fputc('\n', fp);
+	}
+}
+/* }}} */
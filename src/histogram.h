@@ -0,0 +1,28 @@
+/**
+ * sctools: Time histograms
+ * Copyright (C) 2016 Tim Hentenaar.
+ *
+ * This code is licenced under the Simplified BSD License.
+ * See the LICENSE file for details.
+ */
+
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/* Buckets: [0, 1 us), then [2^(n-1), 2^n) us */
+#define HIST_BUCKETS 36
+
+struct histogram {
+	unsigned long bucket[HIST_BUCKETS];
+	unsigned long count;
+	uint64_t      sum, min, max;
+};
+
+void   hist_add(struct histogram *h, uint64_t ns);
+double hist_mean_ms(const struct histogram *h);
+void   hist_print(FILE *fp, const char *title, const struct histogram *h);
+
+#endif /* HISTOGRAM_H */
@@ -0,0 +1,492 @@
+/**
+ * sctools: Listen debug stream decoder
+ * Copyright (C) 2016 Tim Hentenaar.
+ *
+ * This code is licenced under the Simplified BSD License.
+ * See the LICENSE file for details.
+ *
+ * The converter's debug interface sends a stream of text such as
+ * "r5A +28 d28 " for each key event. This splits it into events
+ * with a small state machine, one byte at a time, and formats them
+ * into a large output buffer, which is written out in one go.
+ *
+ * The raw scancodes can also be decoded (see scancode.c), to say
+ * which key each sequence of them is.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "hid_tokens.h"
+#include "monotime.h"
+#include "listen.h"
+
+/* Parser states */
+#define ST_TEXT 0 /* Between events               */
+#define ST_HI   1 /* Seen the type, want a digit  */
+#define ST_LO   2 /* Seen one digit, want another */
+
+/* Room needed in the output buffer for the longest event */
+#define MAX_EVENT_LEN 384
+
+/* Value of each hex digit, or -1 */
+static const signed char hex_value[256] = {
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	 0,  1,  2,  3,  4,  5,  6,  7,  8,  9, -1, -1, -1, -1, -1, -1,
+	-1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
+};
+
+static const char hex_digit[16] = {
+	'0', '1', '2', '3', '4', '5', '6', '7',
+	'8', '9', 'A', 'B', 'C', 'D', 'E', 'F'
+};
+
+/* HID key names, indexed by code */
+static const char *key_name[256];
+static int have_names = 0;
+
+#define N_FORMATS 4
+static const char *formats[N_FORMATS] = {
+	"raw", "decoded", "json", "none"
+};
+
+int listen_format_by_name(const char *name)
+{
+	int i;
+
+	for (i = 0; name && i < N_FORMATS; i++) {
+		if (!strcmp(name, formats[i]))
+			return i;
+	}
+
+	return -1;
+}
+
+/* {{{ listen_init */
+/**
+ * Initialize a decoder.
+ *
+ * \param[in] d      Decoder
+ * \param[in] format Output format (LISTEN_*)
+ * \param[in] fp     Output stream
+ * \param[in] start  Time the session started (ns), which JSON
+ *                   timestamps are relative to.
+ */
+void listen_init(struct listen_decoder *d, int format, FILE *fp,
+                 uint64_t start)
+{
+	int i;
+
+	if (!have_names) {
+		for (i = 0; i < 256; i++)
+			key_name[i] = lookup_hid_token_by_value(i);
+		have_names = 1;
+	}
+
+	for (i = 0; i < LISTEN_MAX_DEVICES; i++)
+		d->parser[i].state = ST_TEXT;
+
+	d->hook        = NULL;
+	d->format      = format;
+	d->scancodes   = 0;
+	d->devices     = 1;
+	d->last_device = -1;
+	d->p           = &d->parser[0];
+	d->start       = start;
+	d->events = 0;
+	d->max_events = 0;
+	d->error  = 0;
+	d->fp     = fp;
+	d->len    = 0;
+}
+/* }}} */
+
+/**
+ * Have \a hook called with every event decoded, along with \a ctx.
+ */
+void listen_set_hook(struct listen_decoder *d,
+                     void (*hook)(const struct listen_event *, void *),
+                     void *ctx)
+{
+	d->hook     = hook;
+	d->hook_ctx = ctx;
+}
+
+/* {{{ listen_set_scancodes */
+/**
+ * Decode the raw scancodes as well, as scancode set \a set (1, 2,
+ * or 3), and say which key each sequence is.
+ */
+void listen_set_scancodes(struct listen_decoder *d, int set)
+{
+	int i;
+
+	d->scancodes = set;
+	for (i = 0; i < LISTEN_MAX_DEVICES; i++)
+		scancode_init(&d->parser[i].sc, set);
+}
+/* }}} */
+
+/**
+ * Stop decoding after \a max_events events (0 for no limit), even
+ * in the middle of a report.
+ */
+void listen_set_limit(struct listen_decoder *d, unsigned long max_events)
+{
+	d->max_events = max_events;
+}
+
+/**
+ * Add up the scancode stats for every device.
+ */
+void listen_scancode_stats(const struct listen_decoder *d,
+                           struct scancode_stats *st)
+{
+	int i;
+
+	memset(st, 0, sizeof(*st));
+	for (i = 0; i < LISTEN_MAX_DEVICES; i++)
+		scancode_add_stats(st, &d->parser[i].sc.stats);
+}
+
+/* {{{ listen_flush */
+/**
+ * Write out anything in the output buffer.
+ *
+ * \return 0 on success, -1 if this or any earlier write failed.
+ */
+int listen_flush(struct listen_decoder *d)
+{
+	if (d->len && (fwrite(d->out, 1, d->len, d->fp) != d->len ||
+	    fflush(d->fp)))
+		d->error = 1;
+
+	d->len = 0;
+	return d->error ? -1 : 0;
+}
+/* }}} */
+
+static void put_str(struct listen_decoder *d, const char *s)
+{
+	while (*s) d->out[d->len++] = *s++;
+}
+
+static void put_dec(struct listen_decoder *d, uint64_t v)
+{
+	char tmp[24];
+	int i = 0;
+
+	do {
+		tmp[i++] = (char)('0' + v % 10);
+		v /= 10;
+	} while (v);
+
+	while (i) d->out[d->len++] = tmp[--i];
+}
+
+static void put_hex(struct listen_decoder *d, unsigned char v)
+{
+	d->out[d->len++] = hex_digit[v >> 4];
+	d->out[d->len++] = hex_digit[v & 15];
+}
+
+/* The start of a JSON object, up to the type */
+static void put_json_head(struct listen_decoder *d,
+                          const struct listen_event *ev)
+{
+	put_str(d, "{\"time_ns\":");
+	put_dec(d, ev->time - d->start);
+	if (d->devices > 1) {
+		put_str(d, ",\"device\":");
+		put_dec(d, ev->device);
+	}
+
+	put_str(d, ",\"type\":\"");
+}
+
+/* {{{ put_json */
+/**
+ * Format an event as a JSON object, e.g.
+ * {"time_ns":1234,"type":"down","code":40,"name":"ENTER"}
+ */
+static void put_json(struct listen_decoder *d)
+{
+	const struct listen_event *ev = &d->p->ev;
+
+	put_json_head(d, ev);
+	switch (ev->type) {
+	case 'r': put_str(d, "scan");  break;
+	case '+': put_str(d, "make");  break;
+	case '-': put_str(d, "break"); break;
+	case 'd': put_str(d, "down");  break;
+	default:  put_str(d, "up");
+	}
+
+	put_str(d, "\",\"code\":");
+	put_dec(d, ev->code);
+	if (ev->type != 'r') {
+		put_str(d, ",\"name\":\"");
+		put_str(d, key_name[ev->code]);
+		d->out[d->len++] = '"';
+	}
+
+	put_str(d, "}\n");
+}
+/* }}} */
+
+/* {{{ put_seq */
+/**
+ * Say what a complete scancode sequence was, after its last byte:
+ * e.g. " <RIGHT break>" or " <malformed: E0>", or as a JSON object,
+ * {"time_ns":1234,"type":"key","event":"break","code":79,
+ *  "name":"RIGHT","bytes":"E0 F0 74","span_ns":0}
+ */
+static void put_seq(struct listen_decoder *d, int result)
+{
+	const struct scancode_seq *seq = &d->p->sc.seq;
+	char span[32];
+	int i;
+
+	if (d->format == LISTEN_DECODED) {
+		put_str(d, " <");
+		if (result == SC_KEY) {
+			put_str(d, key_name[seq->hid]);
+			put_str(d, seq->make ? " make" : " break");
+		} else put_str(d, seq->what);
+
+		if (result == SC_MALFORMED) {
+			d->out[d->len++] = ':';
+			for (i = 0; i < seq->len; i++) {
+				d->out[d->len++] = ' ';
+				put_hex(d, seq->bytes[i]);
+			}
+		}
+
+		if (seq->span) {
+			sprintf(span, ", %.3f ms", (double)seq->span / NS_PER_MS);
+			put_str(d, span);
+		}
+
+		d->out[d->len++] = '>';
+		return;
+	}
+
+	put_json_head(d, &d->p->ev);
+	if (result == SC_KEY) {
+		put_str(d, "key\",\"event\":\"");
+		put_str(d, seq->make ? "make" : "break");
+		put_str(d, "\",\"code\":");
+		put_dec(d, seq->hid);
+		put_str(d, ",\"name\":\"");
+		put_str(d, key_name[seq->hid]);
+	} else if (result == SC_OTHER) {
+		put_str(d, "other\",\"name\":\"");
+		put_str(d, seq->what);
+	} else put_str(d, "malformed");
+
+	put_str(d, "\",\"bytes\":\"");
+	for (i = 0; i < seq->len; i++) {
+		if (i) d->out[d->len++] = ' ';
+		put_hex(d, seq->bytes[i]);
+	}
+
+	put_str(d, "\",\"span_ns\":");
+	put_dec(d, seq->span);
+	put_str(d, "}\n");
+}
+/* }}} */
+
+/* {{{ emit_event */
+static void emit_event(struct listen_decoder *d)
+{
+	struct listen_parser *p = d->p;
+	int result = SC_MORE;
+
+	++d->events;
+	if (d->hook)
+		d->hook(&p->ev, d->hook_ctx);
+
+	if (d->scancodes && p->ev.type == 'r')
+		result = scancode_feed(&p->sc, p->ev.code, p->ev.time);
+
+	switch (d->format) {
+	case LISTEN_RAW:
+		d->out[d->len++] = p->ev.type;
+		d->out[d->len++] = p->digits[0];
+		d->out[d->len++] = p->digits[1];
+	break;
+	case LISTEN_DECODED:
+		d->out[d->len++] = p->ev.type;
+		put_hex(d, p->ev.code);
+		if (p->ev.type != 'r') {
+			put_str(d, " (");
+			put_str(d, key_name[p->ev.code]);
+			d->out[d->len++] = ')';
+		} else if (result != SC_MORE)
+			put_seq(d, result);
+	break;
+	case LISTEN_JSON:
+		put_json(d);
+		if (result != SC_MORE)
+			put_seq(d, result);
+	}
+}
+/* }}} */
+
+/* {{{ emit_text */
+/**
+ * Pass through anything which isn't part of an event, except in
+ * JSON, which only has the events.
+ */
+static void emit_text(struct listen_decoder *d, const char *text,
+                      size_t len)
+{
+	if (d->format == LISTEN_JSON || d->format == LISTEN_NONE)
+		return;
+
+	while (len--) d->out[d->len++] = *text++;
+}
+/* }}} */
+
+/* {{{ switch_device */
+/**
+ * Make \a device's parser the current one. With more than one
+ * device, the text output says which device each report is from.
+ */
+static void switch_device(struct listen_decoder *d, int device)
+{
+	char tag[16];
+
+	d->p = &d->parser[device];
+	if (d->devices < 2 || device == d->last_device)
+		return;
+
+	sprintf(tag, d->last_device < 0 ? "[%d] " : "\n[%d] ", device);
+	d->last_device = device;
+	emit_text(d, tag, strlen(tag));
+}
+/* }}} */
+
+/* {{{ listen_emit */
+/**
+ * Output an event that's already been decoded elsewhere (e.g. by a
+ * listen --serve process), followed by a separator, as it would have
+ * been in the converter's debug text. Events from a device number the
+ * decoder has no parser for are dropped.
+ *
+ * \param[in] d  Decoder
+ * \param[in] ev Event
+ */
+void listen_emit(struct listen_decoder *d, const struct listen_event *ev)
+{
+	if (d->max_events && d->events >= d->max_events)
+		return;
+
+	/* The event came off a socket, so don't trust its device number */
+	if (ev->device >= LISTEN_MAX_DEVICES)
+		return;
+
+	if (d->len > LISTEN_OUTBUF - MAX_EVENT_LEN)
+		listen_flush(d);
+
+	/* Another process may be listening to more devices than we know */
+	if (ev->device >= d->devices) d->devices = ev->device + 1;
+	switch_device(d, ev->device);
+
+	d->p->ev        = *ev;
+	d->p->digits[0] = hex_digit[ev->code >> 4];
+	d->p->digits[1] = hex_digit[ev->code & 15];
+	emit_event(d);
+	emit_text(d, " ", 1);
+}
+/* }}} */
+
+/* {{{ listen_decode */
+/**
+ * Decode a report from the debug interface.
+ *
+ * \param[in] d      Decoder
+ * \param[in] device Device the report came from
+ * \param[in] data   Report
+ * \param[in] len    Report length
+ * \param[in] time   Arrival time of the report (ns)
+ */
+void listen_decode(struct listen_decoder *d, int device,
+                   const unsigned char *data, size_t len, uint64_t time)
+{
+	const unsigned char *end = data + len;
+	struct listen_parser *p;
+	int v;
+
+	switch_device(d, device);
+	p = d->p;
+
+	while (data < end) {
+		/* The rest of the report is past the limit */
+		if (d->max_events && d->events >= d->max_events)
+			break;
+
+		if (d->len > LISTEN_OUTBUF - MAX_EVENT_LEN)
+			listen_flush(d);
+
+		/* Reports are padded with NULs */
+		if (!*data) {
+			++data;
+			continue;
+		}
+
+		switch (p->state) {
+		case ST_TEXT:
+			switch (*data) {
+			case 'r': case '+': case '-': case 'd': case 'u':
+				p->ev.type   = (char)*data;
+				p->ev.time   = time;
+				p->ev.device = (unsigned char)device;
+				p->state     = ST_HI;
+			break;
+			default:
+				emit_text(d, (const char *)data, 1);
+			}
+			++data;
+		break;
+		case ST_HI:
+			if ((v = hex_value[*data]) < 0) {
+				/* Not an event after all, reconsider this byte */
+				emit_text(d, &p->ev.type, 1);
+				p->state = ST_TEXT;
+				continue;
+			}
+
+			p->digits[0] = (char)*data++;
+			p->ev.code   = (unsigned char)(v << 4);
+			p->state     = ST_LO;
+		break;
+		case ST_LO:
+			if ((v = hex_value[*data]) < 0) {
+				emit_text(d, &p->ev.type, 1);
+				emit_text(d, p->digits, 1);
+				p->state = ST_TEXT;
+				continue;
+			}
+
+			p->digits[1] = (char)*data++;
+			p->ev.code  |= (unsigned char)v;
+			p->state     = ST_TEXT;
+			emit_event(d);
+		}
+	}
+}
+/* }}} */
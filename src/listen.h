@@ -0,0 +1,84 @@
+/**
+ * sctools: Listen debug stream decoder
+ * Copyright (C) 2016 Tim Hentenaar.
+ *
+ * This code is licenced under the Simplified BSD License.
+ * See the LICENSE file for details.
+ */
+
+#ifndef LISTEN_H
+#define LISTEN_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "scancode.h"
+
+/* Output formats */
+#define LISTEN_RAW     0 /* The debug text, as sent by the converter  */
+#define LISTEN_DECODED 1 /* ... with key names after the HID codes    */
+#define LISTEN_JSON    2 /* One JSON object per event, one per line   */
+#define LISTEN_NONE    3 /* Nothing (e.g. when recording a trace)     */
+
+#define LISTEN_OUTBUF  65536
+#define LISTEN_MAX_DEVICES 64
+
+/**
+ * A single event from the debug stream, e.g. "d28".
+ *
+ * type is one of 'r' (raw scancode), '+' / '-' (make / break,
+ * translated to a HID code), or 'd' / 'u' (HID code sent to the
+ * host, after remapping).
+ */
+struct listen_event {
+	uint64_t      time;   /* arrival time of the report (ns) */
+	char          type;
+	unsigned char code;
+	unsigned char device; /* which converter it came from    */
+};
+
+/**
+ * Parser state for a device. This is kept between reports, so
+ * events may be split across report boundaries.
+ */
+struct listen_parser {
+	int                     state;
+	struct listen_event     ev;
+	char                    digits[2];
+	struct scancode_decoder sc; /* for the raw scancodes */
+};
+
+struct listen_decoder {
+	void        (*hook)(const struct listen_event *ev, void *ctx);
+	void         *hook_ctx;
+	int           format;
+	int           scancodes;   /* set to decode 'r' events as, or 0 */
+	int           devices;     /* more than 1: tag the output     */
+	int           last_device; /* device the last output was from */
+	struct listen_parser *p;
+	struct listen_parser parser[LISTEN_MAX_DEVICES];
+	uint64_t      start;
+	unsigned long events;
+	unsigned long max_events;  /* stop after this many, or 0     */
+	int           error;
+	FILE         *fp;
+	size_t        len;
+	char          out[LISTEN_OUTBUF];
+};
+
+int  listen_format_by_name(const char *name);
+void listen_init(struct listen_decoder *d, int format, FILE *fp,
+                 uint64_t start);
+void listen_decode(struct listen_decoder *d, int device,
+                   const unsigned char *data, size_t len, uint64_t time);
+void listen_emit(struct listen_decoder *d, const struct listen_event *ev);
+int  listen_flush(struct listen_decoder *d);
+void listen_set_hook(struct listen_decoder *d,
+                     void (*hook)(const struct listen_event *, void *),
+                     void *ctx);
+void listen_set_scancodes(struct listen_decoder *d, int set);
+void listen_set_limit(struct listen_decoder *d, unsigned long max_events);
+void listen_scancode_stats(const struct listen_decoder *d,
+                           struct scancode_stats *st);
+
+#endif /* LISTEN_H */
@@ -0,0 +1,37 @@
+/**
+ * sctools: Monotonic time
+ * Copyright (C) 2016 Tim Hentenaar.
+ *
+ * This code is licenced under the Simplified BSD License.
+ * See the LICENSE file for details.
+ */
+
+#include <time.h>
+#include <errno.h>
+
+#include "monotime.h"
+
+/**
+ * Get the current time from the monotonic clock.
+ *
+ * \return the time in nanoseconds since an arbitrary point.
+ */
+uint64_t monotime_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * NS_PER_S + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * Sleep for the given number of nanoseconds, even if interrupted.
+ */
+void sleep_ns(uint64_t ns)
+{
+	struct timespec ts;
+
+	ts.tv_sec  = (time_t)(ns / NS_PER_S);
+	ts.tv_nsec = (long)(ns % NS_PER_S);
+	while (nanosleep(&ts, &ts) < 0 && errno == EINTR);
+}
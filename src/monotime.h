@@ -0,0 +1,21 @@
+/**
+ * sctools: Monotonic time
+ * Copyright (C) 2016 Tim Hentenaar.
+ *
+ * This code is licenced under the Simplified BSD License.
+ * See the LICENSE file for details.
+ */
+
+#ifndef MONOTIME_H
+#define MONOTIME_H
+
+#include <stdint.h>
+
+#define NS_PER_US 1000UL
+#define NS_PER_MS 1000000UL
+#define NS_PER_S  1000000000UL
+
+uint64_t monotime_ns(void);
+void sleep_ns(uint64_t ns);
+
+#endif /* MONOTIME_H */
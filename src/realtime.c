@@ -0,0 +1,123 @@
+/**
+ * sctools: Real-time scheduling
+ * Copyright (C) 2016 Tim Hentenaar.
+ *
+ * This code is licenced under the Simplified BSD License.
+ * See the LICENSE file for details.
+ *
+ * Keeps a thread from being held up by the rest of the system, so the
+ * times it takes are steady: it's pinned to one CPU, scheduled
+ * SCHED_FIFO, and the process's memory is locked so it never waits on
+ * a page fault. Each of these needs privileges (or rlimits) we may not
+ * have, in which case it's skipped with a warning.
+ */
+
+/* For sched_setaffinity() and CPU_SET() */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+
+#ifdef HAVE_MLOCKALL
+#include <sys/mman.h>
+#endif /* HAVE_MLOCKALL */
+
+#include "realtime.h"
+
+/**
+ * The CPU to pin to if none is given: the last one, as the first
+ * tends to take most of the interrupts.
+ */
+int realtime_default_cpu(void)
+{
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n > 1 ? (int)n - 1 : 0;
+}
+
+/* {{{ realtime_lock */
+/**
+ * Lock all of the process's memory, now and in future, into RAM.
+ */
+void realtime_lock(struct realtime *rt)
+{
+	rt->locked = 0;
+
+#ifdef HAVE_MLOCKALL
+	if (mlockall(MCL_CURRENT | MCL_FUTURE)) {
+		fprintf(stderr, "realtime: unable to lock memory: %s\n",
+		        strerror(errno));
+		return;
+	}
+
+	rt->locked = 1;
+#else
+	fputs("realtime: locking memory isn't supported\n", stderr);
+#endif /* HAVE_MLOCKALL */
+}
+/* }}} */
+
+void realtime_unlock(struct realtime *rt)
+{
+#ifdef HAVE_MLOCKALL
+	if (rt->locked) munlockall();
+#endif /* HAVE_MLOCKALL */
+	rt->locked = 0;
+}
+
+/* {{{ realtime_enter */
+/**
+ * Pin the calling thread to \a cpu, and make it SCHED_FIFO, at a
+ * priority above everything that isn't real-time, but below the
+ * kernel's own threads.
+ *
+ * \param[in] rt  Results
+ * \param[in] cpu CPU to pin to
+ */
+void realtime_enter(struct realtime *rt, int cpu)
+{
+	struct sched_param param;
+	int err, min, max;
+#ifdef HAVE_SCHED_SETAFFINITY
+	cpu_set_t set;
+#endif /* HAVE_SCHED_SETAFFINITY */
+
+	rt->cpu      = -1;
+	rt->priority = 0;
+
+#ifdef HAVE_SCHED_SETAFFINITY
+	CPU_ZERO(&set);
+	CPU_SET((size_t)cpu, &set);
+	if (sched_setaffinity(0, sizeof(set), &set))
+		fprintf(stderr, "realtime: unable to pin to CPU %d: %s\n", cpu,
+		        strerror(errno));
+	else rt->cpu = cpu;
+#else
+	(void)cpu;
+	fputs("realtime: pinning to a CPU isn't supported\n", stderr);
+#endif /* HAVE_SCHED_SETAFFINITY */
+
+	min = sched_get_priority_min(SCHED_FIFO);
+	max = sched_get_priority_max(SCHED_FIFO);
+	memset(&param, 0, sizeof(param));
+	param.sched_priority = min + (max - min) / 2;
+
+	if ((err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param)))
+		fprintf(stderr, "realtime: SCHED_FIFO %s, staying at normal "
+		        "priority\n", err == EPERM ? "not permitted" :
+		        strerror(err));
+	else rt->priority = param.sched_priority;
+}
+/* }}} */
+
+void realtime_print(FILE *fp, const struct realtime *rt)
+{
+	fputs("Realtime:", fp);
+	if (rt->cpu >= 0)   fprintf(fp, " pinned to CPU %d,", rt->cpu);
+	if (rt->priority)   fprintf(fp, " SCHED_FIFO %d,", rt->priority);
+	else                fputs(" normal priority,", fp);
+	fputs(rt->locked ? " memory locked\n" : " memory not locked\n", fp);
+}
@@ -0,0 +1,30 @@
+/**
+ * sctools: Real-time scheduling
+ * Copyright (C) 2016 Tim Hentenaar.
+ *
+ * This code is licenced under the Simplified BSD License.
+ * See the LICENSE file for details.
+ */
+
+#ifndef REALTIME_H
+#define REALTIME_H
+
+#include <stdio.h>
+
+/**
+ * What we managed to get. Anything that isn't permitted is skipped,
+ * and left at its default.
+ */
+struct realtime {
+	int cpu;      /* CPU the thread is pinned to, or -1           */
+	int priority; /* SCHED_FIFO priority, or 0 if not real-time   */
+	int locked;   /* memory is locked, so it can't be paged out   */
+};
+
+int  realtime_default_cpu(void);
+void realtime_lock(struct realtime *rt);
+void realtime_unlock(struct realtime *rt);
+void realtime_enter(struct realtime *rt, int cpu);
+void realtime_print(FILE *fp, const struct realtime *rt);
+
+#endif /* REALTIME_H */
@@ -0,0 +1,94 @@
+/**
+ * sctools: Single-producer, single-consumer report ring
+ * Copyright (C) 2016 Tim Hentenaar.
+ *
+ * This code is licenced under the Simplified BSD License.
+ * See the LICENSE file for details.
+ *
+ * Reports are read straight into a reserved slot, and formatted
+ * straight out of it, so nothing is copied on the way through.
+ */
+
+#include <stdlib.h>
+
+#include "ring.h"
+
+/* {{{ ring_init */
+/**
+ * Allocate a ring.
+ *
+ * \param[in] r    Ring
+ * \param[in] size Number of slots, rounded up to a power of 2.
+ * \return 0 on success, -1 on error.
+ */
+int ring_init(struct ring *r, unsigned long size)
+{
+	unsigned long n = 2;
+
+	while (n < size && n << 1) n <<= 1;
+	if (!(r->slots = calloc(n, sizeof(struct ring_slot))))
+		return -1;
+
+	r->mask     = n - 1;
+	r->head     = 0;
+	r->tail     = 0;
+	r->overflow = 0;
+	r->peak     = 0;
+	return 0;
+}
+/* }}} */
+
+void ring_free(struct ring *r)
+{
+	free(r->slots);
+	r->slots = NULL;
+}
+
+/* {{{ ring_reserve */
+/**
+ * Get the next free slot (producer).
+ *
+ * \return the slot, or NULL if the ring is full.
+ */
+struct ring_slot *ring_reserve(struct ring *r)
+{
+	unsigned long used = r->head - load_acquire(&r->tail);
+
+	if (used > r->mask)
+		return NULL;
+	return &r->slots[r->head & r->mask];
+}
+/* }}} */
+
+/**
+ * Hand the slot from ring_reserve() to the consumer.
+ */
+void ring_commit(struct ring *r)
+{
+	unsigned long used = r->head + 1 - load_acquire(&r->tail);
+
+	if (used > r->peak) r->peak = used;
+	store_release(&r->head, r->head + 1);
+}
+
+/* {{{ ring_peek */
+/**
+ * Get the oldest report in the ring (consumer).
+ *
+ * \return the slot, or NULL if the ring is empty.
+ */
+struct ring_slot *ring_peek(struct ring *r)
+{
+	if (load_acquire(&r->head) == r->tail)
+		return NULL;
+	return &r->slots[r->tail & r->mask];
+}
+/* }}} */
+
+/**
+ * Give the slot from ring_peek() back to the producer.
+ */
+void ring_release(struct ring *r)
+{
+	store_release(&r->tail, r->tail + 1);
+}
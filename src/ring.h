@@ -0,0 +1,59 @@
+/**
+ * sctools: Single-producer, single-consumer report ring
+ * Copyright (C) 2016 Tim Hentenaar.
+ *
+ * This code is licenced under the Simplified BSD License.
+ * See the LICENSE file for details.
+ */
+
+#ifndef RING_H
+#define RING_H
+
+#include <stdint.h>
+#include "rawhid_defs.h"
+
+/* {{{ Atomic loads / stores
+ * GCC >= 4.7 and clang have the __atomic builtins; otherwise, fall
+ * back to a full barrier.
+ */
+#if defined(__clang__) || (defined(__GNUC__) && \
+    ((__GNUC__ * 100) + __GNUC_MINOR__) >= 407)
+#define load_acquire(p)     __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define store_release(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#else
+#define load_acquire(p)     (__sync_synchronize(), *(p))
+#define store_release(p, v) do { __sync_synchronize(); *(p) = (v); } while (0)
+#endif /* }}} */
+
+/**
+ * A report, with the time it was captured.
+ */
+struct ring_slot {
+	uint64_t      time;
+	int           device;
+	size_t        len;
+	unsigned char data[PACKET_LEN];
+};
+
+/**
+ * One thread puts reports in, and one other thread takes them out,
+ * without locking. head and overflow are only written by the
+ * producer, and tail by the consumer.
+ */
+struct ring {
+	struct ring_slot *slots;
+	unsigned long     mask;     /* size - 1 (size is a power of 2) */
+	unsigned long     head;     /* next slot to fill               */
+	unsigned long     tail;     /* next slot to take               */
+	unsigned long     overflow; /* reports dropped, as it was full */
+	unsigned long     peak;     /* most reports held at once       */
+};
+
+int  ring_init(struct ring *r, unsigned long size);
+void ring_free(struct ring *r);
+struct ring_slot *ring_reserve(struct ring *r);
+void ring_commit(struct ring *r);
+struct ring_slot *ring_peek(struct ring *r);
+void ring_release(struct ring *r);
+
+#endif /* RING_H */
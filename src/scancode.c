@@ -0,0 +1,491 @@
+/**
+ * sctools: Scancode set 1/2/3 decoder
+ * Copyright (C) 2016 Tim Hentenaar.
+ *
+ * This code is licenced under the Simplified BSD License.
+ * See the LICENSE file for details.
+ *
+ * Turns the raw scancodes from the listen stream (e.g. "rE0 rF0 r74")
+ * back into key makes and breaks, one byte at a time. Each byte is
+ * put in a class (a prefix, a key code, or something that isn't a key
+ * such as an ACK), and a transition table for the set says what that
+ * means in the current state.
+ *
+ * The time from the first byte of a sequence to the last is kept, so
+ * a keyboard that's slow to send the rest of a sequence stands out.
+ * Bytes in the same report share its arrival time, so only sequences
+ * split across reports have a span.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "monotime.h"
+#include "scancode.h"
+
+#define N_SETS 3
+
+/* Byte classes */
+#define BC_CODE   0
+#define BC_E0     1
+#define BC_E1     2
+#define BC_F0     3
+#define BC_NONKEY 4
+#define N_CLASSES 5
+
+/* States */
+#define S_IDLE    0
+#define S_E0      1 /* seen E0    */
+#define S_F0      2 /* seen F0    */
+#define S_E0F0    3 /* seen E0 F0 */
+#define S_E1      4 /* in an E1 (Pause) sequence */
+#define N_STATES  5
+
+/* Actions */
+#define A_MORE    0 /* go to the next state, and wait for more   */
+#define A_MAKE    1
+#define A_BREAK   2
+#define A_XT      3 /* make, or break if the top bit is set      */
+#define A_OTHER   4
+#define A_BAD     5
+#define A_PAUSE   6 /* match against the set's E1 sequences      */
+
+/* Marks the fake shifts sent around some E0 keys */
+#define FAKE_SHIFT 0x100
+
+#define PAUSE 0x48
+
+struct transition {
+	unsigned char action;
+	unsigned char next;
+};
+
+/* {{{ Transition tables */
+#define GO(state)  { A_MORE,  state  }
+#define DO(action) { action,  S_IDLE }
+#define E1_SEQ     { A_PAUSE, S_E1   }
+
+/* Set 1: the top bit of the code is the break flag */
+static const struct transition xt_machine[N_STATES][N_CLASSES] = {
+	/*          CODE           E0            E1           F0 (a key)    NONKEY */
+	/* IDLE */ { DO(A_XT),    GO(S_E0),     E1_SEQ,      DO(A_XT),     DO(A_OTHER) },
+	/* E0   */ { DO(A_XT),    DO(A_BAD),    DO(A_BAD),   DO(A_XT),     DO(A_XT)    },
+	/* F0   */ { DO(A_BAD),   DO(A_BAD),    DO(A_BAD),   DO(A_BAD),    DO(A_BAD)   },
+	/* E0F0 */ { DO(A_BAD),   DO(A_BAD),    DO(A_BAD),   DO(A_BAD),    DO(A_BAD)   },
+	/* E1   */ { E1_SEQ,      E1_SEQ,       E1_SEQ,      E1_SEQ,       E1_SEQ      }
+};
+
+/* Sets 2 and 3: F0 is the break prefix (set 3 has no E0 or E1) */
+static const struct transition at_machine[N_STATES][N_CLASSES] = {
+	/*          CODE           E0            E1           F0            NONKEY */
+	/* IDLE */ { DO(A_MAKE),  GO(S_E0),     E1_SEQ,      GO(S_F0),     DO(A_OTHER) },
+	/* E0   */ { DO(A_MAKE),  DO(A_BAD),    DO(A_BAD),   GO(S_E0F0),   DO(A_MAKE)  },
+	/* F0   */ { DO(A_BREAK), DO(A_BAD),    DO(A_BAD),   DO(A_BAD),    DO(A_BREAK) },
+	/* E0F0 */ { DO(A_BREAK), DO(A_BAD),    DO(A_BAD),   DO(A_BAD),    DO(A_BREAK) },
+	/* E1   */ { E1_SEQ,      E1_SEQ,       E1_SEQ,      E1_SEQ,       E1_SEQ      }
+};
+
+#undef GO
+#undef DO
+#undef E1_SEQ
+/* }}} */
+
+/* {{{ Key tables: { scancode, HID code } */
+static const unsigned char set1_keys[][2] = {
+	{ 0x01, 0x29 }, { 0x02, 0x1E }, { 0x03, 0x1F }, { 0x04, 0x20 },
+	{ 0x05, 0x21 }, { 0x06, 0x22 }, { 0x07, 0x23 }, { 0x08, 0x24 },
+	{ 0x09, 0x25 }, { 0x0A, 0x26 }, { 0x0B, 0x27 }, { 0x0C, 0x2D },
+	{ 0x0D, 0x2E }, { 0x0E, 0x2A }, { 0x0F, 0x2B }, { 0x10, 0x14 },
+	{ 0x11, 0x1A }, { 0x12, 0x08 }, { 0x13, 0x15 }, { 0x14, 0x17 },
+	{ 0x15, 0x1C }, { 0x16, 0x18 }, { 0x17, 0x0C }, { 0x18, 0x12 },
+	{ 0x19, 0x13 }, { 0x1A, 0x2F }, { 0x1B, 0x30 }, { 0x1C, 0x28 },
+	{ 0x1D, 0xE0 }, { 0x1E, 0x04 }, { 0x1F, 0x16 }, { 0x20, 0x07 },
+	{ 0x21, 0x09 }, { 0x22, 0x0A }, { 0x23, 0x0B }, { 0x24, 0x0D },
+	{ 0x25, 0x0E }, { 0x26, 0x0F }, { 0x27, 0x33 }, { 0x28, 0x34 },
+	{ 0x29, 0x35 }, { 0x2A, 0xE1 }, { 0x2B, 0x31 }, { 0x2C, 0x1D },
+	{ 0x2D, 0x1B }, { 0x2E, 0x06 }, { 0x2F, 0x19 }, { 0x30, 0x05 },
+	{ 0x31, 0x11 }, { 0x32, 0x10 }, { 0x33, 0x36 }, { 0x34, 0x37 },
+	{ 0x35, 0x38 }, { 0x36, 0xE5 }, { 0x37, 0x55 }, { 0x38, 0xE2 },
+	{ 0x39, 0x2C }, { 0x3A, 0x39 }, { 0x3B, 0x3A }, { 0x3C, 0x3B },
+	{ 0x3D, 0x3C }, { 0x3E, 0x3D }, { 0x3F, 0x3E }, { 0x40, 0x3F },
+	{ 0x41, 0x40 }, { 0x42, 0x41 }, { 0x43, 0x42 }, { 0x44, 0x43 },
+	{ 0x45, 0x53 }, { 0x46, 0x47 }, { 0x47, 0x5F }, { 0x48, 0x60 },
+	{ 0x49, 0x61 }, { 0x4A, 0x56 }, { 0x4B, 0x5C }, { 0x4C, 0x5D },
+	{ 0x4D, 0x5E }, { 0x4E, 0x57 }, { 0x4F, 0x59 }, { 0x50, 0x5A },
+	{ 0x51, 0x5B }, { 0x52, 0x62 }, { 0x53, 0x63 }, { 0x54, 0x46 },
+	{ 0x56, 0x64 }, { 0x57, 0x44 }, { 0x58, 0x45 }, { 0x70, 0x88 },
+	{ 0x73, 0x87 }, { 0x79, 0x8A }, { 0x7B, 0x8B }, { 0x7D, 0x89 }
+};
+
+static const unsigned char set1_ext[][2] = {
+	{ 0x1C, 0x58 }, { 0x1D, 0xE4 }, { 0x35, 0x54 }, { 0x37, 0x46 },
+	{ 0x38, 0xE6 }, { 0x46, PAUSE }, { 0x47, 0x4A }, { 0x48, 0x52 },
+	{ 0x49, 0x4B }, { 0x4B, 0x50 }, { 0x4D, 0x4F }, { 0x4F, 0x4D },
+	{ 0x50, 0x51 }, { 0x51, 0x4E }, { 0x52, 0x49 }, { 0x53, 0x4C },
+	{ 0x5B, 0xE3 }, { 0x5C, 0xE7 }, { 0x5D, 0x65 }, { 0x5E, 0x66 }
+};
+
+static const unsigned char set2_keys[][2] = {
+	{ 0x01, 0x42 }, { 0x03, 0x3E }, { 0x04, 0x3C }, { 0x05, 0x3A },
+	{ 0x06, 0x3B }, { 0x07, 0x45 }, { 0x09, 0x43 }, { 0x0A, 0x41 },
+	{ 0x0B, 0x3F }, { 0x0C, 0x3D }, { 0x0D, 0x2B }, { 0x0E, 0x35 },
+	{ 0x11, 0xE2 }, { 0x12, 0xE1 }, { 0x13, 0x88 }, { 0x14, 0xE0 },
+	{ 0x15, 0x14 }, { 0x16, 0x1E }, { 0x1A, 0x1D }, { 0x1B, 0x16 },
+	{ 0x1C, 0x04 }, { 0x1D, 0x1A }, { 0x1E, 0x1F }, { 0x21, 0x06 },
+	{ 0x22, 0x1B }, { 0x23, 0x07 }, { 0x24, 0x08 }, { 0x25, 0x21 },
+	{ 0x26, 0x20 }, { 0x29, 0x2C }, { 0x2A, 0x19 }, { 0x2B, 0x09 },
+	{ 0x2C, 0x17 }, { 0x2D, 0x15 }, { 0x2E, 0x22 }, { 0x31, 0x11 },
+	{ 0x32, 0x05 }, { 0x33, 0x0B }, { 0x34, 0x0A }, { 0x35, 0x1C },
+	{ 0x36, 0x23 }, { 0x3A, 0x10 }, { 0x3B, 0x0D }, { 0x3C, 0x18 },
+	{ 0x3D, 0x24 }, { 0x3E, 0x25 }, { 0x41, 0x36 }, { 0x42, 0x0E },
+	{ 0x43, 0x0C }, { 0x44, 0x12 }, { 0x45, 0x27 }, { 0x46, 0x26 },
+	{ 0x49, 0x37 }, { 0x4A, 0x38 }, { 0x4B, 0x0F }, { 0x4C, 0x33 },
+	{ 0x4D, 0x13 }, { 0x4E, 0x2D }, { 0x51, 0x87 }, { 0x52, 0x34 },
+	{ 0x54, 0x2F }, { 0x55, 0x2E }, { 0x58, 0x39 }, { 0x59, 0xE5 },
+	{ 0x5A, 0x28 }, { 0x5B, 0x30 }, { 0x5D, 0x31 }, { 0x61, 0x64 },
+	{ 0x64, 0x8A }, { 0x66, 0x2A }, { 0x67, 0x8B }, { 0x69, 0x59 },
+	{ 0x6A, 0x89 }, { 0x6B, 0x5C }, { 0x6C, 0x5F }, { 0x70, 0x62 },
+	{ 0x71, 0x63 }, { 0x72, 0x5A }, { 0x73, 0x5D }, { 0x74, 0x5E },
+	{ 0x75, 0x60 }, { 0x76, 0x29 }, { 0x77, 0x53 }, { 0x78, 0x44 },
+	{ 0x79, 0x57 }, { 0x7A, 0x5B }, { 0x7B, 0x56 }, { 0x7C, 0x55 },
+	{ 0x7D, 0x61 }, { 0x7E, 0x47 }, { 0x83, 0x40 }, { 0x84, 0x46 }
+};
+
+static const unsigned char set2_ext[][2] = {
+	{ 0x11, 0xE6 }, { 0x14, 0xE4 }, { 0x1F, 0xE3 }, { 0x27, 0xE7 },
+	{ 0x2F, 0x65 }, { 0x37, 0x66 }, { 0x4A, 0x54 }, { 0x5A, 0x58 },
+	{ 0x69, 0x4D }, { 0x6B, 0x50 }, { 0x6C, 0x4A }, { 0x70, 0x49 },
+	{ 0x71, 0x4C }, { 0x72, 0x51 }, { 0x74, 0x4F }, { 0x75, 0x52 },
+	{ 0x7A, 0x4E }, { 0x7C, 0x46 }, { 0x7D, 0x4B }, { 0x7E, PAUSE }
+};
+
+static const unsigned char set3_keys[][2] = {
+	{ 0x07, 0x3A }, { 0x08, 0x29 }, { 0x0D, 0x2B }, { 0x0E, 0x35 },
+	{ 0x0F, 0x3B }, { 0x11, 0xE0 }, { 0x12, 0xE1 }, { 0x13, 0x64 },
+	{ 0x14, 0x39 }, { 0x15, 0x14 }, { 0x16, 0x1E }, { 0x17, 0x3C },
+	{ 0x19, 0xE2 }, { 0x1A, 0x1D }, { 0x1B, 0x16 }, { 0x1C, 0x04 },
+	{ 0x1D, 0x1A }, { 0x1E, 0x1F }, { 0x1F, 0x3D }, { 0x21, 0x06 },
+	{ 0x22, 0x1B }, { 0x23, 0x07 }, { 0x24, 0x08 }, { 0x25, 0x21 },
+	{ 0x26, 0x20 }, { 0x27, 0x3E }, { 0x29, 0x2C }, { 0x2A, 0x19 },
+	{ 0x2B, 0x09 }, { 0x2C, 0x17 }, { 0x2D, 0x15 }, { 0x2E, 0x22 },
+	{ 0x2F, 0x3F }, { 0x31, 0x11 }, { 0x32, 0x05 }, { 0x33, 0x0B },
+	{ 0x34, 0x0A }, { 0x35, 0x1C }, { 0x36, 0x23 }, { 0x37, 0x40 },
+	{ 0x39, 0xE6 }, { 0x3A, 0x10 }, { 0x3B, 0x0D }, { 0x3C, 0x18 },
+	{ 0x3D, 0x24 }, { 0x3E, 0x25 }, { 0x3F, 0x41 }, { 0x41, 0x36 },
+	{ 0x42, 0x0E }, { 0x43, 0x0C }, { 0x44, 0x12 }, { 0x45, 0x27 },
+	{ 0x46, 0x26 }, { 0x47, 0x42 }, { 0x49, 0x37 }, { 0x4A, 0x38 },
+	{ 0x4B, 0x0F }, { 0x4C, 0x33 }, { 0x4D, 0x13 }, { 0x4E, 0x2D },
+	{ 0x4F, 0x43 }, { 0x52, 0x34 }, { 0x53, 0x31 }, { 0x54, 0x2F },
+	{ 0x55, 0x2E }, { 0x56, 0x44 }, { 0x57, 0x46 }, { 0x58, 0xE4 },
+	{ 0x59, 0xE5 }, { 0x5A, 0x28 }, { 0x5B, 0x30 }, { 0x5C, 0x31 },
+	{ 0x5E, 0x45 }, { 0x5F, 0x47 }, { 0x60, 0x51 }, { 0x61, 0x50 },
+	{ 0x62, PAUSE }, { 0x63, 0x52 }, { 0x64, 0x4C }, { 0x65, 0x4D },
+	{ 0x66, 0x2A }, { 0x67, 0x49 }, { 0x69, 0x59 }, { 0x6A, 0x4F },
+	{ 0x6B, 0x5C }, { 0x6C, 0x5F }, { 0x6D, 0x4E }, { 0x6E, 0x4A },
+	{ 0x6F, 0x4B }, { 0x70, 0x62 }, { 0x71, 0x63 }, { 0x72, 0x5A },
+	{ 0x73, 0x5D }, { 0x74, 0x5E }, { 0x75, 0x60 }, { 0x76, 0x53 },
+	{ 0x77, 0x54 }, { 0x79, 0x58 }, { 0x7A, 0x5B }, { 0x7C, 0x57 },
+	{ 0x7D, 0x61 }, { 0x7E, 0x55 }, { 0x84, 0x56 }, { 0x8B, 0xE3 },
+	{ 0x8C, 0xE7 }, { 0x8D, 0x65 }
+};
+
+/* Fake shifts around E0 keys, e.g. E0 12 E0 7C for Print Screen */
+static const unsigned char set1_fake[] = { 0x2A, 0x36 };
+static const unsigned char set2_fake[] = { 0x12, 0x59 };
+
+/* The Pause key's E1 sequences: make, then break */
+static const unsigned char set1_pause[2][5] = {
+	{ 0xE1, 0x1D, 0x45 }, { 0xE1, 0x9D, 0xC5 }
+};
+
+static const unsigned char set2_pause[2][5] = {
+	{ 0xE1, 0x14, 0x77 }, { 0xE1, 0xF0, 0x14, 0xF0, 0x77 }
+};
+/* }}} */
+
+/* Codes that aren't keys, e.g. replies to commands */
+static const struct nonkey {
+	unsigned char code;
+	unsigned char sets; /* bit n for set n */
+	const char   *name;
+} nonkeys[] = {
+	{ 0x00, 0x0E, "overrun"          },
+	{ 0xAA, 0x0C, "self-test passed" },
+	{ 0xEE, 0x0C, "echo"             },
+	{ 0xFA, 0x0E, "ACK"              },
+	{ 0xFC, 0x0C, "self-test failed" },
+	{ 0xFD, 0x0C, "self-test failed" },
+	{ 0xFE, 0x0E, "resend"           },
+	{ 0xFF, 0x0E, "overrun"          }
+};
+
+#define N_NONKEYS (sizeof(nonkeys) / sizeof(struct nonkey))
+#define N_PAIRS(t) (sizeof(t) / sizeof(t[0]))
+
+static const struct scancode_set {
+	const char              *name;
+	const struct transition (*machine)[N_CLASSES];
+	const unsigned char     (*keys)[2];
+	size_t                   n_keys;
+	const unsigned char     (*ext)[2];
+	size_t                   n_ext;
+	const unsigned char     *fake;
+	size_t                   n_fake;
+	const unsigned char     (*pause)[5];
+	size_t                   pause_len[2];
+} sets[N_SETS] = {
+	{ "set1", xt_machine, set1_keys, N_PAIRS(set1_keys), set1_ext,
+	  N_PAIRS(set1_ext), set1_fake, 2, set1_pause, { 3, 3 } },
+	{ "set2", at_machine, set2_keys, N_PAIRS(set2_keys), set2_ext,
+	  N_PAIRS(set2_ext), set2_fake, 2, set2_pause, { 3, 5 } },
+	{ "set3", at_machine, set3_keys, N_PAIRS(set3_keys), NULL, 0,
+	  NULL, 0, NULL, { 0, 0 } }
+};
+
+/* Built from the tables above by scancode_init() */
+static unsigned char  byte_class[N_SETS][256];
+static unsigned short keymap[N_SETS][2][256]; /* plain, E0 */
+static const char    *nonkey_name[N_SETS][256];
+static int have_tables = 0;
+
+/* {{{ build_tables */
+static void build_tables(void)
+{
+	const struct scancode_set *cs;
+	size_t i;
+	int s;
+
+	memset(byte_class, BC_CODE, sizeof(byte_class));
+	memset(keymap, 0, sizeof(keymap));
+	memset(nonkey_name, 0, sizeof(nonkey_name));
+
+	for (s = 0; s < N_SETS; s++) {
+		cs = &sets[s];
+		for (i = 0; i < cs->n_keys; i++)
+			keymap[s][0][cs->keys[i][0]] = cs->keys[i][1];
+		for (i = 0; i < cs->n_ext; i++)
+			keymap[s][1][cs->ext[i][0]] = cs->ext[i][1];
+		for (i = 0; i < cs->n_fake; i++)
+			keymap[s][1][cs->fake[i]] = FAKE_SHIFT;
+
+		for (i = 0; i < N_NONKEYS; i++) {
+			if (!(nonkeys[i].sets & (1 << (s + 1))))
+				continue;
+			byte_class[s][nonkeys[i].code]  = BC_NONKEY;
+			nonkey_name[s][nonkeys[i].code] = nonkeys[i].name;
+		}
+
+		/* Set 3 doesn't use E0 or E1, and F0 is a key in set 1 */
+		if (cs->n_ext) {
+			byte_class[s][0xE0] = BC_E0;
+			byte_class[s][0xE1] = BC_E1;
+		}
+
+		if (cs->machine == at_machine)
+			byte_class[s][0xF0] = BC_F0;
+	}
+
+	have_tables = 1;
+}
+/* }}} */
+
+int scancode_set_by_name(const char *name)
+{
+	int i;
+
+	for (i = 0; name && i < N_SETS; i++) {
+		if (!strcmp(name, sets[i].name) || !strcmp(name, sets[i].name + 3))
+			return i + 1;
+	}
+
+	return -1;
+}
+
+/* {{{ scancode_init */
+/**
+ * Initialize a decoder.
+ *
+ * \param[in] s   Decoder
+ * \param[in] set Scancode set (1, 2, or 3)
+ */
+void scancode_init(struct scancode_decoder *s, int set)
+{
+	if (!have_tables)
+		build_tables();
+
+	memset(s, 0, sizeof(*s));
+	s->set   = set < 1 || set > N_SETS ? 2 : set;
+	s->state = S_IDLE;
+}
+/* }}} */
+
+/* {{{ match_pause */
+/**
+ * See how far the E1 sequence so far matches the Pause key's.
+ *
+ * \return A_MAKE or A_BREAK if it's complete, A_MORE if it could
+ *         still match, or A_BAD if it can't.
+ */
+static int match_pause(const struct scancode_set *cs,
+                       const struct scancode_decoder *s)
+{
+	int i, action = A_BAD;
+
+	for (i = 0; i < 2 && cs->pause; i++) {
+		if (s->len > cs->pause_len[i] ||
+		    memcmp(s->buf, cs->pause[i], s->len))
+			continue;
+
+		if (s->len == cs->pause_len[i])
+			return i ? A_BREAK : A_MAKE;
+		action = A_MORE;
+	}
+
+	return action;
+}
+/* }}} */
+
+/* {{{ finish */
+/**
+ * Finish the sequence in the buffer, and add it to the stats.
+ */
+static int finish(struct scancode_decoder *s, int result, uint64_t time)
+{
+	struct scancode_stats *st = &s->stats;
+	struct scancode_seq *seq = &s->seq;
+
+	memcpy(seq->bytes, s->buf, s->len);
+	seq->len  = s->len;
+	seq->span = time - s->first;
+	s->len    = 0;
+	s->state  = S_IDLE;
+
+	switch (result) {
+	case SC_KEY:
+		++st->keys;
+		if (!seq->hid) ++st->unknown;
+	break;
+	case SC_OTHER:     ++st->other;     break;
+	case SC_MALFORMED: ++st->malformed; break;
+	}
+
+	if (seq->len > 1) {
+		++st->multi;
+		st->span_sum += seq->span;
+		if (seq->span)               ++st->split;
+		if (seq->span > st->span_max) st->span_max = seq->span;
+	}
+
+	return result;
+}
+/* }}} */
+
+/* {{{ scancode_feed */
+/**
+ * Feed the decoder the next scancode.
+ *
+ * When a sequence is complete, it's described by s->seq until the
+ * next one is.
+ *
+ * \param[in] s    Decoder
+ * \param[in] byte Scancode
+ * \param[in] time Arrival time (ns)
+ * \return SC_MORE, SC_KEY, SC_OTHER, or SC_MALFORMED.
+ */
+int scancode_feed(struct scancode_decoder *s, unsigned char byte,
+                  uint64_t time)
+{
+	const struct scancode_set *cs = &sets[s->set - 1];
+	struct scancode_seq *seq = &s->seq;
+	int cls = byte_class[s->set - 1][byte], action;
+	unsigned int code;
+
+	if (!s->len) s->first = time;
+	action   = cs->machine[s->state][cls].action;
+	s->state = cs->machine[s->state][cls].next;
+	if (s->len < SCANCODE_MAX_SEQ)
+		s->buf[s->len++] = byte;
+
+	if (action == A_PAUSE)
+		action = match_pause(cs, s);
+	if (action == A_MORE)
+		return SC_MORE;
+
+	seq->hid  = 0;
+	seq->make = 0;
+	seq->what = NULL;
+
+	switch (action) {
+	case A_OTHER:
+		seq->what = nonkey_name[s->set - 1][byte];
+		return finish(s, SC_OTHER, time);
+	case A_BAD:
+		seq->what = "malformed";
+		if (cls == BC_CODE || cls == BC_NONKEY)
+			return finish(s, SC_MALFORMED, time);
+
+		/*
+		 * A prefix where it doesn't belong: what came before it is
+		 * malformed, and it starts the next sequence.
+		 */
+		--s->len;
+		finish(s, SC_MALFORMED, time);
+		s->first  = time;
+		s->buf[0] = byte;
+		s->len    = 1;
+		s->state  = cs->machine[S_IDLE][cls].next;
+		return SC_MALFORMED;
+	}
+
+	seq->make = (unsigned char)(action == A_MAKE ||
+	                            (action == A_XT && !(byte & 0x80)));
+
+	/* Pause has a sequence of its own, others are in the tables */
+	if (s->buf[0] == 0xE1 && s->len > 1)
+		code = PAUSE;
+	else code = keymap[s->set - 1][s->buf[0] == 0xE0 && s->len > 1]
+	                  [action == A_XT ? byte & 0x7F : byte];
+
+	if (code == FAKE_SHIFT) {
+		seq->what = "fake shift";
+		return finish(s, SC_OTHER, time);
+	}
+
+	seq->hid = (unsigned char)code;
+	return finish(s, SC_KEY, time);
+}
+/* }}} */
+
+/**
+ * Add \a st to \a total.
+ */
+void scancode_add_stats(struct scancode_stats *total,
+                        const struct scancode_stats *st)
+{
+	total->keys      += st->keys;
+	total->unknown   += st->unknown;
+	total->other     += st->other;
+	total->malformed += st->malformed;
+	total->multi     += st->multi;
+	total->split     += st->split;
+	total->span_sum  += st->span_sum;
+	if (st->span_max > total->span_max)
+		total->span_max = st->span_max;
+}
+
+/* {{{ scancode_print_stats */
+void scancode_print_stats(FILE *fp, int set, const struct scancode_stats *st)
+{
+	fprintf(fp, "Scancodes (set %d): %lu keys (%lu unknown), %lu other, "
+	        "%lu malformed\n", set, st->keys, st->unknown, st->other,
+	        st->malformed);
+
+	if (!st->multi)
+		return;
+
+	fprintf(fp, "%lu multi-byte sequences, %lu split across reports, "
+	        "mean span %.3f ms, max %.3f ms\n", st->multi, st->split,
+	        (double)st->span_sum / (double)st->multi / NS_PER_MS,
+	        (double)st->span_max / NS_PER_MS);
+}
+/* }}} */
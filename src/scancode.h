@@ -0,0 +1,63 @@
+/**
+ * sctools: Scancode set 1/2/3 decoder
+ * Copyright (C) 2016 Tim Hentenaar.
+ *
+ * This code is licenced under the Simplified BSD License.
+ * See the LICENSE file for details.
+ */
+
+#ifndef SCANCODE_H
+#define SCANCODE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/* Results of scancode_feed() */
+#define SC_MORE      0 /* In the middle of a sequence                  */
+#define SC_KEY       1 /* A key was made or broken                     */
+#define SC_OTHER     2 /* Not a key (e.g. an ACK, or a fake shift)     */
+#define SC_MALFORMED 3 /* A sequence that doesn't make sense, dropped  */
+
+#define SCANCODE_MAX_SEQ 8
+
+/**
+ * The last complete sequence fed to a decoder, and what it meant.
+ */
+struct scancode_seq {
+	unsigned char hid;   /* HID code of the key, or 0 if unknown     */
+	unsigned char make;  /* 1 for a make, 0 for a break              */
+	unsigned char len;   /* bytes in the sequence                    */
+	unsigned char bytes[SCANCODE_MAX_SEQ];
+	const char   *what;  /* description, if it isn't a key           */
+	uint64_t      span;  /* first byte to the last (ns)              */
+};
+
+struct scancode_stats {
+	unsigned long keys;      /* makes and breaks               */
+	unsigned long unknown;   /* ... of keys not in the table   */
+	unsigned long other;     /* ACKs, fake shifts, etc.        */
+	unsigned long malformed;
+	unsigned long multi;     /* sequences of more than 1 byte  */
+	unsigned long split;     /* ... that came in > 1 report    */
+	uint64_t      span_sum, span_max;
+};
+
+struct scancode_decoder {
+	int                   set;
+	int                   state;
+	uint64_t              first; /* time of the first byte      */
+	unsigned char         len;   /* bytes in the sequence so far */
+	unsigned char         buf[SCANCODE_MAX_SEQ];
+	struct scancode_seq   seq;
+	struct scancode_stats stats;
+};
+
+int  scancode_set_by_name(const char *name);
+void scancode_init(struct scancode_decoder *s, int set);
+int  scancode_feed(struct scancode_decoder *s, unsigned char byte,
+                   uint64_t time);
+void scancode_add_stats(struct scancode_stats *total,
+                        const struct scancode_stats *st);
+void scancode_print_stats(FILE *fp, int set, const struct scancode_stats *st);
+
+#endif /* SCANCODE_H */
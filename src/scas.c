@@ -3,6 +3,7 @@
 #include "token.h"
 #include "hid_tokens.h"
 #include "macro_tokens.h"
+#include "monotime.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -37,6 +38,89 @@ static unsigned char current_desired_meta = 0;
 static unsigned char current_matched_meta = 0;
 static unsigned char block_type = BLOCK_NONE;
 
+/* Where we are in the source, for the memory map */
+static const char    *current_file = NULL;
+static int            current_line = 0;
+static const char    *block_file = NULL;
+static int            block_line = 0;
+static const char    *macro_file = NULL;
+static int            macro_line = 0;
+
+/* {{{ Statistics (--stats) */
+#define STATS_NONE 0
+#define STATS_TEXT 1
+#define STATS_JSON 2
+
+struct file_stats {
+	char          *name;
+	unsigned int   depth;
+	int            parent;
+	unsigned long  lines;
+	uint64_t       ns, child_ns;
+};
+
+struct block_stats {
+	unsigned long  blocks, bytes, entries;
+	uint64_t       encode_ns;
+};
+
+struct stats {
+	int                format;
+	uint64_t           read_ns, lex_ns, write_ns, total_ns;
+	unsigned long      lines, tokens, lookups, allocs;
+	struct block_stats block[3];
+	struct file_stats *files;
+	unsigned int       n_files, depth;
+	int                file;    /* file being read, or -1 */
+};
+
+static struct stats stats = { STATS_NONE };
+
+/**
+ * Get the time, if we're keeping statistics. Otherwise, the time
+ * is always 0, so nothing is added up.
+ */
+static uint64_t stats_now(void)
+{
+	return stats.format ? monotime_ns() : 0;
+}
+/* }}} */
+
+/* {{{ Memory map (--map, --device) */
+/**
+ * What a converter has room for: the EEPROM (less the 6 bytes the
+ * firmware keeps for itself), and the RAM free once it's running, as
+ * sctool info reports them.
+ */
+struct device_profile {
+	const char   *name;
+	const char   *desc;
+	unsigned int  eeprom;
+	unsigned int  ram_free;
+};
+
+#define N_DEVICES 2
+static const struct device_profile devices[N_DEVICES] = {
+	{ "teensy2",   "Teensy 2.0",   1024, 2048 },
+	{ "teensy++2", "Teensy++ 2.0", 4096, 7680 }
+};
+
+struct map {
+	int                          enabled;
+	const struct device_profile *device;   /* to enforce, or NULL  */
+	char                       **files;    /* every file read      */
+	unsigned int                 n_files;
+
+	/* Runtime RAM the macros need */
+	unsigned int  max_steps;               /* longest step list    */
+	unsigned int  max_depth;               /* deepest PUSH_META    */
+	const char   *steps_file, *depth_file;
+	int           steps_line, depth_line;
+};
+
+static struct map map = { 0, NULL, NULL, 0, 0, 0, NULL, NULL, 0, 0 };
+/* }}} */
+
 struct pair_list {
 	unsigned short *list;
 	unsigned int len;
@@ -59,6 +143,7 @@ static void pair_list_push(int i, unsigned char a, unsigned char b)
 {
 	unsigned short *new_list;
 
+	++stats.allocs;
 	new_list = realloc(pair_lists[i].list,
 	                   (pair_lists[i].len + 1) * sizeof(unsigned short));
 	if (!new_list) {
@@ -97,6 +182,7 @@ static void macro_list_push(struct macro *mac)
 {
 	struct macro *new_list;
 
+	++stats.allocs;
 	new_list = realloc(macro_list,
 	                   (macro_list_len + 1) * sizeof(struct macro));
 	if (!new_list) {
@@ -116,12 +202,20 @@ static void macro_list_clear(void)
 	for (i = 0; i < macro_list_len; i++)
 		free(macro_list[i].commands.list);
 	free(macro_list);
+	macro_list     = NULL;
 	macro_list_len = 0;
 }
 
 struct block {
 	unsigned char *bytes;
 	unsigned char len;
+
+	/* For the memory map */
+	unsigned char  type, select, set, layer;
+	unsigned short keyboard;
+	unsigned int   entries;
+	const char    *file;
+	int            line;
 };
 
 static struct block *block_list = NULL;
@@ -135,6 +229,8 @@ static unsigned int block_list_len = 0;
 static struct block *block_alloc(void)
 {
 	struct block *block = malloc(sizeof(struct block));
+
+	stats.allocs += 2;
 	if (block) {
 		block->bytes = malloc(255);
 		block->len   = 0;
@@ -151,6 +247,7 @@ static void block_list_append(struct block *block)
 {
 	struct block *new_list;
 
+	++stats.allocs;
 	new_list = realloc(block_list,
 	                   (block_list_len + 1) * sizeof(struct block));
 	if (!new_list) {
@@ -163,13 +260,30 @@ static void block_list_append(struct block *block)
 	++block_list_len;
 }
 
+static void stats_block(struct block *block, unsigned int entries)
+{
+	++stats.block[block_type].blocks;
+	stats.block[block_type].bytes   += block->len;
+	stats.block[block_type].entries += entries;
+
+	block->type     = block_type;
+	block->select   = current_select;
+	block->set      = current_scanset;
+	block->layer    = current_layer;
+	block->keyboard = current_keyboard_id;
+	block->entries  = entries;
+	block->file     = block_file;
+	block->line     = block_line;
+}
+
 #define ERR_FILE_NOT_FOUND	1
 #define ERR_INVALID_COMMAND	2
 #define ERR_INVALID_ARGS	3
 #define ERR_BLOCK_TOO_LARGE	4
 #define ERR_MACRO_TOO_LONG	5
 #define ERR_FILE_WRITE		6
-#define N_ERR_MESSAGES      7
+#define ERR_TOO_BIG			7
+#define N_ERR_MESSAGES      8
 
 static const char *err_messages[N_ERR_MESSAGES] = {
 	"unknown error\n",
@@ -178,7 +292,8 @@ static const char *err_messages[N_ERR_MESSAGES] = {
 	"invalid arguments\n",
 	"block too large\n",
 	"macro too long\n",
-	"unable to open file for writing\n"
+	"unable to open file for writing\n",
+	"the config doesn't fit the device\n"
 };
 
 static void print_error(int err)
@@ -229,6 +344,7 @@ static char *get_token(const char *p)
 	const char *p2;
 	ssize_t len;
 	char *token = NULL;
+	uint64_t start = stats_now();
 
 	if (!p || !*p) goto ret;
 
@@ -239,6 +355,8 @@ static char *get_token(const char *p)
 	len = p2 - p;
 	if (!len) goto ret;
 
+	++stats.tokens;
+	++stats.allocs;
 	token = malloc((size_t)len + 1);
 	if (token) {
 		memcpy(token, p, (size_t)len);
@@ -246,6 +364,7 @@ static char *get_token(const char *p)
 	}
 
 ret:
+	stats.lex_ns += stats_now() - start;
 	return token;
 }
 
@@ -269,6 +388,7 @@ static int parse_hid(const char *p)
 	char *t = get_token(p);
 	if (!t) goto ret;
 
+	++stats.lookups;
 	num = lookup_hid_token_by_name(t);
 	free(t);
 
@@ -294,6 +414,7 @@ static int parse_meta_match(const char *p, int *desired, int *matched)
 
 		t = get_token(p);
 		if (t) {
+			++stats.lookups;
 			meta = lookup_meta_token(t);
 			free(t);
 		} else meta = INVALID_NUMBER;
@@ -333,6 +454,7 @@ static int parse_meta_handed(const char *p)
 	while (*p) {
 		t = get_token(p);
 		if (t) {
+			++stats.lookups;
 			meta = lookup_meta_token(t);
 			free(t);
 		} else meta = INVALID_NUMBER;
@@ -361,6 +483,7 @@ static int parse_macro_cmd(const char *p, unsigned char *cmd,
 
 	t = get_token(p);
 	if (t) {
+		++stats.lookups;
 		c = lookup_macro_token_by_name(t);
 		free(t);
 	}
@@ -375,6 +498,7 @@ static int parse_macro_cmd(const char *p, unsigned char *cmd,
 	if (c == Q_PUSH_META) {
 		t = get_token(p);
 		if (t) {
+			++stats.lookups;
 			q = lookup_macro_token_by_name(t);
 			free(t);
 		} else q = INVALID_NUMBER;
@@ -390,7 +514,10 @@ static int parse_macro_cmd(const char *p, unsigned char *cmd,
 
 	t = get_token(p);
 	switch (get_macro_arg_type(c)) {
-	case MACRO_ARG_HID:   v = lookup_hid_token_by_name(t); break;
+	case MACRO_ARG_HID:
+		++stats.lookups;
+		v = lookup_hid_token_by_name(t);
+	break;
 	case MACRO_ARG_META:  v = parse_meta_handed(p);        break;
 	case MACRO_ARG_DELAY: v = parse_int(t, 0, 255);        break;
 	case MACRO_ARG_NONE:  v = 0;                           break;
@@ -424,6 +551,7 @@ static int parse_single_set(const char *p)
 	char *t = get_token(p);
 
 	if (t) {
+		++stats.lookups;
 		s = lookup_set_token(t);
 		free(t);
 	}
@@ -439,6 +567,7 @@ static int parse_multi_set(const char *p)
 	while (p && *p) {
 		t = get_token(p);
 		if (t) {
+			++stats.lookups;
 			s = lookup_set_token(t);
 			free(t);
 
@@ -610,6 +739,7 @@ static int cmd_macro(const char *args)
 	int hid_code, desired_meta, matched_meta, ret = ERR_INVALID_ARGS;
 	char *t = get_token(args);
 
+	++stats.lookups;
 	hid_code = lookup_hid_token_by_name(t);
 	if (hid_code == INVALID_NUMBER) goto ret;
 
@@ -617,6 +747,8 @@ static int cmd_macro(const char *args)
 		goto ret;
 
 	ret = 0;
+	macro_file = current_file;
+	macro_line = current_line;
 	current_macro_phase = 0;
 	current_macro_release_meta = 1;
 	current_hid_code     = (unsigned char)hid_code;
@@ -663,6 +795,39 @@ static int cmd_macrostep(const char *args)
 	return ret;
 }
 
+/**
+ * Note what the macro being ended needs at runtime: its longest list
+ * of steps is queued, and its PUSH_METAs can nest.
+ */
+static void map_macro(void)
+{
+	const struct pair_list *l;
+	unsigned int i, j, depth = 0, cmd, op;
+
+	for (i = PRESS_MCMD_LIST; i <= RELEASE_MCMD_LIST; i++) {
+		l = &pair_lists[i];
+		if (l->len > map.max_steps) {
+			map.max_steps  = l->len;
+			map.steps_file = macro_file;
+			map.steps_line = macro_line;
+		}
+
+		for (j = 0; j < l->len; j++) {
+			cmd = l->list[j] >> 8;
+			op  = cmd & ~(unsigned int)Q_PUSH_META;
+			if (cmd & Q_PUSH_META) ++depth;
+			if (op == Q_POP_ALL_META) depth = 0;
+			else if (op == Q_POP_META && depth) --depth;
+
+			if (depth > map.max_depth) {
+				map.max_depth  = depth;
+				map.depth_file = macro_file;
+				map.depth_line = macro_line;
+			}
+		}
+	}
+}
+
 static int cmd_endmacro(const char *args)
 {
 	int ret = ERR_INVALID_COMMAND;
@@ -686,6 +851,7 @@ static int cmd_endmacro(const char *args)
 		goto ret;
 	}
 
+	++stats.allocs;
 	mac.commands.list = malloc((pair_lists[PRESS_MCMD_LIST].len +
 	                            pair_lists[RELEASE_MCMD_LIST].len)
 	                            * sizeof(unsigned short));
@@ -699,6 +865,7 @@ static int cmd_endmacro(const char *args)
 	memcpy(mac.commands.list + i, pair_lists[RELEASE_MCMD_LIST].list,
 	       (mac.release_flags & 0x3f) * sizeof(unsigned short));
 	mac.commands.len = i + pair_lists[RELEASE_MCMD_LIST].len;
+	map_macro();
 
 	ret = 0;
 	pair_list_clear(PRESS_MCMD_LIST);
@@ -716,6 +883,8 @@ static int cmd_layerdefblock(const char *args)
 	if (block_type != BLOCK_NONE)
 		return ERR_INVALID_COMMAND;
 	block_type = BLOCK_LAYERDEF;
+	block_file = current_file;
+	block_line = current_line;
 	return 0;
 }
 
@@ -726,6 +895,8 @@ static int cmd_remapblock(const char *args)
 	if (block_type != BLOCK_NONE)
 		return ERR_INVALID_COMMAND;
 	block_type = BLOCK_REMAP;
+	block_file = current_file;
+	block_line = current_line;
 	return 0;
 }
 
@@ -736,6 +907,8 @@ static int cmd_macroblock(const char *args)
 	if (block_type != BLOCK_NONE)
 		return ERR_INVALID_COMMAND;
 	block_type = BLOCK_MACRO;
+	block_file = current_file;
+	block_line = current_line;
 	return 0;
 }
 
@@ -804,6 +977,7 @@ static int cmd_endlayerdefblock(const char *args)
 	}
 
 	block->bytes[0] = block->len;
+	stats_block(block, pair_lists[LAYERDEF_LIST].len);
 	block_list_append(block);
 	free(block);
 	pair_list_clear(LAYERDEF_LIST);
@@ -835,6 +1009,7 @@ static int cmd_endremapblock(const char *args)
 	}
 
 	block->bytes[0] = block->len;
+	stats_block(block, pair_lists[REMAP_LIST].len);
 	block_list_append(block);
 	free(block);
 	pair_list_clear(REMAP_LIST);
@@ -873,6 +1048,7 @@ static int cmd_endmacroblock(const char *args)
 	}
 
 	block->bytes[0] = block->len;
+	stats_block(block, macro_list_len);
 	block_list_append(block);
 	free(block);
 	macro_list_clear();
@@ -886,6 +1062,8 @@ ret:
 static int cmd_endblock(const char *args)
 {
 	int ret = ERR_INVALID_COMMAND;
+	unsigned char type = block_type;
+	uint64_t start = stats_now();
 
 	switch (block_type) {
 	case BLOCK_LAYERDEF: ret = cmd_endlayerdefblock(args); break;
@@ -893,6 +1071,7 @@ static int cmd_endblock(const char *args)
 	case BLOCK_MACRO:    ret = cmd_endmacroblock(args);    break;
 	}
 
+	if (!ret) stats.block[type].encode_ns += stats_now() - start;
 	return ret;
 }
 
@@ -923,6 +1102,7 @@ static command_fn find_command(const char *cmd)
 {
 	int i;
 
+	++stats.lookups;
 	for (i = 0; i < N_COMMANDS; i++) {
 		if (!strcmp(cmd, command_map[i].cmd))
 			return command_map[i].fn;
@@ -951,20 +1131,92 @@ static int process_line(char *linebuf)
 	return ret;
 }
 
+/* {{{ Per-file statistics */
+/**
+ * Start keeping statistics for a file, included from the one being
+ * read (if any.)
+ *
+ * \return its index, or -1 if we aren't keeping them.
+ */
+static int stats_file_begin(const char *fname)
+{
+	struct file_stats *files, *f;
+
+	if (!stats.format) return -1;
+	files = realloc(stats.files, (stats.n_files + 1) * sizeof(*files));
+	if (!files) return -1;
+
+	stats.files = files;
+	f = &files[stats.n_files];
+	memset(f, 0, sizeof(*f));
+	if ((f->name = malloc(strlen(fname) + 1)))
+		strcpy(f->name, fname);
+	f->depth    = stats.depth++;
+	f->parent   = stats.file;
+	stats.file  = (int)stats.n_files;
+	return (int)stats.n_files++;
+}
+
+static void stats_file_end(int file, unsigned long lines, uint64_t start)
+{
+	struct file_stats *f;
+
+	if (file < 0) return;
+	f        = &stats.files[file];
+	f->lines = lines;
+	f->ns    = stats_now() - start;
+	if (f->parent >= 0)
+		stats.files[f->parent].child_ns += f->ns;
+	stats.file = f->parent;
+	--stats.depth;
+	stats.lines += lines;
+}
+
+static char *read_line(char *buf, int size, FILE *fp)
+{
+	uint64_t start = stats_now();
+	char *s = fgets(buf, size, fp);
+
+	stats.read_ns += stats_now() - start;
+	return s;
+}
+/* }}} */
+
+/**
+ * Keep a file's name, for the memory map.
+ */
+static const char *map_file(const char *fname)
+{
+	char **files, *name;
+
+	if (!map.enabled) return NULL;
+	files = realloc(map.files, (map.n_files + 1) * sizeof(*files));
+	if (!files) return NULL;
+
+	map.files = files;
+	if ((name = malloc(strlen(fname) + 1)))
+		strcpy(name, fname);
+	return files[map.n_files++] = name;
+}
+
 static int process_file(const char *fname)
 {
 	FILE *fp;
-	int linenum = 0, err = 0;
+	int linenum = 0, err = 0, file, parent_line = current_line;
+	const char *parent = current_file;
 	char linebuf[256];
+	uint64_t start = stats_now();
 
+	file = stats_file_begin(fname);
 	fp = fopen(fname, "r");
 	if (!fp) {
 		err = ERR_FILE_NOT_FOUND;
 		goto ret;
 	}
 
-	while (fgets(linebuf, sizeof(linebuf), fp)) {
-		++linenum;
+	current_file = map_file(fname);
+	while (read_line(linebuf, sizeof(linebuf), fp)) {
+		current_line = ++linenum;
 		err = process_line(linebuf);
 		if (err) {
 			fprintf(stderr, "error at line %d: ", linenum);
@@ -974,6 +1226,9 @@ static int process_file(const char *fname)
 
 ret:
 	if (fp) fclose(fp);
+	stats_file_end(file, (unsigned long)linenum, start);
+	current_file = parent;
+	current_line = parent_line;
 	return err;
 }
 
@@ -1008,19 +1263,327 @@ ret:
 	return err;
 }
 
+/* {{{ print_stats */
+static const char *block_names[3] = {
+	"layerblock", "remapblock", "macroblock"
+};
+
+static double ms(uint64_t ns)
+{
+	return (double)ns / NS_PER_MS;
+}
+
+static void put_json_string(FILE *fp, const char *s)
+{
+	fputc('"', fp);
+	for (; s && *s; s++) {
+		if (*s == '"' || *s == '\\') fprintf(fp, "\\%c", *s);
+		else if ((unsigned char)*s < 0x20) fprintf(fp, "\\u%04x", *s);
+		else fputc(*s, fp);
+	}
+	fputc('"', fp);
+}
+
+static void print_stats_text(FILE *fp, uint64_t encode_ns, uint64_t parse_ns)
+{
+	const struct file_stats *f;
+	const struct block_stats *b;
+	unsigned long blocks = 0, bytes = 6;
+	unsigned int i;
+
+	fprintf(fp, "\nPhase              Time (ms)\n"
+	        "  read            %10.3f\n"
+	        "  lex             %10.3f\n"
+	        "  parse           %10.3f\n"
+	        "  encode          %10.3f\n",
+	        ms(stats.read_ns), ms(stats.lex_ns), ms(parse_ns), ms(encode_ns));
+	for (i = 0; i < 3; i++)
+		fprintf(fp, "    %-12s  %10.3f\n", block_names[i],
+		        ms(stats.block[i].encode_ns));
+	fprintf(fp, "  write           %10.3f\n"
+	        "  total           %10.3f\n",
+	        ms(stats.write_ns), ms(stats.total_ns));
+
+	fputs("\n   Lines   Time (ms)   Self (ms)  File\n", fp);
+	for (i = 0; i < stats.n_files; i++) {
+		f = &stats.files[i];
+		fprintf(fp, "%8lu  %10.3f  %10.3f  %*s%s\n", f->lines, ms(f->ns),
+		        ms(f->ns - f->child_ns), (int)(2 * f->depth), "",
+		        f->name ? f->name : "?");
+	}
+
+	fputs("\nBlocks           Count     Bytes   Entries\n", fp);
+	for (i = 0; i < 3; i++) {
+		b = &stats.block[i];
+		fprintf(fp, "  %-12s %7lu %9lu %9lu\n", block_names[i],
+		        b->blocks, b->bytes, b->entries);
+		blocks += b->blocks;
+		bytes  += b->bytes;
+	}
+	fprintf(fp, "  %-12s %7lu %9lu\n", "total", blocks, bytes);
+
+	fprintf(fp, "\nLines: %lu, tokens: %lu, lookups: %lu, "
+	        "allocations: %lu\n", stats.lines, stats.tokens,
+	        stats.lookups, stats.allocs);
+}
+
+static void print_stats_json(FILE *fp, uint64_t encode_ns, uint64_t parse_ns)
+{
+	const struct file_stats *f;
+	const struct block_stats *b;
+	unsigned long bytes = 6;
+	unsigned int i;
+
+	fprintf(fp, "{\"time_ns\":{\"read\":%lu,\"lex\":%lu,\"parse\":%lu,"
+	        "\"encode\":%lu,\"write\":%lu,\"total\":%lu},\"files\":[",
+	        (unsigned long)stats.read_ns, (unsigned long)stats.lex_ns,
+	        (unsigned long)parse_ns, (unsigned long)encode_ns,
+	        (unsigned long)stats.write_ns, (unsigned long)stats.total_ns);
+
+	for (i = 0; i < stats.n_files; i++) {
+		f = &stats.files[i];
+		fprintf(fp, "%s{\"name\":", i ? "," : "");
+		put_json_string(fp, f->name);
+		fprintf(fp, ",\"depth\":%u,\"lines\":%lu,\"time_ns\":%lu,"
+		        "\"self_ns\":%lu}", f->depth, f->lines, (unsigned long)f->ns,
+		        (unsigned long)(f->ns - f->child_ns));
+	}
+
+	fputs("],\"blocks\":{", fp);
+	for (i = 0; i < 3; i++) {
+		b = &stats.block[i];
+		fprintf(fp, "%s\"%s\":{\"count\":%lu,\"bytes\":%lu,"
+		        "\"entries\":%lu,\"encode_ns\":%lu}", i ? "," : "",
+		        block_names[i], b->blocks, b->bytes, b->entries,
+		        (unsigned long)b->encode_ns);
+		bytes += b->bytes;
+	}
+
+	fprintf(fp, "},\"bytes\":%lu,\"lines\":%lu,\"tokens\":%lu,"
+	        "\"lookups\":%lu,\"allocations\":%lu}\n", bytes, stats.lines,
+	        stats.tokens, stats.lookups, stats.allocs);
+}
+
+/**
+ * Print the statistics, and free the per-file ones.
+ *
+ * \return 0 on success, ERR_FILE_WRITE if they couldn't be written.
+ */
+static int print_stats(const char *path)
+{
+	FILE *fp = stderr;
+	uint64_t encode_ns = 0, parse_ns;
+	unsigned int i;
+	int err = 0;
+
+	for (i = 0; i < 3; i++)
+		encode_ns += stats.block[i].encode_ns;
+
+	/* Parsing is whatever's left */
+	parse_ns = stats.total_ns - stats.read_ns - stats.lex_ns - encode_ns -
+	           stats.write_ns;
+	if (parse_ns > stats.total_ns) parse_ns = 0;
+
+	if (path && !(fp = fopen(path, "w"))) {
+		err = ERR_FILE_WRITE;
+		goto ret;
+	}
+
+	if (stats.format == STATS_JSON)
+		print_stats_json(fp, encode_ns, parse_ns);
+	else print_stats_text(fp, encode_ns, parse_ns);
+
+	if (fp != stderr && fclose(fp))
+		err = ERR_FILE_WRITE;
+
+ret:
+	for (i = 0; i < stats.n_files; i++)
+		free(stats.files[i].name);
+	free(stats.files);
+	return err;
+}
+/* }}} */
+
+/* {{{ print_map */
+static const char *set_names[4] = { "set1", "set2", "set3", "set2ext" };
+
+/* Bytes in the image, with its header */
+static unsigned long image_size(void)
+{
+	unsigned long bytes = 6;
+	unsigned int i;
+
+	for (i = 0; i < block_list_len; i++)
+		bytes += block_list[i].len;
+	return bytes;
+}
+
+/* Bytes of RAM the macros are estimated to need */
+static unsigned int ram_needed(void)
+{
+	return 2 * map.max_steps + map.max_depth;
+}
+
+static void put_sets(char *buf, unsigned char set)
+{
+	size_t len = 0;
+	int i;
+
+	strcpy(buf, "any");
+	for (i = 0; i < 4; i++) {
+		if (set & (1 << i))
+			len += (size_t)sprintf(buf + len, "%s%s", len ? "," : "",
+			                       set_names[i]);
+	}
+}
+
+static void put_source(FILE *fp, const char *file, int line)
+{
+	if (file) fprintf(fp, "%s:%d", file, line);
+	else fputc('-', fp);
+}
+
+/**
+ * Print where everything is in the image, and what it needs from each
+ * device.
+ */
+static void print_map(FILE *fp, const char *target)
+{
+	const struct block *b;
+	const struct device_profile *d;
+	unsigned long offset = 6, size = image_size(), used, bytes[3];
+	unsigned int i, ram = ram_needed();
+	char sets[32];
+
+	fprintf(fp, "\nMemory map of %s (%lu bytes)\n\n"
+	        "  Offset   Size  Type        Layer  Select  Set           "
+	        "Keyboard  Entries  Source\n"
+	        "       0      6  header\n", target, size);
+
+	memset(bytes, 0, sizeof(bytes));
+	for (i = 0; i < block_list_len; i++) {
+		b = &block_list[i];
+		put_sets(sets, b->set);
+		fprintf(fp, "%8lu %6u  %-10s  ", offset, b->len,
+		        b->type < 3 ? block_names[b->type] : "?");
+		if (b->type == BLOCK_REMAP) fprintf(fp, "%5u  ", b->layer);
+		else fputs("    -  ", fp);
+		if (b->select) fprintf(fp, "%-6u  ", b->select);
+		else fputs("any     ", fp);
+		fprintf(fp, "%-12s  ", sets);
+		if (b->keyboard) fprintf(fp, "%04X    ", b->keyboard);
+		else fputs("any     ", fp);
+		fprintf(fp, "%9u  ", b->entries);
+		put_source(fp, b->file, b->line);
+		fputc('\n', fp);
+
+		offset += b->len;
+		if (b->type < 3) bytes[b->type] += b->len;
+	}
+
+	fprintf(fp, "\nTotal: %lu bytes (header 6", size);
+	for (i = 0; i < 3; i++)
+		fprintf(fp, ", %s %lu", block_names[i], bytes[i]);
+
+	fprintf(fp, ")\n\nRuntime RAM (estimated): %u bytes\n"
+	        "  macro queue  %4u  (%u steps, 2 bytes each, at ", ram,
+	        2 * map.max_steps, map.max_steps);
+	put_source(fp, map.steps_file, map.steps_line);
+	fprintf(fp, ")\n  meta stack   %4u  (PUSH_META %u deep, at ",
+	        map.max_depth, map.max_depth);
+	put_source(fp, map.depth_file, map.depth_line);
+
+	fputs(")\n\nDevice        EEPROM used            RAM needed\n", fp);
+	used = size - 2;
+	for (i = 0; i < N_DEVICES; i++) {
+		d = &devices[i];
+		fprintf(fp, "%-12s  %5lu of %5u %5.1f%%  %5u of %5u %5.1f%%%s\n",
+		        d->name, used, d->eeprom - 6,
+		        100.0 * (double)used / (d->eeprom - 6), ram, d->ram_free,
+		        100.0 * ram / d->ram_free,
+		        used > d->eeprom - 6 || ram > d->ram_free ?
+		        "  doesn't fit" : "");
+	}
+}
+/* }}} */
+
+/**
+ * Check the config fits the device given with --device: it would be
+ * refused by sctool write if it's too big for the EEPROM.
+ */
+static int check_device(void)
+{
+	const struct device_profile *d = map.device;
+	unsigned long used = image_size() - 2;
+
+	if (!d) return 0;
+	if (used > d->eeprom - 6) {
+		fprintf(stderr, "The config is %lu bytes, but the %s's EEPROM "
+		        "holds %u.\n", used, d->desc, d->eeprom - 6);
+		return ERR_TOO_BIG;
+	}
+
+	if (ram_needed() > d->ram_free) {
+		fprintf(stderr, "The macros need about %u bytes of RAM, but the "
+		        "%s has %u free.\n", ram_needed(), d->desc, d->ram_free);
+		return ERR_TOO_BIG;
+	}
+
+	return 0;
+}
+
+static const struct device_profile *find_device(const char *name)
+{
+	int i;
+
+	for (i = 0; i < N_DEVICES; i++) {
+		if (!strcmp(name, devices[i].name))
+			return &devices[i];
+	}
+
+	fprintf(stderr, "%s: unknown device (teensy2 or teensy++2)\n", name);
+	return NULL;
+}
+
 int main(int argc, char *argv[])
 {
-	int err = EXIT_SUCCESS, i;
+	int err = EXIT_SUCCESS, i, first;
 	unsigned int j;
+	const char *stats_path = NULL;
+	uint64_t start, t;
 	puts("scas v1.10");
 
-	if (argc < 3) {
-		fputs("usage: scas <text_config> "
-		      "[<text_config> ...] <binary_config>\n", stderr);
+	stats.file = -1;
+	for (first = 1; first < argc && !strncmp(argv[first], "--", 2);
+	     first++) {
+		if (!strcmp(argv[first], "--stats") ||
+		    !strcmp(argv[first], "--stats=text"))
+			stats.format = STATS_TEXT;
+		else if (!strcmp(argv[first], "--stats=json"))
+			stats.format = STATS_JSON;
+		else if (!strcmp(argv[first], "--stats-output") &&
+		         first + 1 < argc)
+			stats_path = argv[++first];
+		else if (!strcmp(argv[first], "--map"))
+			map.enabled = 1;
+		else if (!strcmp(argv[first], "--device") && first + 1 < argc) {
+			if (!(map.device = find_device(argv[++first]))) {
+				err = EXIT_FAILURE;
+				goto ret;
+			}
+		} else break;
+	}
+
+	if (argc - first < 2 || !strncmp(argv[first], "--", 2)) {
+		fputs("usage: scas [--stats[=text|json]] [--stats-output <file>]\n"
+		      "            [--map] [--device teensy2|teensy++2]\n"
+		      "            <text_config> [<text_config> ...] "
+		      "<binary_config>\n", stderr);
 		goto ret;
 	}
 
-	for (i = 1; i < argc - 1; i++) {
+	start = stats_now();
+	for (i = first; i < argc - 1; i++) {
 		err = process_file(argv[i]);
 		if (err) {
 			print_error(err);
@@ -1028,6 +1591,13 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	/* Don't write what the device can't take */
+	if ((err = check_device())) {
+		print_error(err);
+		goto ret;
+	}
+
+	t   = stats_now();
 	err = write_target(argv[argc - 1]);
 	if (err) {
 		fprintf(stderr, "unable to write to file: %s\n",
@@ -1035,12 +1605,25 @@ int main(int argc, char *argv[])
 		goto ret;
 	}
 
+	stats.write_ns = stats_now() - t;
+	stats.total_ns = stats_now() - start;
 	fprintf(stderr, "No errors. Wrote: %s\n", argv[argc - 1]);
 
+	if (stats.format && (err = print_stats(stats_path))) {
+		fprintf(stderr, "unable to write the statistics to: %s\n",
+		        stats_path);
+		goto ret;
+	}
+
+	if (map.enabled)
+		print_map(stdout, argv[argc - 1]);
+
 ret:
 	for (j = 0; j < block_list_len; j++)
 		free(block_list[j].bytes);
 	free(block_list);
+	for (j = 0; j < map.n_files; j++)
+		free(map.files[j]);
+	free(map.files);
 	return err == EXIT_SUCCESS ? err : EXIT_FAILURE;
 }
-
@@ -0,0 +1,977 @@
+/**
+ * sctools: Benchmarks
+ * Copyright (C) 2016 Tim Hentenaar.
+ *
+ * This code is licenced under the Simplified BSD License.
+ * See the LICENSE file for details.
+ *
+ * Times the hot paths of each tool: token lookup, scas's lexer and
+ * block encoder, scdis's rendering, and decoding listen streams and
+ * scancodes (microbenchmarks); and assembling and disassembling the
+ * example configs, and synthetic ones scaled up from them, and writing
+ * and reading a config over the emulated converter (macrobenchmarks).
+ *
+ * Each benchmark is run for long enough to time reliably, then
+ * repeated, and the median time per iteration is reported as JSON.
+ * Given a baseline from an earlier run, each is compared against it,
+ * and any that got slower by more than the threshold fail the run.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <dirent.h>
+
+#include "bench.h"
+#include "commands.h"
+#include "config.h"
+#include "hid_tokens.h"
+#include "listen.h"
+#include "macro_tokens.h"
+#include "monotime.h"
+#include "scancode.h"
+#include "sim.h"
+#include "transport.h"
+
+#define BENCH_VERSION     1
+#define DEFAULT_MIN_MS    100
+#define DEFAULT_REPEAT    5
+#define DEFAULT_THRESHOLD 10.0
+#define MAX_REPEAT        64
+#define MAX_CONFIGS       64
+#define STREAM_LEN        65536
+
+struct bench {
+	const char *name;
+	const char *unit;  /* what one iteration does */
+	int       (*setup)(struct bench *b);
+	int       (*run)(unsigned long n);
+	size_t      bytes; /* per iteration, if it makes sense */
+	int         scale; /* for the synthetic configs        */
+};
+
+struct result {
+	const struct bench *b;
+	unsigned long       iterations;
+	double              ns_per_op, min_ns_per_op;
+	double              baseline;  /* ns per op, or 0 */
+};
+
+struct options {
+	unsigned int  min_ms, repeat;
+	double        threshold;
+	const char   *configs, *baseline, *output, *filter;
+};
+
+static const char *usage =
+	"usage: scbench [options]\n\n"
+	"  Options:\n"
+	"    --configs <dir>      Directory of .sc files (default: configs)\n"
+	"    --output <file>      Write the results there (default: stdout)\n"
+	"    --baseline <file>    Compare against the results of a past run\n"
+	"    --threshold <pct>    Slowdown that fails the run (default 10)\n"
+	"    --filter <text>      Only run benchmarks whose names contain it\n"
+	"    --time <ms>          Minimum time per run (default 100)\n"
+	"    --repeat <n>         Runs of each benchmark (default 5)\n";
+
+/* Keeps the compiler from optimizing the work away */
+static volatile unsigned long sink;
+static FILE *devnull;
+
+/* {{{ Text */
+/**
+ * A config's text, one line after another.
+ */
+struct text {
+	char   *buf;
+	size_t  len, size;
+	size_t  lines;
+};
+
+static int text_add(struct text *t, const char *line)
+{
+	size_t n = strlen(line) + 1;
+	char *tmp;
+
+	if (t->len + n > t->size) {
+		t->size = t->size ? 2 * t->size : 4096;
+		while (t->len + n > t->size) t->size *= 2;
+		if (!(tmp = realloc(t->buf, t->size))) {
+			fputs("Unable to allocate memory for the text\n", stderr);
+			return -1;
+		}
+		t->buf = tmp;
+	}
+
+	memcpy(t->buf + t->len, line, n);
+	t->len += n;
+	t->lines++;
+	return 0;
+}
+
+static int assemble_text(const struct text *t)
+{
+	const char *p;
+	int err = 0;
+
+	for (p = t->buf; p < t->buf + t->len; p += strlen(p) + 1) {
+		if ((err = bench_scas_line(p))) {
+			fprintf(stderr, "scas: error %d on '%s'\n", err, p);
+			break;
+		}
+	}
+
+	return err;
+}
+/* }}} */
+
+/* {{{ Synthetic configs */
+/* HID codes which have names, to remap and make macros for */
+static unsigned char keys[256];
+static unsigned int n_keys;
+
+static void find_keys(void)
+{
+	unsigned int i;
+
+	for (i = 0x04, n_keys = 0; i < 0xa5; i++) {
+		if (lookup_hid_token_by_value((int)i))
+			keys[n_keys++] = (unsigned char)i;
+	}
+}
+
+#define key(i) lookup_hid_token_by_value(keys[(unsigned int)(i) % n_keys])
+
+/**
+ * Generate a config: a layerblock for FN1..FN8, then for each unit of
+ * scale, a block of 60 remaps for each of the 8 layers, and a block of
+ * 12 macros of 4 steps each, each under one of the selects in turn.
+ */
+static int generate(struct text *t, int scale)
+{
+	char line[128];
+	int s, l, i, ok = 0;
+
+	memset(t, 0, sizeof(*t));
+	ok |= text_add(t, "layerblock");
+	for (l = 1; l <= 8; l++) {
+		sprintf(line, "\tFN%d %d", l, l);
+		ok |= text_add(t, line);
+	}
+	ok |= text_add(t, "endblock");
+
+	for (s = 0; s < scale; s++) {
+		if (s % 8) sprintf(line, "ifselect %d", s % 8);
+		else strcpy(line, "ifselect any");
+		ok |= text_add(t, line);
+
+		for (l = 0; l <= 8; l++) {
+			ok |= text_add(t, "remapblock");
+			sprintf(line, "layer %d", l);
+			ok |= text_add(t, line);
+			for (i = 0; i < 60; i++) {
+				sprintf(line, "\t%s %s", key(i + s), key(i + s + l + 1));
+				ok |= text_add(t, line);
+			}
+			ok |= text_add(t, "endblock");
+		}
+
+		ok |= text_add(t, "macroblock");
+		for (i = 0; i < 12; i++) {
+			sprintf(line, "macro %s %s", key(i + s),
+			        i % 2 ? "CTRL" : "-LSHIFT RALT");
+			ok |= text_add(t, line);
+			ok |= text_add(t, "\tPUSH_META CLEAR_META ALL");
+			sprintf(line, "\tPRESS %s", key(i + s + 7));
+			ok |= text_add(t, line);
+			ok |= text_add(t, "\tDELAY 10");
+			ok |= text_add(t, "\tPOP_META");
+			ok |= text_add(t, "endmacro");
+		}
+		ok |= text_add(t, "endblock");
+	}
+
+	return ok;
+}
+/* }}} */
+
+/* {{{ Microbenchmarks */
+static const char *hid_names[256], *macro_names[32];
+static unsigned int n_hid_names, n_macro_names;
+
+static int setup_tokens(struct bench *b)
+{
+	const char *name;
+	int i;
+
+	(void)b;
+	for (i = 0, n_hid_names = 0; i < 256; i++) {
+		if ((name = lookup_hid_token_by_value(i)))
+			hid_names[n_hid_names++] = name;
+	}
+
+	for (i = 0, n_macro_names = 0; i < 32; i++) {
+		if ((name = lookup_macro_token_by_value(i)))
+			macro_names[n_macro_names++] = name;
+	}
+
+	return n_hid_names && n_macro_names ? 0 : -1;
+}
+
+static int run_hid_by_name(unsigned long n)
+{
+	unsigned long i;
+
+	for (i = 0; i < n; i++)
+		sink += (unsigned long)lookup_hid_token_by_name(
+			hid_names[i % n_hid_names]);
+	return 0;
+}
+
+static int run_hid_by_value(unsigned long n)
+{
+	const char *name;
+	unsigned long i;
+
+	for (i = 0; i < n; i++) {
+		if ((name = lookup_hid_token_by_value((int)(i & 0xff))))
+			sink += (unsigned char)*name;
+	}
+
+	return 0;
+}
+
+static int run_macro_by_name(unsigned long n)
+{
+	unsigned long i;
+
+	for (i = 0; i < n; i++)
+		sink += (unsigned long)lookup_macro_token_by_name(
+			macro_names[i % n_macro_names]);
+	return 0;
+}
+
+static const char *lex_line =
+	"\tPUSH_META CLEAR_META \"LCTRL\" PRESS PAD_ASTERIX # comment";
+
+static int setup_lex(struct bench *b)
+{
+	b->bytes = strlen(lex_line);
+	return 0;
+}
+
+static int run_lex(unsigned long n)
+{
+	unsigned long i;
+
+	for (i = 0; i < n; i++)
+		sink += bench_scas_lex(lex_line);
+	return 0;
+}
+
+static struct text block_text;
+
+static int setup_remap_block(struct bench *b)
+{
+	char line[64];
+	unsigned int i;
+
+	free(block_text.buf);
+	memset(&block_text, 0, sizeof(block_text));
+	text_add(&block_text, "remapblock");
+	text_add(&block_text, "layer 1");
+	for (i = 0; i < 120; i++) {
+		sprintf(line, "\t%s %s", key(i), key(i + 1));
+		text_add(&block_text, line);
+	}
+
+	b->bytes = block_text.len;
+	return text_add(&block_text, "endblock");
+}
+
+static int setup_macro_block(struct bench *b)
+{
+	char line[64];
+	unsigned int i;
+
+	free(block_text.buf);
+	memset(&block_text, 0, sizeof(block_text));
+	text_add(&block_text, "macroblock");
+	for (i = 0; i < 12; i++) {
+		sprintf(line, "macro %s SHIFT -LCTRL", key(i));
+		text_add(&block_text, line);
+		text_add(&block_text, "\tPUSH_META CLEAR_META SHIFT");
+		sprintf(line, "\tPRESS %s", key(i + 1));
+		text_add(&block_text, line);
+		text_add(&block_text, "\tPOP_META");
+		text_add(&block_text, "onbreak norestoremeta");
+		text_add(&block_text, "\tBREAK LSHIFT");
+		text_add(&block_text, "endmacro");
+	}
+
+	b->bytes = block_text.len;
+	return text_add(&block_text, "endblock");
+}
+
+static int run_encode_block(unsigned long n)
+{
+	unsigned long i;
+
+	for (i = 0; i < n; i++) {
+		if (assemble_text(&block_text))
+			return -1;
+		bench_scas_reset();
+	}
+
+	return 0;
+}
+
+/* The synthetic config at scale 1, assembled */
+static unsigned char *image1;
+static size_t image1_len;
+
+static int setup_image1(struct bench *b)
+{
+	struct text t;
+	int err;
+
+	if (image1) goto ret;
+	if (generate(&t, 1)) return -1;
+	err = assemble_text(&t);
+	free(t.buf);
+
+	if (err || bench_scas_image(&image1, &image1_len))
+		return -1;
+	bench_scas_reset();
+
+ret:
+	b->bytes = image1_len;
+	return 0;
+}
+
+static int run_scdis_render(unsigned long n)
+{
+	unsigned long i;
+
+	for (i = 0; i < n; i++) {
+		if (bench_scdis(image1, image1_len, devnull))
+			return -1;
+	}
+
+	return 0;
+}
+
+static unsigned char stream[STREAM_LEN];
+static size_t stream_len;
+static struct listen_decoder listen_dec;
+
+/* What the converter sends for each key: the scancodes, and HID code */
+static int setup_listen(struct bench *b)
+{
+	char ev[32];
+	size_t n;
+	unsigned int i;
+
+	for (i = 0, stream_len = 0; stream_len < STREAM_LEN - sizeof(ev); i++) {
+		n = (size_t)sprintf(ev, "r%02X +%02X rF0 r%02X -%02X ",
+		                    (i * 7) & 0x7f, keys[i % n_keys],
+		                    (i * 7) & 0x7f, keys[i % n_keys]);
+		memcpy(stream + stream_len, ev, n);
+		stream_len += n;
+	}
+
+	b->bytes = stream_len;
+	return 0;
+}
+
+static int run_listen(unsigned long n)
+{
+	unsigned long i;
+
+	listen_init(&listen_dec, LISTEN_DECODED, devnull, 0);
+	for (i = 0; i < n; i++)
+		listen_decode(&listen_dec, 0, stream, stream_len, i);
+	return listen_flush(&listen_dec);
+}
+
+/* Set 2: makes and breaks, some of them extended */
+static const unsigned char set2_keys[] = {
+	0x1c, 0x32, 0x21, 0x23, 0x24, 0x2b, 0x34, 0x33, 0x43, 0x3b, 0x42,
+	0x4b, 0x3a, 0x31, 0x44, 0x4d, 0x15, 0x2d, 0x1b, 0x2c, 0x3c, 0x2a
+};
+
+static int setup_scancode(struct bench *b)
+{
+	unsigned int i;
+
+	(void)b;
+	for (i = 0, stream_len = 0; stream_len < STREAM_LEN - 5; i++) {
+		if (i % 4 == 3) stream[stream_len++] = 0xe0;
+		stream[stream_len++] = set2_keys[i % sizeof(set2_keys)];
+		if (i % 4 == 3) stream[stream_len++] = 0xe0;
+		stream[stream_len++] = 0xf0;
+		stream[stream_len++] = set2_keys[i % sizeof(set2_keys)];
+	}
+
+	return 0;
+}
+
+static int run_scancode(unsigned long n)
+{
+	struct scancode_decoder sc;
+	unsigned long i;
+
+	scancode_init(&sc, scancode_set_by_name("2"));
+	for (i = 0; i < n; i++)
+		sink += (unsigned long)scancode_feed(&sc, stream[i % stream_len], i);
+	return 0;
+}
+
+static struct sc_config sim_cfg;
+static struct sim sim;
+
+static int setup_sim(struct bench *b)
+{
+	if (setup_image1(b))
+		return -1;
+
+	b->bytes = 0;
+	sc_config_free(&sim_cfg);
+	sim_free(&sim);
+	if (sc_config_parse(&sim_cfg, image1, image1_len))
+		return -1;
+	return sim_init(&sim, &sim_cfg, SC_SET2, -1);
+}
+
+static int run_sim(unsigned long n)
+{
+	unsigned long i;
+
+	for (i = 0; i < n; i++)
+		sim_key(&sim, keys[(i / 2) % n_keys], !(i & 1), i);
+	sink += sim.stats.out;
+	return 0;
+}
+/* }}} */
+
+/* {{{ Macrobenchmarks */
+static char *config_names[MAX_CONFIGS];
+static unsigned char *config_images[MAX_CONFIGS];
+static size_t config_lens[MAX_CONFIGS];
+static unsigned int n_configs;
+
+static int by_name(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/**
+ * Find the .sc files in the configs directory (the current one), and
+ * assemble each of them once, to find the ones that assemble.
+ */
+static int setup_configs(struct bench *b)
+{
+	DIR *dir;
+	struct dirent *ent;
+	FILE *fp;
+	size_t len;
+	unsigned int i, n = 0;
+
+	if (n_configs) goto ret;
+	if (!(dir = opendir("."))) {
+		fputs("Unable to open the configs directory\n", stderr);
+		return -1;
+	}
+
+	while ((ent = readdir(dir)) && n < MAX_CONFIGS) {
+		len = strlen(ent->d_name);
+		if (len < 4 || strcmp(ent->d_name + len - 3, ".sc")) continue;
+		if (!(config_names[n] = malloc(len + 1))) break;
+		strcpy(config_names[n++], ent->d_name);
+	}
+
+	closedir(dir);
+	qsort(config_names, n, sizeof(char *), by_name);
+
+	for (i = 0; i < n; i++) {
+		if (bench_scas_file(config_names[i]) ||
+		    bench_scas_image(&config_images[n_configs],
+		                     &config_lens[n_configs])) {
+			fprintf(stderr, "Skipping %s: it doesn't assemble\n",
+			        config_names[i]);
+			free(config_names[i]);
+		} else config_names[n_configs++] = config_names[i];
+		bench_scas_reset();
+	}
+
+ret:
+	for (i = 0, b->bytes = 0; i < n_configs; i++) {
+		if ((fp = fopen(config_names[i], "r"))) {
+			fseek(fp, 0, SEEK_END);
+			b->bytes += (size_t)ftell(fp);
+			fclose(fp);
+		}
+	}
+
+	return n_configs ? 0 : -1;
+}
+
+static int run_assemble_configs(unsigned long n)
+{
+	unsigned long i;
+	unsigned int j;
+
+	for (i = 0; i < n; i++) {
+		for (j = 0; j < n_configs; j++) {
+			if (bench_scas_file(config_names[j]))
+				return -1;
+			bench_scas_reset();
+		}
+	}
+
+	return 0;
+}
+
+static int run_disassemble_configs(unsigned long n)
+{
+	unsigned long i;
+	unsigned int j;
+
+	for (i = 0; i < n; i++) {
+		for (j = 0; j < n_configs; j++)
+			bench_scdis(config_images[j], config_lens[j], devnull);
+	}
+
+	return 0;
+}
+
+static struct text synth_text;
+static unsigned char *synth_image;
+static size_t synth_len;
+
+static int setup_synth(struct bench *b)
+{
+	free(synth_text.buf);
+	free(synth_image);
+	synth_image = NULL;
+
+	if (generate(&synth_text, b->scale) || assemble_text(&synth_text) ||
+	    bench_scas_image(&synth_image, &synth_len))
+		return -1;
+
+	bench_scas_reset();
+	b->bytes = strstr(b->name, "scas") ? synth_text.len : synth_len;
+	return 0;
+}
+
+static int run_assemble_synth(unsigned long n)
+{
+	unsigned long i;
+
+	for (i = 0; i < n; i++) {
+		if (assemble_text(&synth_text))
+			return -1;
+		bench_scas_reset();
+	}
+
+	return 0;
+}
+
+static int run_disassemble_synth(unsigned long n)
+{
+	unsigned long i;
+
+	for (i = 0; i < n; i++)
+		bench_scdis(synth_image, synth_len, devnull);
+	return 0;
+}
+
+static char emu_path[] = "/tmp/scbenchXXXXXX";
+static char cmd_write[] = "write", cmd_read[] = "read";
+static char dev_null[] = "/dev/null";
+static int emu_ready;
+
+/**
+ * Run an sctool command, with its output going nowhere.
+ */
+static int quiet_command(int argc, char **argv)
+{
+	int out, err, retval;
+
+	fflush(stdout);
+	fflush(stderr);
+	out = dup(STDOUT_FILENO);
+	err = dup(STDERR_FILENO);
+	dup2(fileno(devnull), STDOUT_FILENO);
+	dup2(fileno(devnull), STDERR_FILENO);
+
+	retval = run_command(argc, argv);
+
+	fflush(stdout);
+	fflush(stderr);
+	dup2(out, STDOUT_FILENO);
+	dup2(err, STDERR_FILENO);
+	close(out);
+	close(err);
+	return retval;
+}
+
+static int setup_emu(struct bench *b)
+{
+	int fd;
+
+	if (setup_image1(b))
+		return -1;
+	if (emu_ready) return 0;
+
+	if ((fd = mkstemp(emu_path)) < 0 ||
+	    write(fd, image1, image1_len) != (ssize_t)image1_len) {
+		fprintf(stderr, "Unable to write %s\n", emu_path);
+		if (fd >= 0) close(fd);
+		return -1;
+	}
+
+	close(fd);
+	if (transport_select("emu:eeprom=4096") || transport_init()) {
+		fputs("Unable to start the emulated converter\n", stderr);
+		return -1;
+	}
+
+	emu_ready = 1;
+	return 0;
+}
+
+static int run_emu_write(unsigned long n)
+{
+	char *argv[3];
+	unsigned long i;
+
+	argv[0] = cmd_write;
+	argv[1] = emu_path;
+	argv[2] = NULL;
+
+	for (i = 0; i < n; i++) {
+		if (quiet_command(2, argv))
+			return -1;
+	}
+
+	return 0;
+}
+
+static int run_emu_read(unsigned long n)
+{
+	char *argv[3];
+	unsigned long i;
+
+	argv[0] = cmd_read;
+	argv[1] = dev_null;
+	argv[2] = NULL;
+
+	for (i = 0; i < n; i++) {
+		if (quiet_command(2, argv))
+			return -1;
+	}
+
+	return 0;
+}
+/* }}} */
+
+static struct bench benches[] = {
+	{ "hid_token_by_name",       "lookup", setup_tokens,
+	  run_hid_by_name,         0, 0 },
+	{ "hid_token_by_value",      "lookup", setup_tokens,
+	  run_hid_by_value,        0, 0 },
+	{ "macro_token_by_name",     "lookup", setup_tokens,
+	  run_macro_by_name,       0, 0 },
+	{ "scas_lex_line",           "line",   setup_lex,
+	  run_lex,                 0, 0 },
+	{ "scas_encode_remap_block", "block",  setup_remap_block,
+	  run_encode_block,        0, 0 },
+	{ "scas_encode_macro_block", "block",  setup_macro_block,
+	  run_encode_block,        0, 0 },
+	{ "scdis_render",            "config", setup_image1,
+	  run_scdis_render,        0, 0 },
+	{ "listen_decode",           "stream", setup_listen,
+	  run_listen,              0, 0 },
+	{ "scancode_decode",         "byte",   setup_scancode,
+	  run_scancode,            0, 0 },
+	{ "sim_key",                 "event",  setup_sim,
+	  run_sim,                 0, 0 },
+	{ "scas_configs",            "set",    setup_configs,
+	  run_assemble_configs,    0, 0 },
+	{ "scdis_configs",           "set",    setup_configs,
+	  run_disassemble_configs, 0, 0 },
+	{ "scas_synthetic_x1",       "config", setup_synth,
+	  run_assemble_synth,      0, 1 },
+	{ "scas_synthetic_x8",       "config", setup_synth,
+	  run_assemble_synth,      0, 8 },
+	{ "scas_synthetic_x64",      "config", setup_synth,
+	  run_assemble_synth,      0, 64 },
+	{ "scdis_synthetic_x1",      "config", setup_synth,
+	  run_disassemble_synth,   0, 1 },
+	{ "scdis_synthetic_x8",      "config", setup_synth,
+	  run_disassemble_synth,   0, 8 },
+	{ "scdis_synthetic_x64",     "config", setup_synth,
+	  run_disassemble_synth,   0, 64 },
+	{ "emu_write",               "config", setup_emu,
+	  run_emu_write,           0, 0 },
+	{ "emu_read",                "config", setup_emu,
+	  run_emu_read,            0, 0 }
+};
+
+#define N_BENCHES (sizeof(benches) / sizeof(benches[0]))
+
+/* {{{ measure */
+static int by_value(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return x < y ? -1 : x > y;
+}
+
+/**
+ * Find how many iterations take at least the minimum time, then time
+ * that many, several times over.
+ *
+ * \return 0 on success, -1 if the benchmark failed.
+ */
+static int measure(struct bench *b, const struct options *o,
+                   struct result *r)
+{
+	double ns[MAX_REPEAT];
+	uint64_t start, elapsed, min_ns = (uint64_t)o->min_ms * NS_PER_MS;
+	unsigned long n = 1;
+	unsigned int i;
+
+	memset(r, 0, sizeof(*r));
+	r->b = b;
+	if (b->setup && b->setup(b))
+		return -1;
+
+	for (;;) {
+		start = monotime_ns();
+		if (b->run(n)) return -1;
+		if ((elapsed = monotime_ns() - start) >= min_ns) break;
+
+		/* Aim a little past the minimum, but no more than 100x */
+		if (elapsed < min_ns / 100) n *= 100;
+		else n = (unsigned long)((double)n * 1.2 * (double)min_ns /
+		                         (double)elapsed) + 1;
+	}
+
+	ns[0] = (double)elapsed / (double)n;
+	for (i = 1; i < o->repeat; i++) {
+		start = monotime_ns();
+		if (b->run(n)) return -1;
+		ns[i] = (double)(monotime_ns() - start) / (double)n;
+	}
+
+	qsort(ns, o->repeat, sizeof(double), by_value);
+	r->iterations    = n;
+	r->ns_per_op     = ns[o->repeat / 2];
+	r->min_ns_per_op = ns[0];
+	return 0;
+}
+/* }}} */
+
+/* {{{ Baseline */
+static char *read_file(const char *path)
+{
+	FILE *fp;
+	char *buf = NULL;
+	long len;
+
+	if (!(fp = fopen(path, "r"))) {
+		fprintf(stderr, "Unable to open '%s'\n", path);
+		return NULL;
+	}
+
+	if (fseek(fp, 0, SEEK_END) || (len = ftell(fp)) < 0 ||
+	    fseek(fp, 0, SEEK_SET) || !(buf = malloc((size_t)len + 1)))
+		goto close;
+
+	buf[fread(buf, 1, (size_t)len, fp)] = '\0';
+
+close:
+	fclose(fp);
+	return buf;
+}
+
+/**
+ * Find a benchmark's time per iteration in the results of a past run.
+ *
+ * \return the time (ns), or 0 if it isn't there.
+ */
+static double baseline_for(const char *json, const char *name)
+{
+	char key[128];
+	const char *p, *end;
+
+	sprintf(key, "\"name\": \"%s\"", name);
+	if (!json || !(p = strstr(json, key)))
+		return 0.0;
+
+	end = strchr(p, '}');
+	if (!(p = strstr(p, "\"ns_per_op\": ")) || (end && p > end))
+		return 0.0;
+	return strtod(p + strlen("\"ns_per_op\": "), NULL);
+}
+/* }}} */
+
+/* {{{ Output */
+static double mb_per_s(const struct result *r)
+{
+	return r->b->bytes ? (double)r->b->bytes * 1000.0 / r->ns_per_op
+	                   : 0.0;
+}
+
+static double change(const struct result *r)
+{
+	return 100.0 * (r->ns_per_op - r->baseline) / r->baseline;
+}
+
+static void write_json(FILE *fp, const struct result *r, unsigned int n)
+{
+	unsigned int i;
+
+	fprintf(fp, "{\n  \"version\": %d,\n  \"benchmarks\": [\n",
+	        BENCH_VERSION);
+	for (i = 0; i < n; i++) {
+		fprintf(fp, "    { \"name\": \"%s\", \"unit\": \"%s\", "
+		        "\"iterations\": %lu, \"ns_per_op\": %.1f, "
+		        "\"min_ns_per_op\": %.1f, \"ops_per_s\": %.1f",
+		        r[i].b->name, r[i].b->unit, r[i].iterations,
+		        r[i].ns_per_op, r[i].min_ns_per_op,
+		        1e9 / r[i].ns_per_op);
+		if (r[i].b->bytes)
+			fprintf(fp, ", \"bytes\": %lu, \"mb_per_s\": %.2f",
+			        (unsigned long)r[i].b->bytes, mb_per_s(&r[i]));
+		if (r[i].baseline > 0.0)
+			fprintf(fp, ", \"baseline_ns_per_op\": %.1f, "
+			        "\"change_pct\": %.1f", r[i].baseline,
+			        change(&r[i]));
+		fprintf(fp, " }%s\n", i + 1 < n ? "," : "");
+	}
+	fputs("  ]\n}\n", fp);
+}
+
+static void print_result(const struct result *r, double threshold)
+{
+	fprintf(stderr, "%-24s %-7s %12.1f", r->b->name, r->b->unit,
+	        r->ns_per_op);
+	if (r->b->bytes) fprintf(stderr, " %9.2f", mb_per_s(r));
+	else fprintf(stderr, " %9s", "");
+	if (r->baseline > 0.0)
+		fprintf(stderr, " %+8.1f%%%s", change(r),
+		        change(r) > threshold ? "  SLOWER" : "");
+	fputc('\n', stderr);
+}
+/* }}} */
+
+/* {{{ parse_options */
+static int parse_options(struct options *o, int argc, char **argv)
+{
+	int i;
+
+	memset(o, 0, sizeof(*o));
+	o->min_ms    = DEFAULT_MIN_MS;
+	o->repeat    = DEFAULT_REPEAT;
+	o->threshold = DEFAULT_THRESHOLD;
+	o->configs   = "configs";
+
+	for (i = 1; i < argc; i++) {
+		if (i + 1 >= argc) return -1;
+		if (!strcmp(argv[i], "--configs")) o->configs = argv[++i];
+		else if (!strcmp(argv[i], "--output")) o->output = argv[++i];
+		else if (!strcmp(argv[i], "--baseline")) o->baseline = argv[++i];
+		else if (!strcmp(argv[i], "--filter")) o->filter = argv[++i];
+		else if (!strcmp(argv[i], "--threshold"))
+			o->threshold = strtod(argv[++i], NULL);
+		else if (!strcmp(argv[i], "--time"))
+			o->min_ms = (unsigned int)strtoul(argv[++i], NULL, 0);
+		else if (!strcmp(argv[i], "--repeat"))
+			o->repeat = (unsigned int)strtoul(argv[++i], NULL, 0);
+		else return -1;
+	}
+
+	if (!o->repeat || o->repeat > MAX_REPEAT) {
+		fprintf(stderr, "The repeat count must be 1 to %d\n", MAX_REPEAT);
+		return -1;
+	}
+
+	return 0;
+}
+/* }}} */
+
+int main(int argc, char **argv)
+{
+	struct options o;
+	struct result results[N_BENCHES];
+	char *baseline = NULL;
+	FILE *fp = stdout;
+	unsigned int i, n = 0, slower = 0;
+	int retval = EXIT_FAILURE;
+
+	if (parse_options(&o, argc, argv)) {
+		fputs(usage, stderr);
+		goto ret;
+	}
+
+	if (o.baseline && !(baseline = read_file(o.baseline)))
+		goto ret;
+
+	if (o.output && !(fp = fopen(o.output, "w"))) {
+		fprintf(stderr, "Unable to open '%s'\n", o.output);
+		goto free_baseline;
+	}
+
+	/* Includes in the configs are relative to their directory */
+	if (!(devnull = fopen("/dev/null", "w")) || chdir(o.configs)) {
+		fprintf(stderr, "Unable to change to '%s': %s\n", o.configs,
+		        strerror(errno));
+		goto close;
+	}
+
+	find_keys();
+	fprintf(stderr, "%-24s %-7s %12s %9s%s\n", "Benchmark", "Unit",
+	        "ns/op", "MB/s", o.baseline ? "    Change" : "");
+
+	for (i = 0; i < N_BENCHES; i++) {
+		if (o.filter && !strstr(benches[i].name, o.filter))
+			continue;
+
+		if (measure(&benches[i], &o, &results[n])) {
+			fprintf(stderr, "%s: failed\n", benches[i].name);
+			goto close;
+		}
+
+		results[n].baseline = baseline_for(baseline, benches[i].name);
+		print_result(&results[n], o.threshold);
+		if (results[n].baseline > 0.0 &&
+		    change(&results[n]) > o.threshold)
+			++slower;
+		++n;
+	}
+
+	write_json(fp, results, n);
+	if (slower)
+		fprintf(stderr, "%u benchmark(s) more than %.0f%% slower than "
+		        "the baseline\n", slower, o.threshold);
+	else retval = EXIT_SUCCESS;
+
+close:
+	if (emu_ready) {
+		transport_exit();
+		unlink(emu_path);
+	}
+
+	if (devnull) fclose(devnull);
+	if (fp != stdout) fclose(fp);
+
+free_baseline:
+	free(baseline);
+
+ret:
+	return retval;
+}
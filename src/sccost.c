@@ -0,0 +1,462 @@
+/**
+ * sctools: Estimate what a binary config costs the converter
+ * Copyright (C) 2016 Tim Hentenaar.
+ *
+ * This code is licenced under the Simplified BSD License.
+ * See the LICENSE file for details.
+ *
+ * The converter reloads the whole config whenever a SELECT_n code is
+ * output, and matches remaps and macros by scanning the config. This
+ * counts that work, for each key in each state (select mask and
+ * layer) that can be reached from power-up:
+ *
+ * - A key's remap is found by walking every block header, and
+ *   comparing every entry of the remap blocks which apply for the
+ *   layer (later ones win, so there's no stopping early). If it
+ *   isn't remapped on the current layer, layer 0 is walked too.
+ * - Its macro is found by walking every block header again, and
+ *   comparing macros until the last one for the key (assuming the
+ *   metas only match that one), or all of them if there isn't one.
+ *   The steps of the longest of its macros are counted as run.
+ * - If it outputs SELECT_n, the reload walks every block header, and
+ *   reads each layer or remap block which applies afterwards.
+ *
+ * These are counts of bytes read from the config, not time: they are
+ * for comparing keys and configs, and spotting the ones which will
+ * feel slow on the converter.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "hid_tokens.h"
+#include "macro_tokens.h"
+
+#define MACRO_HEADER_LEN 5
+#define DEFAULT_TOP      20
+
+struct cost {
+	unsigned int headers; /* block headers read          */
+	unsigned int entries; /* remaps and macros compared  */
+	unsigned int bytes;   /* bytes read to find the key  */
+	unsigned int steps;   /* macro steps run             */
+	unsigned int reload;  /* bytes a SELECT reload reads */
+};
+
+struct key_cost {
+	unsigned char hid, selects, layer;
+	struct cost   cost;
+};
+
+struct options {
+	unsigned char  set;
+	int            keyboard;
+	unsigned int   top;
+	const char    *config;
+};
+
+struct state {
+	const struct sc_config *cfg;
+	unsigned char           set;
+	int                     keyboard;
+	unsigned char           selects;
+};
+
+static const char *usage =
+	"usage: sccost [options] <binary_config>\n\n"
+	"  Options:\n"
+	"    --set <set>          Keyboard's set: set1, set2, set3, or\n"
+	"                         set2ext (default: the one it forces)\n"
+	"    --keyboard <id>      Keyboard ID, for ifkeyboard blocks\n"
+	"    --top <n>            Number of keys to rank (default 20)\n";
+
+#define total(c) ((c)->bytes + (c)->reload)
+
+static int applies(const struct state *st, const struct sc_block *b)
+{
+	return sc_config_applies(b, st->selects, st->set, st->keyboard);
+}
+
+/* {{{ reload_cost */
+/**
+ * Bytes read by a reload, to reach the given selects.
+ */
+static unsigned int reload_cost(const struct state *st, unsigned char selects)
+{
+	struct state next = *st;
+	const struct sc_block *b;
+	unsigned int i, bytes = SC_HEADER_LEN;
+
+	next.selects = selects;
+	for (i = 0; i < st->cfg->n_blocks; i++) {
+		b      = &st->cfg->blocks[i];
+		bytes += b->header;
+		if (b->type != SC_BLOCK_MACRO && applies(&next, b))
+			bytes += b->length - b->header;
+	}
+
+	return bytes;
+}
+/* }}} */
+
+/* {{{ remap_cost */
+/**
+ * Walk the remap blocks for a layer.
+ *
+ * \return what the key is remapped to, or -1 if it isn't.
+ */
+static int remap_cost(const struct state *st, unsigned char layer,
+                      unsigned char hid, struct cost *c)
+{
+	const struct sc_block *b;
+	unsigned int i, j;
+	int code = -1;
+
+	for (i = 0; i < st->cfg->n_blocks; i++) {
+		b = &st->cfg->blocks[i];
+		++c->headers;
+		c->bytes += b->header;
+
+		if (b->type != SC_BLOCK_REMAP || b->layer != layer ||
+		    !applies(st, b))
+			continue;
+
+		c->entries += b->n_entries;
+		c->bytes   += 2 + 2 * b->n_entries;
+		for (j = 0; j < b->n_entries; j++) {
+			if (b->entries[2 * j] == hid)
+				code = b->entries[2 * j + 1];
+		}
+	}
+
+	return code;
+}
+/* }}} */
+
+/* {{{ macro_select */
+/**
+ * Find the first SELECT_n code a macro outputs.
+ *
+ * \return the code, or 0 if it doesn't output one.
+ */
+static unsigned char macro_select(const struct sc_macro *m)
+{
+	const unsigned char *step = m->press;
+	unsigned int i, cmd;
+
+	for (i = 0; i < m->n_press + m->n_release; i++, step += 2) {
+		cmd = step[0] & (unsigned int)~Q_PUSH_META;
+		if ((cmd == Q_KEY_PRESS || cmd == Q_KEY_MAKE) &&
+		    sc_is_select(step[1]))
+			return step[1];
+	}
+
+	return 0;
+}
+/* }}} */
+
+/* {{{ macro_cost */
+static void macro_cost(const struct state *st, unsigned char code,
+                       struct cost *c)
+{
+	const struct sc_block *b;
+	const struct sc_macro *m;
+	unsigned int i, j, n = 0, last = 0, bytes = 0, last_bytes = 0;
+	unsigned char select = 0;
+
+	for (i = 0; i < st->cfg->n_blocks; i++) {
+		b = &st->cfg->blocks[i];
+		++c->headers;
+		c->bytes += b->header;
+
+		if (b->type != SC_BLOCK_MACRO || !applies(st, b))
+			continue;
+
+		bytes += 1;
+		for (j = 0; j < b->n_entries; j++) {
+			m      = &b->macros[j];
+			bytes += MACRO_HEADER_LEN;
+			++n;
+
+			if (m->hid != code) continue;
+			last       = n;
+			last_bytes = bytes;
+
+			if (m->n_press + m->n_release > c->steps)
+				c->steps = m->n_press + m->n_release;
+			if (!select) select = macro_select(m);
+		}
+	}
+
+	c->entries += last ? last : n;
+	c->bytes   += (last ? last_bytes : bytes) + 2 * c->steps;
+	if (select)
+		c->reload = reload_cost(st, sc_config_select(st->selects, select));
+}
+/* }}} */
+
+/* {{{ key_cost */
+static void key_cost(const struct state *st, unsigned char layer,
+                     unsigned char hid, struct cost *c)
+{
+	int code;
+
+	memset(c, 0, sizeof(*c));
+	if ((code = remap_cost(st, layer, hid, c)) < 0 && layer)
+		code = remap_cost(st, 0, hid, c);
+	if (code < 0)
+		code = hid;
+
+	if (sc_is_fn(code))
+		return;
+
+	if (sc_is_select(code)) {
+		c->reload = reload_cost(st, sc_config_select(st->selects,
+		                                             (unsigned char)code));
+		return;
+	}
+
+	macro_cost(st, (unsigned char)code, c);
+}
+/* }}} */
+
+/* {{{ Helpers */
+static const char *key_name(unsigned char hid)
+{
+	static char buf[8];
+	const char *name = find_hid_token_by_value(hid);
+
+	if (name) return name;
+	sprintf(buf, "0x%02X", hid);
+	return buf;
+}
+
+static const char *select_names(unsigned char selects)
+{
+	static char buf[16];
+	return sc_config_select_names(selects, buf);
+}
+
+static int by_total(const void *a, const void *b)
+{
+	const struct key_cost *x = a, *y = b;
+
+	if (total(&x->cost) != total(&y->cost))
+		return total(&x->cost) < total(&y->cost) ? 1 : -1;
+	return x->hid - y->hid;
+}
+/* }}} */
+
+/* {{{ find_keys */
+/**
+ * Find the keys the config remaps, or has macros for.
+ *
+ * \return the number of keys.
+ */
+static unsigned int find_keys(const struct sc_config *cfg,
+                              unsigned char *keys)
+{
+	unsigned char used[256];
+	const struct sc_block *b;
+	unsigned int i, j, n = 0;
+
+	memset(used, 0, sizeof(used));
+	for (i = 0; i < cfg->n_blocks; i++) {
+		b = &cfg->blocks[i];
+		for (j = 0; j < b->n_entries; j++) {
+			if (b->type == SC_BLOCK_REMAP)
+				used[b->entries[2 * j]] = 1;
+			else if (b->type == SC_BLOCK_MACRO)
+				used[b->macros[j].hid] = 1;
+		}
+	}
+
+	for (i = 0; i < 256; i++) {
+		if (used[i]) keys[n++] = (unsigned char)i;
+	}
+
+	return n;
+}
+
+/**
+ * Find the layers a select mask can reach: 0, and those its
+ * layerblocks use.
+ *
+ * \return the number of layers.
+ */
+static unsigned int find_layers(const struct state *st,
+                                unsigned char *layers)
+{
+	unsigned char seen[256];
+	const struct sc_block *b;
+	unsigned int i, j, n = 1;
+
+	memset(seen, 0, sizeof(seen));
+	layers[0] = 0;
+	seen[0]   = 1;
+
+	for (i = 0; i < st->cfg->n_blocks; i++) {
+		b = &st->cfg->blocks[i];
+		if (b->type != SC_BLOCK_LAYERDEF || !applies(st, b))
+			continue;
+
+		for (j = 0; j < b->n_entries; j++) {
+			if (seen[b->entries[2 * j + 1]]) continue;
+			seen[b->entries[2 * j + 1]] = 1;
+			layers[n++] = b->entries[2 * j + 1];
+		}
+	}
+
+	return n;
+}
+/* }}} */
+
+/* {{{ parse_options */
+static int parse_options(struct options *o, int argc, char **argv)
+{
+	int i, set;
+
+	memset(o, 0, sizeof(*o));
+	o->keyboard = -1;
+	o->top      = DEFAULT_TOP;
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--set") && i + 1 < argc) {
+			if ((set = sc_config_set_by_name(argv[++i])) < 0) {
+				fprintf(stderr, "%s: unknown set\n", argv[i]);
+				return -1;
+			}
+			o->set = (unsigned char)set;
+		} else if (!strcmp(argv[i], "--keyboard") && i + 1 < argc) {
+			o->keyboard = (int)strtol(argv[++i], NULL, 0);
+		} else if (!strcmp(argv[i], "--top") && i + 1 < argc) {
+			o->top = (unsigned int)strtoul(argv[++i], NULL, 0);
+		} else if (argv[i][0] == '-' && argv[i][1]) {
+			return -1;
+		} else if (!o->config) {
+			o->config = argv[i];
+		} else return -1;
+	}
+
+	return o->config ? 0 : -1;
+}
+/* }}} */
+
+/* {{{ add_costs */
+/**
+ * Work out the costs of the keys in a state, and add them to the
+ * ranking. The index of the worst one is stored in \a worst.
+ *
+ * \return 0 on success, -1 on error.
+ */
+static int add_costs(const struct state *st, unsigned char layer,
+                     const unsigned char *keys, unsigned int n_keys,
+                     struct key_cost **ranked, unsigned long *n,
+                     unsigned long *worst)
+{
+	struct key_cost *tmp, *kc;
+	unsigned int i;
+
+	if (!(tmp = realloc(*ranked, (*n + n_keys + 1) * sizeof(*tmp)))) {
+		fputs("Unable to allocate memory for the costs\n", stderr);
+		return -1;
+	}
+
+	*ranked = tmp;
+	for (i = 0; i < n_keys; i++) {
+		kc          = &tmp[*n];
+		kc->hid     = keys[i];
+		kc->selects = st->selects;
+		kc->layer   = layer;
+		key_cost(st, layer, keys[i], &kc->cost);
+
+		if (!i || total(&kc->cost) > total(&tmp[*worst].cost))
+			*worst = *n;
+		++*n;
+	}
+
+	return 0;
+}
+/* }}} */
+
+int main(int argc, char **argv)
+{
+	struct options o;
+	struct sc_config cfg;
+	struct state st;
+	struct key_cost *ranked = NULL;
+	struct cost c, other;
+	unsigned char masks[SC_MAX_SELECTS], keys[256], layers[256];
+	unsigned int n_masks, n_keys, n_layers, i, j;
+	unsigned long n = 0, before, worst = 0;
+	int retval = EXIT_FAILURE;
+
+	fputs("sccost v1.10\n", stderr);
+	if (parse_options(&o, argc, argv)) {
+		fputs(usage, stderr);
+		goto ret;
+	}
+
+	if (sc_config_load(&cfg, o.config))
+		goto ret;
+
+	st.cfg      = &cfg;
+	st.set      = o.set ? o.set : sc_config_set(&cfg);
+	st.keyboard = o.keyboard;
+	n_masks     = sc_config_selects(&cfg, st.set, st.keyboard, masks);
+	n_keys      = find_keys(&cfg, keys);
+
+	printf("Config: %lu bytes, %u blocks, %u keys used, %u select "
+	       "state(s)\n\n", (unsigned long)cfg.len, cfg.n_blocks, n_keys,
+	       n_masks);
+	printf("%-8s %5s %7s %12s  %s\n", "Selects", "Layer", "Reload",
+	       "Other keys", "Worst key");
+
+	for (i = 0; i < n_masks; i++) {
+		st.selects = masks[i];
+		n_layers   = find_layers(&st, layers);
+
+		for (j = 0; j < n_layers; j++) {
+			/* A key the config doesn't mention scans everything */
+			key_cost(&st, layers[j], 0, &other);
+			printf("%-8s %5u %7u %12u  ", select_names(masks[i]),
+			       layers[j], reload_cost(&st, masks[i]), total(&other));
+
+			before = n;
+			if (add_costs(&st, layers[j], keys, n_keys, &ranked, &n,
+			              &worst))
+				goto free_ranked;
+
+			if (n > before)
+				printf("%s (%u)", key_name(ranked[worst].hid),
+				       total(&ranked[worst].cost));
+			putchar('\n');
+		}
+	}
+
+	qsort(ranked, n, sizeof(*ranked), by_total);
+	if (n > o.top) n = o.top;
+
+	printf("\nCostliest keys (bytes read, including any reload):\n");
+	printf("%-20s %-8s %5s %7s %7s %7s %5s %7s %7s\n", "Key", "Selects",
+	       "Layer", "Headers", "Entries", "Scanned", "Steps", "Reload",
+	       "Total");
+	for (i = 0; i < n; i++) {
+		c = ranked[i].cost;
+		printf("%-20s %-8s %5u %7u %7u %7u %5u %7u %7u\n",
+		       key_name(ranked[i].hid), select_names(ranked[i].selects),
+		       ranked[i].layer, c.headers, c.entries, c.bytes, c.steps,
+		       c.reload, total(&c));
+	}
+
+	retval = EXIT_SUCCESS;
+
+free_ranked:
+	free(ranked);
+	sc_config_free(&cfg);
+
+ret:
+	return retval;
+}
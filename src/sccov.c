@@ -0,0 +1,516 @@
+/**
+ * sctools: What of a binary config is used
+ * Copyright (C) 2016 Tim Hentenaar.
+ *
+ * This code is licenced under the Simplified BSD License.
+ * See the LICENSE file for details.
+ *
+ * Runs traces recorded by sctool listen --record through a binary
+ * config, as scsim does, and counts how often each remap, layer
+ * definition and macro is used: a remap when it remaps a make, a layer
+ * definition when its FN keys are held, and a macro when it's
+ * triggered and when it's released. Each trace starts from power-up.
+ *
+ * Given the config's source, each entry is shown with the line it came
+ * from. The source is read as scas reads it, following includes: the
+ * entries come out in the same order as they go into the binary.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "hid_tokens.h"
+#include "sclog.h"
+#include "sim.h"
+
+#define MAX_INCLUDE_DEPTH 16
+
+struct options {
+	unsigned char  set;
+	int            keyboard;
+	int            all;
+	const char    *config;
+	const char    *source;
+	char         **traces;
+	unsigned int   n_traces;
+};
+
+/* Where an entry came from */
+struct source_line {
+	const char   *file;
+	unsigned int  line;
+};
+
+struct source {
+	struct source_line *lines;
+	unsigned int        n, size;
+	char              **files;
+	unsigned int        n_files;
+	int                 block;   /* SC_BLOCK_*, or -1 outside blocks */
+};
+
+struct totals {
+	unsigned int entries, used;
+};
+
+static const char *usage =
+	"usage: sccov [options] <binary_config> <trace> [<trace>...]\n\n"
+	"  Options:\n"
+	"    --set <set>          Keyboard's set: set1, set2 (default),\n"
+	"                         set3, or set2ext\n"
+	"    --keyboard <id>      Keyboard ID, for ifkeyboard blocks\n"
+	"    --source <file>      The config's source, for line numbers\n"
+	"    --all                List every entry, not only those unused\n\n"
+	"  Traces are recorded by sctool listen --record.\n";
+
+static const char *metas[4]  = { "CTRL", "SHIFT", "ALT", "GUI" };
+static const char *hmetas[8] = {
+	"LCTRL", "LSHIFT", "LALT", "LGUI",
+	"RCTRL", "RSHIFT", "RALT", "RGUI"
+};
+
+static const char *block_names[3] = {
+	"layerblock", "remapblock", "macroblock"
+};
+
+/* scas's commands: anything else in a layer or remap block is an entry */
+static const char *commands[] = {
+	"force", "include", "ifselect", "ifset", "ifkeyboard", "remapblock",
+	"layerblock", "macroblock", "layer", "macro", "onbreak", "endmacro",
+	"endblock", NULL
+};
+
+/* {{{ Source */
+static int is_command(const char *t)
+{
+	int i;
+
+	for (i = 0; commands[i]; i++) {
+		if (!strcmp(t, commands[i]))
+			return 1;
+	}
+
+	return 0;
+}
+
+static const char *keep_name(struct source *src, const char *path)
+{
+	char **files, *name;
+
+	if (!(files = realloc(src->files, (src->n_files + 1) * sizeof(*files))))
+		return NULL;
+	src->files = files;
+
+	if (!(name = malloc(strlen(path) + 1)))
+		return NULL;
+	strcpy(name, path);
+	return files[src->n_files++] = name;
+}
+
+static int add_line(struct source *src, const char *file, unsigned int line)
+{
+	struct source_line *tmp;
+
+	if (src->n == src->size) {
+		src->size = src->size ? 2 * src->size : 256;
+		if (!(tmp = realloc(src->lines, src->size * sizeof(*tmp))))
+			return -1;
+		src->lines = tmp;
+	}
+
+	src->lines[src->n].file = file;
+	src->lines[src->n].line = line;
+	src->n++;
+	return 0;
+}
+
+/**
+ * Get the next whitespace-separated token from \a p into \a buf
+ * (without any quotes around it.)
+ *
+ * \return what follows it, or NULL if there wasn't one.
+ */
+static const char *next_token(const char *p, char *buf, size_t size)
+{
+	size_t n = 0;
+	char quote = 0;
+
+	while (isspace((unsigned char)*p)) p++;
+	if (!*p) return NULL;
+
+	if (*p == '"') quote = *p++;
+	while (*p && (quote ? *p != quote : !isspace((unsigned char)*p))) {
+		if (n < size - 1) buf[n++] = *p;
+		p++;
+	}
+
+	if (quote && *p) p++;
+	buf[n] = '\0';
+	return p;
+}
+
+static FILE *open_include(const char *name, const char *from, char *path,
+                          size_t size)
+{
+	const char *slash;
+	FILE *fp;
+
+	/* As scas does: relative to where it's run, then to the includer */
+	strncpy(path, name, size - 1);
+	path[size - 1] = '\0';
+	if ((fp = fopen(path, "r")) || !from || name[0] == '/')
+		return fp;
+
+	if (!(slash = strrchr(from, '/')) ||
+	    (size_t)(slash - from) + strlen(name) + 2 > size)
+		return NULL;
+
+	memcpy(path, from, (size_t)(slash - from) + 1);
+	strcpy(path + (slash - from) + 1, name);
+	return fopen(path, "r");
+}
+
+/* {{{ read_source */
+/**
+ * Note the line each entry of a config's source is on, in order.
+ *
+ * \return 0 on success, -1 on error.
+ */
+static int read_source(struct source *src, const char *name,
+                       const char *from, int depth)
+{
+	char line[256], tok[256], path[1024], *com;
+	const char *p, *file;
+	unsigned int n = 0;
+	int ret = -1;
+	FILE *fp;
+
+	if (depth > MAX_INCLUDE_DEPTH) {
+		fprintf(stderr, "%s: includes nested too deeply\n", name);
+		return -1;
+	}
+
+	if (!(fp = open_include(name, from, path, sizeof(path)))) {
+		fprintf(stderr, "Unable to open '%s'\n", name);
+		return -1;
+	}
+
+	if (!(file = keep_name(src, path))) {
+		fputs("Unable to allocate memory for the source\n", stderr);
+		goto close;
+	}
+
+	while (fgets(line, sizeof(line), fp)) {
+		++n;
+		if ((com = strchr(line, '#'))) *com = '\0';
+		if (!(p = next_token(line, tok, sizeof(tok))))
+			continue;
+
+		if (!strcmp(tok, "layerblock"))
+			src->block = SC_BLOCK_LAYERDEF;
+		else if (!strcmp(tok, "remapblock"))
+			src->block = SC_BLOCK_REMAP;
+		else if (!strcmp(tok, "macroblock"))
+			src->block = SC_BLOCK_MACRO;
+		else if (!strcmp(tok, "endblock"))
+			src->block = -1;
+		else if (!strcmp(tok, "include")) {
+			if (!next_token(p, tok, sizeof(tok)) ||
+			    read_source(src, tok, file, depth + 1))
+				goto close;
+		} else if (src->block == SC_BLOCK_MACRO ? !strcmp(tok, "macro") :
+		           src->block >= 0 && !is_command(tok)) {
+			if (add_line(src, file, n)) {
+				fputs("Unable to allocate memory for the source\n",
+				      stderr);
+				goto close;
+			}
+		}
+	}
+
+	ret = ferror(fp) ? -1 : 0;
+
+close:
+	fclose(fp);
+	return ret;
+}
+/* }}} */
+
+static void free_source(struct source *src)
+{
+	unsigned int i;
+
+	for (i = 0; i < src->n_files; i++)
+		free(src->files[i]);
+	free(src->files);
+	free(src->lines);
+}
+/* }}} */
+
+/* {{{ Printing */
+static size_t put_key(char *buf, unsigned char hid)
+{
+	const char *name = find_hid_token_by_value(hid);
+
+	if (name) return (size_t)sprintf(buf, "%s", name);
+	return (size_t)sprintf(buf, "0x%02X", hid);
+}
+
+/**
+ * Write the metas a macro matches, as scas spells them (e.g. SHIFT
+ * -LCTRL.)
+ */
+static size_t put_metas(char *buf, const struct sc_macro *m)
+{
+	unsigned char desired  = m->desired_meta, matched = m->matched_meta;
+	unsigned char unhanded = (unsigned char)(desired & ~matched & 0xf0);
+	unsigned int i, mask;
+	size_t len = 0;
+
+	for (i = 0; i < 4; i++) {
+		mask = (1U << i) | (1U << (i + 4));
+		if (!(unhanded & mask)) continue;
+		len += (size_t)sprintf(buf + len, " %s", metas[i]);
+		desired &= (unsigned char)~mask;
+		matched &= (unsigned char)~mask;
+	}
+
+	for (i = 0; i < 8; i++) {
+		if (!(matched & (1 << i))) continue;
+		len += (size_t)sprintf(buf + len, " %s%s",
+		                       desired & (1 << i) ? "" : "-", hmetas[i]);
+	}
+
+	return len;
+}
+
+/**
+ * Write an entry as it would be in the source (at most 128 bytes.)
+ */
+static void put_entry(char *buf, const struct sc_block *b, unsigned int j)
+{
+	const unsigned char *e = b->entries + 2 * j;
+	size_t len = 0;
+	int i;
+
+	if (b->type == SC_BLOCK_MACRO) {
+		len  = (size_t)sprintf(buf, "macro ");
+		len += put_key(buf + len, b->macros[j].hid);
+		put_metas(buf + len, &b->macros[j]);
+	} else if (b->type == SC_BLOCK_LAYERDEF) {
+		for (i = 0; i < 8; i++) {
+			if (e[0] & (1 << i))
+				len += (size_t)sprintf(buf + len, "FN%d ", i + 1);
+		}
+		sprintf(buf + len, "%d", e[1]);
+	} else {
+		len  = put_key(buf, e[0]);
+		buf[len++] = ' ';
+		put_key(buf + len, e[1]);
+	}
+}
+
+static void put_block(unsigned int n, const struct sc_block *b)
+{
+	printf("\nBlock %u at offset %lu: %s", n, (unsigned long)b->offset,
+	       b->type < 3 ? block_names[b->type] : "unknown");
+	if (b->type == SC_BLOCK_REMAP) printf(", layer %d", b->layer);
+	if (b->select)   printf(", ifselect %d", b->select);
+	if (b->set_mask) printf(", ifset 0x%02X", b->set_mask);
+	if (b->keyboard >= 0) printf(", ifkeyboard %04X", b->keyboard);
+	fputs("\n     Hits  Releases  Entry                         Source\n",
+	      stdout);
+}
+/* }}} */
+
+/* {{{ report */
+/**
+ * List the entries (those never used, unless \a all is set), block by
+ * block, and count them by type.
+ */
+static void report(const struct sc_config *cfg, const unsigned long *hits,
+                   const struct source *src, int all, struct totals *t)
+{
+	const struct sc_block *b;
+	unsigned int i, j, n = 0, shown;
+	unsigned long hit, released;
+	size_t at;
+	char entry[128];
+
+	for (i = 0; i < cfg->n_blocks; i++) {
+		b = &cfg->blocks[i];
+		shown = 0;
+
+		for (j = 0; j < b->n_entries; j++, n++) {
+			if (b->type == SC_BLOCK_MACRO) at = b->macros[j].offset;
+			else at = (size_t)(b->entries + 2 * j - cfg->image);
+
+			hit      = hits[at];
+			released = b->type == SC_BLOCK_MACRO ? hits[at + 1] : 0;
+			if (b->type < 3) {
+				++t[b->type].entries;
+				if (hit) ++t[b->type].used;
+			}
+
+			if (hit && !all) continue;
+			if (!shown++) put_block(i, b);
+
+			put_entry(entry, b, j);
+			printf("%9lu  ", hit);
+			if (b->type == SC_BLOCK_MACRO) printf("%8lu", released);
+			else printf("%8s", "-");
+			printf("  %-28s", entry);
+			if (src && n < src->n)
+				printf("  %s:%u", src->lines[n].file, src->lines[n].line);
+			putchar('\n');
+		}
+	}
+}
+/* }}} */
+
+/* {{{ run_trace */
+/**
+ * Run a trace through the config, from power-up.
+ *
+ * \return the key events in it, or -1 on error.
+ */
+static long run_trace(struct sim_coverage *cov, const struct sc_config *cfg,
+                      const struct options *o, const char *path)
+{
+	struct sclog log;
+	struct listen_event ev;
+	struct sim s;
+	long n = 0;
+	int r = -1;
+
+	if (sclog_open(&log, path))
+		return -1;
+
+	if (sim_init(&s, cfg, o->set, o->keyboard) || sim_set_coverage(&s, cov))
+		goto close;
+
+	while ((r = sclog_read(&log, &ev)) > 0) {
+		if (ev.type != '+' && ev.type != '-')
+			continue;
+		sim_key(&s, ev.code, ev.type == '+', ev.time);
+		++n;
+	}
+
+	if (r) fprintf(stderr, "%s: unable to read the trace\n", path);
+	sim_free(&s);
+
+close:
+	sclog_close(&log);
+	return r ? -1 : n;
+}
+/* }}} */
+
+/* {{{ parse_options */
+static int parse_options(struct options *o, int argc, char **argv)
+{
+	int i, set;
+
+	memset(o, 0, sizeof(*o));
+	o->keyboard = -1;
+	o->traces   = argv;
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--set") && i + 1 < argc) {
+			if ((set = sc_config_set_by_name(argv[++i])) < 0) {
+				fprintf(stderr, "%s: unknown set\n", argv[i]);
+				return -1;
+			}
+			o->set = (unsigned char)set;
+		} else if (!strcmp(argv[i], "--keyboard") && i + 1 < argc) {
+			o->keyboard = (int)strtol(argv[++i], NULL, 0);
+		} else if (!strcmp(argv[i], "--source") && i + 1 < argc) {
+			o->source = argv[++i];
+		} else if (!strcmp(argv[i], "--all")) {
+			o->all = 1;
+		} else if (argv[i][0] == '-' && argv[i][1]) {
+			return -1;
+		} else if (!o->config) {
+			o->config = argv[i];
+		} else o->traces[o->n_traces++] = argv[i];
+	}
+
+	return o->config && o->n_traces ? 0 : -1;
+}
+/* }}} */
+
+static void put_total(const char *what, const struct totals *t)
+{
+	fprintf(stderr, "%-12s %u of %u used", what, t->used, t->entries);
+	if (t->entries)
+		fprintf(stderr, " (%.1f%%)", 100.0 * t->used / t->entries);
+	fputc('\n', stderr);
+}
+
+int main(int argc, char **argv)
+{
+	struct options o;
+	struct sc_config cfg;
+	struct sim_coverage cov;
+	struct source src;
+	struct totals t[3];
+	unsigned int i, entries = 0;
+	long n, events = 0;
+	int have_src = 0, retval = EXIT_FAILURE;
+
+	fputs("sccov v1.10\n", stderr);
+	memset(&src, 0, sizeof(src));
+	src.block = -1;
+
+	if (parse_options(&o, argc, argv)) {
+		fputs(usage, stderr);
+		goto ret;
+	}
+
+	if (sc_config_load(&cfg, o.config))
+		goto ret;
+
+	if (!o.set)
+		o.set = sc_config_set(&cfg);
+
+	if (sim_coverage_init(&cov, &cfg))
+		goto free_cfg;
+
+	for (i = 0; i < o.n_traces; i++) {
+		if ((n = run_trace(&cov, &cfg, &o, o.traces[i])) < 0)
+			goto free_cov;
+		events += n;
+	}
+
+	for (i = 0; i < cfg.n_blocks; i++)
+		entries += cfg.blocks[i].n_entries;
+
+	/* Only if it's the source of this config */
+	if (o.source && !read_source(&src, o.source, NULL, 0)) {
+		if (src.n == entries) have_src = 1;
+		else fprintf(stderr, "%s has %u entries, but the config has %u: "
+		             "not showing source lines\n", o.source, src.n, entries);
+	}
+
+	memset(t, 0, sizeof(t));
+	report(&cfg, cov.hits, have_src ? &src : NULL, o.all, t);
+
+	fflush(stdout);
+	fprintf(stderr, "\n%lu key events in %u trace%s\n", (unsigned long)events,
+	        o.n_traces, o.n_traces == 1 ? "" : "s");
+	put_total("Layer defs:", &t[SC_BLOCK_LAYERDEF]);
+	put_total("Remaps:", &t[SC_BLOCK_REMAP]);
+	put_total("Macros:", &t[SC_BLOCK_MACRO]);
+	retval = EXIT_SUCCESS;
+
+free_cov:
+	sim_coverage_free(&cov);
+
+free_cfg:
+	sc_config_free(&cfg);
+
+ret:
+	free_source(&src);
+	return retval;
+}
@@ -2,15 +2,16 @@
 
 #include "hid_tokens.h"
 #include "macro_tokens.h"
+#include "config.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
 
-/* File buffer */
+/* File buffer, grown to fit the config */
 #define FILE_BUFSIZ (16 * 1024)
-static unsigned char filebuf[FILE_BUFSIZ];
+static unsigned char *filebuf;
 
 /* Block types */
 #define BLOCK_NONE     0xff
@@ -21,7 +22,6 @@ static unsigned char filebuf[FILE_BUFSIZ];
 static FILE *fout = NULL;
 static const char *protocols[2] = { "xt", "at" };
 static const char *sets[8] = { "set1", "set2", "set3", "set2ext", "INVALIDSET", "INVALIDSET", "INVALIDSET", "INVALIDSET" };
-static const char *metas[4] = { "CTRL", "SHIFT", "ALT", "GUI" };
 static const char *hmetas[8] = {
 	"LCTRL", "LSHIFT", "LALT", "LGUI",
 	"RCTRL", "RSHIFT", "RALT", "RGUI"
@@ -93,39 +93,6 @@ ret:
 	return ret;
 }
 
-static char *get_macro_match_metas(unsigned char desired, unsigned char matched)
-{
-	char *ret = NULL;
-	unsigned int mask, i;
-	unsigned char unhanded = (unsigned char)((desired & ~matched) & 0xf0);
-
-	for (i = 0; i < 4; i++) {
-		mask = (unsigned int)((1 << (i + 4)) | (1 << i));
-		if (unhanded & mask) {
-			ret = string_append(ret, metas[i], 1);
-			if (!ret) goto ret;
-			desired &= (unsigned char)~mask;
-			matched &= (unsigned char)~mask;
-		}
-	}
-
-	for (i = 0; i < 8; i++) {
-		mask = (unsigned char)(1 << i);
-		if (matched & mask) {
-			if (!(desired & mask)) {
-				ret = string_append(ret, "-", 0);
-				if (!ret) goto ret;
-			}
-
-			ret = string_append(ret, hmetas[i], 1);
-			if (!ret) goto ret;
-		}
-	}
-
-ret:
-	return ret;
-}
-
 static char *get_macrostep_metas(int val)
 {
 	unsigned int i;
@@ -133,7 +100,7 @@ static char *get_macrostep_metas(int val)
 
 	for (i = 0; i < 8; i++) {
 		if (val & (1 << i)) {
-			ret = string_append(ret, metas[i], 1);
+			ret = string_append(ret, hmetas[i], 1);
 			if (!ret) goto ret;
 		}
 	}
@@ -250,7 +217,7 @@ err:
  */
 static int process_macro(const unsigned char *buf, const unsigned char *bufend)
 {
-	char *s;
+	char *s, metas[SC_META_NAMES_LEN];
 	unsigned int buflen, i, j;
 
 	buflen = (unsigned int)(bufend - buf);
@@ -259,12 +226,11 @@ static int process_macro(const unsigned char *buf, const unsigned char *bufend)
 		goto err;
 	}
 
-	s = get_macro_match_metas(buf[1], buf[2]);
-	if (!s) goto err;
-
-	fprintf(fout, "macro %s %s # %02X %02X\n",
-	        lookup_hid_token_by_value(buf[0]), s, buf[1], buf[2]);
-	free(s);
+	/* No metas (i.e. any) gives an empty string */
+	sc_macro_meta_names(buf[1], buf[2], metas);
+	fprintf(fout, "macro %s %s%s # %02X %02X\n",
+	        lookup_hid_token_by_value(buf[0]), metas, *metas ? " " : "",
+	        buf[1], buf[2]);
 
 	i = (unsigned int)(5 + (((buf[3] & 0x3f) + (buf[4] & 0x3f)) << 1));
 	if (buflen < i) {
@@ -283,7 +249,7 @@ static int process_macro(const unsigned char *buf, const unsigned char *bufend)
 	/* Releases */
 	if (buf[4] & 0x3f) {
 		fprintf(fout, "onbreak%s\n",
-		        (buf[4] & 0x40) ? "" : " norestoremeta");
+		        (buf[4] & 0x80) ? "" : " norestoremeta");
 	}
 
 	for (i = 0; i < (buf[4] & 0x3f); i++, j += 2) {
@@ -433,12 +399,45 @@ ret:
 	return ret;
 }
 
+/**
+ * Read the whole of \a fp into filebuf, however big the EEPROM was.
+ *
+ * \return the length read, or -1 on error.
+ */
+static long read_file(FILE *fp)
+{
+	unsigned char *tmp;
+	size_t len = 0, size = 0, n;
+
+	for (;;) {
+		if (len == size) {
+			size = size ? 2 * size : FILE_BUFSIZ;
+			if (!(tmp = realloc(filebuf, size))) {
+				fputs("error: out of memory\n", stderr);
+				return -1;
+			}
+			filebuf = tmp;
+		}
+
+		if (!(n = fread(filebuf + len, 1, size - len, fp)))
+			break;
+		len += n;
+	}
+
+	if (ferror(fp)) {
+		fputs("error: could not read input file\n", stderr);
+		return -1;
+	}
+
+	return (long)len;
+}
+
 int main(int argc, char** argv)
 {
 	FILE *fp;
-	size_t buflen;
+	long buflen;
 
-	puts("scdis v1.10");
+	fputs("scdis v1.10\n", stderr);
 	fout = stdout;
 
 	if (argc != 2 && argc != 3) {
@@ -446,14 +445,17 @@ int main(int argc, char** argv)
 		exit(EXIT_FAILURE);
 	}
 
-	fp = fopen(argv[1], "rb");
+	/* "-" reads the config from stdin (e.g. from sctool read -) */
+	if (!strcmp(argv[1], "-")) fp = stdin;
+	else fp = fopen(argv[1], "rb");
 	if (!fp) {
 		fprintf(stderr, "error: could not open input file %s\n", argv[1]);
 		exit(EXIT_FAILURE);
 	}
 
-	buflen = fread(filebuf, 1, FILE_BUFSIZ, fp);
-	fclose(fp);
+	buflen = read_file(fp);
+	if (fp != stdin) fclose(fp);
+	if (buflen < 0) exit(EXIT_FAILURE);
 
 	if (argc == 3) {
 		fout = fopen(argv[2], "w+");
@@ -463,12 +465,14 @@ int main(int argc, char** argv)
 		}
 	}
 
-	if (process_file(filebuf, buflen)) {
+	if (process_file(filebuf, (size_t)buflen)) {
 		fclose(fout);
+		free(filebuf);
 		fputs("errors encountered, see output file\n", stderr);
 		exit(EXIT_FAILURE);
 	}
 
 	fclose(fout);
+	free(filebuf);
 	return 0;
 }
@@ -0,0 +1,572 @@
+/**
+ * sctools: Generate synthetic configs
+ * Copyright (C) 2016 Tim Hentenaar.
+ *
+ * This code is licenced under the Simplified BSD License.
+ * See the LICENSE file for details.
+ *
+ * Writes a tree of valid config sources, of a given size and shape,
+ * for testing and benchmarking the tools (and the converter) on configs
+ * much bigger than anyone writes by hand. The same options and seed
+ * always give the same tree.
+ *
+ * main.sc starts with a layerblock for FN1..FNn, and a base layer
+ * remapblock putting FN1..FNn, then SELECT_0..SELECT_n, on F13 and
+ * up. Then come the variants: one for any select and keyboard, one
+ * for each select (ifselect), and one for each keyboard ID
+ * (ifkeyboard). Each remaps a share of the keys on every layer, and
+ * has a number of macros, made of random steps. With an include
+ * depth, main.sc includes include1.sc, which includes include2.sc,
+ * and so on, and the variants are spread across the files.
+ *
+ * The size of each block is worked out as scas will encode it, so
+ * blocks are split before they'd go over 255 bytes, macros never go
+ * over 63 steps, and a config can be filled up to a given size (e.g.
+ * the size of the EEPROM) with more macros.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "hid_tokens.h"
+
+#define MAX_BLOCK     255
+#define MAX_STEPS     63
+#define MAX_DEPTH     16
+#define MAX_KEYBOARDS 64
+
+/* Keys to remap, and make macros for: A..PAD_EQUALS */
+#define FIRST_KEY     0x04
+#define N_KEYS        100
+
+/* F13 and up have FN1..FNn, then SELECT_0..SELECT_n on them */
+#define FIRST_TRIGGER 0x68
+#define HID_FN1       0xd0
+#define HID_SELECT_0  0xd8
+
+#define DIST_UNIFORM   0
+#define DIST_GEOMETRIC 1
+#define DIST_MAX       2
+
+/* Up to this many metas pushed by a macro */
+#define MAX_PUSHED    4
+
+struct options {
+	unsigned long  seed;
+	unsigned int   remaps;      /* % of the keys remapped on each layer */
+	unsigned int   layers;
+	unsigned int   macros;      /* per variant */
+	unsigned int   min_steps, max_steps;
+	int            dist;
+	unsigned int   selects, keyboards, depth;
+	unsigned long  fill;
+	const char    *dir;
+};
+
+struct gen {
+	const struct options *o;
+	unsigned long  rng;
+	FILE          *fp;
+	unsigned int   hdr;         /* block header size, for the variant */
+	unsigned int   block_len;   /* macroblock being written, or 0 */
+	unsigned long  blocks, bytes, macros, steps;
+};
+
+static const char *usage[] = {
+	"usage: scgen [options] <directory>\n\n",
+	"  Options:\n",
+	"    --seed <n>           Random seed (default: 1)\n",
+	"    --remaps <pct>       % of the keys remapped on each layer\n",
+	"                         (default: 25)\n",
+	"    --layers <n>         FN layers, 0-8 (default: 2)\n",
+	"    --macros <n>         Macros in each variant (default: 16)\n",
+	"    --steps <min>:<max>  Steps in each macro, 1-63 (default: 1:8)\n",
+	"    --dist <dist>        How the steps are distributed: uniform\n",
+	"                         (default), geometric, or max\n",
+	"    --selects <n>        A variant for selects 1..n, 0-7\n",
+	"    --keyboards <n>      A variant for n keyboard IDs\n",
+	"    --depth <n>          Include depth (default: 0)\n",
+	"    --fill <bytes>       Add macros until the config is this big\n",
+	NULL
+};
+
+static const char *metas[] = {
+	"LCTRL", "LSHIFT", "LALT", "LGUI", "RCTRL", "RSHIFT", "RALT", "RGUI",
+	"CTRL", "SHIFT", "ALT", "GUI"
+};
+
+static const char *meta_ops[] = {
+	"SET_META", "CLEAR_META", "TOGGLE_META", "ASSIGN_META"
+};
+
+/* What the macros match */
+static const char *matches[] = {
+	"", " CTRL", " SHIFT", " ALT", " GUI", " -LSHIFT RALT",
+	" LCTRL -RCTRL", " SHIFT -CTRL"
+};
+
+#define N_ELEMENTS(X) (sizeof(X) / sizeof((X)[0]))
+
+/* {{{ Random numbers (xorshift, so a seed gives the same tree anywhere) */
+static void seed_random(struct gen *g, unsigned long seed)
+{
+	g->rng = ((seed * 2654435761UL) ^ 0x5eed) & 0xffffffffUL;
+	if (!g->rng) g->rng = 1;
+}
+
+static unsigned int random_below(struct gen *g, unsigned int n)
+{
+	g->rng ^= (g->rng << 13) & 0xffffffffUL;
+	g->rng ^= g->rng >> 17;
+	g->rng ^= (g->rng << 5) & 0xffffffffUL;
+	return (unsigned int)(g->rng % n);
+}
+
+static const char *random_key(struct gen *g)
+{
+	return lookup_hid_token_by_value(
+		(int)(FIRST_KEY + random_below(g, N_KEYS)));
+}
+
+/**
+ * Draw the number of steps for a macro, from the distribution.
+ */
+static unsigned int random_steps(struct gen *g)
+{
+	unsigned int n = g->o->min_steps;
+
+	switch (g->o->dist) {
+	case DIST_UNIFORM:
+		n += random_below(g, g->o->max_steps - n + 1);
+	break;
+	case DIST_GEOMETRIC:
+		while (n < g->o->max_steps && random_below(g, 2)) ++n;
+	break;
+	case DIST_MAX:
+		n = g->o->max_steps;
+	break;
+	}
+
+	return n;
+}
+/* }}} */
+
+/* {{{ write_layers */
+/**
+ * Write the layerblock, and the base layer remaps for the FN and
+ * SELECT keys.
+ */
+static void write_layers(struct gen *g)
+{
+	unsigned int i, n = g->o->layers;
+
+	if (n) {
+		fputs("layerblock\n", g->fp);
+		for (i = 1; i <= n; i++)
+			fprintf(g->fp, "\tFN%u %u\n", i, i);
+		fputs("endblock\n\n", g->fp);
+		g->bytes += 3 + 2 * n;
+		++g->blocks;
+	}
+
+	if (g->o->selects) n += g->o->selects + 1;
+	if (!n) return;
+
+	fputs("remapblock\nlayer 0\n", g->fp);
+	for (i = 0; i < n; i++) {
+		fprintf(g->fp, "\t%s %s\n",
+		        lookup_hid_token_by_value((int)(FIRST_TRIGGER + i)),
+		        lookup_hid_token_by_value((int)(i < g->o->layers
+		            ? HID_FN1 + i : HID_SELECT_0 + i - g->o->layers)));
+	}
+	fputs("endblock\n", g->fp);
+	g->bytes += 4 + 2 * n;
+	++g->blocks;
+}
+/* }}} */
+
+/* {{{ write_remaps */
+/**
+ * Remap a share of the keys on a layer, in as many blocks as it takes.
+ */
+static void write_remaps(struct gen *g, unsigned int layer)
+{
+	unsigned char keys[N_KEYS], t;
+	unsigned int i, j, n, per_block;
+
+	/* Pick the keys by shuffling them, and taking the first n */
+	for (i = 0; i < N_KEYS; i++)
+		keys[i] = (unsigned char)(FIRST_KEY + i);
+	n = N_KEYS * g->o->remaps / 100;
+	for (i = 0; i < n; i++) {
+		j       = i + random_below(g, N_KEYS - i);
+		t       = keys[i];
+		keys[i] = keys[j];
+		keys[j] = t;
+	}
+
+	per_block = (MAX_BLOCK - g->hdr - 2) / 2;
+	for (i = 0; i < n; i++) {
+		if (!(i % per_block)) {
+			if (i) fputs("endblock\n", g->fp);
+			fprintf(g->fp, "remapblock\nlayer %u\n", layer);
+			g->bytes += g->hdr + 2;
+			++g->blocks;
+		}
+
+		fprintf(g->fp, "\t%s %s\n", lookup_hid_token_by_value(keys[i]),
+		        random_key(g));
+		g->bytes += 2;
+	}
+
+	if (n) fputs("endblock\n", g->fp);
+}
+/* }}} */
+
+/* {{{ Macros */
+/**
+ * Write a random step. Any metas pushed are popped by the last step.
+ */
+static void write_step(struct gen *g, unsigned int *pushed, int last)
+{
+	unsigned int r = random_below(g, 100);
+	const char *push = "";
+
+	++g->steps;
+	if (last && *pushed) {
+		fputs("\tPOP_ALL_META\n", g->fp);
+		*pushed = 0;
+		return;
+	}
+
+	if (r >= 85 && *pushed) {
+		fputs("\tPOP_META\n", g->fp);
+		--*pushed;
+		return;
+	}
+
+	if (r >= 70 && r < 85 && !last && *pushed < MAX_PUSHED) {
+		push = "PUSH_META ";
+		++*pushed;
+		r = random_below(g, 70);
+	}
+
+	if (r >= 55 && r < 70) {
+		fprintf(g->fp, "\t%s%s %s\n", push,
+		        meta_ops[random_below(g, N_ELEMENTS(meta_ops))],
+		        metas[random_below(g, N_ELEMENTS(metas))]);
+	} else if (r >= 45 && r < 55 && !*push) {
+		fprintf(g->fp, "\tDELAY %u\n", 1 + random_below(g, 50));
+	} else fprintf(g->fp, "\t%sPRESS %s\n", push, random_key(g));
+}
+
+/**
+ * Get the bytes a macro of \a len bytes adds to the config, including
+ * the header of a new block, if it needs one.
+ */
+static unsigned int macro_cost(const struct gen *g, unsigned int len)
+{
+	if (g->block_len && g->block_len + len <= MAX_BLOCK)
+		return len;
+	return g->hdr + 1 + len;
+}
+
+static void end_macros(struct gen *g)
+{
+	if (!g->block_len) return;
+	fputs("endblock\n", g->fp);
+	g->block_len = 0;
+}
+
+static void write_macro(struct gen *g, unsigned int n_press,
+                        unsigned int n_release)
+{
+	unsigned int i, pushed = 0, len = 5 + 2 * (n_press + n_release);
+
+	if (macro_cost(g, len) != len) {
+		end_macros(g);
+		fputs("macroblock\n", g->fp);
+		g->block_len = g->hdr + 1;
+		g->bytes    += g->block_len;
+		++g->blocks;
+	}
+
+	fprintf(g->fp, "macro %s%s\n", random_key(g),
+	        matches[random_below(g, N_ELEMENTS(matches))]);
+	for (i = 0; i < n_press; i++)
+		write_step(g, &pushed, i + 1 == n_press);
+
+	if (n_release) {
+		fprintf(g->fp, "onbreak%s\n",
+		        random_below(g, 4) ? "" : " norestoremeta");
+		for (i = 0; i < n_release; i++)
+			write_step(g, &pushed, i + 1 == n_release);
+	}
+
+	fputs("endmacro\n", g->fp);
+	g->block_len += len;
+	g->bytes     += len;
+	++g->macros;
+}
+
+/**
+ * Write a random macro. Half of them have onbreak steps, as many as
+ * will fit in a block with the press steps.
+ */
+static void write_random_macro(struct gen *g)
+{
+	unsigned int n_press, n_release = 0, room;
+
+	n_press = random_steps(g);
+	room    = (MAX_BLOCK - g->hdr - 1 - 5) / 2 - n_press;
+	if (random_below(g, 2)) {
+		n_release = random_steps(g);
+		if (n_release > room) n_release = room;
+	}
+
+	write_macro(g, n_press, n_release);
+}
+/* }}} */
+
+/* {{{ write_variant */
+/**
+ * Write the remaps and macros for a select (or 0 for any), and a
+ * keyboard ID (or 0 for any).
+ */
+static void write_variant(struct gen *g, unsigned int select,
+                          unsigned int keyboard)
+{
+	unsigned int i;
+
+	fputs("\n", g->fp);
+	if (select) fprintf(g->fp, "ifselect %u\n", select);
+	else fputs("ifselect any\n", g->fp);
+	if (keyboard) fprintf(g->fp, "ifkeyboard %04X\n", keyboard);
+	else fputs("ifkeyboard any\n", g->fp);
+
+	g->hdr = keyboard ? 4 : 2;
+	for (i = 0; i <= g->o->layers; i++)
+		write_remaps(g, i);
+
+	for (i = 0; i < g->o->macros; i++)
+		write_random_macro(g);
+	end_macros(g);
+}
+/* }}} */
+
+/* {{{ write_fill */
+/**
+ * Add macros for any select and keyboard until the config is as big
+ * as it's meant to be, or as close to it as it can get.
+ */
+static void write_fill(struct gen *g)
+{
+	unsigned long total;
+	unsigned int n;
+
+	fputs("\n# Filler\nifselect any\nifkeyboard any\n", g->fp);
+	g->hdr = 2;
+
+	for (;;) {
+		total = 6 + g->bytes;
+		if (total >= g->o->fill) break;
+
+		for (n = random_steps(g);
+		     n > 1 && macro_cost(g, 5 + 2 * n) > g->o->fill - total; n--);
+		if (macro_cost(g, 5 + 2 * n) > g->o->fill - total)
+			break;
+		write_macro(g, n, 0);
+	}
+
+	end_macros(g);
+}
+/* }}} */
+
+/* {{{ parse_options */
+static int parse_uint(const char *s, unsigned int min, unsigned int max,
+                      unsigned int *v)
+{
+	char *end;
+	unsigned long x = strtoul(s, &end, 0);
+
+	if (end == s || *end || x < min || x > max) {
+		fprintf(stderr, "%s: should be %u-%u\n", s, min, max);
+		return -1;
+	}
+
+	*v = (unsigned int)x;
+	return 0;
+}
+
+static int parse_options(struct options *o, int argc, char **argv)
+{
+	int i;
+	char *end;
+
+	memset(o, 0, sizeof(*o));
+	o->seed      = 1;
+	o->remaps    = 25;
+	o->layers    = 2;
+	o->macros    = 16;
+	o->min_steps = 1;
+	o->max_steps = 8;
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--seed") && i + 1 < argc) {
+			o->seed = strtoul(argv[++i], NULL, 0);
+		} else if (!strcmp(argv[i], "--remaps") && i + 1 < argc) {
+			if (parse_uint(argv[++i], 0, 100, &o->remaps)) return -1;
+		} else if (!strcmp(argv[i], "--layers") && i + 1 < argc) {
+			if (parse_uint(argv[++i], 0, 8, &o->layers)) return -1;
+		} else if (!strcmp(argv[i], "--macros") && i + 1 < argc) {
+			if (parse_uint(argv[++i], 0, 65535, &o->macros)) return -1;
+		} else if (!strcmp(argv[i], "--steps") && i + 1 < argc) {
+			o->min_steps = (unsigned int)strtoul(argv[++i], &end, 10);
+			o->max_steps = o->min_steps;
+			if (*end == ':')
+				o->max_steps = (unsigned int)strtoul(end + 1, &end, 10);
+			if (*end || !o->min_steps || o->max_steps > MAX_STEPS ||
+			    o->min_steps > o->max_steps) {
+				fprintf(stderr, "%s: should be <min>:<max>, 1-%d\n",
+				        argv[i], MAX_STEPS);
+				return -1;
+			}
+		} else if (!strcmp(argv[i], "--dist") && i + 1 < argc) {
+			++i;
+			if (!strcmp(argv[i], "uniform")) o->dist = DIST_UNIFORM;
+			else if (!strcmp(argv[i], "geometric")) o->dist = DIST_GEOMETRIC;
+			else if (!strcmp(argv[i], "max")) o->dist = DIST_MAX;
+			else {
+				fprintf(stderr, "%s: unknown distribution\n", argv[i]);
+				return -1;
+			}
+		} else if (!strcmp(argv[i], "--selects") && i + 1 < argc) {
+			if (parse_uint(argv[++i], 0, 7, &o->selects)) return -1;
+		} else if (!strcmp(argv[i], "--keyboards") && i + 1 < argc) {
+			if (parse_uint(argv[++i], 0, MAX_KEYBOARDS, &o->keyboards))
+				return -1;
+		} else if (!strcmp(argv[i], "--depth") && i + 1 < argc) {
+			if (parse_uint(argv[++i], 0, MAX_DEPTH, &o->depth)) return -1;
+		} else if (!strcmp(argv[i], "--fill") && i + 1 < argc) {
+			o->fill = strtoul(argv[++i], NULL, 0);
+		} else if (argv[i][0] == '-' && argv[i][1]) {
+			return -1;
+		} else if (!o->dir) {
+			o->dir = argv[i];
+		} else return -1;
+	}
+
+	return o->dir ? 0 : -1;
+}
+/* }}} */
+
+static void write_header(FILE *fp, const struct options *o)
+{
+	static const char *dists[] = { "uniform", "geometric", "max" };
+
+	fprintf(fp, "# Generated by: scgen --seed %lu --remaps %u --layers %u "
+	        "--macros %u --steps %u:%u --dist %s --selects %u "
+	        "--keyboards %u --depth %u --fill %lu\n"
+	        "# Includes are relative to this directory, so assemble it "
+	        "from here.\n\n", o->seed, o->remaps, o->layers, o->macros,
+	        o->min_steps, o->max_steps, dists[o->dist], o->selects,
+	        o->keyboards, o->depth, o->fill);
+}
+
+int main(int argc, char **argv)
+{
+	struct options o;
+	struct gen g;
+	FILE *files[MAX_DEPTH + 1];
+	unsigned int keyboards[MAX_KEYBOARDS];
+	unsigned int i, j, n_files = 0, n_variants;
+	char *path = NULL;
+	int retval = EXIT_FAILURE;
+
+	fputs("scgen v1.10\n", stderr);
+	if (parse_options(&o, argc, argv)) {
+		for (i = 0; usage[i]; i++)
+			fputs(usage[i], stderr);
+		goto ret;
+	}
+
+	if (mkdir(o.dir, 0755) && errno != EEXIST) {
+		fprintf(stderr, "Unable to create '%s': %s\n", o.dir,
+		        strerror(errno));
+		goto ret;
+	}
+
+	if (!(path = malloc(strlen(o.dir) + 32))) {
+		fputs("Unable to allocate memory for the paths\n", stderr);
+		goto ret;
+	}
+
+	for (n_files = 0; n_files <= o.depth; n_files++) {
+		if (n_files) sprintf(path, "%s/include%u.sc", o.dir, n_files);
+		else sprintf(path, "%s/main.sc", o.dir);
+
+		if (!(files[n_files] = fopen(path, "w"))) {
+			fprintf(stderr, "Unable to open '%s'\n", path);
+			goto close;
+		}
+	}
+
+	memset(&g, 0, sizeof(g));
+	g.o = &o;
+	seed_random(&g, o.seed);
+
+	/* Keyboard IDs (distinct, and neither 0 nor FFFF) */
+	for (i = 0; i < o.keyboards; i++) {
+		do {
+			keyboards[i] = 1 + random_below(&g, 0xfffe);
+			for (j = 0; j < i && keyboards[j] != keyboards[i]; j++);
+		} while (j < i);
+	}
+
+	g.fp = files[0];
+	write_header(g.fp, &o);
+	write_layers(&g);
+
+	/* Spread the variants across the files */
+	n_variants = 1 + o.selects + o.keyboards;
+	for (i = 0; i < n_variants; i++) {
+		g.fp = files[i % n_files];
+		if (i <= o.selects) write_variant(&g, i, 0);
+		else write_variant(&g, 0, keyboards[i - o.selects - 1]);
+	}
+
+	for (i = 1; i < n_files; i++)
+		fprintf(files[i - 1], "\ninclude include%u.sc\n", i);
+
+	if (6 + g.bytes > o.fill && o.fill)
+		fprintf(stderr, "Warning: the config is already %lu bytes\n",
+		        6 + g.bytes);
+	else if (o.fill) {
+		g.fp = files[n_files - 1];
+		write_fill(&g);
+	}
+
+	for (i = 0; i < n_files; i++) {
+		if (fflush(files[i]) || ferror(files[i])) {
+			fprintf(stderr, "Unable to write the config to '%s'\n", o.dir);
+			goto close;
+		}
+	}
+
+	fprintf(stderr, "Wrote %u file%s: %lu blocks, %lu macros (%lu steps), "
+	        "%lu bytes assembled\n", n_files, n_files == 1 ? "" : "s",
+	        g.blocks, g.macros, g.steps, 6 + g.bytes);
+	retval = EXIT_SUCCESS;
+
+close:
+	for (i = 0; i < n_files; i++)
+		fclose(files[i]);
+
+ret:
+	free(path);
+	return retval;
+}
@@ -0,0 +1,488 @@
+/**
+ * sctools: Run a binary config on a keyboard, in software
+ * Copyright (C) 2016 Tim Hentenaar.
+ *
+ * This code is licenced under the Simplified BSD License.
+ * See the LICENSE file for details.
+ *
+ * Takes keyboards' events from evdev, feeds them through a binary
+ * config as the converter would, and sends what comes out from a
+ * virtual keyboard made with uinput. Keys with no HID code pass
+ * through unchanged, and the host's LEDs are passed back to the
+ * keyboards.
+ *
+ * Everything happens on one thread, waiting in epoll: a read of a
+ * keyboard's events is answered with one write to the virtual
+ * keyboard, and nothing is allocated once it's running. What macro
+ * delays hold back waits in a ring, and is sent when it's due.
+ *
+ * The time each key takes, from the kernel's timestamp on its event
+ * to the write to the virtual keyboard, is printed on exit, or on
+ * SIGUSR1.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+
+#include "config.h"
+#include "sim.h"
+#include "evdev.h"
+#include "histogram.h"
+#include "monotime.h"
+#include "realtime.h"
+
+#if defined(HAVE_LINUX_UINPUT_H) && defined(HAVE_SYS_EPOLL_H)
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#ifndef input_event_sec
+#define input_event_sec  time.tv_sec
+#define input_event_usec time.tv_usec
+#endif /* input_event_sec */
+
+#define MAX_KEYBOARDS 16
+#define READ_EVENTS   64
+#define DEFER_SIZE    1024 /* power of 2 */
+#define UINPUT_INDEX  MAX_KEYBOARDS
+
+struct options {
+	unsigned char  set;
+	int            keyboard;
+	int            grab;
+	int            cpu;
+	const char    *name;
+	const char    *config;
+	const char    *path[MAX_KEYBOARDS];
+	unsigned int   n_paths;
+};
+
+/* Keys passed through, as deferred events: code is the key */
+#define PASS_DOWN 'D'
+#define PASS_UP   'U'
+
+/* An output event held back by a macro delay */
+struct deferred {
+	uint64_t       due;
+	int            type;
+	unsigned short code;
+};
+
+struct sckbd {
+	struct sim       sim;
+	struct uinput    out;
+	int              epfd;
+	int              fd[MAX_KEYBOARDS];
+	const char      *path[MAX_KEYBOARDS];
+	unsigned int     n_fd, n_open;
+	uint64_t         now;       /* when the current events were read */
+
+	struct deferred  defer[DEFER_SIZE];
+	unsigned long    head, tail;
+
+	unsigned long    passed;    /* keys passed through                */
+	unsigned long    deferred;  /* output events held back            */
+	unsigned long    overflows; /* sent early, as the ring was full   */
+	struct histogram latency;   /* event timestamp to write           */
+	struct histogram work;      /* read to write                      */
+};
+
+/* In two, to stay within C90's limit */
+static const char *usage[] = {
+	"usage: sckbd [options] <binary_config> <device> [<device>...]\n\n"
+	"  Options:\n"
+	"    --set <set>          Keyboard's set: set1, set2 (default),\n"
+	"                         set3, or set2ext\n"
+	"    --keyboard <id>      Keyboard ID, for ifkeyboard blocks\n",
+	"    --name <name>        Name of the virtual keyboard\n"
+	"    --no-grab            Don't take the keyboards for ourselves\n"
+	"    --realtime           Run at real-time priority, on one CPU\n"
+	"    --cpu <n>            CPU to run on (implies --realtime)\n\n"
+	"  Devices are evdev keyboards, e.g. /dev/input/event3.\n"
+};
+
+static struct sckbd kbd;
+static volatile sig_atomic_t stop = 0;
+static volatile sig_atomic_t dump = 0;
+
+static void on_signal(int sig)
+{
+	if (sig == SIGUSR1) dump = 1;
+	else stop = 1;
+}
+
+static uint64_t event_time(const struct input_event *ev)
+{
+	return (uint64_t)ev->input_event_sec * NS_PER_S +
+	       (uint64_t)ev->input_event_usec * NS_PER_US;
+}
+
+static void send_event(struct sckbd *k, int type, unsigned short code)
+{
+	if (type == PASS_DOWN || type == PASS_UP)
+		uinput_key(&k->out, code, type == PASS_DOWN);
+	else uinput_event(&k->out, type, (unsigned char)code);
+}
+
+/* {{{ put_event */
+/**
+ * Send an output event, or hold it back until \a due if a macro delay
+ * has put the simulator ahead of us. Once anything is held back,
+ * everything after it is too, so the order is kept.
+ */
+static void put_event(struct sckbd *k, uint64_t due, int type,
+                      unsigned short code)
+{
+	struct deferred *d;
+
+	if (due <= k->now && k->head == k->tail) {
+		send_event(k, type, code);
+		return;
+	}
+
+	if (k->tail - k->head == DEFER_SIZE) {
+		++k->overflows;
+		send_event(k, type, code);
+		return;
+	}
+
+	d = &k->defer[k->tail++ & (DEFER_SIZE - 1)];
+	d->due  = due;
+	d->type = type;
+	d->code = code;
+	++k->deferred;
+}
+/* }}} */
+
+static void sim_event(struct sim *s, int type, unsigned char code, void *ctx)
+{
+	put_event(ctx, s->time, type, code);
+}
+
+/**
+ * Send whatever is due, and flush the virtual keyboard.
+ */
+static void send_due(struct sckbd *k, uint64_t now)
+{
+	struct deferred *d;
+
+	while (k->head != k->tail) {
+		d = &k->defer[k->head & (DEFER_SIZE - 1)];
+		if (d->due > now) break;
+		send_event(k, d->type, d->code);
+		++k->head;
+	}
+
+	uinput_flush(&k->out);
+}
+
+/**
+ * How long to wait for events (ms): until the next deferred event is
+ * due, or forever.
+ */
+static int next_timeout(const struct sckbd *k)
+{
+	uint64_t now, due;
+
+	if (k->head == k->tail) return -1;
+	now = monotime_ns();
+	due = k->defer[k->head & (DEFER_SIZE - 1)].due;
+	return due <= now ? 0 : (int)((due - now + NS_PER_MS - 1) / NS_PER_MS);
+}
+
+static void drop_keyboard(struct sckbd *k, unsigned int i)
+{
+	evdev_close(k->fd[i]);
+	k->fd[i] = -1;
+	--k->n_open;
+}
+
+/* {{{ read_keyboard */
+static void read_keyboard(struct sckbd *k, unsigned int i)
+{
+	struct input_event ev[READ_EVENTS];
+	uint64_t when[READ_EVENTS], t, done;
+	unsigned int j, n, keys = 0;
+	ssize_t len;
+	int hid;
+
+	if ((len = read(k->fd[i], ev, sizeof(ev))) <= 0) {
+		if (len < 0 && (errno == EAGAIN || errno == EINTR)) return;
+		fprintf(stderr, "%s: %s\n", k->path[i],
+		        len ? strerror(errno) : "gone");
+		drop_keyboard(k, i);
+		return;
+	}
+
+	k->now = monotime_ns();
+	n = (unsigned int)((size_t)len / sizeof(*ev));
+	for (j = 0; j < n; j++) {
+		/* The virtual keyboard does its own autorepeat */
+		if (ev[j].type != EV_KEY || ev[j].value == 2)
+			continue;
+
+		t = event_time(&ev[j]);
+		if (!t || t > k->now) t = k->now;
+		when[keys++] = t;
+
+		if ((hid = evdev_hid(ev[j].code)) < 0) {
+			put_event(k, t, ev[j].value ? PASS_DOWN : PASS_UP,
+			          ev[j].code);
+			++k->passed;
+		} else sim_key(&k->sim, (unsigned char)hid, ev[j].value, t);
+	}
+
+	if (!keys) return;
+	send_due(k, k->now);
+
+	done = monotime_ns();
+	hist_add(&k->work, done - k->now);
+	for (j = 0; j < keys; j++)
+		hist_add(&k->latency, done - when[j]);
+}
+/* }}} */
+
+/* {{{ read_leds */
+/**
+ * Pass the host's LEDs on to the keyboards.
+ */
+static void read_leds(struct sckbd *k)
+{
+	struct input_event ev[READ_EVENTS], led[2];
+	unsigned int i, j, n;
+	ssize_t len;
+
+	if ((len = read(k->out.fd, ev, sizeof(ev))) <= 0)
+		return;
+
+	memset(led, 0, sizeof(led));
+	led[1].type = EV_SYN;
+	led[1].code = SYN_REPORT;
+
+	n = (unsigned int)((size_t)len / sizeof(*ev));
+	for (j = 0; j < n; j++) {
+		if (ev[j].type != EV_LED) continue;
+		led[0] = ev[j];
+
+		/* Keyboards we could only open read-only go without */
+		for (i = 0; i < k->n_fd; i++) {
+			if (k->fd[i] >= 0)
+				len = write(k->fd[i], led, sizeof(led));
+		}
+	}
+}
+/* }}} */
+
+static void print_stats(const struct sckbd *k)
+{
+	fprintf(stderr, "Keys in: %lu, out: %lu, passed through: %lu\n"
+	        "Macros: %lu, deferred events: %lu",
+	        k->sim.stats.in + k->passed, k->out.keys, k->passed,
+	        k->sim.stats.macros, k->deferred);
+	if (k->overflows)
+		fprintf(stderr, " (%lu sent early)", k->overflows);
+	if (k->out.unmapped)
+		fprintf(stderr, ", HID codes with no key: %lu", k->out.unmapped);
+	fputc('\n', stderr);
+
+	hist_print(stderr, "Latency (event to virtual keyboard)", &k->latency);
+	hist_print(stderr, "Processing (read to write)", &k->work);
+}
+
+/* {{{ parse_options */
+static int parse_options(struct options *o, int argc, char **argv)
+{
+	int i, set;
+
+	memset(o, 0, sizeof(*o));
+	o->keyboard = -1;
+	o->grab     = 1;
+	o->cpu      = -1;
+	o->name     = "sckbd virtual keyboard";
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--set") && i + 1 < argc) {
+			if ((set = sc_config_set_by_name(argv[++i])) < 0) {
+				fprintf(stderr, "%s: unknown set\n", argv[i]);
+				return -1;
+			}
+			o->set = (unsigned char)set;
+		} else if (!strcmp(argv[i], "--keyboard") && i + 1 < argc) {
+			o->keyboard = (int)strtol(argv[++i], NULL, 0);
+		} else if (!strcmp(argv[i], "--name") && i + 1 < argc) {
+			o->name = argv[++i];
+		} else if (!strcmp(argv[i], "--no-grab")) {
+			o->grab = 0;
+		} else if (!strcmp(argv[i], "--realtime")) {
+			if (o->cpu < 0) o->cpu = realtime_default_cpu();
+		} else if (!strcmp(argv[i], "--cpu") && i + 1 < argc) {
+			if ((o->cpu = atoi(argv[++i])) < 0) {
+				fprintf(stderr, "%s: invalid CPU\n", argv[i]);
+				return -1;
+			}
+		} else if (argv[i][0] == '-' && argv[i][1]) {
+			return -1;
+		} else if (!o->config) {
+			o->config = argv[i];
+		} else if (o->n_paths < MAX_KEYBOARDS) {
+			o->path[o->n_paths++] = argv[i];
+		} else {
+			fprintf(stderr, "At most %d keyboards\n", MAX_KEYBOARDS);
+			return -1;
+		}
+	}
+
+	return o->config && o->n_paths ? 0 : -1;
+}
+/* }}} */
+
+/* {{{ add_fd */
+static int add_fd(int epfd, int fd, unsigned int index)
+{
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events   = EPOLLIN;
+	ev.data.u32 = index;
+	if (!epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev))
+		return 0;
+
+	fprintf(stderr, "Unable to watch for events: %s\n", strerror(errno));
+	return -1;
+}
+/* }}} */
+
+int main(int argc, char **argv)
+{
+	struct options o;
+	struct sc_config cfg;
+	struct sckbd *k = &kbd;
+	struct epoll_event ev[MAX_KEYBOARDS + 1];
+	struct sigaction sa;
+	struct realtime rt;
+	unsigned int i;
+	int n, j, retval = EXIT_FAILURE;
+
+	fputs("sckbd v1.10\n", stderr);
+	if (parse_options(&o, argc, argv)) {
+		fputs(usage[0], stderr);
+		fputs(usage[1], stderr);
+		goto ret;
+	}
+
+	if (sc_config_load(&cfg, o.config))
+		goto ret;
+
+	if (!o.set)
+		o.set = sc_config_set(&cfg);
+
+	if (sim_init(&k->sim, &cfg, o.set, o.keyboard))
+		goto free_cfg;
+	sim_set_output(&k->sim, sim_event, k);
+
+	if ((k->epfd = epoll_create(MAX_KEYBOARDS + 1)) < 0) {
+		fprintf(stderr, "Unable to create an epoll instance: %s\n",
+		        strerror(errno));
+		goto free_sim;
+	}
+
+	for (i = 0; i < o.n_paths; i++) {
+		k->path[i] = o.path[i];
+		k->fd[i]   = -1;
+	}
+	k->n_fd = o.n_paths;
+
+	/*
+	 * Open the keyboards first: each is only grabbed once the keys held
+	 * on it (such as the Enter that started us) are released.
+	 */
+	for (i = 0; i < k->n_fd; i++) {
+		if ((k->fd[i] = evdev_open(k->path[i], o.grab)) < 0)
+			goto close_keyboards;
+		++k->n_open;
+		if (add_fd(k->epfd, k->fd[i], i))
+			goto close_keyboards;
+	}
+
+	if (uinput_open(&k->out, o.name) ||
+	    add_fd(k->epfd, k->out.fd, UINPUT_INDEX))
+		goto close_uinput;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_signal;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGUSR1, &sa, NULL);
+
+	if (o.cpu >= 0) {
+		realtime_enter(&rt, o.cpu);
+		realtime_lock(&rt);
+		realtime_print(stderr, &rt);
+	}
+
+	fprintf(stderr, "Running %s on %u keyboard%s\n", o.config, k->n_open,
+	        k->n_open == 1 ? "" : "s");
+
+	while (!stop && k->n_open && !k->out.error) {
+		if (dump) {
+			print_stats(k);
+			dump = 0;
+		}
+
+		if ((n = epoll_wait(k->epfd, ev, MAX_KEYBOARDS + 1,
+		                    next_timeout(k))) < 0) {
+			if (errno == EINTR) continue;
+			fprintf(stderr, "epoll_wait: %s\n", strerror(errno));
+			break;
+		}
+
+		for (j = 0; j < n; j++) {
+			if (ev[j].data.u32 == UINPUT_INDEX) read_leds(k);
+			else if (k->fd[ev[j].data.u32] >= 0)
+				read_keyboard(k, ev[j].data.u32);
+		}
+
+		if (k->head != k->tail)
+			send_due(k, monotime_ns());
+	}
+
+	if (k->out.error)
+		fprintf(stderr, "Unable to write to the virtual keyboard: %s\n",
+		        strerror(errno));
+	else retval = EXIT_SUCCESS;
+
+	/* Send anything still held back, rather than leave keys down */
+	send_due(k, (uint64_t)-1);
+	print_stats(k);
+	if (o.cpu >= 0) realtime_unlock(&rt);
+
+close_uinput:
+	uinput_close(&k->out);
+
+close_keyboards:
+	for (i = 0; i < k->n_fd; i++) {
+		if (k->fd[i] >= 0) evdev_close(k->fd[i]);
+	}
+	close(k->epfd);
+
+free_sim:
+	sim_free(&k->sim);
+
+free_cfg:
+	sc_config_free(&cfg);
+
+ret:
+	return retval;
+}
+
+#else /* HAVE_LINUX_UINPUT_H && HAVE_SYS_EPOLL_H */
+
+int main(void)
+{
+	fputs("sckbd needs Linux's evdev, uinput and epoll\n", stderr);
+	return EXIT_FAILURE;
+}
+#endif /* HAVE_LINUX_UINPUT_H && HAVE_SYS_EPOLL_H */
@@ -0,0 +1,495 @@
+/**
+ * sctools: Link binary configs for several keyboards into one
+ * Copyright (C) 2016 Tim Hentenaar.
+ *
+ * This code is licenced under the Simplified BSD License.
+ * See the LICENSE file for details.
+ *
+ * Each input is a binary config for one model of keyboard, tagged with
+ * the keyboard ID or set that model is known by. The output has the
+ * blocks which are the same in every input once, as they are, and the
+ * rest gated with ifkeyboard or ifset, so that each model sees exactly
+ * the blocks of its own config, in the same order.
+ *
+ * Order matters (later remaps win, and the first macro to match is
+ * run), so only the blocks common to all inputs in the same order are
+ * shared: the first input's blocks are matched in order against the
+ * rest. Each model's own blocks go between the shared ones they
+ * were between.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+
+#define MAX_INPUTS 16
+#define NO_MATCH   ((unsigned int)-1)
+#define GATED_MAX  1024 /* a block, gated, and split if need be */
+
+struct input {
+	const char      *path;
+	int              keyboard;  /* tag: ifkeyboard, or -1 */
+	unsigned char    set;       /* tag: ifset mask, or 0  */
+	struct sc_config cfg;
+	unsigned int     next;      /* next block to write    */
+	unsigned int    *match;     /* by shared block        */
+};
+
+struct link {
+	struct input   in[MAX_INPUTS];
+	unsigned int   n_in;
+	const char    *output;
+	char          *tmp;         /* written, then renamed to output */
+	FILE          *fp;
+	unsigned long  bytes, naive;
+	unsigned int   shared, gated, dropped;
+	unsigned long  shared_bytes, gated_bytes;
+	int            error;
+};
+
+static const char *usage =
+	"usage: sclink -o <binary_config> <tag> <binary_config>\n"
+	"              <tag> <binary_config> [<tag> <binary_config>...]\n\n"
+	"  Each input's tag is the model of keyboard it's for:\n"
+	"    --keyboard <id>      Keyboard ID (0x for hex)\n"
+	"    --set <set>          Keyboard's set: set1, set2, set3, or\n"
+	"                         set2ext\n";
+
+static int same_block(const struct sc_config *a, const struct sc_block *x,
+                      const struct sc_config *b, const struct sc_block *y)
+{
+	return x->length == y->length &&
+	       !memcmp(a->image + x->offset, b->image + y->offset, x->length);
+}
+
+/* {{{ entry_len */
+/**
+ * Get the length of the block entry at \a p.
+ */
+static unsigned int entry_len(const struct sc_block *b,
+                              const unsigned char *p)
+{
+	if (b->type != SC_BLOCK_MACRO)
+		return 2;
+	return 5 + 2 * (unsigned int)((p[3] & SC_MACRO_STEPS) +
+	                              (p[4] & SC_MACRO_STEPS));
+}
+/* }}} */
+
+/* {{{ gate */
+/**
+ * Encode a block, gated to one model: its header is rebuilt with the
+ * model's keyboard ID or set added to any it already had. If that
+ * makes it too large, it's split between its entries into as many
+ * blocks as it takes, in the same order.
+ *
+ * \param[out] out      Encoded block(s) (at most GATED_MAX bytes)
+ * \param[out] n_blocks Number of blocks encoded
+ * \param[in]  in       Model
+ * \param[in]  b        Block
+ * \return their length, 0 if the model would never see it, or -1 if
+ *         one of its entries is too large with the gate.
+ */
+static int gate(unsigned char *out, unsigned int *n_blocks,
+                const struct input *in, const struct sc_block *b)
+{
+	unsigned char hdr[5], set = b->set_mask;
+	int keyboard = b->keyboard;
+	unsigned int hlen = 2, prefix, count, len = 0, n;
+	const unsigned char *data, *p, *q, *end;
+
+	*n_blocks = 0;
+	if (in->keyboard >= 0) {
+		if (keyboard >= 0 && keyboard != in->keyboard)
+			return 0;
+		keyboard = in->keyboard;
+	} else {
+		set = (set & 0x0f) ? (unsigned char)(set & in->set) : in->set;
+		if (!set) return 0;
+	}
+
+	hdr[1] = (unsigned char)(b->type | (b->select << 3));
+	if (set) {
+		hdr[1] |= SC_BLOCK_HAS_SET;
+		hdr[hlen++] = set;
+	}
+
+	if (keyboard >= 0) {
+		hdr[1] |= SC_BLOCK_HAS_ID;
+		hdr[hlen++] = (unsigned char)(keyboard & 0xff);
+		hdr[hlen++] = (unsigned char)(keyboard >> 8);
+	}
+
+	/* The layer and count (remaps), or just the count, come first */
+	data   = in->cfg.image + b->offset + b->header;
+	end    = in->cfg.image + b->offset + b->length;
+	prefix = b->type == SC_BLOCK_REMAP ? 2 : 1;
+	p      = data + prefix;
+
+	do {
+		for (q = p, count = 0; q < end; q += n, count++) {
+			n = entry_len(b, q);
+			if (hlen + prefix + (unsigned int)(q - p) + n > 255)
+				break;
+		}
+
+		if (q == p && p < end)
+			return -1;
+
+		hdr[0] = (unsigned char)(hlen + prefix + (unsigned int)(q - p));
+		memcpy(out + len, hdr, hlen);
+		memcpy(out + len + hlen, data, prefix);
+		out[len + hlen + prefix - 1] = (unsigned char)count;
+		memcpy(out + len + hlen + prefix, p, (size_t)(q - p));
+		len += hdr[0];
+		++*n_blocks;
+		p = q;
+	} while (p < end);
+
+	return (int)len;
+}
+/* }}} */
+
+static void put_bytes(struct link *l, const unsigned char *p, size_t len)
+{
+	if (fwrite(p, 1, len, l->fp) != len)
+		l->error = 1;
+	l->bytes += len;
+}
+
+/* {{{ put_model_blocks */
+/**
+ * Write a model's own blocks, up to (not including) block \a end.
+ *
+ * \return 0 on success, -1 on error.
+ */
+static int put_model_blocks(struct link *l, struct input *in,
+                            unsigned int end)
+{
+	const struct sc_block *b;
+	unsigned char out[GATED_MAX];
+	unsigned int n_blocks;
+	int len;
+
+	for (; in->next < end; in->next++) {
+		b = &in->cfg.blocks[in->next];
+		if ((len = gate(out, &n_blocks, in, b)) < 0) {
+			fprintf(stderr, "%s: block at offset %lu has a macro too "
+			        "large to gate\n", in->path,
+			        (unsigned long)b->offset);
+			return -1;
+		}
+
+		if (!len) {
+			++l->dropped;
+			continue;
+		}
+
+		put_bytes(l, out, (size_t)len);
+		l->gated       += n_blocks;
+		l->gated_bytes += (unsigned long)len;
+	}
+
+	return 0;
+}
+/* }}} */
+
+/* {{{ find_shared */
+/**
+ * Find the blocks common to every input, in order.
+ *
+ * \return the number of them, or -1 on error.
+ */
+static int find_shared(struct link *l)
+{
+	const struct input *first = &l->in[0];
+	unsigned int i, j, k, n = 0, *pos;
+
+	for (i = 0; i < l->n_in; i++) {
+		if (!(l->in[i].match = malloc((first->cfg.n_blocks + 1) *
+		                              sizeof(unsigned int)))) {
+			fputs("Unable to allocate memory\n", stderr);
+			return -1;
+		}
+	}
+
+	if (!(pos = calloc(l->n_in, sizeof(*pos)))) {
+		fputs("Unable to allocate memory\n", stderr);
+		return -1;
+	}
+
+	for (i = 0; i < first->cfg.n_blocks; i++) {
+		for (k = 1; k < l->n_in; k++) {
+			l->in[k].match[n] = NO_MATCH;
+			for (j = pos[k]; j < l->in[k].cfg.n_blocks; j++) {
+				if (same_block(&first->cfg, &first->cfg.blocks[i],
+				               &l->in[k].cfg, &l->in[k].cfg.blocks[j])) {
+					l->in[k].match[n] = j;
+					break;
+				}
+			}
+			if (l->in[k].match[n] == NO_MATCH) break;
+		}
+
+		if (k < l->n_in) continue;
+		l->in[0].match[n] = i;
+		for (k = 1; k < l->n_in; k++)
+			pos[k] = l->in[k].match[n] + 1;
+		++n;
+	}
+
+	free(pos);
+	return (int)n;
+}
+/* }}} */
+
+/* {{{ check_headers */
+/**
+ * Pick the header for the output: the inputs' version, and what they
+ * force, if they agree.
+ */
+static void check_headers(const struct link *l, unsigned char *hdr)
+{
+	const struct sc_config *cfg;
+	unsigned int i;
+
+	memcpy(hdr, l->in[0].cfg.image, SC_HEADER_LEN);
+	for (i = 1; i < l->n_in; i++) {
+		cfg = &l->in[i].cfg;
+		if (cfg->version[0] != hdr[2] || cfg->version[1] != hdr[3])
+			fprintf(stderr, "%s: settings version %d.%d, not %d.%d\n",
+			        l->in[i].path, cfg->version[0], cfg->version[1],
+			        hdr[2], hdr[3]);
+
+		if (cfg->force != hdr[4] && (hdr[4] & 0x0f)) {
+			fprintf(stderr, "%s: forces a different set; the output "
+			        "won't force one\n", l->in[i].path);
+			hdr[4] &= 0xf0;
+		}
+	}
+}
+/* }}} */
+
+/* {{{ check_tag */
+/**
+ * Check a model's tag against those of the models before it: each
+ * must have its own, and all must be of the same kind, or a keyboard
+ * would see the blocks of more than one model.
+ *
+ * \return 0 if it's OK, -1 if not.
+ */
+static int check_tag(const struct link *l, int keyboard, int set)
+{
+	const struct input *in;
+	unsigned int i;
+
+	for (i = 0; i < l->n_in; i++) {
+		in = &l->in[i];
+		if ((in->keyboard >= 0) != (keyboard >= 0)) {
+			fputs("Tag every input by keyboard ID, or every input by "
+			      "set, not some of each\n", stderr);
+			return -1;
+		}
+
+		if (keyboard >= 0 && in->keyboard == keyboard) {
+			fprintf(stderr, "Keyboard ID %04X is already the tag of "
+			        "'%s'\n", keyboard, in->path);
+			return -1;
+		}
+
+		if (set && (in->set & set)) {
+			fprintf(stderr, "%s is already the tag of '%s'\n",
+			        sc_config_set_name((unsigned char)set), in->path);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+/* }}} */
+
+/* {{{ parse_options */
+static int parse_options(struct link *l, int argc, char **argv)
+{
+	int i, keyboard = -1, set = 0;
+	char *end;
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+			l->output = argv[++i];
+		} else if (!strcmp(argv[i], "--keyboard") && i + 1 < argc) {
+			keyboard = (int)strtol(argv[++i], &end, 0);
+			if (*end || keyboard <= 0 || keyboard > 0xffff) {
+				fprintf(stderr, "%s: invalid keyboard ID\n", argv[i]);
+				return -1;
+			}
+			set = 0;
+		} else if (!strcmp(argv[i], "--set") && i + 1 < argc) {
+			if ((set = sc_config_set_by_name(argv[++i])) <= 0) {
+				fprintf(stderr, "%s: unknown set\n", argv[i]);
+				return -1;
+			}
+			keyboard = -1;
+		} else if (argv[i][0] == '-' && argv[i][1]) {
+			return -1;
+		} else if (keyboard < 0 && !set) {
+			fprintf(stderr, "%s: no --keyboard or --set given for it\n",
+			        argv[i]);
+			return -1;
+		} else if (l->n_in == MAX_INPUTS) {
+			fprintf(stderr, "At most %d inputs\n", MAX_INPUTS);
+			return -1;
+		} else if (check_tag(l, keyboard, set)) {
+			return -1;
+		} else {
+			l->in[l->n_in].path     = argv[i];
+			l->in[l->n_in].keyboard = keyboard;
+			l->in[l->n_in].set      = (unsigned char)set;
+			l->n_in++;
+			keyboard = -1;
+			set      = 0;
+		}
+	}
+
+	return l->output && l->n_in > 1 ? 0 : -1;
+}
+/* }}} */
+
+/* {{{ count_naive */
+/**
+ * Count the bytes the inputs would take, simply gated and put end to
+ * end.
+ */
+static unsigned long count_naive(const struct link *l)
+{
+	unsigned char out[GATED_MAX];
+	unsigned long bytes = SC_HEADER_LEN;
+	unsigned int i, j, n_blocks;
+	int len;
+
+	for (i = 0; i < l->n_in; i++) {
+		for (j = 0; j < l->in[i].cfg.n_blocks; j++) {
+			if ((len = gate(out, &n_blocks, &l->in[i],
+			                &l->in[i].cfg.blocks[j])) > 0)
+				bytes += (unsigned long)len;
+		}
+	}
+
+	return bytes;
+}
+/* }}} */
+
+static void print_tag(const struct input *in)
+{
+	char tag[32];
+
+	if (in->keyboard >= 0) sprintf(tag, "ifkeyboard %04X", in->keyboard);
+	else sprintf(tag, "ifset %s", sc_config_set_name(in->set));
+	fprintf(stderr, "  %-16s  %-28s %6u %7lu\n", tag, in->path,
+	        in->cfg.n_blocks, (unsigned long)in->cfg.len);
+}
+
+int main(int argc, char **argv)
+{
+	struct link l;
+	struct input *in;
+	const struct sc_block *b;
+	unsigned char hdr[SC_HEADER_LEN];
+	unsigned int i, k, n_loaded = 0;
+	int n_shared, retval = EXIT_FAILURE;
+
+	fputs("sclink v1.10\n", stderr);
+	memset(&l, 0, sizeof(l));
+	if (parse_options(&l, argc, argv)) {
+		fputs(usage, stderr);
+		goto ret;
+	}
+
+	for (n_loaded = 0; n_loaded < l.n_in; n_loaded++) {
+		in = &l.in[n_loaded];
+		if (sc_config_load(&in->cfg, in->path))
+			goto free;
+	}
+
+	check_headers(&l, hdr);
+	if ((n_shared = find_shared(&l)) < 0)
+		goto free;
+
+	/* Nothing is left at the output unless it's all written */
+	if (!(l.tmp = malloc(strlen(l.output) + 5))) {
+		fputs("Unable to allocate memory\n", stderr);
+		goto free;
+	}
+
+	sprintf(l.tmp, "%s.tmp", l.output);
+	if (!(l.fp = fopen(l.tmp, "wb"))) {
+		fprintf(stderr, "Unable to open '%s' for writing\n", l.tmp);
+		goto free;
+	}
+
+	put_bytes(&l, hdr, SC_HEADER_LEN);
+	for (k = 0; k <= (unsigned int)n_shared; k++) {
+		for (i = 0; i < l.n_in; i++) {
+			in = &l.in[i];
+			if (put_model_blocks(&l, in, k < (unsigned int)n_shared ?
+			                     in->match[k] : in->cfg.n_blocks))
+				goto close;
+		}
+
+		if (k == (unsigned int)n_shared) break;
+		in = &l.in[0];
+		b  = &in->cfg.blocks[in->match[k]];
+		put_bytes(&l, in->cfg.image + b->offset, b->length);
+		++l.shared;
+		l.shared_bytes += b->length;
+		for (i = 0; i < l.n_in; i++)
+			++l.in[i].next;
+	}
+
+	if (fclose(l.fp) || l.error) {
+		fprintf(stderr, "Unable to write to '%s'\n", l.tmp);
+		l.fp = NULL;
+		goto close;
+	}
+
+	l.fp = NULL;
+	if (rename(l.tmp, l.output)) {
+		fprintf(stderr, "Unable to rename '%s' to '%s'\n", l.tmp,
+		        l.output);
+		goto close;
+	}
+
+	l.naive = count_naive(&l);
+	fputs("  Tag               Input                        Blocks   Bytes\n",
+	      stderr);
+	for (i = 0; i < l.n_in; i++)
+		print_tag(&l.in[i]);
+
+	fprintf(stderr, "Shared: %u blocks (%lu bytes), once for every "
+	        "keyboard\nGated:  %u blocks (%lu bytes)", l.shared,
+	        l.shared_bytes, l.gated, l.gated_bytes);
+	if (l.dropped)
+		fprintf(stderr, ", and %u dropped, as their own ifkeyboard or "
+		        "ifset rules their model out", l.dropped);
+	fprintf(stderr, "\nWrote %s: %lu bytes, against %lu concatenated "
+	        "(%ld saved, %.1f%%)\n", l.output, l.bytes, l.naive,
+	        (long)l.naive - (long)l.bytes,
+	        100.0 * ((double)l.naive - (double)l.bytes) / (double)l.naive);
+	retval = EXIT_SUCCESS;
+
+close:
+	if (l.fp) fclose(l.fp);
+	if (retval != EXIT_SUCCESS) remove(l.tmp);
+
+free:
+	free(l.tmp);
+	for (i = 0; i < n_loaded; i++) {
+		sc_config_free(&l.in[i].cfg);
+		free(l.in[i].match);
+	}
+
+ret:
+	return retval;
+}
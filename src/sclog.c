@@ -0,0 +1,214 @@
+/**
+ * sctools: Binary trace of listen events
+ * Copyright (C) 2016 Tim Hentenaar.
+ *
+ * This code is licenced under the Simplified BSD License.
+ * See the LICENSE file for details.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "sclog.h"
+
+#define SCLOG_BUFSIZ 65536
+
+static void put_u64(unsigned char *p, uint64_t v)
+{
+	int i;
+
+	for (i = 0; i < 8; i++, v >>= 8)
+		p[i] = (unsigned char)(v & 0xff);
+}
+
+static uint64_t get_u64(const unsigned char *p)
+{
+	uint64_t v = 0;
+	int i;
+
+	for (i = 7; i >= 0; i--)
+		v = (v << 8) | p[i];
+	return v;
+}
+
+/**
+ * Fill in a trace header, from \a log's start times.
+ */
+void sclog_pack_header(const struct sclog *log, unsigned char *hdr)
+{
+	memcpy(hdr, "SCLOG", 5);
+	hdr[5] = SCLOG_VERSION;
+	hdr[6] = SCLOG_RECORD_LEN;
+	hdr[7] = 0;
+	put_u64(hdr + 8, log->wall_start);
+	put_u64(hdr + 16, log->start);
+}
+
+/**
+ * Check a trace header, and take the start times from it.
+ *
+ * \return 0 on success, -1 if it's not a header we understand.
+ */
+int sclog_unpack_header(struct sclog *log, const unsigned char *hdr)
+{
+	if (memcmp(hdr, "SCLOG", 5) || hdr[5] != SCLOG_VERSION ||
+	    hdr[6] != SCLOG_RECORD_LEN)
+		return -1;
+
+	log->wall_start = get_u64(hdr + 8);
+	log->start      = get_u64(hdr + 16);
+	return 0;
+}
+
+/**
+ * Encode an event as a record.
+ */
+void sclog_pack(const struct sclog *log, const struct listen_event *ev,
+                unsigned char *rec)
+{
+	put_u64(rec, ev->time - log->start);
+	rec[8]  = (unsigned char)ev->type;
+	rec[9]  = ev->code;
+	rec[10] = ev->device;
+	rec[11] = 0;
+}
+
+/**
+ * Decode a record.
+ */
+void sclog_unpack(const struct sclog *log, const unsigned char *rec,
+                  struct listen_event *ev)
+{
+	ev->time   = log->start + get_u64(rec);
+	ev->type   = (char)rec[8];
+	ev->code   = rec[9];
+	ev->device = rec[10];
+}
+
+/* {{{ sclog_create */
+/**
+ * Create a trace, and write its header.
+ *
+ * \param[in] log   Trace
+ * \param[in] path  File to write
+ * \param[in] start Monotonic time the trace starts at (ns). Events
+ *                  are recorded relative to this.
+ * \return 0 on success, -1 on error.
+ */
+int sclog_create(struct sclog *log, const char *path, uint64_t start)
+{
+	unsigned char hdr[SCLOG_HEADER_LEN];
+
+	memset(log, 0, sizeof(*log));
+	if (!(log->fp = fopen(path, "wb"))) {
+		fprintf(stderr, "Unable to open '%s' for writing\n", path);
+		goto err;
+	}
+
+	/* Records are small: write them out in large blocks */
+	setvbuf(log->fp, NULL, _IOFBF, SCLOG_BUFSIZ);
+	log->wall_start = (uint64_t)time(NULL);
+	log->start      = start;
+
+	sclog_pack_header(log, hdr);
+	if (fwrite(hdr, 1, SCLOG_HEADER_LEN, log->fp) == SCLOG_HEADER_LEN)
+		return 0;
+
+	fprintf(stderr, "Unable to write to '%s'\n", path);
+	fclose(log->fp);
+	log->fp = NULL;
+
+err:
+	return -1;
+}
+/* }}} */
+
+/* {{{ sclog_write */
+/**
+ * Append an event to the trace. Errors are picked up by
+ * sclog_close().
+ */
+void sclog_write(struct sclog *log, const struct listen_event *ev)
+{
+	unsigned char rec[SCLOG_RECORD_LEN];
+
+	sclog_pack(log, ev, rec);
+	if (fwrite(rec, 1, SCLOG_RECORD_LEN, log->fp) != SCLOG_RECORD_LEN)
+		log->error = 1;
+	++log->records;
+}
+/* }}} */
+
+/* {{{ sclog_open */
+/**
+ * Open a trace for reading, and check its header.
+ *
+ * \param[in] log  Trace
+ * \param[in] path File to read
+ * \return 0 on success, -1 on error.
+ */
+int sclog_open(struct sclog *log, const char *path)
+{
+	unsigned char hdr[SCLOG_HEADER_LEN];
+
+	memset(log, 0, sizeof(*log));
+	if (!(log->fp = fopen(path, "rb"))) {
+		fprintf(stderr, "Unable to open '%s'\n", path);
+		goto err;
+	}
+
+	setvbuf(log->fp, NULL, _IOFBF, SCLOG_BUFSIZ);
+	if (fread(hdr, 1, SCLOG_HEADER_LEN, log->fp) != SCLOG_HEADER_LEN ||
+	    sclog_unpack_header(log, hdr)) {
+		fprintf(stderr, "%s: not a version %d trace\n", path,
+		        SCLOG_VERSION);
+		goto close;
+	}
+
+	return 0;
+
+close:
+	fclose(log->fp);
+	log->fp = NULL;
+
+err:
+	return -1;
+}
+/* }}} */
+
+/* {{{ sclog_read */
+/**
+ * Read the next event from a trace.
+ *
+ * \return 1 if an event was read, 0 at the end of the trace, or
+ *         -1 on error (including a truncated record).
+ */
+int sclog_read(struct sclog *log, struct listen_event *ev)
+{
+	unsigned char rec[SCLOG_RECORD_LEN];
+	size_t n;
+
+	if ((n = fread(rec, 1, SCLOG_RECORD_LEN, log->fp)) !=
+	    SCLOG_RECORD_LEN)
+		return n || ferror(log->fp) ? -1 : 0;
+
+	sclog_unpack(log, rec, ev);
+	++log->records;
+	return 1;
+}
+/* }}} */
+
+/**
+ * Close a trace.
+ *
+ * \return 0 on success, -1 if anything couldn't be written.
+ */
+int sclog_close(struct sclog *log)
+{
+	if (log->fp && fclose(log->fp))
+		log->error = 1;
+
+	log->fp = NULL;
+	return log->error ? -1 : 0;
+}
@@ -0,0 +1,62 @@
+/**
+ * sctools: Binary trace of listen events
+ * Copyright (C) 2016 Tim Hentenaar.
+ *
+ * This code is licenced under the Simplified BSD License.
+ * See the LICENSE file for details.
+ */
+
+#ifndef SCLOG_H
+#define SCLOG_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "listen.h"
+
+/**
+ * A trace starts with a header:
+ *
+ *  0  "SCLOG"
+ *  5  version (1)
+ *  6  record length (12)
+ *  7  reserved (0)
+ *  8  wall clock time the trace started (seconds since the epoch)
+ * 16  monotonic clock time the trace started (ns)
+ *
+ * followed by a fixed-size record per event:
+ *
+ *  0  time since the trace started (ns)
+ *  8  type ('r', '+', '-', 'd' or 'u')
+ *  9  code
+ * 10  device
+ * 11  reserved (0)
+ *
+ * All of the integers are little-endian.
+ */
+#define SCLOG_VERSION    1
+#define SCLOG_HEADER_LEN 24
+#define SCLOG_RECORD_LEN 12
+
+struct sclog {
+	FILE         *fp;
+	uint64_t      wall_start;   /* seconds since the epoch */
+	uint64_t      start;        /* monotonic, ns           */
+	unsigned long records;
+	int           error;
+};
+
+void sclog_pack_header(const struct sclog *log, unsigned char *hdr);
+int  sclog_unpack_header(struct sclog *log, const unsigned char *hdr);
+void sclog_pack(const struct sclog *log, const struct listen_event *ev,
+                unsigned char *rec);
+void sclog_unpack(const struct sclog *log, const unsigned char *rec,
+                  struct listen_event *ev);
+
+int  sclog_create(struct sclog *log, const char *path, uint64_t start);
+void sclog_write(struct sclog *log, const struct listen_event *ev);
+int  sclog_open(struct sclog *log, const char *path);
+int  sclog_read(struct sclog *log, struct listen_event *ev);
+int  sclog_close(struct sclog *log);
+
+#endif /* SCLOG_H */
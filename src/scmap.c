@@ -0,0 +1,349 @@
+/**
+ * sctools: Materialize a binary config into dense keymaps
+ * Copyright (C) 2016 Tim Hentenaar.
+ *
+ * This code is licenced under the Simplified BSD License.
+ * See the LICENSE file for details.
+ *
+ * Works out what every key does in every state a config can reach:
+ * for each set, keyboard ID, select mask reachable from power-up, and
+ * layer, a table of what each of the 256 codes is remapped to, and
+ * which macros (in the order they're matched) each one can trigger,
+ * and for which metas.
+ *
+ * The tables are written as CSV, one row per key, or in binary:
+ *
+ *  0  "SCMAP"
+ *  5  version (1)
+ *  6  number of tables (4 bytes)
+ *
+ * followed by the tables:
+ *
+ *  0  set (SC_SET*)
+ *  1  selects (bit n for select n)
+ *  2  layer
+ *  3  keyboard ID (2 bytes; 0xFFFF for none)
+ *  5  number of macros (2 bytes)
+ *  7  what each code is remapped to (256 bytes)
+ *
+ * then each macro as: key, desired metas, matched metas, and the
+ * offset of the macro in the config (2 bytes). A key's macros are
+ * in the order they're matched. All of the integers are little-endian.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hid_tokens.h"
+#include "sim.h"
+
+#define SCMAP_VERSION 1
+#define NO_KEYBOARD   0xffff
+
+#define FORMAT_CSV    0
+#define FORMAT_BINARY 1
+
+struct options {
+	unsigned char  set;
+	int            keyboard, any_keyboard;
+	int            format;
+	const char    *config;
+	const char    *output;
+};
+
+struct writer {
+	FILE         *fp;
+	int           format;
+	unsigned long tables;
+};
+
+static const char *usage =
+	"usage: scmap [options] <binary_config> [<output>]\n\n"
+	"  Options:\n"
+	"    --set <set>          Only this set: set1, set2, set3, or\n"
+	"                         set2ext (default: every set, or the one\n"
+	"                         it forces)\n"
+	"    --keyboard <id>      Only this keyboard ID (default: none, and\n"
+	"                         each one the config uses)\n"
+	"    --format <fmt>       csv (default) or binary\n";
+
+/* {{{ Helpers */
+static void put_le16(unsigned char *p, unsigned int v)
+{
+	p[0] = (unsigned char)(v & 0xff);
+	p[1] = (unsigned char)(v >> 8);
+}
+
+static void put_le32(unsigned char *p, unsigned long v)
+{
+	put_le16(p, (unsigned int)(v & 0xffff));
+	put_le16(p + 2, (unsigned int)((v >> 16) & 0xffff));
+}
+
+static void put_key(FILE *fp, unsigned char hid)
+{
+	const char *name = find_hid_token_by_value(hid);
+
+	if (name) fputs(name, fp);
+	else fprintf(fp, "0x%02X", hid);
+}
+
+/**
+ * Write the metas a macro matches, as scas spells them (e.g. SHIFT
+ * -LCTRL), or "any".
+ */
+static void put_metas(FILE *fp, const struct sc_macro *m)
+{
+	char names[SC_META_NAMES_LEN];
+
+	sc_macro_meta_names(m->desired_meta, m->matched_meta, names);
+	fputs(*names ? names : "any", fp);
+}
+/* }}} */
+
+/* {{{ write_csv */
+static void write_csv(struct writer *w, const struct sim *s,
+                      unsigned char layer)
+{
+	char selects[16];
+	unsigned int i, j;
+	unsigned char code;
+
+	sc_config_select_names(s->selects, selects);
+	for (i = 0; i < 256; i++) {
+		code = sim_remap(s, layer, (unsigned char)i);
+
+		fprintf(w->fp, "%s,", sc_config_set_name(s->set));
+		if (s->keyboard < 0) fputs("any", w->fp);
+		else fprintf(w->fp, "%04X", s->keyboard);
+		fprintf(w->fp, ",%s,%u,", selects, layer);
+		put_key(w->fp, (unsigned char)i);
+		fputc(',', w->fp);
+		put_key(w->fp, code);
+		fputc(',', w->fp);
+
+		for (j = s->macro_first[code]; j < s->macro_first[code + 1]; j++) {
+			if (j > s->macro_first[code]) fputc(' ', w->fp);
+			put_metas(w->fp, s->macros[j]);
+			fprintf(w->fp, "@%lu", (unsigned long)s->macros[j]->offset);
+		}
+
+		fputc('\n', w->fp);
+	}
+}
+/* }}} */
+
+/* {{{ write_binary */
+static void write_binary(struct writer *w, const struct sim *s,
+                         unsigned char layer)
+{
+	unsigned char hdr[7], out[256], rec[5];
+	const struct sc_macro *m;
+	unsigned int i, j, n = 0;
+
+	for (i = 0; i < 256; i++) {
+		out[i] = sim_remap(s, layer, (unsigned char)i);
+		n     += s->macro_first[out[i] + 1] - s->macro_first[out[i]];
+	}
+
+	hdr[0] = s->set;
+	hdr[1] = s->selects;
+	hdr[2] = layer;
+	put_le16(hdr + 3, s->keyboard < 0 ? NO_KEYBOARD
+	                                  : (unsigned int)s->keyboard);
+	put_le16(hdr + 5, n);
+	fwrite(hdr, 1, sizeof(hdr), w->fp);
+	fwrite(out, 1, sizeof(out), w->fp);
+
+	for (i = 0; i < 256; i++) {
+		for (j = s->macro_first[out[i]]; j < s->macro_first[out[i] + 1];
+		     j++) {
+			m      = s->macros[j];
+			rec[0] = (unsigned char)i;
+			rec[1] = m->desired_meta;
+			rec[2] = m->matched_meta;
+			put_le16(rec + 3, (unsigned int)m->offset);
+			fwrite(rec, 1, sizeof(rec), w->fp);
+		}
+	}
+}
+/* }}} */
+
+/* {{{ write_tables */
+/**
+ * Write a table for each layer of each reachable select mask, or
+ * just count them if there's no file to write them to.
+ *
+ * \return 0 on success, -1 on error.
+ */
+static int write_tables(struct writer *w, const struct sc_config *cfg,
+                        unsigned char set, int keyboard)
+{
+	struct sim s;
+	unsigned char masks[SC_MAX_SELECTS], seen[256];
+	unsigned int n_masks, i, j;
+	int retval = -1;
+
+	if (sim_init(&s, cfg, set, keyboard))
+		goto ret;
+
+	n_masks = sc_config_selects(cfg, set, keyboard, masks);
+	for (i = 0; i < n_masks; i++) {
+		if (sim_select(&s, masks[i]))
+			goto free;
+
+		/* Layer 0, and each one the FN keys can reach */
+		memset(seen, 0, sizeof(seen));
+		seen[0] = 1;
+		for (j = 0; j < 256; j++)
+			seen[s.layer_of[j]] = 1;
+
+		for (j = 0; j < SIM_MAX_LAYERS; j++) {
+			if (!seen[j]) continue;
+			if (w->fp && w->format == FORMAT_CSV)
+				write_csv(w, &s, (unsigned char)j);
+			else if (w->fp)
+				write_binary(w, &s, (unsigned char)j);
+			++w->tables;
+		}
+	}
+
+	retval = 0;
+
+free:
+	sim_free(&s);
+
+ret:
+	return retval;
+}
+/* }}} */
+
+/* {{{ parse_options */
+static int parse_options(struct options *o, int argc, char **argv)
+{
+	int i, set;
+
+	memset(o, 0, sizeof(*o));
+	o->any_keyboard = 1;
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--set") && i + 1 < argc) {
+			if ((set = sc_config_set_by_name(argv[++i])) < 0) {
+				fprintf(stderr, "%s: unknown set\n", argv[i]);
+				return -1;
+			}
+			o->set = (unsigned char)set;
+		} else if (!strcmp(argv[i], "--keyboard") && i + 1 < argc) {
+			o->keyboard     = (int)strtol(argv[++i], NULL, 0);
+			o->any_keyboard = 0;
+		} else if (!strcmp(argv[i], "--format") && i + 1 < argc) {
+			++i;
+			if (!strcmp(argv[i], "csv")) o->format = FORMAT_CSV;
+			else if (!strcmp(argv[i], "binary")) o->format = FORMAT_BINARY;
+			else {
+				fprintf(stderr, "%s: unknown format\n", argv[i]);
+				return -1;
+			}
+		} else if (argv[i][0] == '-' && argv[i][1]) {
+			return -1;
+		} else if (!o->config) {
+			o->config = argv[i];
+		} else if (!o->output) {
+			o->output = argv[i];
+		} else return -1;
+	}
+
+	return o->config ? 0 : -1;
+}
+/* }}} */
+
+int main(int argc, char **argv)
+{
+	struct options o;
+	struct sc_config cfg;
+	struct writer w;
+	FILE *fp;
+	unsigned char hdr[10], sets[4];
+	int *keyboards;
+	unsigned int n_sets = 0, n_keyboards = 1, i, j, pass;
+	int retval = EXIT_FAILURE;
+
+	fputs("scmap v1.10\n", stderr);
+	if (parse_options(&o, argc, argv)) {
+		fputs(usage, stderr);
+		goto ret;
+	}
+
+	if (sc_config_load(&cfg, o.config))
+		goto ret;
+
+	/* The sets and keyboards to materialize the tables for */
+	if (o.set) sets[n_sets++] = o.set;
+	else if ((cfg.force & 0x0f) >= 1 && (cfg.force & 0x0f) <= 4)
+		sets[n_sets++] = sc_config_set(&cfg);
+	else {
+		for (i = 0; i < 4; i++)
+			sets[n_sets++] = (unsigned char)(1 << i);
+	}
+
+	if (!(keyboards = malloc((cfg.n_blocks + 1) * sizeof(int)))) {
+		fputs("Unable to allocate memory for the keyboard IDs\n", stderr);
+		goto free_cfg;
+	}
+
+	keyboards[0] = o.keyboard;
+	if (o.any_keyboard) {
+		keyboards[0] = -1;
+		n_keyboards += sc_config_keyboards(&cfg, keyboards + 1);
+	}
+
+	if (!o.output || !strcmp(o.output, "-")) fp = stdout;
+	else if (!(fp = fopen(o.output, o.format == FORMAT_CSV ? "w" : "wb"))) {
+		fprintf(stderr, "Unable to open '%s'\n", o.output);
+		goto free_keyboards;
+	}
+
+	/* Count the tables for the header first, then write them */
+	memset(&w, 0, sizeof(w));
+	w.format = o.format;
+	for (pass = o.format == FORMAT_CSV; pass < 2; pass++) {
+		if (pass == 1) {
+			memcpy(hdr, "SCMAP", 5);
+			hdr[5] = SCMAP_VERSION;
+			put_le32(hdr + 6, w.tables);
+			if (o.format == FORMAT_CSV)
+				fputs("set,keyboard,selects,layer,key,output,macros\n", fp);
+			else fwrite(hdr, 1, sizeof(hdr), fp);
+		}
+
+		w.fp     = pass ? fp : NULL;
+		w.tables = 0;
+		for (i = 0; i < n_sets; i++) {
+			for (j = 0; j < n_keyboards; j++) {
+				if (write_tables(&w, &cfg, sets[i], keyboards[j]))
+					goto close;
+			}
+		}
+	}
+
+	if (fflush(fp) || ferror(fp)) {
+		fputs("Unable to write the tables\n", stderr);
+		goto close;
+	}
+
+	fprintf(stderr, "Wrote %lu tables.\n", w.tables);
+	retval = EXIT_SUCCESS;
+
+close:
+	if (fp != stdout) fclose(fp);
+
+free_keyboards:
+	free(keyboards);
+
+free_cfg:
+	sc_config_free(&cfg);
+
+ret:
+	return retval;
+}
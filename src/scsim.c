@@ -0,0 +1,438 @@
+/**
+ * sctools: Run a binary config on the host
+ * Copyright (C) 2016 Tim Hentenaar.
+ *
+ * This code is licenced under the Simplified BSD License.
+ * See the LICENSE file for details.
+ *
+ * Feeds HID events through a binary config, as the converter would,
+ * and prints what the host would see. The input is either a trace
+ * recorded by sctool listen --record, or text: +CODE for a make and
+ * -CODE for a break, where CODE is a HID code's name, or else the code
+ * in hex (e.g. +LSHIFT +A -A -LSHIFT, or +E1 +04 -04 -E1). A name wins
+ * where it could also be read as hex, so +A is A and +F1 is F1; write
+ * 0x0A or 0xF1 for those codes. Anything else in the text, such as
+ * the rest of sctool listen's output, is ignored, as is everything
+ * after a '#' on a line. Text events are 1 ms apart.
+ *
+ * With --output uinput, the output is typed on a virtual keyboard
+ * instead, at the input's pace (or --speed times it), so a config can
+ * be tried out on the host without a converter.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "hid_tokens.h"
+#include "monotime.h"
+#include "sclog.h"
+#include "sim.h"
+#include "evdev.h"
+
+#define OUTPUT_REPORTS 0
+#define OUTPUT_EVENTS  1
+#define OUTPUT_NONE    2
+#define OUTPUT_UINPUT  3
+
+/* Time for the host to notice the virtual keyboard, before it's used */
+#define UINPUT_SETTLE (500 * NS_PER_MS)
+
+struct input {
+	struct listen_event *ev;
+	unsigned long        n, size;
+};
+
+struct options {
+	unsigned char  set;
+	int            keyboard;
+	int            output;
+	unsigned long  repeat;
+	double         speed;
+	const char    *config;
+	const char    *input;
+};
+
+/* Typing on a virtual keyboard */
+struct player {
+	struct uinput out;
+	double        speed;  /* 0 to type as fast as we can */
+	uint64_t      start;  /* when the input started      */
+	uint64_t      last;   /* simulator time last sent    */
+};
+
+/* In two, to stay within C90's limit */
+static const char *usage[] = {
+	"usage: scsim [options] <binary_config> [<input>]\n\n"
+	"  Options:\n"
+	"    --set <set>          Keyboard's set: set1, set2 (default),\n"
+	"                         set3, or set2ext\n"
+	"    --keyboard <id>      Keyboard ID, for ifkeyboard blocks\n"
+	"    --output <fmt>       reports (default), events, none, or\n"
+	"                         uinput (type it on a virtual keyboard)\n",
+	"    --speed <x>          Type x times as fast as the input\n"
+	"                         (default 1, 0 for no waiting)\n"
+	"    --repeat <n>         Run the input n times\n\n"
+	"  The input is a trace from sctool listen --record, or text\n"
+	"  (+CODE / -CODE.) It's read from stdin if not given.\n"
+};
+
+/* {{{ add_event */
+static int add_event(struct input *in, uint64_t time, char type,
+                     unsigned char code)
+{
+	struct listen_event *tmp;
+
+	if (in->n == in->size) {
+		in->size = in->size ? 2 * in->size : 1024;
+		if (!(tmp = realloc(in->ev, in->size * sizeof(*tmp)))) {
+			fputs("Unable to allocate memory for the input\n", stderr);
+			return -1;
+		}
+		in->ev = tmp;
+	}
+
+	in->ev[in->n].time   = time;
+	in->ev[in->n].type   = type;
+	in->ev[in->n].code   = code;
+	in->ev[in->n].device = 0;
+	in->n++;
+	return 0;
+}
+/* }}} */
+
+/* {{{ parse_code */
+/**
+ * Parse a HID code, by name, or else in hex.
+ *
+ * \return the code, or -1 if it isn't one.
+ */
+static int parse_code(const char *s)
+{
+	char *end;
+	long v;
+	int code;
+
+	if ((code = lookup_hid_token_by_name(s)) >= 0)
+		return code;
+
+	if (isxdigit((unsigned char)*s)) {
+		v = strtol(s, &end, 16);
+		if (!*end && v >= 0 && v <= 0xff)
+			return (int)v;
+	}
+
+	return -1;
+}
+/* }}} */
+
+/* {{{ read_text */
+static int read_text(struct input *in, FILE *fp)
+{
+	char word[64];
+	int c, code;
+	size_t len = 0;
+	uint64_t time = 0;
+
+	do {
+		c = fgetc(fp);
+		if (c == '#') {
+			while ((c = fgetc(fp)) != EOF && c != '\n');
+		}
+
+		if (c != EOF && !isspace(c)) {
+			if (len < sizeof(word) - 1)
+				word[len++] = (char)c;
+			continue;
+		}
+
+		if (!len) continue;
+		word[len] = '\0';
+		len = 0;
+
+		if ((word[0] != '+' && word[0] != '-') ||
+		    (code = parse_code(word + 1)) < 0)
+			continue;
+
+		if (add_event(in, time, word[0], (unsigned char)code))
+			return -1;
+		time += NS_PER_MS;
+	} while (c != EOF);
+
+	return ferror(fp) ? -1 : 0;
+}
+/* }}} */
+
+/* {{{ read_trace */
+static int read_trace(struct input *in, const char *path)
+{
+	struct sclog log;
+	struct listen_event ev;
+	uint64_t first = 0;
+	int r;
+
+	if (sclog_open(&log, path))
+		return -1;
+
+	/* Traces have the recorder's monotonic times: start from 0 */
+	while ((r = sclog_read(&log, &ev)) > 0) {
+		if (ev.type != '+' && ev.type != '-')
+			continue;
+		if (!in->n) first = ev.time;
+		if (add_event(in, ev.time - first, ev.type, ev.code))
+			break;
+	}
+
+	sclog_close(&log);
+	return r ? -1 : 0;
+}
+/* }}} */
+
+/* {{{ read_input */
+static int read_input(struct input *in, const char *path)
+{
+	char magic[5];
+	FILE *fp;
+	int retval;
+
+	if (!path || !strcmp(path, "-"))
+		return read_text(in, stdin);
+
+	if (!(fp = fopen(path, "rb"))) {
+		fprintf(stderr, "Unable to open '%s'\n", path);
+		return -1;
+	}
+
+	if (fread(magic, 1, sizeof(magic), fp) == sizeof(magic) &&
+	    !memcmp(magic, "SCLOG", sizeof(magic))) {
+		fclose(fp);
+		return read_trace(in, path);
+	}
+
+	rewind(fp);
+	retval = read_text(in, fp);
+	fclose(fp);
+
+	if (retval)
+		fprintf(stderr, "Unable to read '%s'\n", path);
+	return retval;
+}
+/* }}} */
+
+/* {{{ Output */
+static void print_code(unsigned char code)
+{
+	const char *name = find_hid_token_by_value(code);
+
+	if (name) printf("%02X %s\n", code, name);
+	else printf("%02X\n", code);
+}
+
+static void put_event(struct sim *s, int type, unsigned char code, void *ctx)
+{
+	(void)ctx;
+
+	printf("%10.3f %c ", (double)s->time / NS_PER_MS, type);
+	if (type == SIM_META) printf("%02X\n", code);
+	else print_code(code);
+}
+
+static void put_report(struct sim *s, int type, unsigned char code, void *ctx)
+{
+	struct sim_report r;
+	int i;
+
+	(void)type;
+	(void)code;
+	(void)ctx;
+
+	sim_report(s, &r);
+	printf("%10.3f %02X 00", (double)r.time / NS_PER_MS, r.meta);
+	for (i = 0; i < SIM_REPORT_KEYS; i++)
+		printf(" %02X", r.keys[i]);
+	putchar('\n');
+}
+
+/**
+ * Type an output event on the virtual keyboard. Events at the same
+ * time go in the same report; before a later one, we wait until it's
+ * due.
+ */
+static void put_uinput(struct sim *s, int type, unsigned char code, void *ctx)
+{
+	struct player *p = ctx;
+	uint64_t due, now;
+
+	if (s->time != p->last) {
+		uinput_flush(&p->out);
+		p->last = s->time;
+
+		if (p->speed > 0) {
+			due = p->start + (uint64_t)((double)s->time / p->speed);
+			if ((now = monotime_ns()) < due)
+				sleep_ns(due - now);
+		}
+	}
+
+	uinput_event(&p->out, type, code);
+}
+/* }}} */
+
+/* {{{ parse_options */
+static int parse_options(struct options *o, int argc, char **argv)
+{
+	int i, set;
+
+	memset(o, 0, sizeof(*o));
+	o->keyboard = -1;
+	o->repeat   = 1;
+	o->speed    = 1;
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--set") && i + 1 < argc) {
+			if ((set = sc_config_set_by_name(argv[++i])) < 0) {
+				fprintf(stderr, "%s: unknown set\n", argv[i]);
+				return -1;
+			}
+			o->set = (unsigned char)set;
+		} else if (!strcmp(argv[i], "--keyboard") && i + 1 < argc) {
+			o->keyboard = (int)strtol(argv[++i], NULL, 0);
+		} else if (!strcmp(argv[i], "--output") && i + 1 < argc) {
+			++i;
+			if (!strcmp(argv[i], "reports")) o->output = OUTPUT_REPORTS;
+			else if (!strcmp(argv[i], "events")) o->output = OUTPUT_EVENTS;
+			else if (!strcmp(argv[i], "none")) o->output = OUTPUT_NONE;
+			else if (!strcmp(argv[i], "uinput")) o->output = OUTPUT_UINPUT;
+			else {
+				fprintf(stderr, "%s: unknown output format\n", argv[i]);
+				return -1;
+			}
+		} else if (!strcmp(argv[i], "--speed") && i + 1 < argc) {
+			if ((o->speed = strtod(argv[++i], NULL)) < 0) {
+				fprintf(stderr, "%s: invalid speed\n", argv[i]);
+				return -1;
+			}
+		} else if (!strcmp(argv[i], "--repeat") && i + 1 < argc) {
+			if (!(o->repeat = strtoul(argv[++i], NULL, 0))) {
+				fprintf(stderr, "%s: invalid count\n", argv[i]);
+				return -1;
+			}
+		} else if (argv[i][0] == '-' && argv[i][1]) {
+			return -1;
+		} else if (!o->config) {
+			o->config = argv[i];
+		} else if (!o->input) {
+			o->input = argv[i];
+		} else return -1;
+	}
+
+	return o->config ? 0 : -1;
+}
+/* }}} */
+
+static void print_stats(const struct sim_stats *st)
+{
+	fprintf(stderr, "Input events:    %lu\n"
+	        "Output events:   %lu\n"
+	        "Remapped keys:   %lu\n"
+	        "Macros:          %lu (%lu steps)\n"
+	        "Layer changes:   %lu\n"
+	        "Config reloads:  %lu\n",
+	        st->in, st->out, st->remapped, st->macros, st->steps,
+	        st->layer_changes, st->reloads);
+
+	if (st->meta_overflows)
+		fprintf(stderr, "Meta stack overflows: %lu\n", st->meta_overflows);
+	if (st->boots)
+		fprintf(stderr, "BOOT steps (ignored): %lu\n", st->boots);
+}
+
+int main(int argc, char **argv)
+{
+	struct options o;
+	struct sc_config cfg;
+	struct input in;
+	struct sim s;
+	struct player p;
+	unsigned long i, r;
+	uint64_t start, elapsed, offset = 0, last = 0;
+	int retval = EXIT_FAILURE;
+
+	fputs("scsim v1.10\n", stderr);
+	memset(&in, 0, sizeof(in));
+
+	if (parse_options(&o, argc, argv)) {
+		fputs(usage[0], stderr);
+		fputs(usage[1], stderr);
+		goto ret;
+	}
+
+	if (sc_config_load(&cfg, o.config))
+		goto ret;
+
+	if (!o.set)
+		o.set = sc_config_set(&cfg);
+
+	if (read_input(&in, o.input))
+		goto free_cfg;
+
+	if (sim_init(&s, &cfg, o.set, o.keyboard))
+		goto free_input;
+
+	if (o.output == OUTPUT_REPORTS)
+		sim_set_output(&s, put_report, NULL);
+	else if (o.output == OUTPUT_EVENTS)
+		sim_set_output(&s, put_event, NULL);
+	else if (o.output == OUTPUT_UINPUT) {
+		if (uinput_open(&p.out, "scsim virtual keyboard"))
+			goto free_sim;
+		sim_set_output(&s, put_uinput, &p);
+		sleep_ns(UINPUT_SETTLE);
+		p.speed = o.speed;
+		p.last  = 0;
+		p.start = monotime_ns();
+	}
+
+	start = monotime_ns();
+	for (r = 0; r < o.repeat; r++) {
+		for (i = 0; i < in.n; i++) {
+			last = offset + in.ev[i].time;
+			sim_key(&s, in.ev[i].code, in.ev[i].type == '+', last);
+		}
+		offset = last + NS_PER_MS;
+	}
+	elapsed = monotime_ns() - start;
+
+	if (o.output == OUTPUT_UINPUT) {
+		uinput_flush(&p.out);
+		sleep_ns(UINPUT_SETTLE);
+		fprintf(stderr, "Typed %lu key events%s\n", p.out.keys,
+		        p.out.error ? ", but some couldn't be written" : "");
+		if (p.out.unmapped)
+			fprintf(stderr, "HID codes with no key: %lu\n",
+			        p.out.unmapped);
+		uinput_close(&p.out);
+	}
+
+	fflush(stdout);
+	print_stats(&s.stats);
+	fprintf(stderr, "%lu events in %.3f s (%.0f events/s)\n",
+	        s.stats.in, (double)elapsed / NS_PER_S,
+	        elapsed ? (double)s.stats.in * NS_PER_S / (double)elapsed : 0.0);
+
+	if (o.output != OUTPUT_UINPUT || !p.out.error)
+		retval = EXIT_SUCCESS;
+
+free_sim:
+	sim_free(&s);
+
+free_input:
+	free(in.ev);
+
+free_cfg:
+	sc_config_free(&cfg);
+
+ret:
+	return retval;
+}
@@ -11,21 +11,47 @@
 #include <string.h>
 #include <errno.h>
 
-#include <hidapi/hidapi.h>
 #include "rawhid_defs.h"
+#include "transport.h"
 #include "commands.h"
+#include "hidstats.h"
 
 static const char *usage =
 	"Soarer's Converter Tool 1.0\n"
-	"Usage: %s command [command options...]\n\n"
+	"Usage: %s command [command options...]\n\n";
+
+/* One string per option and command, to stay within C90's limit */
+static const char *usage_options[] = {
 	"  Options:\n"
-	"    -h                   Show this message.\n\n"
-	"  Commands:\n"
-	"     boot                Cause the device to reboot to bootloader\n"
-	"     info                Get device info\n"
-	"     listen              Listen for keypresses\n"
+	"    -h                   Show this message.\n",
+	"    -t <transport>       Device transport: hidapi (default), hidraw,\n"
+	"                         fake, emu[:option=value,...], or\n"
+	"                         replay:file=<capture>[,option=value,...]\n",
+	"    --capture <file>     Record the session with the device\n",
+	"    --stats              Time every HID transaction, and summarize\n"
+	"                         them on stderr at the end\n"
+	"    --stats-json <file>  ... as JSON lines (- for stdout)\n"
+	"    --stats-prom <file>  ... as a Prometheus textfile\n\n",
+	NULL
+};
+
+static const char *usage_commands[] = {
+	"  Commands:\n",
+	"     analyze <trace>     Analyze a trace recorded by listen --record\n",
+	"     batch [commands...] Run several commands over one device handle,\n"
+	"                         from the command line or stdin\n",
+	"     boot                Cause the device to reboot to bootloader\n",
+	"     info                Get device info\n",
+	"     listen [options]    Listen for keypresses\n",
 	"     read <output file>  Read the current config from EEPROM\n"
-	"     write <input file>  Write the given file to EEPROM\n";
+	"                         (- for stdout)\n",
+	"     write <input file>  Write the given file to EEPROM\n",
+	NULL
+};
+
+/* Transaction statistics: HS_* formats, and where to write them */
+static int stats_formats = 0;
+static const char *stats_json, *stats_prom;
 
 /**
  * Handle command-line switches.
@@ -49,6 +75,40 @@ static int parse_args(int argc, char *argv[])
 		/* ... or --help */
 		if (argv[n_args][1] == '-' && argv[n_args][2] == 'h')
 			goto err;
+
+		/* Record the session (--capture <file>) */
+		if (!strcmp(argv[n_args], "--capture")) {
+			if (++n_args >= argc) goto err;
+			transport_capture(argv[n_args]);
+			continue;
+		}
+
+		/* Transaction statistics (--stats, --stats-json, --stats-prom) */
+		if (!strcmp(argv[n_args], "--stats")) {
+			stats_formats |= HS_TEXT;
+			continue;
+		}
+
+		if (!strcmp(argv[n_args], "--stats-json") ||
+		    !strcmp(argv[n_args], "--stats-prom")) {
+			if (++n_args >= argc) goto err;
+			if (argv[n_args - 1][8] == 'j') {
+				stats_formats |= HS_JSON;
+				stats_json = argv[n_args];
+			} else {
+				stats_formats |= HS_PROMETHEUS;
+				stats_prom = argv[n_args];
+			}
+			continue;
+		}
+
+		/* Select the transport (-t <name>) */
+		if (argv[n_args][1] == 't') {
+			if (++n_args >= argc || transport_select(argv[n_args])) {
+				fputs("unknown transport\n", stderr);
+				goto err;
+			}
+		}
 	} while (++n_args < argc);
 	return n_args;
 
@@ -66,8 +126,19 @@ int main(int argc, char *argv[])
 		goto show_usage;
 	if (n_args) argc -= n_args;
 
-	puts("Soarer's Converter Tool v1.0");
-	hid_init();
+	/* On stderr, since read can write the config to stdout */
+	fputs("Soarer's Converter Tool v1.0\n", stderr);
+	if (transport_init()) {
+		fprintf(stderr, "Unable to initialize the %s transport\n",
+		        transport_name());
+		return EXIT_FAILURE;
+	}
+
+	if (stats_formats &&
+	    hidstats_open(stats_formats, stats_json, stats_prom)) {
+		transport_exit();
+		return EXIT_FAILURE;
+	}
 
 	/* Do command */
 	retval = run_command(argc, &argv[n_args]);
@@ -76,12 +147,14 @@ int main(int argc, char *argv[])
 		fputs("invalid command\n", stderr);
 	}
 
-	hid_exit();
+	if (hidstats_close(stderr) && !retval)
+		retval = -1;
+
+	transport_exit();
 	return retval ? EXIT_FAILURE : EXIT_SUCCESS;
 
 show_usage:
 	do_usage(argv[0]);
-	hid_exit();
 	exit(EXIT_FAILURE);
 }
 
@@ -107,7 +180,13 @@ show_usage:
  */
 static void do_usage(const char *progname)
 {
+	int i;
+
 	printf(usage, progname);
+	for (i = 0; usage_options[i]; i++)
+		fputs(usage_options[i], stdout);
+	for (i = 0; usage_commands[i]; i++)
+		fputs(usage_commands[i], stdout);
 }
 
 /* {{{ GCC >= 4.6: restore -Wformat-security */
@@ -0,0 +1,267 @@
+/**
+ * sctools: Listen event server
+ * Copyright (C) 2016 Tim Hentenaar.
+ *
+ * This code is licenced under the Simplified BSD License.
+ * See the LICENSE file for details.
+ *
+ * listen --serve reads the device once, and sends every event to any
+ * number of local subscribers over a Unix socket. Each subscriber has
+ * a bounded queue; one that can't keep up is dropped, rather than
+ * holding up the reader.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "server.h"
+
+/* {{{ make_address */
+/**
+ * Fill in a socket address for \a path.
+ *
+ * \return 0 on success, -1 if the path is too long.
+ */
+static int make_address(struct sockaddr_un *addr, const char *path)
+{
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr->sun_path)) {
+		fprintf(stderr, "%s: socket path too long\n", path);
+		return -1;
+	}
+
+	strcpy(addr->sun_path, path);
+	return 0;
+}
+/* }}} */
+
+/* {{{ server_start */
+/**
+ * Start listening for subscribers.
+ *
+ * \param[in] s     Server
+ * \param[in] path  Socket path. A stale socket there is replaced.
+ * \param[in] start Monotonic time the session started (ns)
+ * \return 0 on success, -1 on error.
+ */
+int server_start(struct server *s, const char *path, uint64_t start)
+{
+	struct sockaddr_un addr;
+	struct sigaction sa;
+	struct stat st;
+
+	memset(s, 0, sizeof(*s));
+	s->path           = path;
+	s->log.start      = start;
+	s->log.wall_start = (uint64_t)time(NULL);
+
+	if (make_address(&addr, path))
+		goto err;
+
+	/* A vanished subscriber shouldn't take us with it */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = SIG_IGN;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGPIPE, &sa, NULL);
+
+	if (!stat(path, &st) && S_ISSOCK(st.st_mode))
+		unlink(path);
+
+	if ((s->fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ||
+	    bind(s->fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+	    listen(s->fd, SERVER_MAX_CLIENTS) ||
+	    fcntl(s->fd, F_SETFL, O_NONBLOCK)) {
+		fprintf(stderr, "Unable to listen on '%s': %s\n", path,
+		        strerror(errno));
+		if (s->fd >= 0) close(s->fd);
+		goto err;
+	}
+
+	return 0;
+
+err:
+	s->fd = -1;
+	return -1;
+}
+/* }}} */
+
+static void drop_client(struct server *s, int i, const char *why)
+{
+	if (why) fprintf(stderr, "\nsubscriber %d: %s, dropped\n", i, why);
+	close(s->clients[i]->fd);
+	free(s->clients[i]);
+	s->clients[i] = s->clients[--s->n_clients];
+}
+
+/* {{{ enqueue */
+/**
+ * Queue data for a subscriber.
+ *
+ * \return 0 on success, -1 if the queue is full.
+ */
+static int enqueue(struct server_client *c, const unsigned char *data,
+                   size_t len)
+{
+	if (c->len + len > SERVER_QUEUE_LEN)
+		return -1;
+
+	memcpy(c->queue + c->len, data, len);
+	c->len += len;
+	return 0;
+}
+/* }}} */
+
+/* {{{ server_event */
+/**
+ * Queue an event for every subscriber. Any subscriber whose queue is
+ * full is dropped.
+ */
+void server_event(struct server *s, const struct listen_event *ev)
+{
+	unsigned char rec[SCLOG_RECORD_LEN];
+	int i;
+
+	sclog_pack(&s->log, ev, rec);
+	for (i = s->n_clients - 1; i >= 0; i--) {
+		if (enqueue(s->clients[i], rec, SCLOG_RECORD_LEN)) {
+			++s->dropped;
+			drop_client(s, i, "too slow");
+		}
+	}
+}
+/* }}} */
+
+/* {{{ accept_clients */
+static void accept_clients(struct server *s)
+{
+	unsigned char hdr[SCLOG_HEADER_LEN];
+	struct server_client *c;
+	int fd;
+
+	while ((fd = accept(s->fd, NULL, NULL)) >= 0) {
+		if (s->n_clients >= SERVER_MAX_CLIENTS ||
+		    !(c = malloc(sizeof(struct server_client)))) {
+			fputs("\nToo many subscribers, refused one\n", stderr);
+			close(fd);
+			continue;
+		}
+
+		fcntl(fd, F_SETFL, O_NONBLOCK);
+		c->fd  = fd;
+		c->len = 0;
+		sclog_pack_header(&s->log, hdr);
+		enqueue(c, hdr, SCLOG_HEADER_LEN);
+		s->clients[s->n_clients++] = c;
+	}
+}
+/* }}} */
+
+/* {{{ server_poll */
+/**
+ * Accept new subscribers, and send what's queued, waiting up to
+ * \a timeout_ms for something to do.
+ */
+void server_poll(struct server *s, int timeout_ms)
+{
+	struct pollfd fds[SERVER_MAX_CLIENTS + 1];
+	struct server_client *c;
+	unsigned char junk[64];
+	ssize_t n;
+	int i;
+
+	fds[0].fd     = s->fd;
+	fds[0].events = POLLIN;
+	for (i = 0; i < s->n_clients; i++) {
+		fds[i + 1].fd     = s->clients[i]->fd;
+		fds[i + 1].events = (short)(POLLIN |
+		                            (s->clients[i]->len ? POLLOUT : 0));
+	}
+
+	if (poll(fds, (nfds_t)s->n_clients + 1, timeout_ms) <= 0)
+		return;
+
+	/* Backwards, as dropping a client moves the last one into its slot */
+	for (i = s->n_clients - 1; i >= 0; i--) {
+		c = s->clients[i];
+		if (fds[i + 1].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+			drop_client(s, i, NULL);
+			continue;
+		}
+
+		/* Subscribers don't send anything; EOF means they've gone */
+		if ((fds[i + 1].revents & POLLIN) &&
+		    read(c->fd, junk, sizeof(junk)) <= 0) {
+			drop_client(s, i, NULL);
+			continue;
+		}
+
+		if (!(fds[i + 1].revents & POLLOUT))
+			continue;
+
+		if ((n = write(c->fd, c->queue, c->len)) < 0) {
+			if (errno != EAGAIN && errno != EINTR)
+				drop_client(s, i, NULL);
+			continue;
+		}
+
+		c->len -= (size_t)n;
+		memmove(c->queue, c->queue + n, c->len);
+	}
+
+	if (fds[0].revents & POLLIN)
+		accept_clients(s);
+}
+/* }}} */
+
+/**
+ * Stop serving: drop every subscriber, and remove the socket.
+ */
+void server_stop(struct server *s)
+{
+	while (s->n_clients)
+		drop_client(s, s->n_clients - 1, NULL);
+
+	if (s->fd >= 0) {
+		close(s->fd);
+		unlink(s->path);
+	}
+}
+
+/* {{{ server_connect */
+/**
+ * Connect to a listen --serve process.
+ *
+ * \param[in] path Socket path
+ * \return the socket, or -1 on error.
+ */
+int server_connect(const char *path)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	if (make_address(&addr, path))
+		return -1;
+
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ||
+	    connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+		fprintf(stderr, "Unable to connect to '%s': %s\n", path,
+		        strerror(errno));
+		if (fd >= 0) close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+/* }}} */
@@ -0,0 +1,48 @@
+/**
+ * sctools: Listen event server
+ * Copyright (C) 2016 Tim Hentenaar.
+ *
+ * This code is licenced under the Simplified BSD License.
+ * See the LICENSE file for details.
+ */
+
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stddef.h>
+
+#include "listen.h"
+#include "sclog.h"
+
+#define SERVER_MAX_CLIENTS 32
+#define SERVER_QUEUE_LEN   (4096 * SCLOG_RECORD_LEN)
+
+/**
+ * A subscriber, and the events queued for it.
+ */
+struct server_client {
+	int           fd;
+	size_t        len;
+	unsigned char queue[SERVER_QUEUE_LEN];
+};
+
+/**
+ * Events are sent to each subscriber in the .sclog format: the
+ * header, followed by a record per event.
+ */
+struct server {
+	int                   fd;
+	const char           *path;
+	struct sclog          log;     /* start times, for the records */
+	int                   n_clients;
+	unsigned long         dropped; /* clients dropped for being slow */
+	struct server_client *clients[SERVER_MAX_CLIENTS];
+};
+
+int  server_start(struct server *s, const char *path, uint64_t start);
+void server_event(struct server *s, const struct listen_event *ev);
+void server_poll(struct server *s, int timeout_ms);
+void server_stop(struct server *s);
+int  server_connect(const char *path);
+
+#endif /* SERVER_H */
@@ -0,0 +1,469 @@
+/**
+ * sctools: Converter simulator
+ * Copyright (C) 2016 Tim Hentenaar.
+ *
+ * This code is licenced under the Simplified BSD License.
+ * See the LICENSE file for details.
+ *
+ * Runs a binary config the way the converter does, on the HID codes
+ * from its initial translation (the '+' and '-' codes in the listen
+ * stream):
+ *
+ * 1. The key is remapped, by the current layer's remaps, falling back
+ *    to the base layer's. Remapping to FN1..FN8 changes the layer, as
+ *    defined by the layerblocks for the combination of FN keys down.
+ * 2. The first macro, in config order, for the remapped key whose
+ *    metas match is run. Otherwise the key goes to the host.
+ * 3. SELECT_n codes sent to the host toggle select n instead (SELECT_0
+ *    resets them all), and reload the config: only the blocks whose
+ *    ifselect, ifset, and ifkeyboard match apply.
+ *
+ * A key's break always does what its make did, even if the layer or
+ * the selects have changed since, so nothing is left stuck down. When
+ * a macro's key is broken, its onbreak steps are run, and the metas
+ * are restored to what they were when it was triggered, unless it has
+ * norestoremeta.
+ *
+ * The blocks which apply are compiled into tables on each reload, so
+ * handling a key is a few lookups, and a short scan of the macros for
+ * that key.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "macro_tokens.h"
+#include "monotime.h"
+#include "sim.h"
+
+#define NO_REMAP 0x100
+
+#define is_meta_key(c) ((c) >= SIM_LCTRL)
+
+static void emit(struct sim *s, int type, unsigned char code)
+{
+	++s->stats.out;
+	if (s->output)
+		s->output(s, type, code, s->ctx);
+}
+
+static void set_meta(struct sim *s, unsigned char meta)
+{
+	if (meta == s->meta) return;
+	s->meta = meta;
+	emit(s, SIM_META, meta);
+}
+
+/* {{{ sim_reload */
+/**
+ * Compile the blocks which apply with the current selects into the
+ * lookup tables. Nothing is allocated, as this may happen in the middle
+ * of a stream; sim_init() made room for all the macros.
+ *
+ * \return 0 on success, -1 on error.
+ */
+int sim_reload(struct sim *s)
+{
+	const struct sc_config *cfg = s->cfg;
+	const struct sc_block *b;
+	unsigned int pos[257], i, j;
+	int layer;
+
+	memset(s->layer_of, 0, sizeof(s->layer_of));
+	memset(pos, 0, sizeof(pos));
+	if (s->cov) {
+		memset(s->cov->remap_at, 0, sizeof(s->cov->remap_at));
+		memset(s->cov->layer_at, 0, sizeof(s->cov->layer_at));
+	}
+	for (i = 0; i < SIM_MAX_LAYERS; i++) {
+		for (j = 0; j < 256; j++)
+			s->remap[i][j] = NO_REMAP;
+	}
+
+	/* Later blocks override earlier ones; macros are kept in order */
+	for (i = 0; i < cfg->n_blocks; i++) {
+		b = &cfg->blocks[i];
+		if (!sc_config_applies(b, s->selects, s->set, s->keyboard))
+			continue;
+
+		switch (b->type) {
+		case SC_BLOCK_LAYERDEF:
+			for (j = 0; j < b->n_entries; j++) {
+				layer = b->entries[2 * j + 1];
+				if (layer >= SIM_MAX_LAYERS) continue;
+				s->layer_of[b->entries[2 * j]] = (unsigned char)layer;
+				if (s->cov)
+					s->cov->layer_at[b->entries[2 * j]] =
+						(size_t)(b->entries + 2 * j - cfg->image);
+			}
+		break;
+		case SC_BLOCK_REMAP:
+			if (b->layer >= SIM_MAX_LAYERS) {
+				fprintf(stderr, "Block at offset %lu: layer %d is "
+				        "beyond %d, ignored\n", (unsigned long)b->offset,
+				        b->layer, SIM_MAX_LAYERS - 1);
+				break;
+			}
+
+			for (j = 0; j < b->n_entries; j++) {
+				s->remap[b->layer][b->entries[2 * j]] =
+					b->entries[2 * j + 1];
+				if (s->cov)
+					s->cov->remap_at[b->layer][b->entries[2 * j]] =
+						(size_t)(b->entries + 2 * j - cfg->image);
+			}
+		break;
+		case SC_BLOCK_MACRO:
+			for (j = 0; j < b->n_entries; j++)
+				++pos[b->macros[j].hid + 1];
+		}
+	}
+
+	/* Bucket the macros by key */
+	for (i = 1; i < 257; i++)
+		pos[i] += pos[i - 1];
+	memcpy(s->macro_first, pos, sizeof(pos));
+
+	for (i = 0; i < cfg->n_blocks; i++) {
+		b = &cfg->blocks[i];
+		if (b->type != SC_BLOCK_MACRO ||
+		    !sc_config_applies(b, s->selects, s->set, s->keyboard))
+			continue;
+
+		for (j = 0; j < b->n_entries; j++)
+			s->macros[pos[b->macros[j].hid]++] = &b->macros[j];
+	}
+
+	s->layer = s->layer_of[s->fn];
+	++s->stats.reloads;
+	return 0;
+}
+/* }}} */
+
+/* {{{ sim_init */
+/**
+ * Initialize a simulator, as the converter is at power-up: only
+ * select 0 is active, and no keys are down.
+ *
+ * \param[in] s        Simulator
+ * \param[in] cfg      Config to run
+ * \param[in] set      Scancode set the keyboard uses (SC_SET*)
+ * \param[in] keyboard Keyboard ID, or -1 for none
+ * \return 0 on success, -1 on error.
+ */
+int sim_init(struct sim *s, const struct sc_config *cfg, unsigned char set,
+             int keyboard)
+{
+	unsigned int i;
+
+	memset(s, 0, sizeof(*s));
+	s->cfg      = cfg;
+	s->set      = set;
+	s->keyboard = keyboard;
+	s->selects  = 1;
+
+	/* Room for every macro, so that a reload never has to allocate */
+	for (i = 0; i < cfg->n_blocks; i++) {
+		if (cfg->blocks[i].type == SC_BLOCK_MACRO)
+			s->n_macros += cfg->blocks[i].n_entries;
+	}
+
+	if (s->n_macros && !(s->macros =
+	    malloc(s->n_macros * sizeof(struct sc_macro *)))) {
+		fputs("Unable to allocate memory for the macros\n", stderr);
+		return -1;
+	}
+
+	if (sim_reload(s))
+		return -1;
+
+	s->stats.reloads = 0;
+	return 0;
+}
+/* }}} */
+
+void sim_free(struct sim *s)
+{
+	free((void *)s->macros);
+	s->macros   = NULL;
+	s->n_macros = 0;
+}
+
+void sim_set_output(struct sim *s,
+                    void (*output)(struct sim *, int, unsigned char, void *),
+                    void *ctx)
+{
+	s->output = output;
+	s->ctx    = ctx;
+}
+
+/* {{{ Coverage */
+/**
+ * Set up coverage counts for a config.
+ *
+ * \return 0 on success, -1 on error.
+ */
+int sim_coverage_init(struct sim_coverage *c, const struct sc_config *cfg)
+{
+	memset(c, 0, sizeof(*c));
+	if ((c->hits = calloc(cfg->len + 1, sizeof(*c->hits))))
+		return 0;
+
+	fputs("Unable to allocate memory for the coverage\n", stderr);
+	return -1;
+}
+
+void sim_coverage_free(struct sim_coverage *c)
+{
+	free(c->hits);
+	c->hits = NULL;
+}
+
+/**
+ * Count what a simulator uses of its config in \a c (or stop counting,
+ * if it's NULL.)
+ *
+ * \return 0 on success, -1 on error.
+ */
+int sim_set_coverage(struct sim *s, struct sim_coverage *c)
+{
+	unsigned long reloads = s->stats.reloads;
+	int ret;
+
+	s->cov = c;
+	ret = sim_reload(s);
+	s->stats.reloads = reloads;
+	return ret;
+}
+
+static void cover_remap(struct sim *s, unsigned char hid)
+{
+	size_t at;
+
+	if (!(at = s->cov->remap_at[s->layer][hid]))
+		at = s->cov->remap_at[0][hid];
+	if (at) ++s->cov->hits[at];
+}
+
+static void cover_layer(struct sim *s)
+{
+	if (s->cov->layer_at[s->fn])
+		++s->cov->hits[s->cov->layer_at[s->fn]];
+}
+/* }}} */
+
+/* {{{ output_key */
+/**
+ * Send a key to the host, or handle it if it's one of ours.
+ */
+static void output_key(struct sim *s, unsigned char code, int down)
+{
+	unsigned char bit;
+
+	/* A key remapped to nothing (or an error code) isn't sent */
+	if (code < SIM_FIRST_KEY || sc_is_fn(code))
+		return;
+
+	if (sc_is_select(code)) {
+		if (!down) return;
+		s->selects = sc_config_select(s->selects, code);
+		sim_reload(s);
+		return;
+	}
+
+	if (is_meta_key(code)) {
+		bit = (unsigned char)(1 << (code - SIM_LCTRL));
+		set_meta(s, (unsigned char)(down ? s->meta | bit : s->meta & ~bit));
+		return;
+	}
+
+	if (!down == !s->down[code])
+		return;
+
+	s->down[code] = (unsigned char)down;
+	if (down) ++s->n_down;
+	else --s->n_down;
+	emit(s, down ? SIM_DOWN : SIM_UP, code);
+}
+/* }}} */
+
+/* {{{ run_steps */
+static void run_steps(struct sim *s, const unsigned char *step,
+                      unsigned int n)
+{
+	unsigned char cmd, val;
+	unsigned int i, k;
+
+	for (i = 0; i < n; i++, step += 2) {
+		cmd = step[0];
+		val = step[1];
+		++s->stats.steps;
+
+		if (cmd & Q_PUSH_META) {
+			if (s->meta_sp < SIM_META_STACK)
+				s->meta_stack[s->meta_sp++] = s->meta;
+			else ++s->stats.meta_overflows;
+		}
+
+		switch (cmd & ~Q_PUSH_META) {
+		case Q_KEY_PRESS:
+			output_key(s, val, 1);
+			output_key(s, val, 0);
+		break;
+		case Q_KEY_MAKE:    output_key(s, val, 1);          break;
+		case Q_KEY_RELEASE: output_key(s, val, 0);          break;
+		case Q_ASSIGN_META: set_meta(s, val);               break;
+		case Q_SET_META:    set_meta(s, s->meta | val);     break;
+		case Q_CLEAR_META:
+			set_meta(s, (unsigned char)(s->meta & ~val));
+		break;
+		case Q_TOGGLE_META: set_meta(s, s->meta ^ val);     break;
+		case Q_POP_META:
+			if (s->meta_sp) set_meta(s, s->meta_stack[--s->meta_sp]);
+		break;
+		case Q_POP_ALL_META:
+			if (s->meta_sp) set_meta(s, s->meta_stack[0]);
+			s->meta_sp = 0;
+		break;
+		case Q_DELAY_MS:
+			s->time += (uint64_t)val * NS_PER_MS;
+		break;
+		case Q_CLEAR_ALL:
+			for (k = 0; k < SIM_LCTRL && s->n_down; k++)
+				output_key(s, (unsigned char)k, 0);
+			set_meta(s, 0);
+		break;
+		case Q_BOOT:
+			++s->stats.boots;
+		break;
+		}
+	}
+}
+/* }}} */
+
+/* {{{ find_macro */
+/**
+ * Find the first macro for \a code whose metas match.
+ */
+static const struct sc_macro *find_macro(const struct sim *s,
+                                         unsigned char code)
+{
+	unsigned int i;
+
+	for (i = s->macro_first[code]; i < s->macro_first[code + 1]; i++) {
+		if (sc_macro_matches(s->macros[i], s->meta))
+			return s->macros[i];
+	}
+
+	return NULL;
+}
+/* }}} */
+
+/**
+ * Get what a key is remapped to on a layer: by the layer's remaps, or
+ * else the base layer's.
+ */
+unsigned char sim_remap(const struct sim *s, unsigned char layer,
+                        unsigned char hid)
+{
+	unsigned short code;
+
+	if ((code = s->remap[layer][hid]) == NO_REMAP &&
+	    (code = s->remap[0][hid]) == NO_REMAP)
+		return hid;
+	return (unsigned char)code;
+}
+
+/**
+ * Activate the given selects (bit n for select n), as if the
+ * SELECT_n codes had been output.
+ *
+ * \return 0 on success, -1 on error.
+ */
+int sim_select(struct sim *s, unsigned char selects)
+{
+	s->selects = selects;
+	return sim_reload(s);
+}
+
+/* {{{ sim_key */
+/**
+ * Make or break a key, as translated to a HID code.
+ *
+ * \param[in] s    Simulator
+ * \param[in] hid  HID code
+ * \param[in] make 1 for a make, 0 for a break
+ * \param[in] time Time of the event (ns). Macro delays may have put
+ *                 the simulator ahead of it.
+ */
+void sim_key(struct sim *s, unsigned char hid, int make, uint64_t time)
+{
+	const struct sc_macro *m;
+	unsigned short code;
+
+	if (time > s->time) s->time = time;
+	++s->stats.in;
+
+	if (!make) {
+		code = s->made_as[hid];
+		if (sc_is_fn(code)) {
+			s->fn &= (unsigned char)~(1 << (code - SIM_FN1));
+			if (s->cov) cover_layer(s);
+		} else if ((m = s->active[hid])) {
+			if (s->cov) ++s->cov->hits[m->offset + 1];
+			run_steps(s, m->release, m->n_release);
+			if (m->restore_meta) set_meta(s, s->saved_meta[hid]);
+			s->active[hid] = NULL;
+		} else output_key(s, (unsigned char)code, 0);
+		goto layer;
+	}
+
+	if ((code = sim_remap(s, s->layer, hid)) != hid)
+		++s->stats.remapped;
+	s->made_as[hid] = (unsigned char)code;
+	if (s->cov) cover_remap(s, hid);
+
+	if (sc_is_fn(code)) {
+		s->fn |= (unsigned char)(1 << (code - SIM_FN1));
+		if (s->cov) cover_layer(s);
+	} else if (!s->active[hid] && (m = find_macro(s, (unsigned char)code))) {
+		++s->stats.macros;
+		if (s->cov) ++s->cov->hits[m->offset];
+		s->active[hid]     = m;
+		s->saved_meta[hid] = s->meta;
+		run_steps(s, m->press, m->n_press);
+	} else if (!s->active[hid])
+		output_key(s, (unsigned char)code, 1);
+
+layer:
+	if (s->layer != s->layer_of[s->fn]) {
+		s->layer = s->layer_of[s->fn];
+		++s->stats.layer_changes;
+	}
+}
+/* }}} */
+
+/* {{{ sim_report */
+/**
+ * Build the report the host would have after the last output event.
+ */
+void sim_report(const struct sim *s, struct sim_report *r)
+{
+	unsigned int i, n = 0;
+
+	memset(r, 0, sizeof(*r));
+	r->time = s->time;
+	r->meta = s->meta;
+
+	if (s->n_down > SIM_REPORT_KEYS) {
+		memset(r->keys, 0x01, SIM_REPORT_KEYS);
+		return;
+	}
+
+	for (i = 0; i < SIM_LCTRL && n < s->n_down; i++) {
+		if (s->down[i])
+			r->keys[n++] = (unsigned char)i;
+	}
+}
+/* }}} */
@@ -0,0 +1,117 @@
+/**
+ * sctools: Converter simulator
+ * Copyright (C) 2016 Tim Hentenaar.
+ *
+ * This code is licenced under the Simplified BSD License.
+ * See the LICENSE file for details.
+ */
+
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdint.h>
+
+#include "config.h"
+
+#define SIM_MAX_LAYERS     32
+#define SIM_META_STACK     16
+#define SIM_REPORT_KEYS    6
+
+/* Codes handled by the converter itself */
+#define SIM_FN1       SC_HID_FN1
+#define SIM_SELECT_0  SC_HID_SELECT_0
+#define SIM_LCTRL     0xE0 /* first modifier */
+#define SIM_FIRST_KEY 0x04 /* below are no key, and errors */
+
+/* Output events */
+#define SIM_DOWN 'd'
+#define SIM_UP   'u'
+#define SIM_META 'm' /* code is the new meta byte */
+
+/**
+ * An output report, as sent to the host in boot protocol. If more
+ * than SIM_REPORT_KEYS keys are down, every slot is 0x01
+ * (ErrorRollOver).
+ */
+struct sim_report {
+	uint64_t      time;
+	unsigned char meta;
+	unsigned char keys[SIM_REPORT_KEYS];
+};
+
+struct sim_stats {
+	unsigned long in;          /* input makes and breaks     */
+	unsigned long out;         /* output events              */
+	unsigned long remapped;    /* keys changed by a remap    */
+	unsigned long macros;      /* macros triggered           */
+	unsigned long steps;       /* macro steps run            */
+	unsigned long reloads;     /* config reloads (SELECT_n)  */
+	unsigned long layer_changes;
+	unsigned long meta_overflows;
+	unsigned long boots;       /* BOOT steps (ignored)       */
+};
+
+/**
+ * How often each entry of a config was used, counted at the entry's
+ * offset in the image: a remap when it remaps a make, a layer
+ * definition when its FN keys are held, and a macro when it's
+ * triggered (at its offset) and released (at the offset after).
+ */
+struct sim_coverage {
+	unsigned long *hits;                   /* one per byte of the image */
+	size_t         remap_at[SIM_MAX_LAYERS][256]; /* 0: not remapped    */
+	size_t         layer_at[256];          /* by FN keys down           */
+};
+
+struct sim {
+	const struct sc_config *cfg;
+	unsigned char  set;        /* SC_SET*                     */
+	int            keyboard;   /* keyboard ID, or -1          */
+	unsigned char  selects;    /* bit n for select n          */
+	unsigned char  fn;         /* FN keys down                */
+	unsigned char  layer;
+	unsigned char  meta;
+	unsigned char  down[256];  /* output keys down            */
+	unsigned int   n_down;
+	uint64_t       time;
+
+	/* What each input key was made as, so it's broken as the same */
+	unsigned char  made_as[256];
+	const struct sc_macro *active[256];
+	unsigned char  saved_meta[256];
+
+	unsigned char  meta_stack[SIM_META_STACK];
+	unsigned int   meta_sp;
+
+	/* Tables for the blocks which apply, rebuilt on a reload */
+	unsigned char  layer_of[256]; /* by FN keys down           */
+	unsigned short remap[SIM_MAX_LAYERS][256]; /* 0x100: none   */
+	unsigned int   macro_first[257]; /* into macros, by key     */
+	const struct sc_macro **macros; /* room for all the config's */
+	unsigned int   n_macros;
+
+	void         (*output)(struct sim *s, int type, unsigned char code,
+	                       void *ctx);
+	void          *ctx;
+	struct sim_coverage *cov;
+	struct sim_stats stats;
+};
+
+int  sim_init(struct sim *s, const struct sc_config *cfg, unsigned char set,
+              int keyboard);
+void sim_free(struct sim *s);
+void sim_set_output(struct sim *s,
+                    void (*output)(struct sim *, int, unsigned char, void *),
+                    void *ctx);
+int  sim_reload(struct sim *s);
+int  sim_select(struct sim *s, unsigned char selects);
+unsigned char sim_remap(const struct sim *s, unsigned char layer,
+                        unsigned char hid);
+void sim_key(struct sim *s, unsigned char hid, int make, uint64_t time);
+void sim_report(const struct sim *s, struct sim_report *r);
+
+int  sim_coverage_init(struct sim_coverage *c, const struct sc_config *cfg);
+void sim_coverage_free(struct sim_coverage *c);
+int  sim_set_coverage(struct sim *s, struct sim_coverage *c);
+
+#endif /* SIM_H */
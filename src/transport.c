@@ -0,0 +1,130 @@
+/**
+ * sctools: Transport layer
+ * Copyright (C) 2016 Tim Hentenaar.
+ *
+ * This code is licenced under the Simplified BSD License.
+ * See the LICENSE file for details.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "transport.h"
+#include "emulator.h"
+#include "transport_replay.h"
+
+#define N_TRANSPORTS 5
+static const struct transport_ops *transports[N_TRANSPORTS] = {
+	&hidapi_transport,
+	&hidraw_transport,
+	&fake_transport,
+	&emu_transport,
+	&replay_transport
+};
+
+static const struct transport_ops *current = &hidapi_transport;
+static const char *current_options = NULL;
+static const char *capture_path = NULL;
+
+/* {{{ transport_select */
+/**
+ * Select the backend to use.
+ *
+ * \param[in] spec Backend name, optionally followed by a colon and
+ *                 backend-specific options (e.g. "emu:eeprom=1024").
+ * \return 0 on success, -1 if no such backend exists.
+ */
+int transport_select(const char *spec)
+{
+	int i;
+	size_t len;
+	const char *opts;
+
+	if (!spec) goto err;
+	opts = strchr(spec, ':');
+	len  = opts ? (size_t)(opts - spec) : strlen(spec);
+
+	for (i = 0; i < N_TRANSPORTS; i++) {
+		if (strlen(transports[i]->name) == len &&
+		    !memcmp(spec, transports[i]->name, len)) {
+			current         = transports[i];
+			current_options = opts ? opts + 1 : NULL;
+			return 0;
+		}
+	}
+
+err:
+	return -1;
+}
+/* }}} */
+
+const char *transport_name(void)
+{
+	return current->name;
+}
+
+/**
+ * Record everything sent to, and received from, the device into
+ * \a path, whichever backend is selected.
+ */
+void transport_capture(const char *path)
+{
+	capture_path = path;
+}
+
+int transport_init(void)
+{
+	if (capture_path && !record_wrap(current, capture_path))
+		current = &record_transport;
+	return current->init ? current->init(current_options) : 0;
+}
+
+void transport_exit(void)
+{
+	if (current->exit)
+		current->exit();
+}
+
+/* {{{ transport_open */
+/**
+ * Find the converter interface matching \a match and open it.
+ *
+ * \param[in] match Interface to look for
+ * \return the device, or NULL if it can't be found or opened.
+ */
+struct transport *transport_open(const struct transport_match *match)
+{
+	return current->open(match);
+}
+/* }}} */
+
+/* {{{ transport_open_all */
+/**
+ * Open every converter interface matching \a match.
+ *
+ * \param[in]  match Interface to look for
+ * \param[out] devs  Devices opened
+ * \param[in]  max   Most devices to open
+ * \return the number of devices opened (0 if none could be).
+ */
+int transport_open_all(const struct transport_match *match,
+                       struct transport **devs, int max)
+{
+	if (current->open_all)
+		return current->open_all(match, devs, max);
+
+	/* Backends that can only find one device */
+	return max > 0 && (devs[0] = current->open(match)) ? 1 : 0;
+}
+/* }}} */
+
+/**
+ * Get a descriptor which polls readable when \a t has a report
+ * waiting.
+ *
+ * \return the descriptor, or -1 if the backend doesn't have one.
+ */
+int transport_fd(struct transport *t)
+{
+	return t->ops->fd ? t->ops->fd(t) : -1;
+}
@@ -0,0 +1,80 @@
+/**
+ * sctools: Transport layer
+ * Copyright (C) 2016 Tim Hentenaar.
+ *
+ * This code is licenced under the Simplified BSD License.
+ * See the LICENSE file for details.
+ */
+
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <stddef.h>
+
+/**
+ * Describes which of the converter's interfaces to open.
+ *
+ * Backends that have the HID usage information use \a usage_page
+ * and \a usage, otherwise they fall back to \a interface.
+ */
+struct transport_match {
+	int usage_page;
+	int usage;
+	int interface;
+};
+
+struct transport;
+
+/**
+ * Backend operations.
+ *
+ * read() returns the number of bytes read, 0 on timeout, or -1
+ * on error. A negative timeout blocks. write() returns the
+ * number of bytes written, or -1 on error.
+ *
+ * open_all() opens every matching device, up to \a max, and returns
+ * how many it opened. fd() returns a descriptor which polls readable
+ * when a report is waiting, or -1. Either may be NULL.
+ */
+struct transport_ops {
+	const char *name;
+	int  (*init)(const char *options);
+	void (*exit)(void);
+	struct transport *(*open)(const struct transport_match *match);
+	int  (*write)(struct transport *t, const unsigned char *buf,
+	              size_t len);
+	int  (*read)(struct transport *t, unsigned char *buf, size_t len,
+	             int timeout_ms);
+	void (*close)(struct transport *t);
+	int  (*open_all)(const struct transport_match *match,
+	                 struct transport **devs, int max);
+	int  (*fd)(struct transport *t);
+};
+
+/**
+ * An open device. Backends embed this as the first member of their
+ * own device structure.
+ */
+struct transport {
+	const struct transport_ops *ops;
+};
+
+extern const struct transport_ops hidapi_transport;
+extern const struct transport_ops hidraw_transport;
+extern const struct transport_ops fake_transport;
+
+int  transport_select(const char *spec);
+const char *transport_name(void);
+void transport_capture(const char *path);
+int  transport_init(void);
+void transport_exit(void);
+struct transport *transport_open(const struct transport_match *match);
+int  transport_open_all(const struct transport_match *match,
+                        struct transport **devs, int max);
+int  transport_fd(struct transport *t);
+
+#define transport_write(T, B, L)    ((T)->ops->write((T), (B), (L)))
+#define transport_read(T, B, L, MS) ((T)->ops->read((T), (B), (L), (MS)))
+#define transport_close(T)          ((T)->ops->close(T))
+
+#endif /* TRANSPORT_H */
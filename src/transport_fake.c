@@ -0,0 +1,182 @@
+/**
+ * sctools: In-memory fake transport
+ * Copyright (C) 2016 Tim Hentenaar.
+ *
+ * This code is licenced under the Simplified BSD License.
+ * See the LICENSE file for details.
+ *
+ * Every write is handed to a responder, which may queue reports for
+ * the host to read. Without a responder, writes are accepted and
+ * reads simply time out, like a device that never answers.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rawhid_defs.h"
+#include "transport.h"
+#include "transport_fake.h"
+
+#define FAKE_QUEUE_LEN 16
+
+struct fake_device {
+	struct transport t;
+	struct transport_match match;
+	unsigned char queue[FAKE_QUEUE_LEN][PACKET_LEN];
+	size_t queue_len[FAKE_QUEUE_LEN];
+	unsigned int head, count;
+	void *priv;
+};
+
+static const struct fake_responder *responder = NULL;
+static void *responder_ctx = NULL;
+static int n_devices = 1;
+
+/* {{{ fake_set_responder */
+/**
+ * Install the functions that answer the host.
+ *
+ * \param[in] r   Responder (NULL for none)
+ * \param[in] ctx Passed to the responder unchanged
+ */
+void fake_set_responder(const struct fake_responder *r, void *ctx)
+{
+	responder     = r;
+	responder_ctx = ctx;
+}
+/* }}} */
+
+/**
+ * Set the number of devices open_all() finds.
+ */
+void fake_set_devices(int n)
+{
+	n_devices = n;
+}
+
+/* {{{ fake_push */
+/**
+ * Queue a report for the host to read.
+ *
+ * \param[in] t   Device
+ * \param[in] buf Report data
+ * \param[in] len Report length (at most PACKET_LEN)
+ * \return 0 on success, -1 if the queue is full.
+ */
+int fake_push(struct transport *t, const unsigned char *buf, size_t len)
+{
+	struct fake_device *dev = (struct fake_device *)t;
+	unsigned int i;
+
+	if (dev->count >= FAKE_QUEUE_LEN)
+		return -1;
+
+	if (len > PACKET_LEN) len = PACKET_LEN;
+	i = (dev->head + dev->count++) % FAKE_QUEUE_LEN;
+	memcpy(dev->queue[i], buf, len);
+	dev->queue_len[i] = len;
+	return 0;
+}
+/* }}} */
+
+const struct transport_match *fake_match(struct transport *t)
+{
+	return &((struct fake_device *)t)->match;
+}
+
+void fake_set_priv(struct transport *t, void *priv)
+{
+	((struct fake_device *)t)->priv = priv;
+}
+
+void *fake_priv(struct transport *t)
+{
+	return ((struct fake_device *)t)->priv;
+}
+
+static struct transport *fake_open(const struct transport_match *match)
+{
+	struct fake_device *dev = calloc(1, sizeof(struct fake_device));
+
+	if (!dev) {
+		fputs("Unable to open device\n", stderr);
+		return NULL;
+	}
+
+	dev->t.ops = &fake_transport;
+	dev->match = *match;
+	if (responder && responder->open &&
+	    responder->open(&dev->t, responder_ctx) < 0) {
+		free(dev);
+		return NULL;
+	}
+
+	return &dev->t;
+}
+
+static int fake_open_all(const struct transport_match *match,
+                         struct transport **devs, int max)
+{
+	int n = 0;
+
+	while (n < n_devices && n < max && (devs[n] = fake_open(match)))
+		++n;
+	return n;
+}
+
+static int fake_write(struct transport *t, const unsigned char *buf,
+                      size_t len)
+{
+	if (responder && responder->write &&
+	    responder->write(t, buf, len, responder_ctx) < 0)
+		return -1;
+	return (int)len;
+}
+
+/* {{{ fake_read */
+/**
+ * Dequeue a report. If the queue is empty, the responder gets a
+ * chance to produce something within \a timeout_ms, otherwise
+ * it's a timeout.
+ */
+static int fake_read(struct transport *t, unsigned char *buf, size_t len,
+                     int timeout_ms)
+{
+	struct fake_device *dev = (struct fake_device *)t;
+	size_t n;
+
+	if (!dev->count && responder && responder->wait &&
+	    responder->wait(t, timeout_ms, responder_ctx) < 0)
+		return -1;
+
+	if (!dev->count)
+		return 0;
+
+	n = dev->queue_len[dev->head];
+	if (n > len) n = len;
+	memcpy(buf, dev->queue[dev->head], n);
+	dev->head = (dev->head + 1) % FAKE_QUEUE_LEN;
+	--dev->count;
+	return (int)n;
+}
+/* }}} */
+
+static void fake_close(struct transport *t)
+{
+	if (responder && responder->close)
+		responder->close(t, responder_ctx);
+	free(t);
+}
+
+const struct transport_ops fake_transport = {
+	"fake",
+	NULL,
+	NULL,
+	fake_open,
+	fake_write,
+	fake_read,
+	fake_close,
+	fake_open_all,
+	NULL
+};
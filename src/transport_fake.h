@@ -0,0 +1,38 @@
+/**
+ * sctools: In-memory fake transport
+ * Copyright (C) 2016 Tim Hentenaar.
+ *
+ * This code is licenced under the Simplified BSD License.
+ * See the LICENSE file for details.
+ */
+
+#ifndef TRANSPORT_FAKE_H
+#define TRANSPORT_FAKE_H
+
+#include "transport.h"
+
+/**
+ * Something playing the part of the device. Any of these may be
+ * NULL. Returning -1 from any of them is reported to the host as
+ * an I/O error (or, for open(), as a missing device).
+ *
+ * write() sees every report the host sends. wait() is called when
+ * the host reads with nothing queued, and may take up to
+ * \a timeout_ms (negative for no limit) to queue a report.
+ */
+struct fake_responder {
+	int  (*open)(struct transport *t, void *ctx);
+	int  (*write)(struct transport *t, const unsigned char *buf,
+	              size_t len, void *ctx);
+	int  (*wait)(struct transport *t, int timeout_ms, void *ctx);
+	void (*close)(struct transport *t, void *ctx);
+};
+
+void fake_set_responder(const struct fake_responder *r, void *ctx);
+void fake_set_devices(int n);
+int  fake_push(struct transport *t, const unsigned char *buf, size_t len);
+const struct transport_match *fake_match(struct transport *t);
+void fake_set_priv(struct transport *t, void *priv);
+void *fake_priv(struct transport *t);
+
+#endif /* TRANSPORT_FAKE_H */
@@ -0,0 +1,142 @@
+/**
+ * sctools: hidapi transport
+ * Copyright (C) 2016 Tim Hentenaar.
+ *
+ * This code is licenced under the Simplified BSD License.
+ * See the LICENSE file for details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <hidapi/hidapi.h>
+#include "rawhid_defs.h"
+#include "transport.h"
+
+struct hidapi_device {
+	struct transport t;
+	hid_device *dev;
+};
+
+static int hidapi_init(const char *options)
+{
+	(void)options;
+	return hid_init();
+}
+
+static void hidapi_exit(void)
+{
+	hid_exit();
+}
+
+/* {{{ is_match */
+/**
+ * Check whether an enumerated device is the interface we want.
+ */
+static int is_match(const struct hid_device_info *info,
+                    const struct transport_match *match)
+{
+	/* XXX: hidapi's usage page info is worthless with hidraw */
+	int is_hidraw = strstr(info->path, "/dev/") != NULL;
+
+	if (!is_hidraw &&
+	    info->usage      == match->usage &&
+	    info->usage_page == match->usage_page)
+		return 1;
+
+	/* Search by interface if we don't have the usage info */
+	return (is_hidraw || (!info->usage && !info->usage_page)) &&
+	       info->interface_number == match->interface;
+}
+/* }}} */
+
+/* {{{ hidapi_open_all */
+/**
+ * Find the converters, and open them.
+ *
+ * \param[in]  match Interface to look for
+ * \param[out] devs  Device handles
+ * \param[in]  max   Most devices to open
+ * \return the number of devices opened.
+ */
+static int hidapi_open_all(const struct transport_match *match,
+                           struct transport **devs, int max)
+{
+	int n = 0, found = 0;
+	struct hid_device_info *info, *cur_dev;
+	struct hidapi_device *dev;
+
+	/* Enumerate devices */
+	info = hid_enumerate(SC_VID, SC_PID);
+	for (cur_dev = info; cur_dev && n < max; cur_dev = cur_dev->next) {
+		if (!is_match(cur_dev, match))
+			continue;
+
+		++found;
+		if (!(dev = malloc(sizeof(struct hidapi_device))))
+			break;
+
+		dev->t.ops = &hidapi_transport;
+		if (!(dev->dev = hid_open_path(cur_dev->path))) {
+			free(dev);
+			continue;
+		}
+
+		devs[n++] = &dev->t;
+	}
+
+	/* Free the enumeration data */
+	if (info) hid_free_enumeration(info);
+
+	if (!found) fputs("No devices found.\n", stderr);
+	else if (!n) fputs("Unable to open device\n", stderr);
+	return n;
+}
+/* }}} */
+
+/* {{{ hidapi_open */
+/**
+ * Find the converter
+ *
+ * \param[in] match Interface to look for
+ * \return the device handle, or NULL if the device can't be found.
+ */
+static struct transport *hidapi_open(const struct transport_match *match)
+{
+	struct transport *t;
+
+	return hidapi_open_all(match, &t, 1) ? t : NULL;
+}
+/* }}} */
+
+static int hidapi_write(struct transport *t, const unsigned char *buf,
+                        size_t len)
+{
+	return hid_write(((struct hidapi_device *)t)->dev, buf, len);
+}
+
+static int hidapi_read(struct transport *t, unsigned char *buf, size_t len,
+                       int timeout_ms)
+{
+	return hid_read_timeout(((struct hidapi_device *)t)->dev, buf, len,
+	                        timeout_ms);
+}
+
+static void hidapi_close(struct transport *t)
+{
+	hid_close(((struct hidapi_device *)t)->dev);
+	free(t);
+}
+
+const struct transport_ops hidapi_transport = {
+	"hidapi",
+	hidapi_init,
+	hidapi_exit,
+	hidapi_open,
+	hidapi_write,
+	hidapi_read,
+	hidapi_close,
+	hidapi_open_all,
+	NULL
+};
@@ -0,0 +1,283 @@
+/**
+ * sctools: Native Linux hidraw transport
+ * Copyright (C) 2016 Tim Hentenaar.
+ *
+ * This code is licenced under the Simplified BSD License.
+ * See the LICENSE file for details.
+ *
+ * This talks to /dev/hidrawN directly. Reports are read and written
+ * straight from / to the caller's buffer, and read timeouts are handled
+ * with poll(), so there's no helper thread and no intermediate copies.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+
+#include "rawhid_defs.h"
+#include "transport.h"
+
+#ifdef HAVE_LINUX_HIDRAW_H
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <poll.h>
+#include <linux/hidraw.h>
+
+struct hidraw_device {
+	struct transport t;
+	int fd;
+};
+
+/* {{{ get_usage */
+/**
+ * Get the top-level usage page and usage from a report descriptor.
+ *
+ * \param[in]  fd         hidraw device
+ * \param[out] usage_page Usage page (0 if not found)
+ * \param[out] usage      Usage (0 if not found)
+ */
+static void get_usage(int fd, int *usage_page, int *usage)
+{
+	int size;
+	unsigned int i, n, val, j;
+	struct hidraw_report_descriptor desc;
+
+	*usage_page = *usage = 0;
+	if (ioctl(fd, HIDIOCGRDESCSIZE, &size) < 0 || size <= 0)
+		return;
+
+	desc.size = (unsigned int)size;
+	if (ioctl(fd, HIDIOCGRDESC, &desc) < 0)
+		return;
+
+	for (i = 0; i < desc.size; i += n + 1) {
+		/* Long item */
+		if (desc.value[i] == 0xfe) {
+			n = (i + 1 < desc.size) ? desc.value[i + 1] + 2U : 0;
+			continue;
+		}
+
+		n = desc.value[i] & 3;
+		if (n == 3) n = 4;
+		if (i + n >= desc.size)
+			break;
+
+		for (val = 0, j = n; j; j--)
+			val = (val << 8) | desc.value[i + j];
+
+		switch (desc.value[i] & 0xfc) {
+		case 0x04: /* Usage Page */
+			if (!*usage_page) *usage_page = (int)(val & 0xffff);
+		break;
+		case 0x08: /* Usage */
+			if (!*usage) *usage = (int)(val & 0xffff);
+		break;
+		case 0xa0: /* Collection */
+			return;
+		}
+	}
+}
+/* }}} */
+
+/* {{{ get_interface */
+/**
+ * Get the USB interface number of a hidraw node from sysfs.
+ *
+ * \param[in] name Node name (e.g. "hidraw3")
+ * \return the interface number, or -1 if unknown.
+ */
+static int get_interface(const char *name)
+{
+	char path[PATH_MAX], real[PATH_MAX];
+	char *p, *base;
+
+	if (strlen(name) > 64)
+		goto err;
+
+	sprintf(path, "/sys/class/hidraw/%s/device", name);
+	if (!realpath(path, real))
+		goto err;
+
+	/* .../1-1:1.3/0003:16C0:047D.0005 -> 1-1:1.3 */
+	if (!(p = strrchr(real, '/')))
+		goto err;
+	*p = '\0';
+
+	if (!(base = strrchr(real, '/')) || !strchr(base, ':') ||
+	    !(p = strrchr(base, '.')))
+		goto err;
+	return atoi(p + 1);
+
+err:
+	return -1;
+}
+/* }}} */
+
+/* {{{ hidraw_open_all */
+/**
+ * Find the converters by scanning /dev for hidraw nodes.
+ *
+ * \param[in]  match Interface to look for
+ * \param[out] devs  Device handles
+ * \param[in]  max   Most devices to open
+ * \return the number of devices opened.
+ */
+static int hidraw_open_all(const struct transport_match *match,
+                           struct transport **devs, int max)
+{
+	int fd, n = 0, usage_page, usage;
+	char path[PATH_MAX];
+	DIR *dir;
+	struct dirent *ent;
+	struct hidraw_devinfo info;
+	struct hidraw_device *dev;
+
+	if (!(dir = opendir("/dev")))
+		goto not_found;
+
+	while (n < max && (ent = readdir(dir))) {
+		if (strncmp(ent->d_name, "hidraw", 6) ||
+		    strlen(ent->d_name) > 64)
+			continue;
+
+		sprintf(path, "/dev/%s", ent->d_name);
+		if ((fd = open(path, O_RDWR)) < 0)
+			continue;
+
+		if (ioctl(fd, HIDIOCGRAWINFO, &info) < 0 ||
+		    (unsigned short)info.vendor  != SC_VID ||
+		    (unsigned short)info.product != SC_PID)
+			goto next;
+
+		/* Prefer the usage info, since we have it here */
+		get_usage(fd, &usage_page, &usage);
+		if (usage_page || usage) {
+			if (usage_page != match->usage_page ||
+			    usage      != match->usage)
+				goto next;
+		} else if (get_interface(ent->d_name) != match->interface)
+			goto next;
+
+		if (!(dev = malloc(sizeof(struct hidraw_device)))) {
+			fputs("Unable to open device\n", stderr);
+			close(fd);
+			break;
+		}
+
+		dev->t.ops = &hidraw_transport;
+		dev->fd    = fd;
+		devs[n++]  = &dev->t;
+		continue;
+
+next:
+		close(fd);
+	}
+
+	closedir(dir);
+	if (n) return n;
+
+not_found:
+	fputs("No devices found.\n", stderr);
+	return 0;
+}
+/* }}} */
+
+/* {{{ hidraw_open */
+/**
+ * Find the converter.
+ *
+ * \param[in] match Interface to look for
+ * \return the device handle, or NULL if the device can't be found.
+ */
+static struct transport *hidraw_open(const struct transport_match *match)
+{
+	struct transport *t;
+
+	return hidraw_open_all(match, &t, 1) ? t : NULL;
+}
+/* }}} */
+
+static int hidraw_fd(struct transport *t)
+{
+	return ((struct hidraw_device *)t)->fd;
+}
+
+static int hidraw_write(struct transport *t, const unsigned char *buf,
+                        size_t len)
+{
+	ssize_t n;
+
+	do n = write(((struct hidraw_device *)t)->fd, buf, len);
+	while (n < 0 && errno == EINTR);
+	return (int)n;
+}
+
+/* {{{ hidraw_read */
+/**
+ * Read a report, waiting at most \a timeout_ms for it to arrive.
+ * An interrupted wait is reported as a timeout.
+ */
+static int hidraw_read(struct transport *t, unsigned char *buf, size_t len,
+                       int timeout_ms)
+{
+	int n;
+	ssize_t r;
+	struct pollfd pfd;
+
+	pfd.fd      = ((struct hidraw_device *)t)->fd;
+	pfd.events  = POLLIN;
+	pfd.revents = 0;
+
+	if ((n = poll(&pfd, 1, timeout_ms)) <= 0)
+		return (n < 0 && errno != EINTR) ? -1 : 0;
+
+	if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL))
+		return -1;
+
+	if ((r = read(pfd.fd, buf, len)) < 0)
+		return (errno == EINTR || errno == EAGAIN) ? 0 : -1;
+	return (int)r;
+}
+/* }}} */
+
+static void hidraw_close(struct transport *t)
+{
+	close(((struct hidraw_device *)t)->fd);
+	free(t);
+}
+
+#else
+
+static struct transport *hidraw_open(const struct transport_match *match)
+{
+	(void)match;
+	fputs("The hidraw transport isn't available on this platform\n",
+	      stderr);
+	return NULL;
+}
+
+#define hidraw_write    NULL
+#define hidraw_read     NULL
+#define hidraw_close    NULL
+#define hidraw_open_all NULL
+#define hidraw_fd       NULL
+
+#endif /* HAVE_LINUX_HIDRAW_H */
+
+const struct transport_ops hidraw_transport = {
+	"hidraw",
+	NULL,
+	NULL,
+	hidraw_open,
+	hidraw_write,
+	hidraw_read,
+	hidraw_close,
+	hidraw_open_all,
+	hidraw_fd
+};
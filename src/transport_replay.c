@@ -0,0 +1,586 @@
+/**
+ * sctools: Capture and replay of transport sessions
+ * Copyright (C) 2016 Tim Hentenaar.
+ *
+ * This code is licenced under the Simplified BSD License.
+ * See the LICENSE file for details.
+ *
+ * The record transport wraps another one, and writes every call made
+ * to it (open, write, read and close), with what was sent or received,
+ * when, and how long it took, to a trace (see hidtrace.h).
+ *
+ * The replay transport plays such a trace back: each call is answered
+ * the way the device answered the same call in the capture, either
+ * taking as long as it did then, or straight away. Each device has its
+ * own place in the capture, so devices read by another thread (as by
+ * listen --all) are replayed independently. Writes are checked against
+ * the capture, and any difference is reported.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "rawhid_defs.h"
+#include "transport.h"
+#include "monotime.h"
+#include "hidtrace.h"
+#include "transport_replay.h"
+
+#define MAX_WARNINGS 10
+
+/* {{{ Recording */
+struct record_device {
+	struct transport  t;
+	struct transport *inner;
+	unsigned char     index;
+};
+
+static struct {
+	const struct transport_ops *ops;   /* the transport recorded */
+	const char     *path;
+	struct hidtrace trace;
+	pthread_mutex_t lock;
+	unsigned int    opened;
+} rec;
+
+/**
+ * Record the transport \a ops, into \a path, once it's initialized.
+ *
+ * \return 0 on success, -1 if there's nothing to record.
+ */
+int record_wrap(const struct transport_ops *ops, const char *path)
+{
+	if (!ops || !path) return -1;
+	rec.ops  = ops;
+	rec.path = path;
+	return 0;
+}
+
+/**
+ * Write a record of a call, which started at \a start.
+ */
+static void record_call(unsigned char device, unsigned char call,
+                        unsigned char result, uint64_t start,
+                        const unsigned char *data, size_t len)
+{
+	struct hidtrace_record r;
+
+	r.time        = start - rec.trace.start;
+	r.duration_us = (unsigned long)((monotime_ns() - start) / NS_PER_US);
+	r.device      = device;
+	r.call        = call;
+	r.result      = result;
+	r.len         = (unsigned char)(len > PACKET_LEN ? PACKET_LEN : len);
+	if (r.len) memcpy(r.data, data, r.len);
+
+	pthread_mutex_lock(&rec.lock);
+	hidtrace_write(&rec.trace, &r);
+	pthread_mutex_unlock(&rec.lock);
+}
+
+static void pack_match(unsigned char *p, const struct transport_match *m)
+{
+	p[0] = (unsigned char)(m->usage_page & 0xff);
+	p[1] = (unsigned char)((m->usage_page >> 8) & 0xff);
+	p[2] = (unsigned char)(m->usage & 0xff);
+	p[3] = (unsigned char)((m->usage >> 8) & 0xff);
+	p[4] = (unsigned char)m->interface;
+}
+
+static int record_init(const char *options)
+{
+	if (hidtrace_create(&rec.trace, rec.path, monotime_ns()))
+		return -1;
+
+	pthread_mutex_init(&rec.lock, NULL);
+	if (rec.ops->init && rec.ops->init(options)) {
+		hidtrace_close(&rec.trace);
+		pthread_mutex_destroy(&rec.lock);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void record_exit(void)
+{
+	if (rec.ops->exit)
+		rec.ops->exit();
+
+	if (hidtrace_close(&rec.trace))
+		fprintf(stderr, "Error writing the capture '%s'\n", rec.path);
+	else fprintf(stderr, "Captured %lu calls to '%s'\n",
+	             rec.trace.records, rec.path);
+	pthread_mutex_destroy(&rec.lock);
+}
+
+/* {{{ record_device */
+/**
+ * Wrap a device that's just been opened, and record the open.
+ */
+static struct transport *record_device(struct transport *inner,
+                                       const struct transport_match *m,
+                                       unsigned char call, uint64_t start)
+{
+	struct record_device *dev = NULL;
+	unsigned char match[5];
+
+	pack_match(match, m);
+	if (inner && !(dev = calloc(1, sizeof(struct record_device)))) {
+		transport_close(inner);
+		inner = NULL;
+	}
+
+	if (!inner) {
+		record_call(0, call, HT_ERROR, start, match, sizeof(match));
+		return NULL;
+	}
+
+	dev->t.ops = &record_transport;
+	dev->inner = inner;
+	dev->index = (unsigned char)(rec.opened++ & 0xff);
+	record_call(dev->index, call, HT_OK, start, match, sizeof(match));
+	return &dev->t;
+}
+/* }}} */
+
+static struct transport *record_open(const struct transport_match *m)
+{
+	uint64_t start = monotime_ns();
+	return record_device(rec.ops->open(m), m, HT_OPEN, start);
+}
+
+static int record_open_all(const struct transport_match *m,
+                           struct transport **devs, int max)
+{
+	uint64_t start = monotime_ns();
+	int i, j, n;
+
+	if (!rec.ops->open_all)
+		return max > 0 && (devs[0] = record_open(m)) ? 1 : 0;
+
+	n = rec.ops->open_all(m, devs, max);
+	if (n <= 0) {
+		record_device(NULL, m, HT_OPEN_ALL, start);
+		return 0;
+	}
+
+	for (i = j = 0; i < n; i++) {
+		if ((devs[j] = record_device(devs[i], m, HT_OPEN_ALL, start)))
+			++j;
+	}
+	return j;
+}
+
+static int record_write(struct transport *t, const unsigned char *buf,
+                        size_t len)
+{
+	struct record_device *dev = (struct record_device *)t;
+	uint64_t start = monotime_ns();
+	int n = transport_write(dev->inner, buf, len);
+
+	record_call(dev->index, HT_WRITE, n < 0 ? HT_ERROR : HT_OK, start,
+	            buf, len);
+	return n;
+}
+
+static int record_read(struct transport *t, unsigned char *buf, size_t len,
+                       int timeout_ms)
+{
+	struct record_device *dev = (struct record_device *)t;
+	uint64_t start = monotime_ns();
+	int n = transport_read(dev->inner, buf, len, timeout_ms);
+
+	record_call(dev->index, HT_READ,
+	            n > 0 ? HT_OK : (n ? HT_ERROR : HT_TIMEOUT), start, buf,
+	            n > 0 ? (size_t)n : 0);
+	return n;
+}
+
+static void record_close(struct transport *t)
+{
+	struct record_device *dev = (struct record_device *)t;
+
+	record_call(dev->index, HT_CLOSE, HT_OK, monotime_ns(), NULL, 0);
+	transport_close(dev->inner);
+	free(dev);
+}
+
+static int record_fd(struct transport *t)
+{
+	return transport_fd(((struct record_device *)t)->inner);
+}
+
+const struct transport_ops record_transport = {
+	"record",
+	record_init,
+	record_exit,
+	record_open,
+	record_write,
+	record_read,
+	record_close,
+	record_open_all,
+	record_fd
+};
+/* }}} */
+
+/* {{{ Replay */
+struct replay_device {
+	struct transport t;
+	unsigned char    index;
+	unsigned long    next;      /* this device's place in the capture */
+	int              ended;
+};
+
+static struct replay_config config = { NULL, 0, 0 };
+
+static struct {
+	struct hidtrace_record *records;
+	unsigned long n, next_open;
+	unsigned long writes, matched, diverged;
+	pthread_mutex_t lock;
+} replay;
+
+/* {{{ diverge */
+/**
+ * Report where the host did something other than what's in the
+ * capture.
+ *
+ * \return -1 if that's an error (strict=1), otherwise 0.
+ */
+static int diverge(const struct replay_device *dev, unsigned long at,
+                   const char *what)
+{
+	unsigned long n;
+
+	pthread_mutex_lock(&replay.lock);
+	n = ++replay.diverged;
+	pthread_mutex_unlock(&replay.lock);
+
+	if (n <= MAX_WARNINGS) {
+		fprintf(stderr, "replay: device %d, record %lu: %s\n",
+		        dev->index, at, what);
+	}
+	if (n == MAX_WARNINGS)
+		fputs("replay: not reporting any more differences\n", stderr);
+	return config.strict ? -1 : 0;
+}
+/* }}} */
+
+/* {{{ peek */
+/**
+ * Find the next write or read for \a dev in the capture.
+ *
+ * \return the record, or NULL if the device's part of the capture
+ *         is over.
+ */
+static const struct hidtrace_record *peek(struct replay_device *dev)
+{
+	const struct hidtrace_record *r;
+
+	for (; dev->next < replay.n; dev->next++) {
+		r = &replay.records[dev->next];
+		if (r->device != dev->index) continue;
+		if (r->call == HT_WRITE || r->call == HT_READ) return r;
+		if (r->call == HT_CLOSE) break;
+	}
+
+	return NULL;
+}
+/* }}} */
+
+/**
+ * Take as long as the device did, unless asked to hurry.
+ */
+static void pace(const struct hidtrace_record *r)
+{
+	if (!config.fast && r->duration_us)
+		sleep_ns((uint64_t)r->duration_us * NS_PER_US);
+}
+
+/* {{{ parse_option */
+/**
+ * Parse a single "name=value" option.
+ *
+ * \return 0 on success, -1 if the option is invalid.
+ */
+static int parse_option(char *opt)
+{
+	char *val = strchr(opt, '=');
+
+	if (!val) goto err;
+	*val++ = '\0';
+
+	if (!strcmp(opt, "file"))
+		config.file = val;
+	else if (!strcmp(opt, "timing") && !strcmp(val, "original"))
+		config.fast = 0;
+	else if (!strcmp(opt, "timing") && !strcmp(val, "fast"))
+		config.fast = 1;
+	else if (!strcmp(opt, "strict"))
+		config.strict = (int)strtol(val, NULL, 0);
+	else goto err;
+	return 0;
+
+err:
+	fprintf(stderr, "replay: invalid option '%s'\n", opt);
+	return -1;
+}
+/* }}} */
+
+/* {{{ replay_init */
+/**
+ * Parse the options, and load the capture.
+ *
+ * \param[in] options Comma-separated list of name=value pairs
+ * \return 0 on success, -1 on error.
+ */
+static int replay_init(const char *options)
+{
+	static char *opts = NULL;
+	struct hidtrace tr;
+	struct hidtrace_record *tmp;
+	unsigned long size = 0;
+	char *p, *next;
+	int r;
+
+	if (options) {
+		if (!(opts = malloc(strlen(options) + 1)))
+			goto err;
+		strcpy(opts, options);
+
+		for (p = opts; p && *p; p = next) {
+			if ((next = strchr(p, ','))) *next++ = '\0';
+			if (parse_option(p)) goto err;
+		}
+	}
+
+	if (!config.file) {
+		fputs("replay: no capture given (file=...)\n", stderr);
+		goto err;
+	}
+
+	if (hidtrace_open(&tr, config.file))
+		goto err;
+
+	memset(&replay, 0, sizeof(replay));
+	while (1) {
+		if (replay.n == size) {
+			size = size ? size * 2 : 1024;
+			if (!(tmp = realloc(replay.records,
+			                    size * sizeof(*replay.records))))
+				goto close;
+			replay.records = tmp;
+		}
+
+		if ((r = hidtrace_read(&tr, &replay.records[replay.n])) <= 0)
+			break;
+		++replay.n;
+	}
+
+	if (r < 0) {
+		fprintf(stderr, "%s: bad record %lu\n", config.file, replay.n);
+		goto close;
+	}
+
+	hidtrace_close(&tr);
+	pthread_mutex_init(&replay.lock, NULL);
+	return 0;
+
+close:
+	hidtrace_close(&tr);
+	free(replay.records);
+	replay.records = NULL;
+
+err:
+	free(opts);
+	opts = NULL;
+	return -1;
+}
+/* }}} */
+
+static void replay_exit(void)
+{
+	if (replay.writes) {
+		fprintf(stderr, "replay: %lu of %lu writes matched the capture",
+		        replay.matched, replay.writes);
+		if (replay.diverged)
+			fprintf(stderr, ", %lu differences", replay.diverged);
+		fputc('\n', stderr);
+	}
+
+	free(replay.records);
+	replay.records = NULL;
+	pthread_mutex_destroy(&replay.lock);
+}
+
+/* {{{ next_open */
+/**
+ * Take the next open in the capture, and check it was for the same
+ * interface.
+ *
+ * \return the record, or NULL if there are no more.
+ */
+static const struct hidtrace_record *
+next_open(const struct transport_match *m)
+{
+	const struct hidtrace_record *r;
+	unsigned char match[5];
+
+	for (; replay.next_open < replay.n; replay.next_open++) {
+		r = &replay.records[replay.next_open];
+		if (r->call != HT_OPEN && r->call != HT_OPEN_ALL)
+			continue;
+
+		pack_match(match, m);
+		if (r->len != sizeof(match) || memcmp(r->data, match, r->len))
+			fprintf(stderr, "replay: record %lu: opening a different "
+			        "interface than the capture\n", replay.next_open);
+		++replay.next_open;
+		return r;
+	}
+
+	return NULL;
+}
+/* }}} */
+
+static struct transport *replay_device(const struct hidtrace_record *r)
+{
+	struct replay_device *dev;
+
+	if (!r || r->result != HT_OK ||
+	    !(dev = calloc(1, sizeof(struct replay_device)))) {
+		fputs("Unable to open device\n", stderr);
+		return NULL;
+	}
+
+	dev->t.ops = &replay_transport;
+	dev->index = r->device;
+	dev->next  = (unsigned long)(r - replay.records) + 1;
+	return &dev->t;
+}
+
+static struct transport *replay_open(const struct transport_match *m)
+{
+	return replay_device(next_open(m));
+}
+
+/* {{{ replay_open_all */
+/**
+ * Open the devices open_all() found in the capture: those recorded
+ * together, at the same time.
+ */
+static int replay_open_all(const struct transport_match *m,
+                           struct transport **devs, int max)
+{
+	const struct hidtrace_record *r, *first;
+	int n = 0;
+
+	if (max <= 0 || !(first = next_open(m)))
+		return 0;
+
+	if ((devs[0] = replay_device(first)))
+		++n;
+
+	while (n && n < max && replay.next_open < replay.n) {
+		r = &replay.records[replay.next_open];
+		if (r->call != HT_OPEN_ALL || r->time != first->time)
+			break;
+
+		++replay.next_open;
+		if ((devs[n] = replay_device(r)))
+			++n;
+	}
+
+	return n;
+}
+/* }}} */
+
+/* {{{ replay_write */
+/**
+ * Check a write against the capture, and fail it if it failed then.
+ */
+static int replay_write(struct transport *t, const unsigned char *buf,
+                        size_t len)
+{
+	struct replay_device *dev = (struct replay_device *)t;
+	const struct hidtrace_record *r = peek(dev);
+	size_t n = len > PACKET_LEN ? PACKET_LEN : len;
+
+	++replay.writes;
+	if (!r || r->call != HT_WRITE)
+		return diverge(dev, dev->next, "a write not in the capture") ?
+		       -1 : (int)len;
+
+	++dev->next;
+	pace(r);
+	if (r->len != n || memcmp(r->data, buf, n)) {
+		if (diverge(dev, dev->next - 1,
+		            "written differently than in the capture"))
+			return -1;
+	} else ++replay.matched;
+
+	return r->result == HT_OK ? (int)len : -1;
+}
+/* }}} */
+
+/* {{{ replay_read */
+/**
+ * Answer a read the way the device did in the capture. Writes the
+ * host should have made first are skipped.
+ *
+ * The timeout comes from the capture, rather than \a timeout_ms, so
+ * that the session plays out just the same.
+ */
+static int replay_read(struct transport *t, unsigned char *buf, size_t len,
+                       int timeout_ms)
+{
+	struct replay_device *dev = (struct replay_device *)t;
+	const struct hidtrace_record *r;
+	size_t n;
+
+	(void)timeout_ms;
+	while ((r = peek(dev)) && r->call == HT_WRITE) {
+		++dev->next;
+		if (diverge(dev, dev->next - 1, "a write that wasn't made"))
+			return -1;
+	}
+
+	if (!r) {
+		if (!dev->ended)
+			fprintf(stderr, "replay: device %d: end of the capture\n",
+			        dev->index);
+		dev->ended = 1;
+		return -1;
+	}
+
+	++dev->next;
+	pace(r);
+	if (r->result != HT_OK)
+		return r->result == HT_TIMEOUT ? 0 : -1;
+
+	n = r->len > len ? len : r->len;
+	memcpy(buf, r->data, n);
+	return (int)n;
+}
+/* }}} */
+
+static void replay_close(struct transport *t)
+{
+	free(t);
+}
+
+const struct transport_ops replay_transport = {
+	"replay",
+	replay_init,
+	replay_exit,
+	replay_open,
+	replay_write,
+	replay_read,
+	replay_close,
+	replay_open_all,
+	NULL
+};
+/* }}} */
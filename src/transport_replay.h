@@ -0,0 +1,29 @@
+/**
+ * sctools: Capture and replay of transport sessions
+ * Copyright (C) 2016 Tim Hentenaar.
+ *
+ * This code is licenced under the Simplified BSD License.
+ * See the LICENSE file for details.
+ */
+
+#ifndef TRANSPORT_REPLAY_H
+#define TRANSPORT_REPLAY_H
+
+#include "transport.h"
+
+/**
+ * Replay settings, parsed from the transport options
+ * (e.g. "replay:file=session.schid,timing=fast,strict=1").
+ */
+struct replay_config {
+	const char *file;    /* capture to replay                      */
+	int         fast;    /* don't wait as long as the device did   */
+	int         strict;  /* fail if the host strays from the capture */
+};
+
+extern const struct transport_ops record_transport;
+extern const struct transport_ops replay_transport;
+
+int record_wrap(const struct transport_ops *ops, const char *path);
+
+#endif /* TRANSPORT_REPLAY_H */